@@ -18,7 +18,6 @@
  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 #pragma once
-#include <map>
 #include <ArduProf.h>
 
 #include "./AppEvent.h"
@@ -34,8 +33,7 @@ public:
     static void printChipInfo(void);
 
 protected:
-    typedef void (QueueMain::*funcPtr)(const Message &);
-    std::map<int16_t, funcPtr> handlerMap;
+    __EVENT_TABLE_DECLARATION(QueueMain, EventNull)
 
 private:
     static QueueMain *_instance;
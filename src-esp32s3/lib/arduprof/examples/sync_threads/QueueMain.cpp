@@ -31,7 +31,7 @@ QueueMain *QueueMain::_instance = nullptr;
 ////////////////////////////////////////////////////////////////////////////////////////////
 
 #define TASK_QUEUE_SIZE 128 // message queue size for app task
-static uint8_t ucQueueStorageArea[TASK_QUEUE_SIZE * sizeof(Message)];
+static uint8_t ucQueueStorageArea[TASK_QUEUE_SIZE * sizeof(ardufreertos::QueueItem)];
 static StaticQueue_t xStaticQueue;
 
 ////////////////////////////////////////////////////////////////////////////////////////////
@@ -44,17 +44,16 @@ void QueueMain::printChipInfo(void)
     PRINTLN("===============================================================================");
 }
 
-QueueMain::QueueMain() : ardufreertos::MessageBus(TASK_QUEUE_SIZE, ucQueueStorageArea, &xStaticQueue),
-                         handlerMap()
+QueueMain::QueueMain() : ardufreertos::MessageBus(TASK_QUEUE_SIZE, ucQueueStorageArea, &xStaticQueue)
 {
     _instance = this;
-
-    handlerMap = {
-        __EVENT_MAP(QueueMain, EventNull), // {EventNull, &QueueMain::handlerEventNull},
-    };
 }
 #endif
 
+// setup event handlers
+__EVENT_TABLE_DEFINITION(QueueMain,
+                         __EVENT_MAP(QueueMain, EventNull)); // {EventNull, &QueueMain::handlerEventNull},
+
 void QueueMain::start(void *ctx)
 {
     // LOG_TRACE("on core ", xPortGetCoreID(), ", xPortGetFreeHeapSize()=", xPortGetFreeHeapSize());
@@ -65,12 +64,7 @@ void QueueMain::start(void *ctx)
 
 void QueueMain::onMessage(const Message &msg)
 {
-    auto func = handlerMap[msg.event];
-    if (func)
-    {
-        (this->*func)(msg);
-    }
-    else
+    if (!handlerTable.dispatch(this, msg))
     {
         LOG_TRACE("Unsupported event=", msg.event, ", iParam=", msg.iParam, ", uParam=", msg.uParam, ", lParam=", msg.lParam);
     }
@@ -40,15 +40,16 @@ ThreadApp *ThreadApp::_instance = nullptr;
 #define TASK_INIT_STACK_SIZE 4096
 #define TASK_INIT_PRIORITY 0
 
-static uint8_t ucQueueStorageArea[TASK_QUEUE_SIZE * sizeof(Message)];
+static uint8_t ucQueueStorageArea[TASK_QUEUE_SIZE * sizeof(ardufreertos::QueueItem)];
 static StaticQueue_t xStaticQueue;
 
 static StackType_t xStack[TASK_STACK_SIZE];
 static StaticTask_t xTaskBuffer;
 
 ////////////////////////////////////////////////////////////////////////////////////////////
-ThreadApp::ThreadApp() : ardufreertos::ThreadBase(TASK_QUEUE_SIZE, ucQueueStorageArea, &xStaticQueue),
+ThreadApp::ThreadApp() : ardufreertos::ThreadBase(TASK_QUEUE_SIZE, ucQueueStorageArea, &xStaticQueue)
 #if CONFIG_IDF_TARGET_ESP32 || CONFIG_IDF_TARGET_ESP32S3 || CONFIG_IDF_TARGET_ESP32C3
+                         ,
                          _timer1Hz("Timer 1Hz",
                                    pdMS_TO_TICKS(1000),
                                    [](TimerHandle_t xTimer)
@@ -61,16 +62,10 @@ ThreadApp::ThreadApp() : ardufreertos::ThreadBase(TASK_QUEUE_SIZE, ucQueueStorag
                                                context->threadApp->postEvent(context->queueMain, EventNull);
                                            }
                                        }
-                                   }),
+                                   })
 #endif
-                         handlerMap()
 {
     _instance = this;
-
-    // setup event handlers
-    handlerMap = {
-        __EVENT_MAP(ThreadApp, EventNull), // {EventNull, &ThreadApp::handlerEventNull},
-    };
 }
 
 void ThreadApp::start(void *ctx)
@@ -108,15 +103,14 @@ void ThreadApp::setup(void)
 }
 
 /////////////////////////////////////////////////////////////////////////////
+// setup event handlers
+__EVENT_TABLE_DEFINITION(ThreadApp,
+                         __EVENT_MAP(ThreadApp, EventNull)); // {EventNull, &ThreadApp::handlerEventNull},
+
 void ThreadApp::onMessage(const Message &msg)
 {
     // LOG_TRACE("event=", msg.event, ", iParam=", msg.iParam, ", uParam=", msg.uParam, ", lParam=", msg.lParam);
-    auto func = handlerMap[msg.event];
-    if (func)
-    {
-        (this->*func)(msg);
-    }
-    else
+    if (!handlerTable.dispatch(this, msg))
     {
         LOG_TRACE("Unsupported event=", msg.event, ", iParam=", msg.iParam, ", uParam=", msg.uParam, ", lParam=", msg.lParam);
     }
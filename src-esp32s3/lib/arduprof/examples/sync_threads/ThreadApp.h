@@ -18,7 +18,6 @@
  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 #pragma once
-#include <map>
 #include <ArduProf.h>
 
 #include "./AppEvent.h"
@@ -32,8 +31,7 @@ public:
     virtual void onMessage(const Message &msg);
 
 protected:
-    typedef void (ThreadApp::*handlerFunc)(const Message &);
-    std::map<int16_t, handlerFunc> handlerMap;
+    __EVENT_TABLE_DECLARATION(ThreadApp, EventNull)
 
 private:
     static ThreadApp *_instance;
@@ -0,0 +1,161 @@
+/* Copyright 2024 teamprof.net@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+  Host benchmark of the panel messages: LampModel (JSON, cJSON) vs LampCbor (CBOR, tinycbor),
+  the codecs of main/model compiled for the host.
+
+  build & run (Linux), cJSON from ESP-IDF (or CJSON_DIR), tinycbor from managed_components:
+    cmake -S . -B build -DCJSON_DIR=$IDF_PATH/components/json/cJSON && cmake --build build && ./build/bench_codec
+
+  For each message the panel and the lamp exchange: bytes on the wire (payload and frame:
+  FrameLine '\n' for JSON, FrameLength header for CBOR), CPU time and heap allocations of the
+  lamp side, which decodes the panel commands and encodes its state and samples. The sample
+  carries a full SystemSampler snapshot (SnapshotSize bytes): hex digits in JSON, a byte
+  string in CBOR. Absolute numbers are those of the host, the ratios carry over to the ESP32.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <cJSON.h>
+#include "ArduProfFreeRTOS.h"
+#include "model/LampModel.h"
+#include "model/LampCbor.h"
+
+#define LOOP_COUNT 200000
+#define SAMPLE_LOOP_COUNT 20000
+
+/////////////////////////////////////////////////////////////////////////////
+// cJSON allocations, counted through its hooks (LampCbor encodes into the caller's buffer)
+static size_t allocCount;
+static void *countingMalloc(size_t size)
+{
+    allocCount++;
+    return malloc(size);
+}
+
+typedef struct _CodecResult
+{
+    size_t wire;   // payload and frame bytes
+    double ns;     // per message
+    double allocs; // per message
+} CodecResult;
+
+static uint8_t sample[ardufreertos::SystemSampler::SnapshotSize];
+static uint8_t cborBuffer[sizeof(sample) + LampCbor::OVERHEAD];
+static volatile int sink;
+
+template <typename Func>
+static CodecResult measure(int count, size_t wire, Func func)
+{
+    allocCount = 0;
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; i++)
+    {
+        func(i);
+    }
+    auto end = std::chrono::steady_clock::now();
+    return {wire, std::chrono::duration<double, std::nano>(end - begin).count() / count, (double)allocCount / count};
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// lamp side: encode (update, sample), JSON
+static size_t jsonEncode(const char *event, int arg0, int arg1, const void *data, size_t size)
+{
+    LampModel model;
+    size_t length = 0;
+    if (model.build(LampModel::NAME, event, arg0, arg1) && (!data || model.addData(data, size)))
+    {
+        const char *str = model.stringnify();
+        length = str ? strlen(str) : 0;
+        model.stringDelete((void *)str);
+    }
+    return length + 1; // FrameLine '\n'
+}
+// lamp side: encode (update, sample), CBOR
+static size_t cborEncode(const char *event, int arg0, int arg1, const void *data, size_t size)
+{
+    LampCbor model;
+    return model.build(cborBuffer, sizeof(cborBuffer), LampModel::NAME, event, arg0, arg1, data, size) + FRAME_HEADER_MAX;
+}
+
+static void print(const char *name, const CodecResult &json, const CodecResult &cbor)
+{
+    printf("  %-11s: JSON %5zu B %8.1f ns %4.1f allocs | CBOR %5zu B %8.1f ns %4.1f allocs | %5.2fx smaller, %5.2fx faster\n",
+           name, json.wire, json.ns, json.allocs, cbor.wire, cbor.ns, cbor.allocs,
+           (double)json.wire / cbor.wire, json.ns / cbor.ns);
+}
+
+int main(void)
+{
+    cJSON_Hooks hooks = {countingMalloc, free};
+    cJSON_InitHooks(&hooks);
+    for (size_t i = 0; i < sizeof(sample); i++)
+    {
+        sample[i] = (uint8_t)(i * 37 + (i >> 5)); // as dense as names, counters and stack sizes
+    }
+
+    // panel -> lamp: user-click, decoded by the lamp (ThreadPanel::processTcpFrame())
+    const char *clickJson = "{\"device\":\"lamp-esp\",\"event\":\"user-click\",\"arg0\":2,\"arg1\":0}";
+    size_t clickJsonLength = strlen(clickJson);
+    uint8_t clickCbor[32];
+    LampCbor clickModel;
+    size_t clickCborLength = clickModel.build(clickCbor, sizeof(clickCbor), LampModel::NAME, LampModel::USER_CLICK, 2, 0);
+
+    auto clickJsonResult = measure(LOOP_COUNT, clickJsonLength + 1, [&](int)
+                                   {
+        LampModel model;
+        if (model.parse(clickJson, clickJsonLength) && !strcmp(model.event(), LampModel::USER_CLICK))
+        {
+            sink = model.arg0();
+        } });
+    auto clickCborResult = measure(LOOP_COUNT, clickCborLength + FRAME_HEADER_MAX, [&](int)
+                                   {
+        LampCbor model;
+        if (model.parse(clickCbor, clickCborLength) && !strcmp(model.event(), LampModel::USER_CLICK))
+        {
+            sink = model.arg0();
+        } });
+
+    // lamp -> panel: update with the lamp state, encoded by the lamp (ThreadPanel::sendLampEvent())
+    size_t updateJsonWire = jsonEncode(LampModel::UPDATE, 0, 1, nullptr, 0);
+    size_t updateCborWire = cborEncode(LampModel::UPDATE, 0, 1, nullptr, 0);
+    auto updateJsonResult = measure(LOOP_COUNT, updateJsonWire, [](int i)
+                                    { sink = (int)jsonEncode(LampModel::UPDATE, 0, i & 1, nullptr, 0); });
+    auto updateCborResult = measure(LOOP_COUNT, updateCborWire, [](int i)
+                                    { sink = (int)cborEncode(LampModel::UPDATE, 0, i & 1, nullptr, 0); });
+
+    // lamp -> panel: sample with a SystemSampler snapshot
+    size_t sampleJsonWire = jsonEncode(LampModel::SAMPLE, sizeof(sample), 0, sample, sizeof(sample));
+    size_t sampleCborWire = cborEncode(LampModel::SAMPLE, sizeof(sample), 0, sample, sizeof(sample));
+    auto sampleJsonResult = measure(SAMPLE_LOOP_COUNT, sampleJsonWire, [](int)
+                                    { sink = (int)jsonEncode(LampModel::SAMPLE, sizeof(sample), 0, sample, sizeof(sample)); });
+    auto sampleCborResult = measure(SAMPLE_LOOP_COUNT, sampleCborWire, [](int)
+                                    { sink = (int)cborEncode(LampModel::SAMPLE, sizeof(sample), 0, sample, sizeof(sample)); });
+
+    printf("panel messages, JSON (LampModel, cJSON) vs CBOR (LampCbor, tinycbor), bytes on the wire with framing\n");
+    print("user-click", clickJsonResult, clickCborResult);
+    print("update", updateJsonResult, updateCborResult);
+    print("sample", sampleJsonResult, sampleCborResult);
+    printf("  (user-click: decode, update and sample: encode; sample data %zu bytes)\n", sizeof(sample));
+
+    return clickCborLength && updateCborWire > FRAME_HEADER_MAX && sampleCborWire > sizeof(sample) ? 0 : 1;
+}
@@ -0,0 +1,239 @@
+/* Copyright 2024 teamprof.net@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+  Host micro-benchmark: std::map handlerMap vs EventTable vs typed dispatch.
+
+  build & run (Linux):
+    cmake -S . -B build && cmake --build build && ./build/bench_dispatch
+
+  Both buses map the same handlers as ThreadPanel (EventNull, EventSystem,
+  EventApp = 100). The message stream mixes known events with unknown ones,
+  which std::map::operator[] inserts as null entries. The typed bus decodes
+  the same messages into structs (MessageTypes) and calls on() overloads.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <map>
+#include <vector>
+#include "type/EventTable.h"
+#include "type/TypedMessage.h"
+
+#define __EVENT_MAP(class, event)      \
+    {                                  \
+        event, &class ::handler##event \
+    }
+
+enum AppEvent : int16_t
+{
+    EventNull = 0,
+    EventSystem,
+    EventApp = 100,
+};
+
+#define LOOP_COUNT 10000000
+#define STREAM_SIZE 4096 // power of 2
+
+/////////////////////////////////////////////////////////////////////////////
+// buses are polymorphic (MessageBus::onMessage is virtual), keep that here too
+class MapBus
+{
+public:
+    MapBus() : count(0)
+    {
+        handlerMap = {
+            __EVENT_MAP(MapBus, EventApp),
+            __EVENT_MAP(MapBus, EventSystem),
+            __EVENT_MAP(MapBus, EventNull),
+        };
+    }
+
+    virtual ~MapBus() {}
+
+    virtual void onMessage(const Message &msg)
+    {
+        auto func = handlerMap[msg.event];
+        if (func)
+        {
+            (this->*func)(msg);
+        }
+        else
+        {
+            count += 1000;
+        }
+    }
+
+    size_t mapSize(void)
+    {
+        return handlerMap.size();
+    }
+
+    uint32_t count;
+
+private:
+    typedef void (MapBus::*handlerFunc)(const Message &);
+    std::map<int16_t, handlerFunc> handlerMap;
+
+    void handlerEventApp(const Message &msg) { count += msg.lParam; }
+    void handlerEventSystem(const Message &msg) { count += msg.uParam; }
+    void handlerEventNull(const Message &msg) { count += 1; }
+};
+
+/////////////////////////////////////////////////////////////////////////////
+class TableBus
+{
+public:
+    TableBus() : count(0)
+    {
+    }
+
+    virtual ~TableBus() {}
+
+    virtual void onMessage(const Message &msg)
+    {
+        if (!handlerTable.dispatch(this, msg))
+        {
+            count += 1000;
+        }
+    }
+
+    uint32_t count;
+
+    __EVENT_TABLE_DECLARATION(TableBus, EventApp)
+
+private:
+    void handlerEventApp(const Message &msg) { count += msg.lParam; }
+    void handlerEventSystem(const Message &msg) { count += msg.uParam; }
+    void handlerEventNull(const Message &msg) { count += 1; }
+};
+
+__EVENT_TABLE_DEFINITION(TableBus,
+                         __EVENT_MAP(TableBus, EventApp),
+                         __EVENT_MAP(TableBus, EventSystem),
+                         __EVENT_MAP(TableBus, EventNull));
+
+/////////////////////////////////////////////////////////////////////////////
+// the three events of the stream as typed messages: lParam is packed first, then uParam
+struct AppValue
+{
+    static constexpr int16_t eventId = EventApp;
+    static constexpr int16_t sourceId = 0;
+    uint32_t value;
+};
+struct SystemValue
+{
+    static constexpr int16_t eventId = EventSystem;
+    static constexpr int16_t sourceId = 0;
+    uint16_t reserved[2]; // lParam, 2-byte alignment keeps the struct at 6 bytes
+    uint16_t value;
+};
+struct NullValue
+{
+    static constexpr int16_t eventId = EventNull;
+    static constexpr int16_t sourceId = 0;
+};
+
+class TypedBus
+{
+public:
+    typedef MessageTypes<AppValue, SystemValue, NullValue> TypedHandlers;
+
+    TypedBus() : count(0)
+    {
+    }
+
+    virtual ~TypedBus() {}
+
+    virtual void onMessage(const Message &msg)
+    {
+        if (!TypedHandlers::dispatch(this, msg))
+        {
+            count += 1000;
+        }
+    }
+
+    uint32_t count;
+
+private:
+    friend TypedHandlers;
+
+    void on(const AppValue &msg) { count += msg.value; }
+    void on(const SystemValue &msg) { count += msg.value; }
+    void on(const NullValue &msg) { count += 1; }
+};
+
+/////////////////////////////////////////////////////////////////////////////
+template <typename Bus>
+static double run(Bus &bus, const std::vector<Message> &stream)
+{
+    auto begin = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < LOOP_COUNT; i++)
+    {
+        bus.onMessage(stream[i & (STREAM_SIZE - 1)]);
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - begin).count() / LOOP_COUNT;
+}
+
+int main(int argc, char *argv[])
+{
+    // 1 in 8 messages carries an event without handler
+    std::vector<Message> stream;
+    srand(1);
+    for (int i = 0; i < STREAM_SIZE; i++)
+    {
+        Message msg = {EventNull, 0, 1, 2};
+        switch (rand() % 8)
+        {
+        case 0:
+            msg.event = (int16_t)(200 + rand() % 64);
+            break;
+        case 1:
+        case 2:
+        case 3:
+            msg.event = EventApp;
+            break;
+        case 4:
+        case 5:
+            msg.event = EventSystem;
+            break;
+        default:
+            break;
+        }
+        stream.push_back(msg);
+    }
+
+    MapBus mapBus;
+    TableBus tableBus;
+    double nsMap = run(mapBus, stream);
+    double nsTable = run(tableBus, stream);
+    TypedBus typedBus;
+    double nsTyped = run(typedBus, stream);
+
+    printf("dispatch of %d messages (%zu distinct unknown events in stream)\n", LOOP_COUNT, mapBus.mapSize() - 3);
+    printf("  std::map handlerMap : %6.2f ns/msg, map grew to %zu heap nodes\n", nsMap, mapBus.mapSize());
+    printf("  EventTable          : %6.2f ns/msg, %zu entries, %zu bytes .rodata\n",
+           nsTable, TableBus::handlerTable.size(), sizeof(TableBus::HandlerTable));
+    printf("  MessageTypes        : %6.2f ns/msg, %zu-byte message, no casts in handlers\n", nsTyped, sizeof(Message));
+    printf("  speed-up            : %6.2fx (EventTable), %6.2fx (MessageTypes)\n", nsMap / nsTable, nsMap / nsTyped);
+
+    return (mapBus.count == tableBus.count && tableBus.count == typedBus.count) ? 0 : 1;
+}
@@ -0,0 +1,746 @@
+/* Copyright 2024 teamprof.net@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+  Host benchmark of ardufreertos message passing on the POSIX port (ARDUPROF_POSIX).
+
+  build & run (Linux):
+    cmake -S . -B build && cmake --build build && ./build/bench_messaging
+
+  1. post-to-dispatch latency of an idle ThreadBase: FreeRTOS queue, urgent lane, ISR ring
+  2. latency of an urgent message queued behind a bulk backlog, with and without lanes
+  3. throughput with N producer tasks, batch size 1 and 16
+  4. queue-full behaviour per OverflowPolicy: drop newest, block, drop oldest, reject (QueueStats)
+  5. bursts of state updates, queued one by one or coalesced in the mailbox (postCoalesced)
+  6. hand-off of 512 byte payloads: malloc + memcpy vs BufferPool blocks (postBuffer)
+  7. request / response round trip: request + reply event through two queues vs call()
+  8. cost of the message-flow trace: one MessageTrace record, a post with the trace on and off
+
+  Absolute numbers are those of the host scheduler, use them to compare variants.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include "ArduProf.h"
+
+using namespace ardufreertos;
+
+enum BenchEvent : int16_t
+{
+    EventPing = 0, // lParam=<sequence number>
+    EventWork,     // uParam=<busy time in us>
+    EventStop,
+    EventState, // uParam=<device>, lParam=<state>
+    EventHeap,  // uParam=<length>, lParam=<slot in heapSlots>
+    EventBlock, // lParam=<BufferHandle>
+    EventRequest, // lParam=<value>, answered with value + 1
+};
+
+static inline uint64_t nowNs(void)
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static inline void busyWaitUs(uint32_t us)
+{
+    uint64_t end = nowNs() + (uint64_t)us * 1000ULL;
+    while (nowNs() < end)
+    {
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+class BenchThread : public ThreadBase
+{
+public:
+    BenchThread(uint16_t queueLength) : ThreadBase(queueLength),
+                                        dispatched(0),
+                                        sendNs(nullptr),
+                                        isStopped(false)
+    {
+    }
+
+    BenchThread(MessageRing *ring) : ThreadBase(ring),
+                                     dispatched(0),
+                                     sendNs(nullptr),
+                                     isStopped(false)
+    {
+    }
+
+    virtual void start(void *ctx)
+    {
+        ThreadBase::start(ctx);
+        xTaskCreate(
+            [](void *instance)
+            { static_cast<ThreadBase *>(instance)->run(); },
+            "BenchThread",
+            4096,
+            this,
+            2,
+            &_taskHandle);
+    }
+
+    virtual void onMessage(const Message &msg)
+    {
+        handlerTable.dispatch(this, msg);
+        dispatched.fetch_add(1, std::memory_order_release);
+    }
+
+    // the task still touches the object after messageLoopForever() returns: stopped threads are never deleted
+    void stop(void)
+    {
+        postEvent(EventStop);
+        while (!isStopped.load(std::memory_order_acquire))
+        {
+            vTaskDelay(1);
+        }
+    }
+
+    void waitDispatched(uint32_t count)
+    {
+        while (dispatched.load(std::memory_order_acquire) < count)
+        {
+            portYIELD();
+        }
+    }
+
+    std::atomic<uint32_t> dispatched;
+    const uint64_t *sendNs;         // send time of each ping, indexed by sequence number
+    std::vector<uint32_t> latencyNs; // post-to-dispatch latency of each ping
+
+protected:
+    __EVENT_TABLE_DECLARATION(BenchThread, EventStop)
+
+private:
+    std::atomic<bool> isStopped;
+
+    __EVENT_FUNC_DECLARATION(EventPing)
+    __EVENT_FUNC_DECLARATION(EventWork)
+    __EVENT_FUNC_DECLARATION(EventStop)
+};
+
+__EVENT_TABLE_DEFINITION(BenchThread,
+                         __EVENT_MAP(BenchThread, EventPing),
+                         __EVENT_MAP(BenchThread, EventWork),
+                         __EVENT_MAP(BenchThread, EventStop));
+
+__EVENT_FUNC_DEFINITION(BenchThread, EventPing, msg)
+{
+    if (sendNs)
+    {
+        latencyNs.push_back((uint32_t)(nowNs() - sendNs[msg.lParam]));
+    }
+}
+
+__EVENT_FUNC_DEFINITION(BenchThread, EventWork, msg)
+{
+    busyWaitUs(msg.uParam);
+}
+
+__EVENT_FUNC_DEFINITION(BenchThread, EventStop, msg)
+{
+    _isDone = true;
+    isStopped.store(true, std::memory_order_release);
+}
+
+static int benchContext; // ThreadBase::start() requires a context
+
+static BenchThread *startThread(BenchThread *thread, uint16_t batchSize = 1)
+{
+    thread->setBatchSize(batchSize);
+    thread->start(&benchContext);
+    return thread;
+}
+
+static void printLatency(const char *name, std::vector<uint32_t> &samples)
+{
+    std::sort(samples.begin(), samples.end());
+    size_t n = samples.size();
+    printf("  %-34s p50=%7.2f us  p99=%7.2f us  max=%8.2f us  (%zu samples)\n", name,
+           samples[n / 2] / 1000.0, samples[n * 99 / 100] / 1000.0, samples[n - 1] / 1000.0, n);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// 1. post-to-dispatch latency of an idle thread
+/////////////////////////////////////////////////////////////////////////////
+#define PING_COUNT 20000
+
+static void pingLatency(const char *name, BenchThread *thread, MessagePriority priority, bool isIsr)
+{
+    std::vector<uint64_t> sendNs(PING_COUNT);
+    thread->sendNs = sendNs.data();
+    thread->latencyNs.reserve(PING_COUNT);
+    for (uint32_t i = 0; i < PING_COUNT; i++)
+    {
+        sendNs[i] = nowNs();
+        if (isIsr)
+        {
+            PosixIsrScope isr;
+            thread->postEvent(EventPing, 0, 0, i);
+        }
+        else
+        {
+            thread->postEvent(priority, EventPing, 0, 0, i);
+        }
+        thread->waitDispatched(i + 1);
+    }
+    thread->stop();
+    printLatency(name, thread->latencyNs);
+}
+
+static void benchLatency(void)
+{
+    printf("1. post-to-dispatch latency, idle thread\n");
+
+    pingLatency("FreeRTOS queue", startThread(new BenchThread(128)), PriorityNormal, false);
+
+    BenchThread *lanes = new BenchThread(128);
+    lanes->createLanes(8, 32);
+    pingLatency("FreeRTOS queue set, urgent lane", startThread(lanes), PriorityUrgent, false);
+
+    static MessageRing ring(128);
+    pingLatency("MessageRing, posted from ISR", startThread(new BenchThread(&ring)), PriorityNormal, true);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// 2. urgent message behind a bulk backlog
+/////////////////////////////////////////////////////////////////////////////
+#define BACKLOG_ROUNDS 200
+#define BACKLOG_SIZE 64    // bulk messages queued ahead of the urgent one
+#define BACKLOG_WORK_US 10 // busy time of each bulk message
+#define BACKLOG_GATE_US 1000 // keeps the consumer busy while the backlog is queued
+
+static void backlogLatency(const char *name, BenchThread *thread)
+{
+    std::vector<uint64_t> sendNs(BACKLOG_ROUNDS);
+    thread->sendNs = sendNs.data();
+    uint32_t expected = 0;
+    for (uint32_t i = 0; i < BACKLOG_ROUNDS; i++)
+    {
+        thread->postEvent(PriorityUrgent, EventWork, 0, BACKLOG_GATE_US, 0, portMAX_DELAY);
+        for (int j = 0; j < BACKLOG_SIZE; j++)
+        {
+            thread->postEvent(PriorityBulk, EventWork, 0, BACKLOG_WORK_US, 0, portMAX_DELAY);
+        }
+        sendNs[i] = nowNs();
+        thread->postEvent(PriorityUrgent, EventPing, 0, 0, i, portMAX_DELAY);
+        expected += BACKLOG_SIZE + 2;
+        thread->waitDispatched(expected);
+    }
+    thread->stop();
+    printLatency(name, thread->latencyNs);
+}
+
+static void benchBacklog(void)
+{
+    printf("2. urgent message behind %d bulk messages of %d us (consumer busy %d us while queued)\n",
+           BACKLOG_SIZE, BACKLOG_WORK_US, BACKLOG_GATE_US);
+
+    backlogLatency("single FIFO", startThread(new BenchThread(128)));
+
+    BenchThread *lanes = new BenchThread(128);
+    lanes->createLanes(8, 128);
+    backlogLatency("urgent / bulk lanes", startThread(lanes));
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// 3. throughput with N producers
+/////////////////////////////////////////////////////////////////////////////
+#define THROUGHPUT_MESSAGES 400000
+
+typedef struct _Producer
+{
+    BenchThread *thread;
+    MessageRing *ring; // ring backend of thread, posted from simulated ISR
+    uint32_t count;
+    TickType_t xTicksToWait;
+    std::atomic<bool> isDone;
+    uint64_t blockedNs; // time spent in postEvent()
+} Producer;
+
+static void producerTask(void *param)
+{
+    Producer *producer = static_cast<Producer *>(param);
+    uint64_t blockedNs = 0;
+    for (uint32_t i = 0; i < producer->count; i++)
+    {
+        uint64_t begin = nowNs();
+        if (producer->ring)
+        {
+            PosixIsrScope isr;
+            while (producer->ring->count() == producer->ring->capacity())
+            {
+                portYIELD(); // a real ISR drops instead, see MessageRing::dropped()
+            }
+            producer->thread->postEvent(EventPing, 0, 0, i);
+        }
+        else
+        {
+            producer->thread->postEvent(EventPing, 0, 0, i, producer->xTicksToWait);
+        }
+        blockedNs += nowNs() - begin;
+    }
+    producer->blockedNs = blockedNs;
+    producer->isDone.store(true, std::memory_order_release);
+    vTaskDelete(nullptr);
+}
+
+// returns dispatched messages; elapsed time and producer blocked time in ns
+static uint32_t runProducers(BenchThread *thread, int producers, uint32_t total, TickType_t xTicksToWait, MessageRing *ring,
+                             uint64_t &elapsedNs, uint64_t &blockedNs)
+{
+    std::vector<Producer> list(producers);
+    uint64_t begin = nowNs();
+    for (auto &producer : list)
+    {
+        producer.thread = thread;
+        producer.count = total / producers;
+        producer.xTicksToWait = xTicksToWait;
+        producer.ring = ring;
+        producer.isDone = false;
+        producer.blockedNs = 0;
+        xTaskCreate(producerTask, "producer", 4096, &producer, 1, nullptr);
+    }
+
+    blockedNs = 0;
+    for (auto &producer : list)
+    {
+        while (!producer.isDone.load(std::memory_order_acquire))
+        {
+            vTaskDelay(1);
+        }
+        blockedNs += producer.blockedNs;
+    }
+
+    // drain: wait until nothing was dispatched for 20 ms
+    uint32_t dispatched;
+    do
+    {
+        dispatched = thread->dispatched.load();
+        vTaskDelay(pdMS_TO_TICKS(20));
+    } while (dispatched != thread->dispatched.load());
+    elapsedNs = nowNs() - begin;
+    thread->stop();
+    return dispatched;
+}
+
+static void benchThroughput(void)
+{
+    printf("3. throughput, %d messages, queue length 128, blocking post\n", THROUGHPUT_MESSAGES);
+    const int producerCounts[] = {1, 2, 4, 8};
+    const uint16_t batchSizes[] = {1, 16};
+    for (auto batchSize : batchSizes)
+    {
+        for (auto producers : producerCounts)
+        {
+            uint64_t elapsedNs, blockedNs;
+            uint32_t dispatched = runProducers(startThread(new BenchThread(128), batchSize), producers, THROUGHPUT_MESSAGES,
+                                               portMAX_DELAY, nullptr, elapsedNs, blockedNs);
+            printf("  FreeRTOS queue, batch %2u, %d producer(s) : %8.0f msg/s\n", batchSize, producers, dispatched * 1e9 / elapsedNs);
+        }
+    }
+
+    static MessageRing ring(128);
+    uint64_t elapsedNs, blockedNs;
+    uint32_t dispatched = runProducers(startThread(new BenchThread(&ring), 16), 1, THROUGHPUT_MESSAGES, 0, &ring, elapsedNs, blockedNs);
+    printf("  MessageRing,    batch 16, 1 ISR producer  : %8.0f msg/s\n", dispatched * 1e9 / elapsedNs);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// 4. queue full
+/////////////////////////////////////////////////////////////////////////////
+#define FULL_QUEUE_LENGTH 16
+#define FULL_PRODUCERS 4
+#define FULL_MESSAGES 20000
+#define FULL_WORK_US 5 // consumer busy time per message
+
+class SlowThread : public BenchThread
+{
+public:
+    SlowThread() : BenchThread(FULL_QUEUE_LENGTH)
+    {
+    }
+
+    virtual void onMessage(const Message &msg)
+    {
+        if (msg.event == EventPing)
+        {
+            busyWaitUs(FULL_WORK_US);
+        }
+        BenchThread::onMessage(msg);
+    }
+};
+
+static void benchQueueFull(void)
+{
+    printf("4. queue full: queue length %d, %d producers x %d messages, consumer %d us per message\n",
+           FULL_QUEUE_LENGTH, FULL_PRODUCERS, FULL_MESSAGES / FULL_PRODUCERS, FULL_WORK_US);
+
+    const struct
+    {
+        const char *name;
+        OverflowPolicy policy;
+    } policies[] = {
+        {"OverflowDropNewest", OverflowDropNewest},
+        {"OverflowBlock", OverflowBlock},
+        {"OverflowDropOldest", OverflowDropOldest},
+        {"OverflowReject", OverflowReject},
+    };
+    for (auto &entry : policies)
+    {
+        uint64_t elapsedNs, blockedNs;
+        SlowThread *thread = new SlowThread();
+        thread->setOverflowPolicy(entry.policy, portMAX_DELAY);
+        uint32_t dispatched = runProducers(startThread(thread), FULL_PRODUCERS, FULL_MESSAGES, 0, nullptr, elapsedNs, blockedNs);
+        const QueueStats &stats = thread->queueStats();
+        printf("  %-19s: delivered %5u, lost %5u (dropped %u, oldest %u, rejected %u), producers blocked %7.1f ms in total\n",
+               entry.name, dispatched, stats.lost(), stats.dropped, stats.droppedOldest, stats.rejected, blockedNs / 1e6);
+        printf("  %-19s  high water %u, latency p50 < %lu us, p99 < %lu us, max %lu us\n", "",
+               stats.highWater, (unsigned long)stats.latencyPercentileUs(50), (unsigned long)stats.latencyPercentileUs(99),
+               (unsigned long)stats.maxLatencyUs);
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// 5. coalesced state updates
+/////////////////////////////////////////////////////////////////////////////
+#define STATE_ROUNDS 200
+#define STATE_DEVICES 2     // one coalescing key per device
+#define STATE_BURST 32      // state updates per device and round
+#define STATE_WORK_US 50    // busy time of each state handler, e.g. a TCP send
+#define STATE_GATE_US 1000  // keeps the consumer busy while the burst is posted
+
+class StateThread : public BenchThread
+{
+public:
+    StateThread() : BenchThread(256),
+                    stateCalls(0),
+                    pings(0),
+                    states()
+    {
+    }
+
+    virtual void onMessage(const Message &msg)
+    {
+        if (msg.event == EventState)
+        {
+            busyWaitUs(STATE_WORK_US);
+            states[msg.uParam] = msg.lParam;
+            stateCalls++;
+        }
+        else if (msg.event == EventPing)
+        {
+            pings.fetch_add(1, std::memory_order_release);
+        }
+        BenchThread::onMessage(msg);
+    }
+
+    uint32_t stateCalls;
+    std::atomic<uint32_t> pings;
+    uint32_t states[STATE_DEVICES]; // latest state seen by the handler
+};
+
+static void stateBursts(const char *name, StateThread *thread, bool isCoalesced)
+{
+    uint64_t startNs = nowNs();
+    bool isLatest = true;
+    for (uint32_t i = 0; i < STATE_ROUNDS; i++)
+    {
+        thread->postEvent(EventWork, 0, STATE_GATE_US, 0, portMAX_DELAY);
+        for (uint32_t j = 0; j < STATE_BURST; j++)
+        {
+            for (uint16_t device = 0; device < STATE_DEVICES; device++)
+            {
+                uint32_t state = i * STATE_BURST + j;
+                if (isCoalesced)
+                {
+                    thread->postCoalesced(thread, EventState, 0, device, state);
+                }
+                else
+                {
+                    thread->postEvent(EventState, 0, device, state, portMAX_DELAY);
+                }
+            }
+        }
+        thread->postEvent(EventPing, 0, 0, 0, portMAX_DELAY);
+        while (thread->pings.load(std::memory_order_acquire) < i + 1)
+        {
+            portYIELD();
+        }
+        for (uint16_t device = 0; device < STATE_DEVICES; device++)
+        {
+            isLatest = isLatest && (thread->states[device] == (i + 1) * STATE_BURST - 1);
+        }
+    }
+    uint64_t elapsedNs = nowNs() - startNs;
+    thread->stop();
+
+    const QueueStats &stats = thread->queueStats();
+    printf("  %-22s: %6u handler calls, %6u coalesced, %7.1f ms, latest state delivered: %s\n", name,
+           thread->stateCalls, stats.coalesced, elapsedNs / 1e6, isLatest ? "yes" : "NO");
+}
+
+static void benchCoalescing(void)
+{
+    printf("5. %d rounds of %d state updates x %d devices, handler %d us (consumer busy %d us while posted)\n",
+           STATE_ROUNDS, STATE_BURST, STATE_DEVICES, STATE_WORK_US, STATE_GATE_US);
+
+    stateBursts("postEvent()", static_cast<StateThread *>(startThread(new StateThread())), false);
+
+    StateThread *thread = new StateThread();
+    thread->createMailbox();
+    stateBursts("postCoalesced()", static_cast<StateThread *>(startThread(thread)), true);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// 6. payload hand-off
+/////////////////////////////////////////////////////////////////////////////
+#define PAYLOAD_MESSAGES 200000
+#define PAYLOAD_SIZE 512
+#define PAYLOAD_QUEUE_LENGTH 64
+#define PAYLOAD_BLOCKS (PAYLOAD_QUEUE_LENGTH + 8) // queued blocks + the ones held by producer and consumer
+
+static uint8_t *heapSlots[PAYLOAD_BLOCKS]; // a heap pointer does not fit in lParam on 64-bit hosts
+
+class PayloadThread : public BenchThread
+{
+public:
+    PayloadThread() : BenchThread(PAYLOAD_QUEUE_LENGTH),
+                      checksum(0)
+    {
+    }
+
+    virtual void onMessage(const Message &msg)
+    {
+        if (msg.event == EventHeap)
+        {
+            uint8_t *data = heapSlots[msg.lParam];
+            checksum += data[0] + data[msg.uParam - 1];
+            free(data);
+        }
+        else if (msg.event == EventBlock)
+        {
+            BufferRef payload(msg.lParam);
+            checksum += payload.data()[0] + payload.data()[payload.length() - 1];
+        }
+        BenchThread::onMessage(msg);
+    }
+
+    uint32_t checksum;
+};
+
+// "recv" stands for the driver writing a received payload
+static inline void recvPayload(uint8_t *buffer, const uint8_t *source)
+{
+    memcpy(buffer, source, PAYLOAD_SIZE);
+}
+
+static void benchPayload(void)
+{
+    printf("6. hand-off of %d payloads of %d bytes, queue length %d\n", PAYLOAD_MESSAGES, PAYLOAD_SIZE, PAYLOAD_QUEUE_LENGTH);
+
+    static uint8_t source[PAYLOAD_SIZE];
+    static uint8_t rxBuf[PAYLOAD_SIZE];
+    memset(source, 0x5A, sizeof(source));
+
+    PayloadThread *thread = static_cast<PayloadThread *>(startThread(new PayloadThread()));
+    uint64_t startNs = nowNs();
+    for (uint32_t i = 0; i < PAYLOAD_MESSAGES; i++)
+    {
+        // receive into a static buffer, then copy to the heap for the consumer
+        recvPayload(rxBuf, source);
+        uint32_t slot = i % PAYLOAD_BLOCKS;
+        heapSlots[slot] = (uint8_t *)malloc(PAYLOAD_SIZE);
+        memcpy(heapSlots[slot], rxBuf, PAYLOAD_SIZE);
+        thread->postEvent(EventHeap, 0, PAYLOAD_SIZE, slot, portMAX_DELAY);
+    }
+    thread->waitDispatched(PAYLOAD_MESSAGES);
+    uint64_t heapNs = nowNs() - startNs;
+    thread->stop();
+    printf("  %-22s: %6.0f ns per message\n", "malloc + memcpy", (double)heapNs / PAYLOAD_MESSAGES);
+
+    BufferPool pool(PAYLOAD_SIZE, PAYLOAD_BLOCKS);
+    thread = static_cast<PayloadThread *>(startThread(new PayloadThread()));
+    uint32_t waits = 0;
+    startNs = nowNs();
+    for (uint32_t i = 0; i < PAYLOAD_MESSAGES; i++)
+    {
+        // receive straight into a pool block and hand the block over
+        BufferRef block = BufferRef::alloc(pool);
+        while (!block.isValid())
+        {
+            waits++;
+            portYIELD();
+            block = BufferRef::alloc(pool);
+        }
+        recvPayload(block.data(), source);
+        block.setLength(PAYLOAD_SIZE);
+        thread->postBuffer(thread, EventBlock, 0, 0, std::move(block), portMAX_DELAY);
+    }
+    thread->waitDispatched(PAYLOAD_MESSAGES);
+    uint64_t poolNs = nowNs() - startNs;
+    thread->stop();
+
+    const PoolStats &stats = pool.stats();
+    printf("  %-22s: %6.0f ns per message, %u blocks, high water %u, in use %u, exhausted %u times\n", "BufferPool",
+           (double)poolNs / PAYLOAD_MESSAGES, stats.blocks, stats.highWater, stats.inUse, stats.failures);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// 7. request / response
+/////////////////////////////////////////////////////////////////////////////
+#define CALL_COUNT 20000
+
+class EchoThread : public BenchThread
+{
+public:
+    EchoThread() : BenchThread(16),
+                   replyQueue(nullptr)
+    {
+    }
+
+    virtual void onMessage(const Message &msg)
+    {
+        if (msg.event == EventRequest)
+        {
+            if (isCall())
+            {
+                reply(msg.lParam + 1);
+            }
+            else
+            {
+                postEvent(replyQueue, EventRequest, 0, 0, msg.lParam + 1, portMAX_DELAY);
+            }
+        }
+        BenchThread::onMessage(msg);
+    }
+
+    MessageQueue *replyQueue; // queue of the requester for reply events
+};
+
+static void benchCall(void)
+{
+    printf("7. request / response round trip, %d requests\n", CALL_COUNT);
+
+    EchoThread *thread = static_cast<EchoThread *>(startThread(new EchoThread()));
+    QueueHandle_t replyHandle = xQueueCreate(16, sizeof(QueueItem));
+    MessageQueue replyQueue(replyHandle);
+    thread->replyQueue = &replyQueue;
+
+    std::vector<uint32_t> samples;
+    samples.reserve(CALL_COUNT);
+    bool isCorrect = true;
+    for (uint32_t i = 0; i < CALL_COUNT; i++)
+    {
+        uint64_t begin = nowNs();
+        replyQueue.postEvent(thread, EventRequest, 0, 0, i, portMAX_DELAY);
+        QueueItem item;
+        xQueueReceive(replyHandle, &item, portMAX_DELAY);
+        samples.push_back((uint32_t)(nowNs() - begin));
+        isCorrect = isCorrect && item.msg.lParam == i + 1;
+    }
+    printLatency("request + reply event", samples);
+
+    samples.clear();
+    uint32_t timeouts = 0;
+    for (uint32_t i = 0; i < CALL_COUNT; i++)
+    {
+        uint64_t begin = nowNs();
+        uint32_t result = 0;
+        if (replyQueue.call(thread, EventRequest, 0, 0, i, result) != CallOk)
+        {
+            timeouts++;
+        }
+        samples.push_back((uint32_t)(nowNs() - begin));
+        isCorrect = isCorrect && result == i + 1;
+    }
+    printLatency("call()", samples);
+    printf("  replies correct: %s, failed calls: %u\n", isCorrect ? "yes" : "NO", timeouts);
+
+    thread->stop();
+    vQueueDelete(replyHandle);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// 8. message-flow trace
+/////////////////////////////////////////////////////////////////////////////
+#define TRACE_COUNT 1000000
+
+static void printCost(const char *name, uint64_t beginNs, uint32_t count)
+{
+    printf("  %-34s %7.1f ns\n", name, (nowNs() - beginNs) / (double)count);
+}
+
+static void benchTrace(void)
+{
+    printf("8. message-flow trace (MessageTrace), per record / per post\n");
+
+    MessageTrace &trace = MessageTrace::instance();
+    Message msg = {
+        .event = EventPing,
+        .iParam = 0,
+        .uParam = 0,
+        .lParam = 0,
+    };
+    uint64_t begin = nowNs();
+    for (uint32_t i = 0; i < TRACE_COUNT; i++)
+    {
+        trace.record(TracePost, i, i, msg, 1, 2);
+    }
+    printCost("record()", begin, TRACE_COUNT);
+
+    // post and take back on the same task: the queue operations plus the trace
+    QueueHandle_t handle = xQueueCreate(1, sizeof(QueueItem));
+    MessageQueue queue(handle);
+    queue.setTraceName("bench");
+    for (int isEnabled = 1; isEnabled >= 0; isEnabled--)
+    {
+        trace.setEnabled(isEnabled);
+        QueueItem item;
+        begin = nowNs();
+        for (uint32_t i = 0; i < TRACE_COUNT / 10; i++)
+        {
+            queue.postEvent(EventPing, 0, 0, i);
+            xQueueReceive(handle, &item, 0);
+        }
+        printCost(isEnabled ? "postEvent() + receive, trace on" : "postEvent() + receive, trace off", begin, TRACE_COUNT / 10);
+    }
+    trace.setEnabled(true);
+    vQueueDelete(handle);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+int main(int argc, char *argv[])
+{
+    printf("ArduProf " ARDUPROF_VER " on POSIX threads\n");
+    benchLatency();
+    benchBacklog();
+    benchThroughput();
+    benchQueueFull();
+    benchCoalescing();
+    benchPayload();
+    benchCall();
+    benchTrace();
+    return 0;
+}
@@ -0,0 +1,140 @@
+/* Copyright 2024 teamprof.net@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+  Host benchmark of MessageBroker fan-out on the POSIX port (ARDUPROF_POSIX).
+
+  build & run (Linux):
+    cmake -S . -B build && cmake --build build && ./build/bench_pubsub
+
+  Cost of one publish() to N subscribers, against posting the N copies by hand with postEvent().
+  Subscriber queues are not consumed during a round and are emptied between rounds, so only the
+  producer side is measured. Absolute numbers are those of the host, use them to compare variants.
+*/
+#include <stdio.h>
+#include <chrono>
+#include <vector>
+#include "ArduProf.h"
+
+using namespace ardufreertos;
+
+#define ROUNDS 100
+#define PUBLISHES 500    // per round, fits in the subscriber queues
+#define OTHER_TOPICS 8   // unrelated topics in the broker table
+#define EVENT_STATE 100
+#define STATE_DEVICE 3
+
+static inline uint64_t nowNs(void)
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// posts on behalf of the producer, postEvent() is a member of MessageQueue
+class Producer : public MessageQueue
+{
+public:
+    Producer() : MessageQueue((uint16_t)1)
+    {
+    }
+};
+
+static void fanOut(int subscriberCount)
+{
+    std::vector<QueueHandle_t> handles;
+    std::vector<MessageQueue *> queues;
+    MessageBroker broker;
+    Producer other; // takes one subscriber bit
+    for (int i = 0; i < OTHER_TOPICS; i++)
+    {
+        broker.subscribe(&other, EVENT_STATE + 1 + i);
+    }
+    for (int i = 0; i < subscriberCount; i++)
+    {
+        QueueHandle_t handle = xQueueCreate(PUBLISHES, sizeof(QueueItem));
+        handles.push_back(handle);
+        queues.push_back(new MessageQueue(handle));
+        broker.subscribe(queues.back(), EVENT_STATE, STATE_DEVICE);
+    }
+
+    Producer producer;
+    Message msg = {
+        .event = EVENT_STATE,
+        .iParam = STATE_DEVICE,
+        .uParam = 0,
+        .lParam = 0,
+    };
+    uint64_t publishNs = 0, manualNs = 0;
+    uint32_t delivered = 0;
+    for (int round = 0; round < ROUNDS; round++)
+    {
+        uint64_t begin = nowNs();
+        for (uint32_t i = 0; i < PUBLISHES; i++)
+        {
+            msg.lParam = i;
+            delivered += broker.publish(msg);
+        }
+        publishNs += nowNs() - begin;
+        for (auto handle : handles)
+        {
+            xQueueReset(handle);
+        }
+
+        begin = nowNs();
+        for (uint32_t i = 0; i < PUBLISHES; i++)
+        {
+            msg.lParam = i;
+            for (auto queue : queues)
+            {
+                producer.postEvent(queue, msg);
+            }
+        }
+        manualNs += nowNs() - begin;
+        for (auto handle : handles)
+        {
+            xQueueReset(handle);
+        }
+    }
+
+    const double publishes = (double)ROUNDS * PUBLISHES;
+    printf("  %2d subscriber(s): publish() %7.0f ns, per subscriber %5.0f ns | postEvent() x %-2d %7.0f ns | delivered %u\n",
+           subscriberCount, publishNs / publishes, subscriberCount ? publishNs / publishes / subscriberCount : 0.0,
+           subscriberCount, manualNs / publishes, delivered);
+
+    for (auto queue : queues)
+    {
+        delete queue;
+    }
+    for (auto handle : handles)
+    {
+        vQueueDelete(handle);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    printf("ArduProf " ARDUPROF_VER " on POSIX threads\n");
+    printf("fan-out of one publish(), %d topics in the broker, %d x %d publishes\n", OTHER_TOPICS + 1, ROUNDS, PUBLISHES);
+    const int counts[] = {0, 1, 2, 4, 8, 16, 31};
+    for (auto count : counts)
+    {
+        fanOut(count);
+    }
+    return 0;
+}
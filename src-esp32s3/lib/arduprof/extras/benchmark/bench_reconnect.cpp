@@ -0,0 +1,342 @@
+/* Copyright 2024 teamprof.net@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+  Host benchmark of a TCP client under a reconnect storm on the POSIX port (ARDUPROF_POSIX, C++20).
+
+  build & run (Linux):
+    cmake -S . -B build && cmake --build build && ./build/bench_reconnect
+
+  A local stand-in for the panel server either accepts, sends one JSON line and closes at once
+  (a flapping server) or does not listen at all (a server down: connect is refused). The client
+  reconnects without delay, CYCLES times, in two ways:
+  - task per connection (the former TaskTcpClient): each cycle creates a task which blocks in
+    connect() and recv(), reports to the bus and deletes itself
+  - coroutine (ThreadPanel::runTcpClient()): each cycle is a coroutine of the bus awaiting
+    connectAsync() and recvAsync() on the shared IoPoller task
+  Meanwhile a ticker posts a ping every PING_PERIOD_US to the bus: its latency shows whether the
+  bus stays responsive. On ESP-IDF each created task also allocates its stack (4 KB) and TCB from
+  the heap; the host only shows the CPU time. Absolute numbers are those of the host.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include "ArduProf.h"
+
+using namespace ardufreertos;
+
+#define CYCLES 5000
+#define PING_PERIOD_US 500
+#define PINGS 100000             // most pings of one run
+#define CLIENT_STACK_SIZE 4096   // of the former TaskTcpClient
+#define GREETING "{\"device\":\"lamp-esp\",\"event\":\"req-update\",\"arg0\":0,\"arg1\":0}"
+
+enum BenchEvent : int16_t
+{
+    EventPing = 0, // lParam=<sequence number>
+    EventClosed,   // a connection cycle is over, iParam=<0 or -errno>
+};
+
+static inline uint64_t nowNs(void)
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static inline uint64_t cpuNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// stand-in server: accept, send one line, close
+/////////////////////////////////////////////////////////////////////////////
+class StandInServer
+{
+public:
+    StandInServer() : _sock(-1), _isStopped(false), _accepted(0)
+    {
+    }
+
+    // listen on a free loopback port, or only reserve one (isListening false: connect is refused)
+    uint16_t open(bool isListening)
+    {
+        _sock = socket(AF_INET, SOCK_STREAM, 0);
+        int reuse = 1;
+        setsockopt(_sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        struct sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t addrlen = sizeof(addr);
+        bind(_sock, (struct sockaddr *)&addr, sizeof(addr));
+        getsockname(_sock, (struct sockaddr *)&addr, &addrlen);
+        if (isListening)
+        {
+            listen(_sock, 64);
+            _thread = std::thread([this]
+                                  { serve(); });
+        }
+        return ntohs(addr.sin_port);
+    }
+
+    void close(void)
+    {
+        _isStopped.store(true);
+        shutdown(_sock, SHUT_RDWR); // ends accept()
+        if (_thread.joinable())
+        {
+            _thread.join();
+        }
+        ::close(_sock);
+    }
+
+    uint32_t accepted(void)
+    {
+        return _accepted.load();
+    }
+
+private:
+    int _sock;
+    std::thread _thread;
+    std::atomic<bool> _isStopped;
+    std::atomic<uint32_t> _accepted;
+
+    void serve(void)
+    {
+        while (!_isStopped.load())
+        {
+            int client = accept(_sock, nullptr, nullptr);
+            if (client < 0)
+            {
+                continue;
+            }
+            _accepted++;
+            send(client, GREETING, sizeof(GREETING) - 1, MSG_NOSIGNAL);
+            ::close(client);
+        }
+    }
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// client bus: starts the next cycle when one is closed, times the pings
+/////////////////////////////////////////////////////////////////////////////
+class ClientBus : public ThreadBase
+{
+public:
+    enum Mode
+    {
+        TaskPerConnection,
+        CoroutineClient,
+    };
+
+    ClientBus(Mode mode, uint16_t port) : ThreadBase(256),
+                                          sendNs(PINGS),
+                                          cycles(0),
+                                          failures(0),
+                                          received(0),
+                                          tasksCreated(0),
+                                          isDone(false),
+                                          _mode(mode),
+                                          _port(port)
+    {
+        latencyNs.reserve(PINGS);
+    }
+
+    virtual void start(void *ctx)
+    {
+        ThreadBase::start(ctx);
+        xTaskCreate(
+            [](void *instance)
+            { static_cast<ThreadBase *>(instance)->run(); },
+            "ClientBus", 4096, this, 2, &_taskHandle);
+    }
+
+    virtual void setup(void)
+    {
+        ThreadBase::setup();
+        connect();
+    }
+
+    virtual void onMessage(const Message &msg)
+    {
+        switch (msg.event)
+        {
+        case EventPing:
+            latencyNs.push_back((uint32_t)(nowNs() - sendNs[msg.lParam]));
+            break;
+        case EventClosed:
+            failures += msg.iParam < 0 ? 1 : 0;
+            if (++cycles < CYCLES)
+            {
+                connect();
+            }
+            else
+            {
+                isDone.store(true);
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    std::vector<uint64_t> sendNs;
+    std::vector<uint32_t> latencyNs;
+    uint32_t cycles;
+    uint32_t failures;
+    std::atomic<uint32_t> received;
+    uint32_t tasksCreated;
+    std::atomic<bool> isDone;
+
+private:
+    Mode _mode;
+    uint16_t _port;
+
+    struct sockaddr_in serverAddr(void)
+    {
+        struct sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(_port);
+        return addr;
+    }
+
+    void connect(void)
+    {
+        if (_mode == CoroutineClient)
+        {
+            runClient();
+            return;
+        }
+        tasksCreated++;
+        xTaskCreate([](void *instance)
+                    { static_cast<ClientBus *>(instance)->runTask(); },
+                    "tcpClient", CLIENT_STACK_SIZE, this, 2, nullptr);
+    }
+
+    // the former TaskTcpClient: blocking connect() and recv() in a task of its own
+    void runTask(void)
+    {
+        int sock = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in addr = serverAddr();
+        int result = 0;
+        if (::connect(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+        {
+            result = -errno;
+        }
+        else
+        {
+            char rxBuf[128];
+            int len;
+            while ((len = recv(sock, rxBuf, sizeof(rxBuf), 0)) > 0)
+            {
+                received += len;
+            }
+        }
+        ::close(sock);
+        postEvent(this, EventClosed, (int16_t)result);
+        vTaskDelete(nullptr);
+    }
+
+    // ThreadPanel::runTcpClient(): awaited on IoPoller, no task
+    Coroutine runClient(void)
+    {
+        int sock = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in addr = serverAddr();
+        int result = co_await connectAsync(sock, (struct sockaddr *)&addr, sizeof(addr), 1000);
+        if (result == 0)
+        {
+            char rxBuf[128];
+            int len;
+            while ((len = co_await recvAsync(sock, rxBuf, sizeof(rxBuf), 1000)) > 0)
+            {
+                received += len;
+            }
+        }
+        ::close(sock);
+        postEvent(this, EventClosed, (int16_t)result);
+    }
+};
+
+static int benchContext; // ThreadBase::start() requires a context
+
+static void storm(const char *name, ClientBus::Mode mode, bool isListening)
+{
+    StandInServer server;
+    uint16_t port = server.open(isListening);
+    ClientBus *bus = new ClientBus(mode, port);
+
+    UBaseType_t baseTasks = uxTaskGetNumberOfTasks();
+    UBaseType_t peakTasks = 0;
+    uint64_t beginCpu = cpuNs();
+    uint64_t beginNs = nowNs();
+    bus->start(&benchContext);
+
+    // ticker: pings the bus while it reconnects
+    uint32_t pings = 0;
+    while (!bus->isDone.load() && pings < PINGS)
+    {
+        bus->sendNs[pings] = nowNs();
+        bus->postEvent(bus, EventPing, 0, 0, pings, pdMS_TO_TICKS(10));
+        pings++;
+        UBaseType_t tasks = uxTaskGetNumberOfTasks();
+        peakTasks = tasks > peakTasks ? tasks : peakTasks;
+        usleep(PING_PERIOD_US);
+    }
+    uint64_t elapsedNs = nowNs() - beginNs;
+    uint64_t elapsedCpu = cpuNs() - beginCpu;
+    usleep(20000); // last pings
+    server.close();
+
+    std::vector<uint32_t> &samples = bus->latencyNs;
+    std::sort(samples.begin(), samples.end());
+    size_t n = samples.size();
+    printf("  %-28s: %6.0f cycles/s, %6.1f us CPU per cycle, %4u refused, %7u bytes received, %4u tasks created, peak +%lu tasks\n",
+           name, bus->cycles * 1e9 / elapsedNs, elapsedCpu / 1000.0 / bus->cycles, bus->failures,
+           bus->received.load(), bus->tasksCreated, peakTasks > baseTasks ? peakTasks - baseTasks : 0);
+    if (n)
+    {
+        printf("  %-28s  ping latency p50=%6.2f us  p99=%7.2f us  max=%8.2f us  (%zu pings)\n", "",
+               samples[n / 2] / 1000.0, samples[n * 99 / 100] / 1000.0, samples[n - 1] / 1000.0, n);
+    }
+    // the bus task keeps running: the benchmark process ends soon
+}
+
+int main(int argc, char *argv[])
+{
+    printf("ArduProf " ARDUPROF_VER " on POSIX threads\n");
+    printf("reconnect storm, %d cycles, ping every %d us\n", CYCLES, PING_PERIOD_US);
+    printf("1. flapping server: accept, one line, close\n");
+    storm("task per connection", ClientBus::TaskPerConnection, true);
+    storm("coroutine (IoPoller)", ClientBus::CoroutineClient, true);
+    printf("2. server down: connect refused\n");
+    storm("task per connection", ClientBus::TaskPerConnection, false);
+    storm("coroutine (IoPoller)", ClientBus::CoroutineClient, false);
+    return 0;
+}
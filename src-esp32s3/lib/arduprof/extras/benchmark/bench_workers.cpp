@@ -0,0 +1,139 @@
+/* Copyright 2024 teamprof.net@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+  Host benchmark of WorkerPool on the POSIX port (ARDUPROF_POSIX).
+
+  build & run (Linux):
+    cmake -S . -B build && cmake --build build && ./build/bench_workers
+
+  A MessageBus-like producer offloads CPU-bound jobs (rendering a 1 KB LED frame) to a WorkerPool of
+  1 to ARDUPROF_WORKER_MAX workers; each job posts a "done" message back to the producer queue. All
+  jobs are submitted from one task, so every worker but the first one only gets work by stealing.
+  Speed-up is bounded by the CPUs of the host: on a single CPU it stays around 1.
+*/
+#include <stdio.h>
+#include <chrono>
+#include <thread>
+#include "ArduProf.h"
+
+using namespace ardufreertos;
+
+#define JOBS 4000
+#define FRAME_BYTES 1024
+#define FRAME_PASSES 16 // work per job
+#define EVENT_DONE 1
+
+static inline uint64_t nowNs(void)
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+typedef struct _Frame
+{
+    uint32_t seed;
+    uint8_t pixels[FRAME_BYTES];
+} Frame;
+
+static Frame frames[JOBS];
+
+static void renderFrame(void *arg)
+{
+    Frame *frame = static_cast<Frame *>(arg);
+    uint32_t x = frame->seed;
+    for (int pass = 0; pass < FRAME_PASSES; pass++)
+    {
+        for (int i = 0; i < FRAME_BYTES; i++)
+        {
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            frame->pixels[i] = (uint8_t)(frame->pixels[i] + (x >> 24));
+        }
+    }
+}
+
+static double runPool(uint8_t workerCount, double baseNs)
+{
+    QueueHandle_t doneHandle = xQueueCreate(JOBS, sizeof(QueueItem));
+    MessageQueue doneQueue(doneHandle);
+    WorkerPool pool;
+    pool.start(workerCount);
+
+    uint64_t begin = nowNs();
+    uint32_t done = 0;
+    QueueItem item;
+    for (uint32_t i = 0; i < JOBS; i++)
+    {
+        frames[i].seed = i + 1;
+        while (!pool.submit(renderFrame, &frames[i], &doneQueue, EVENT_DONE, 0, 0, i))
+        {
+            // deque full: handle a completion first, as a MessageBus would
+            xQueueReceive(doneHandle, &item, portMAX_DELAY);
+            done++;
+        }
+    }
+    while (done < JOBS)
+    {
+        xQueueReceive(doneHandle, &item, portMAX_DELAY);
+        done++;
+    }
+    double ns = (double)(nowNs() - begin);
+
+    uint32_t executed = 0, stolen = 0;
+    printf("  %u worker(s): %7.1f ms, %6.0f jobs/s, speed-up %4.2f | jobs per worker", workerCount, ns / 1e6, JOBS / (ns / 1e9), baseNs > 0 ? baseNs / ns : 1.0);
+    for (uint8_t i = 0; i < workerCount; i++)
+    {
+        const WorkerStats &stats = pool.stats(i);
+        executed += stats.executed;
+        stolen += stats.stolen;
+        printf(" %u", stats.executed);
+    }
+    printf(", stolen %u, deque full %u\n", stolen, pool.rejected());
+
+    pool.stop();
+    vQueueDelete(doneHandle);
+    return ns;
+}
+
+int main(int argc, char *argv[])
+{
+    printf("ArduProf " ARDUPROF_VER " on POSIX threads, %u CPU(s)\n", std::thread::hardware_concurrency());
+    printf("%d jobs of %d x %d byte frame passes, deque size %d\n", JOBS, FRAME_PASSES, FRAME_BYTES, ARDUPROF_WORKER_DEQUE_SIZE);
+
+    uint64_t begin = nowNs();
+    for (uint32_t i = 0; i < JOBS; i++)
+    {
+        frames[i].seed = i + 1;
+        renderFrame(&frames[i]);
+    }
+    printf("  inline  : %7.1f ms\n", (nowNs() - begin) / 1e6);
+
+    double baseNs = 0;
+    for (uint8_t count = 1; count <= ARDUPROF_WORKER_MAX; count++)
+    {
+        double ns = runPool(count, baseNs);
+        if (count == 1)
+        {
+            baseNs = ns;
+        }
+    }
+    return 0;
+}
@@ -19,16 +19,8 @@
  */
 #pragma once
 
-class ThreadPanel;
-class LampModel;
-
-class TaskTcpClient
-{
-public:
-    static void start(void *threadParent);
-
-private:
-    static char _rxBuf[];
-    static void run(void *threadParent);
-    static void processJsonData(ThreadPanel *parent, LampModel &model);
-};
\ No newline at end of file
+// ESP-IDF logging of the application sources built by the host benchmarks (bench_codec), compiled out
+#define ESP_LOGE(tag, format, ...) ((void)(tag))
+#define ESP_LOGW(tag, format, ...) ((void)(tag))
+#define ESP_LOGI(tag, format, ...) ((void)(tag))
+#define ESP_LOGD(tag, format, ...) ((void)(tag))
@@ -0,0 +1,182 @@
+# Copyright 2024 teamprof.net@gmail.com
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy of this
+# software and associated documentation files (the "Software"), to deal in the Software
+# without restriction, including without limitation the rights to use, copy, modify,
+# merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+# permit persons to whom the Software is furnished to do so, subject to the following
+# conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+# INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+# PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+# HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+# OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+# SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+"""
+Convert a dump of the ArduProf message-flow trace (MessageTrace) into Chrome trace JSON,
+to be opened in https://ui.perfetto.dev or chrome://tracing.
+
+  python3 trace2chrome.py dump.bin -o trace.json
+  python3 trace2chrome.py serial.log -o trace.json --events ../../../../main/AppEvent.h
+
+The input is either the binary written by MessageTrace::dump() or a serial log holding
+"APTR:<hex>" lines (e.g. "matter arduprof trace"); the last dump of the input is converted.
+Each track (bus or named task) becomes a thread: handlers are slices, posts are instant
+events, and a flow arrow links every post to the dispatch of its message.
+"""
+import argparse
+import json
+import re
+import struct
+import sys
+
+MAGIC = b"APTR"
+HEADER = struct.Struct("<4sHHHHII")  # magic, version, recordSize, tracks, nameSize, count, lost
+RECORD = struct.Struct("<IIIhhBBBB")  # seq, timeUs, postUs, event, iParam, type, src, dst, result
+
+TRACE_POST, TRACE_BEGIN, TRACE_END = 1, 2, 3
+TRACK_ISR = 0xFF
+PID = 1
+
+POST_RESULTS = ["ok", "coalesced", "droppedOldest", "dropped", "timeout", "rejected", "invalid"]
+RESERVED_EVENTS = {-32768: "mailbox", -32767: "delayInit", -32766: "call"}
+
+
+def read_input(path):
+    with open(path, "rb") as f:
+        data = f.read()
+    if data.startswith(MAGIC):
+        return data
+    # serial log: concatenate the hex of all "APTR:" lines
+    hexdata = "".join(re.findall(r"APTR:([0-9a-fA-F]+)", data.decode("utf-8", "replace")))
+    return bytes.fromhex(hexdata)
+
+
+def parse_dumps(data):
+    dumps = []
+    offset = 0
+    while offset + HEADER.size <= len(data):
+        magic, version, record_size, tracks, name_size, count, lost = HEADER.unpack_from(data, offset)
+        if magic != MAGIC or version != 1 or record_size != RECORD.size:
+            raise ValueError("not an ArduProf trace dump at offset %d" % offset)
+        offset += HEADER.size
+        names = []
+        for i in range(tracks):
+            raw = data[offset + i * name_size : offset + (i + 1) * name_size]
+            names.append(raw.split(b"\0", 1)[0].decode("utf-8", "replace"))
+        offset += tracks * name_size
+        records = []
+        for i in range(count):
+            if offset + RECORD.size > len(data):
+                break  # truncated log
+            records.append(RECORD.unpack_from(data, offset))
+            offset += RECORD.size
+        dumps.append((names, lost, records))
+    return dumps
+
+
+def parse_events(path):
+    """enumerator names of a C/C++ header, e.g. AppEvent.h"""
+    names = {}
+    with open(path) as f:
+        text = re.sub(r"//[^\n]*|/\*.*?\*/", "", f.read(), flags=re.S)
+    for body in re.findall(r"enum[^{;]*\{([^}]*)\}", text):
+        value = -1
+        for entry in body.split(","):
+            match = re.match(r"\s*(\w+)\s*(?:=\s*(-?\d+))?\s*$", entry)
+            if not match:
+                continue
+            value = int(match.group(2)) if match.group(2) else value + 1
+            names.setdefault(value, match.group(1))
+    return names
+
+
+def convert(names, lost, records, event_names):
+    def track_name(track):
+        if track == TRACK_ISR:
+            return "ISR"
+        return names[track] if track < len(names) and names[track] else "track %d" % track
+
+    def event_name(event):
+        return event_names.get(event) or RESERVED_EVENTS.get(event) or "event %d" % event
+
+    def delta(us, base):
+        d = (us - base) & 0xFFFFFFFF  # clockUs() wraps after ~71 minutes
+        return d - (1 << 32) if d >= 1 << 31 else d
+
+    # a post is recorded after its message is queued, it may follow the dispatch in the ring
+    t0 = records[0][1] if records else 0
+    t0 += min([delta(r[1], t0) for r in records] or [0])
+
+    def ts(us):
+        return delta(us, t0)
+
+    out = [{"ph": "M", "pid": PID, "name": "process_name", "args": {"name": "ArduProf"}}]
+    for track in sorted({r[6] for r in records} | {r[7] for r in records}):
+        out.append({"ph": "M", "pid": PID, "tid": track, "name": "thread_name", "args": {"name": track_name(track)}})
+
+    # a dispatch is matched to its post by (destination, post time)
+    dispatched = {(r[7], r[2]) for r in records if r[5] == TRACE_BEGIN}
+    flows = {}
+    for r in records:
+        if r[5] == TRACE_POST and r[8] <= 2 and (r[7], r[2]) in dispatched:
+            flows.setdefault((r[7], r[2]), len(flows) + 1)
+    depth = {}
+    for seq, time_us, post_us, event, iparam, kind, src, dst, result in records:
+        key = (dst, post_us)
+        if kind == TRACE_POST:
+            status = POST_RESULTS[result] if result < len(POST_RESULTS) else str(result)
+            out.append({"ph": "i", "s": "t", "pid": PID, "tid": src, "ts": ts(time_us), "cat": "post",
+                        "name": "post " + event_name(event),
+                        "args": {"to": track_name(dst), "iParam": iparam, "result": status}})
+            if result <= 2 and key in flows:
+                out.append({"ph": "s", "pid": PID, "tid": src, "ts": ts(time_us), "cat": "message",
+                            "name": "message", "id": flows[key]})
+        elif kind == TRACE_BEGIN:
+            depth[dst] = depth.get(dst, 0) + 1
+            out.append({"ph": "B", "pid": PID, "tid": dst, "ts": ts(time_us), "cat": "handler",
+                        "name": event_name(event),
+                        "args": {"iParam": iparam, "latencyUs": ts(time_us) - ts(post_us)}})
+            if key in flows:
+                out.append({"ph": "f", "bp": "e", "pid": PID, "tid": dst, "ts": ts(time_us), "cat": "message",
+                            "name": "message", "id": flows[key]})
+        elif kind == TRACE_END:
+            if depth.get(dst, 0) == 0:
+                continue  # its begin was overwritten
+            depth[dst] -= 1
+            out.append({"ph": "E", "pid": PID, "tid": dst, "ts": ts(time_us)})
+
+    return {"traceEvents": out, "displayTimeUnit": "ms",
+            "otherData": {"records": len(records), "lost": lost}}
+
+
+def main():
+    parser = argparse.ArgumentParser(description="ArduProf MessageTrace dump to Chrome trace JSON")
+    parser.add_argument("input", help="binary dump or serial log with APTR: lines")
+    parser.add_argument("-o", "--output", help="output JSON file, stdout if omitted")
+    parser.add_argument("--events", action="append", default=[], help="C/C++ header with event enums, repeatable")
+    args = parser.parse_args()
+
+    dumps = parse_dumps(read_input(args.input))
+    if not dumps:
+        sys.exit("no trace dump found in %s" % args.input)
+    event_names = {}
+    for path in args.events:
+        event_names.update(parse_events(path))
+
+    names, lost, records = dumps[-1]
+    trace = convert(names, lost, records, event_names)
+    if args.output:
+        with open(args.output, "w") as f:
+            json.dump(trace, f)
+    else:
+        json.dump(trace, sys.stdout)
+    print("%d records, %d lost, %d tracks" % (len(records), lost, len(names)), file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
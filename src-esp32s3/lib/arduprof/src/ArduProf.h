@@ -22,7 +22,17 @@
 #include "./LibLog.h"
 
 #include "./type/Message.h"
+#include "./type/EventTable.h"
 #include "./type/JsonMessage.h"
+#include "./type/FrameDecoder.h"
+#include "./type/SendRing.h"
+
+// host (Linux) build: FreeRTOS API on POSIX threads, see os/posix/FreeRTOSPosix.h
+#if defined ARDUPROF_POSIX
+#undef ARDUPROF_MBED
+#undef ARDUPROF_FREERTOS
+#define ARDUPROF_FREERTOS
+#endif
 
 #if !defined ARDUPROF_MBED && !defined ARDUPROF_FREERTOS
 #if CONFIG_IDF_TARGET_ESP32 || CONFIG_IDF_TARGET_ESP32S3 || CONFIG_IDF_TARGET_ESP32C3
@@ -33,13 +43,21 @@
 #endif
 
 #if defined ARDUPROF_FREERTOS
+#if defined ARDUPROF_POSIX
+#include "./os/posix/FreeRTOSPosix.h"
+#else
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
 #include "freertos/timers.h"
+#endif
 // #include <FreeRTOS.h>
 // #include <task.h>
 #include "./os/freertos/thread/ThreadBase.h"
+#include "./os/freertos/thread/StaticThread.h"
+#include "./os/freertos/MessageBroker.h"
+#include "./os/freertos/WorkerPool.h"
+#include "./os/freertos/SystemSampler.h"
 #include "./os/freertos/peripheral/PeriodicTimer.h"
 #include "./os/freertos/peripheral/SoftwareTimer.h"
 #include "./os/freertos/peripheral/Gpio.h"
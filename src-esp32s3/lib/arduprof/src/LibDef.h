@@ -29,15 +29,19 @@
 // v1.0: first release
 // v1.2: add namespace freertos
 // v1.3: support esp-idf toolchain
+// v1.4: replace std::map handler map by compile-time EventTable
+// v1.5: batched dispatch, priority lanes, lock-free ISR ring, POSIX host port
 #define LIB_MAJOR_VER 1
-#define LIB_MINOR_VER 3
+#define LIB_MINOR_VER 5
 ////////////////////////////////////////////////////////////////////////////////////////////
 
 #define dim(x) (sizeof(x) / sizeof(x[0]))
 #define sizeofarray(a) (sizeof(a) / sizeof(a[0]))
 
+#if !defined ARDUPROF_POSIX // 64-bit host build
 static_assert(sizeof(void *) == sizeof(uint32_t), "sizeof(void *) == sizeof(uint32_t)");
 static_assert(sizeof(unsigned long) == sizeof(uint32_t), "sizeof(unsigned long) == sizeof(uint32_t)");
+#endif
 
 #ifndef UNUSED
 #define UNUSED(x) ((void)(x))
@@ -0,0 +1,342 @@
+/* Copyright 2024 teamprof.net@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#pragma once
+#include <stdint.h>
+#include "../../type/MessageStats.h"
+
+#if defined ARDUPROF_FREERTOS
+
+#ifndef ARDUPROF_BUFFER_POOL_COUNT
+#define ARDUPROF_BUFFER_POOL_COUNT 4 // number of BufferPool instances which can exist at the same time
+#endif
+
+namespace ardufreertos
+{
+    // reference to a pool block carried in Message::lParam, 0 is the null handle.
+    // bit 31..28: pool id + 1, bit 27..16: generation of the block, bit 15..0: block index
+    typedef uint32_t BufferHandle;
+
+    /////////////////////////////////////////////////////////////////////////////
+    // Fixed-block buffer pool with reference counting.
+    // alloc(), retain() and release() are safe from any task or ISR and never call malloc.
+    // A handle becomes stale when its block is freed: data() then returns nullptr and release() ignores it.
+    /////////////////////////////////////////////////////////////////////////////
+    class BufferPool
+    {
+    public:
+        // "storage" (blockSize x blockCount bytes) is allocated if nullptr
+        BufferPool(uint16_t blockSize, uint16_t blockCount, uint8_t *storage = nullptr) : _storage(storage ? storage : new uint8_t[blockSize * blockCount]),
+                                                                                          _isStaticStorage(storage != nullptr),
+                                                                                          _blockSize(blockSize),
+                                                                                          _refCount(new uint16_t[blockCount]()),
+                                                                                          _generation(new uint16_t[blockCount]()),
+                                                                                          _length(new uint16_t[blockCount]()),
+                                                                                          _freeList(new uint16_t[blockCount]),
+                                                                                          _freeCount(blockCount),
+                                                                                          _id(-1),
+                                                                                          _stats()
+        {
+            configASSERT(blockSize && blockCount);
+            portMUX_INITIALIZE(&_mux);
+            for (uint16_t i = 0; i < blockCount; i++)
+            {
+                _freeList[i] = blockCount - 1 - i; // block 0 is allocated first
+            }
+            _stats.blocks = blockCount;
+
+            portENTER_CRITICAL(registryMux());
+            for (int i = 0; i < ARDUPROF_BUFFER_POOL_COUNT; i++)
+            {
+                if (registry()[i] == nullptr)
+                {
+                    registry()[i] = this;
+                    _id = i;
+                    break;
+                }
+            }
+            portEXIT_CRITICAL(registryMux());
+            configASSERT(_id >= 0);
+        }
+
+        ~BufferPool()
+        {
+            portENTER_CRITICAL(registryMux());
+            if (_id >= 0)
+            {
+                registry()[_id] = nullptr;
+            }
+            portEXIT_CRITICAL(registryMux());
+
+            if (!_isStaticStorage)
+            {
+                delete[] _storage;
+            }
+            delete[] _refCount;
+            delete[] _generation;
+            delete[] _length;
+            delete[] _freeList;
+        }
+
+        // a block with reference count 1 and length 0, or 0 if the pool is exhausted
+        BufferHandle alloc(void)
+        {
+            BufferHandle handle = 0;
+            portENTER_CRITICAL_SAFE(&_mux);
+            if (_freeCount)
+            {
+                uint16_t index = _freeList[--_freeCount];
+                _refCount[index] = 1;
+                _length[index] = 0;
+                handle = makeHandle(index);
+
+                _stats.allocs++;
+                if (++_stats.inUse > _stats.highWater)
+                {
+                    _stats.highWater = _stats.inUse;
+                }
+            }
+            else
+            {
+                _stats.failures++;
+            }
+            portEXIT_CRITICAL_SAFE(&_mux);
+            return handle;
+        }
+
+        // add a reference, e.g. before posting the same block to a second thread
+        bool retain(BufferHandle handle)
+        {
+            bool isValid = false;
+            portENTER_CRITICAL_SAFE(&_mux);
+            int index = indexOf(handle);
+            if (index >= 0)
+            {
+                _refCount[index]++;
+                isValid = true;
+            }
+            portEXIT_CRITICAL_SAFE(&_mux);
+            return isValid;
+        }
+
+        // drop a reference, the block returns to the pool with the last one
+        void release(BufferHandle handle)
+        {
+            portENTER_CRITICAL_SAFE(&_mux);
+            int index = indexOf(handle);
+            if (index >= 0 && --_refCount[index] == 0)
+            {
+                _generation[index]++;
+                _freeList[_freeCount++] = (uint16_t)index;
+                _stats.inUse--;
+            }
+            portEXIT_CRITICAL_SAFE(&_mux);
+        }
+
+        uint8_t *data(BufferHandle handle)
+        {
+            int index = indexOf(handle);
+            return index >= 0 ? _storage + index * _blockSize : nullptr;
+        }
+
+        // number of valid bytes, set by the producer
+        uint16_t length(BufferHandle handle)
+        {
+            int index = indexOf(handle);
+            return index >= 0 ? _length[index] : 0;
+        }
+        void setLength(BufferHandle handle, uint16_t length)
+        {
+            int index = indexOf(handle);
+            if (index >= 0)
+            {
+                _length[index] = length < _blockSize ? length : _blockSize;
+            }
+        }
+
+        uint16_t blockSize(void)
+        {
+            return _blockSize;
+        }
+
+        const PoolStats &stats(void)
+        {
+            return _stats;
+        }
+        void resetStats(void)
+        {
+            portENTER_CRITICAL_SAFE(&_mux);
+            _stats.resetCounters();
+            portEXIT_CRITICAL_SAFE(&_mux);
+        }
+
+        // pool which owns "handle", nullptr for the null handle or a deleted pool
+        static BufferPool *fromHandle(BufferHandle handle)
+        {
+            int id = (int)(handle >> 28) - 1;
+            return (id >= 0 && id < ARDUPROF_BUFFER_POOL_COUNT) ? registry()[id] : nullptr;
+        }
+
+    private:
+        uint8_t *_storage;
+        bool _isStaticStorage;
+        uint16_t _blockSize;
+
+        uint16_t *_refCount;   // per block, 0 when free
+        uint16_t *_generation; // per block, incremented when freed, invalidates stale handles
+        uint16_t *_length;     // per block, valid bytes
+        uint16_t *_freeList;   // stack of free block indices
+        uint16_t _freeCount;
+
+        int _id; // index in registry()
+        portMUX_TYPE _mux;
+        PoolStats _stats;
+
+        inline BufferHandle makeHandle(uint16_t index)
+        {
+            return ((BufferHandle)(_id + 1) << 28) | ((BufferHandle)(_generation[index] & 0x0FFF) << 16) | index;
+        }
+
+        // block index of a live handle of this pool, -1 otherwise
+        inline int indexOf(BufferHandle handle)
+        {
+            uint16_t index = (uint16_t)(handle & 0xFFFF);
+            if (handle == 0 || (int)(handle >> 28) != _id + 1 || index >= _stats.blocks ||
+                _refCount[index] == 0 || ((handle >> 16) & 0x0FFF) != (_generation[index] & 0x0FFFU))
+            {
+                return -1;
+            }
+            return index;
+        }
+
+        static BufferPool **registry(void)
+        {
+            static BufferPool *pools[ARDUPROF_BUFFER_POOL_COUNT];
+            return pools;
+        }
+        static portMUX_TYPE *registryMux(void)
+        {
+            static portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+            return &mux;
+        }
+    };
+
+    /////////////////////////////////////////////////////////////////////////////
+    // Owner of one reference of a pool block, released when the BufferRef goes out of scope.
+    // A message posted with postBuffer() carries one reference: adopt it in the handler with
+    //   BufferRef payload(msg.lParam);
+    // and copy the BufferRef to keep the block beyond the handler.
+    /////////////////////////////////////////////////////////////////////////////
+    class BufferRef
+    {
+    public:
+        BufferRef() : _handle(0)
+        {
+        }
+        explicit BufferRef(BufferHandle handle) : _handle(handle) // adopts the reference of "handle"
+        {
+        }
+        BufferRef(const BufferRef &other) : _handle(other._handle)
+        {
+            BufferPool *pool = BufferPool::fromHandle(_handle);
+            if (pool == nullptr || !pool->retain(_handle))
+            {
+                _handle = 0;
+            }
+        }
+        BufferRef(BufferRef &&other) : _handle(other.detach())
+        {
+        }
+        BufferRef &operator=(const BufferRef &other)
+        {
+            if (this != &other)
+            {
+                BufferRef copy(other);
+                reset();
+                _handle = copy.detach();
+            }
+            return *this;
+        }
+        ~BufferRef()
+        {
+            reset();
+        }
+
+        // allocate a block of "pool", check with isValid()
+        static BufferRef alloc(BufferPool &pool)
+        {
+            return BufferRef(pool.alloc());
+        }
+
+        bool isValid(void)
+        {
+            return data() != nullptr;
+        }
+        uint8_t *data(void)
+        {
+            BufferPool *pool = BufferPool::fromHandle(_handle);
+            return pool ? pool->data(_handle) : nullptr;
+        }
+        uint16_t length(void)
+        {
+            BufferPool *pool = BufferPool::fromHandle(_handle);
+            return pool ? pool->length(_handle) : 0;
+        }
+        void setLength(uint16_t length)
+        {
+            BufferPool *pool = BufferPool::fromHandle(_handle);
+            if (pool)
+            {
+                pool->setLength(_handle, length);
+            }
+        }
+        uint16_t capacity(void)
+        {
+            BufferPool *pool = BufferPool::fromHandle(_handle);
+            return pool ? pool->blockSize() : 0;
+        }
+
+        BufferHandle handle(void)
+        {
+            return _handle;
+        }
+        // give up ownership without releasing, e.g. to hand the reference to postBuffer()
+        BufferHandle detach(void)
+        {
+            BufferHandle handle = _handle;
+            _handle = 0;
+            return handle;
+        }
+        void reset(void)
+        {
+            BufferPool *pool = BufferPool::fromHandle(_handle);
+            if (pool)
+            {
+                pool->release(_handle);
+            }
+            _handle = 0;
+        }
+
+    private:
+        BufferHandle _handle;
+    };
+
+} // namespace ardufreertos
+
+#endif // ARDUPROF_FREERTOS
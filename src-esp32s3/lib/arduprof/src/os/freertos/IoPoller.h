@@ -0,0 +1,527 @@
+/* Copyright 2024 teamprof.net@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include "./MessageCoroutine.h"
+
+#if !defined ARDUPROF_COROUTINE_IO && ARDUPROF_COROUTINE
+#define ARDUPROF_COROUTINE_IO 1 // socket awaitables, lwIP on ESP-IDF or BSD sockets on the host
+#endif
+
+#if defined ARDUPROF_FREERTOS && ARDUPROF_COROUTINE && ARDUPROF_COROUTINE_IO
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#ifndef ARDUPROF_IO_WATCHES
+#define ARDUPROF_IO_WATCHES 8 // sockets awaited at the same time, all buses
+#endif
+
+#ifndef ARDUPROF_IO_POLLER_STACK
+#define ARDUPROF_IO_POLLER_STACK 3072
+#endif
+
+#ifndef ARDUPROF_IO_POLLER_PRIORITY
+#define ARDUPROF_IO_POLLER_PRIORITY 3
+#endif
+
+namespace ardufreertos
+{
+    /////////////////////////////////////////////////////////////////////////////
+    // Readiness of the sockets awaited by coroutines of all buses, in one shared task.
+    // The task sleeps in select() on the watched sockets plus a loopback UDP socket used to wake it
+    // when the watch list changes. A ready socket marks its AwaitSlot and posts ARDUPROF_EVENT_RESUME
+    // to the bus; the recv() or connect() result itself is read in the task of the bus.
+    /////////////////////////////////////////////////////////////////////////////
+    class IoPoller
+    {
+    public:
+        static IoPoller &instance(void)
+        {
+            static IoPoller poller;
+            existing() = &poller;
+            return poller;
+        }
+        // the poller if it was ever used, nullptr otherwise
+        static IoPoller *&existing(void)
+        {
+            static IoPoller *poller = nullptr;
+            return poller;
+        }
+
+        // resume slot "index" of "slots" when "fd" is readable (writable), returns false if no watch is free
+        bool watch(int fd, bool isWrite, MessageQueue *bus, AwaitSlots *slots, int index)
+        {
+            if (!start())
+            {
+                return false;
+            }
+            bool isAdded = false;
+            portENTER_CRITICAL(&_mux);
+            for (int i = 0; i < ARDUPROF_IO_WATCHES; i++)
+            {
+                Watch &w = _watches[i];
+                if (w.slots == nullptr)
+                {
+                    w.fd = fd;
+                    w.isWrite = isWrite;
+                    w.bus = bus;
+                    w.slots = slots;
+                    w.index = (uint8_t)index;
+                    w.generation = slots->slot(index).generation;
+                    isAdded = true;
+                    break;
+                }
+            }
+            portEXIT_CRITICAL(&_mux);
+            if (isAdded)
+            {
+                wake();
+            }
+            return isAdded;
+        }
+
+        // drop the watches of one slot (index >= 0) or of all slots of a bus (index < 0)
+        void cancel(AwaitSlots *slots, int index = -1)
+        {
+            portENTER_CRITICAL(&_mux);
+            for (int i = 0; i < ARDUPROF_IO_WATCHES; i++)
+            {
+                Watch &w = _watches[i];
+                if (w.slots == slots && (index < 0 || w.index == index))
+                {
+                    w.slots = nullptr;
+                }
+            }
+            portEXIT_CRITICAL(&_mux);
+            wake(); // the socket may be closed next
+        }
+
+    private:
+        typedef struct _Watch
+        {
+            int fd;
+            bool isWrite;
+            uint8_t index;
+            uint16_t generation;
+            MessageQueue *bus;
+            AwaitSlots *slots; // nullptr if the watch is free
+        } Watch;
+
+        enum State : int
+        {
+            StateIdle = 0,
+            StateStarting,
+            StateRunning,
+        };
+
+        Watch _watches[ARDUPROF_IO_WATCHES];
+        portMUX_TYPE _mux;
+        std::atomic<int> _state;
+        int _wakeSock;
+        struct sockaddr_in _wakeAddr;
+
+        IoPoller() : _watches(), _state(StateIdle), _wakeSock(-1), _wakeAddr()
+        {
+            portMUX_INITIALIZE(&_mux);
+        }
+
+        // called by the task of a bus: create the wake socket and the poller task on first use
+        bool start(void)
+        {
+            int state = StateIdle;
+            if (!_state.compare_exchange_strong(state, StateStarting))
+            {
+                while (state == StateStarting) // another bus is starting it
+                {
+                    vTaskDelay(1);
+                    state = _state.load();
+                }
+                return state == StateRunning;
+            }
+            if (!createTask())
+            {
+                _state.store(StateIdle);
+                return false;
+            }
+            _state.store(StateRunning);
+            return true;
+        }
+
+        bool createTask(void)
+        {
+            int sock = socket(AF_INET, SOCK_DGRAM, 0);
+            if (sock < 0)
+            {
+                return false;
+            }
+            struct sockaddr_in addr = {};
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            socklen_t addrlen = sizeof(addr);
+            if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+                getsockname(sock, (struct sockaddr *)&addr, &addrlen) != 0)
+            {
+                close(sock);
+                return false;
+            }
+            fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+            _wakeSock = sock;
+            _wakeAddr = addr;
+
+            if (xTaskCreate([](void *instance)
+                            { static_cast<IoPoller *>(instance)->run(); },
+                            "IoPoller", ARDUPROF_IO_POLLER_STACK, this, ARDUPROF_IO_POLLER_PRIORITY, nullptr) != pdPASS)
+            {
+                close(sock);
+                _wakeSock = -1;
+                return false;
+            }
+            return true;
+        }
+
+        void wake(void)
+        {
+            if (_wakeSock >= 0)
+            {
+                uint8_t byte = 0;
+                sendto(_wakeSock, &byte, 1, 0, (struct sockaddr *)&_wakeAddr, sizeof(_wakeAddr));
+            }
+        }
+
+        void run(void)
+        {
+            MessageTrace::instance().nameTask("IoPoller");
+            while (true)
+            {
+                fd_set readSet, writeSet;
+                FD_ZERO(&readSet);
+                FD_ZERO(&writeSet);
+                FD_SET(_wakeSock, &readSet);
+                int maxFd = _wakeSock;
+
+                portENTER_CRITICAL(&_mux);
+                for (int i = 0; i < ARDUPROF_IO_WATCHES; i++)
+                {
+                    Watch &w = _watches[i];
+                    if (w.slots)
+                    {
+                        FD_SET(w.fd, w.isWrite ? &writeSet : &readSet);
+                        maxFd = w.fd > maxFd ? w.fd : maxFd;
+                    }
+                }
+                portEXIT_CRITICAL(&_mux);
+
+                int n = select(maxFd + 1, &readSet, &writeSet, nullptr, nullptr);
+                if (n < 0)
+                {
+                    // a watched socket was closed meanwhile: wake every waiter, its recv() reports the error
+                    FD_ZERO(&readSet);
+                    FD_ZERO(&writeSet);
+                    markAll(readSet, writeSet);
+                    continue;
+                }
+                if (FD_ISSET(_wakeSock, &readSet))
+                {
+                    uint8_t buffer[16];
+                    while (recv(_wakeSock, buffer, sizeof(buffer), 0) > 0)
+                    {
+                    }
+                }
+                markReady(readSet, writeSet);
+            }
+        }
+
+        void markAll(fd_set &readSet, fd_set &writeSet)
+        {
+            portENTER_CRITICAL(&_mux);
+            for (int i = 0; i < ARDUPROF_IO_WATCHES; i++)
+            {
+                if (_watches[i].slots)
+                {
+                    FD_SET(_watches[i].fd, _watches[i].isWrite ? &writeSet : &readSet);
+                }
+            }
+            portEXIT_CRITICAL(&_mux);
+            markReady(readSet, writeSet);
+        }
+
+        void markReady(fd_set &readSet, fd_set &writeSet)
+        {
+            for (int i = 0; i < ARDUPROF_IO_WATCHES; i++)
+            {
+                Watch ready = {};
+                portENTER_CRITICAL(&_mux);
+                Watch &w = _watches[i];
+                if (w.slots && FD_ISSET(w.fd, w.isWrite ? &writeSet : &readSet))
+                {
+                    ready = w;
+                    w.slots = nullptr;
+                }
+                portEXIT_CRITICAL(&_mux);
+
+                if (ready.slots && ready.slots->setReady(ready.index, ready.generation))
+                {
+                    // a hint lost to a full queue only delays the resume to the next message of the bus
+                    ready.bus->postEvent(ready.bus, ARDUPROF_EVENT_RESUME, ready.index, ready.generation, 0, pdMS_TO_TICKS(10));
+                }
+            }
+        }
+    };
+
+    /////////////////////////////////////////////////////////////////////////////
+    // co_await recvAsync(sock, buffer, length, timeoutMs): bytes received, 0 if the peer closed,
+    // -errno on error and -ETIMEDOUT on timeout. Data already waiting is returned without suspending
+    /////////////////////////////////////////////////////////////////////////////
+    class RecvAwaiter : public AwaitBase
+    {
+    public:
+        RecvAwaiter(MessageQueue *bus, AwaitSlots *slots, int sock, void *buffer, size_t length, int32_t timeoutMs) : AwaitBase(bus, slots, AwaitRead, timeoutMs),
+                                                                                                                       _sock(sock),
+                                                                                                                       _buffer(buffer),
+                                                                                                                       _length(length),
+                                                                                                                       _result(0),
+                                                                                                                       _isDone(false)
+        {
+        }
+        bool await_ready(void)
+        {
+            _isDone = tryRecv();
+            return _isDone;
+        }
+        bool await_suspend(std::coroutine_handle<> handle)
+        {
+            if (!suspend(handle))
+            {
+                return false;
+            }
+            if (!IoPoller::instance().watch(_sock, false, _bus, _slots, _index))
+            {
+                _slots->release(_index);
+                _index = -1;
+                return false;
+            }
+            return true;
+        }
+        int await_resume(void)
+        {
+            if (!_isDone)
+            {
+                if (isTimeout())
+                {
+                    return -ETIMEDOUT;
+                }
+                tryRecv();
+            }
+            return _result;
+        }
+
+    private:
+        int _sock;
+        void *_buffer;
+        size_t _length;
+        int _result;
+        bool _isDone; // completed without suspending
+
+        bool tryRecv(void)
+        {
+            int len = recv(_sock, _buffer, _length, MSG_DONTWAIT);
+            _result = len >= 0 ? len : -errno;
+            return len >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+        }
+    };
+
+    /////////////////////////////////////////////////////////////////////////////
+    // co_await sendAsync(sock, data, length, timeoutMs): bytes sent, maybe fewer than "length",
+    // -errno on error, -ETIMEDOUT on timeout and -EAGAIN if the send buffer filled up again before
+    // the bus task could use it (await again). Data which fits in the send buffer is sent without suspending.
+    // co_await sendvAsync(sock, iov, count, timeoutMs): the same for "count" buffers in one sendmsg(),
+    // "iov" must stay valid until resumed
+    /////////////////////////////////////////////////////////////////////////////
+    class SendAwaiter : public AwaitBase
+    {
+    public:
+        SendAwaiter(MessageQueue *bus, AwaitSlots *slots, int sock, const void *data, size_t length, int32_t timeoutMs) : AwaitBase(bus, slots, AwaitWrite, timeoutMs),
+                                                                                                                          _sock(sock),
+                                                                                                                          _data(data),
+                                                                                                                          _length(length),
+                                                                                                                          _iov(nullptr),
+                                                                                                                          _iovCount(0),
+                                                                                                                          _result(0),
+                                                                                                                          _isDone(false)
+        {
+        }
+        SendAwaiter(MessageQueue *bus, AwaitSlots *slots, int sock, const struct iovec *iov, int count, int32_t timeoutMs) : AwaitBase(bus, slots, AwaitWrite, timeoutMs),
+                                                                                                                             _sock(sock),
+                                                                                                                             _data(nullptr),
+                                                                                                                             _length(0),
+                                                                                                                             _iov(iov),
+                                                                                                                             _iovCount(count),
+                                                                                                                             _result(0),
+                                                                                                                             _isDone(false)
+        {
+        }
+        bool await_ready(void)
+        {
+            _isDone = trySend();
+            return _isDone;
+        }
+        bool await_suspend(std::coroutine_handle<> handle)
+        {
+            if (!suspend(handle))
+            {
+                return false;
+            }
+            if (!IoPoller::instance().watch(_sock, true, _bus, _slots, _index))
+            {
+                _slots->release(_index);
+                _index = -1;
+                return false;
+            }
+            return true;
+        }
+        int await_resume(void)
+        {
+            if (!_isDone)
+            {
+                if (isTimeout())
+                {
+                    return -ETIMEDOUT;
+                }
+                trySend();
+            }
+            return _result;
+        }
+
+    private:
+        int _sock;
+        const void *_data;
+        size_t _length;
+        const struct iovec *_iov; // sendvAsync()
+        int _iovCount;
+        int _result;
+        bool _isDone; // completed without suspending
+
+        bool trySend(void)
+        {
+#if defined MSG_NOSIGNAL
+            const int flags = MSG_DONTWAIT | MSG_NOSIGNAL; // a closed peer is an error, not SIGPIPE
+#else
+            const int flags = MSG_DONTWAIT;
+#endif
+            int len;
+            if (_iov)
+            {
+                struct msghdr msg = {};
+                msg.msg_iov = const_cast<struct iovec *>(_iov);
+                msg.msg_iovlen = _iovCount;
+                len = sendmsg(_sock, &msg, flags);
+            }
+            else
+            {
+                len = send(_sock, _data, _length, flags);
+            }
+            _result = len >= 0 ? len : -errno;
+            return len >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+        }
+    };
+
+    /////////////////////////////////////////////////////////////////////////////
+    // co_await connectAsync(sock, addr, addrlen, timeoutMs): 0 once connected, -errno on error,
+    // -ETIMEDOUT on timeout and -EAGAIN if the connect in progress could not be awaited (no free slot
+    // or IoPoller watch): close the socket. The socket is back in blocking mode afterwards
+    /////////////////////////////////////////////////////////////////////////////
+    class ConnectAwaiter : public AwaitBase
+    {
+    public:
+        ConnectAwaiter(MessageQueue *bus, AwaitSlots *slots, int sock, const struct sockaddr *addr, socklen_t addrlen, int32_t timeoutMs) : AwaitBase(bus, slots, AwaitWrite, timeoutMs),
+                                                                                                                                            _sock(sock),
+                                                                                                                                            _flags(fcntl(sock, F_GETFL, 0)),
+                                                                                                                                            _result(0)
+        {
+            fcntl(_sock, F_SETFL, _flags | O_NONBLOCK);
+            if (connect(_sock, addr, addrlen) != 0)
+            {
+                _result = -errno;
+            }
+        }
+        bool await_ready(void)
+        {
+            if (_result == -EINPROGRESS)
+            {
+                return false;
+            }
+            fcntl(_sock, F_SETFL, _flags);
+            return true;
+        }
+        bool await_suspend(std::coroutine_handle<> handle)
+        {
+            if (suspend(handle) && IoPoller::instance().watch(_sock, true, _bus, _slots, _index))
+            {
+                return true;
+            }
+            if (_index >= 0)
+            {
+                _slots->release(_index);
+                _index = -1;
+            }
+            // still in progress: SO_ERROR would read 0, as if connected
+            _result = -EAGAIN;
+            fcntl(_sock, F_SETFL, _flags);
+            return false;
+        }
+        int await_resume(void)
+        {
+            if (_result == -EINPROGRESS)
+            {
+                if (isTimeout())
+                {
+                    _result = -ETIMEDOUT;
+                }
+                else
+                {
+                    int error = 0;
+                    socklen_t length = sizeof(error);
+                    if (getsockopt(_sock, SOL_SOCKET, SO_ERROR, &error, &length) != 0)
+                    {
+                        error = errno; // e.g. the socket was closed meanwhile
+                    }
+                    _result = -error;
+                }
+                fcntl(_sock, F_SETFL, _flags);
+            }
+            return _result;
+        }
+
+    private:
+        int _sock;
+        int _flags;
+        int _result;
+    };
+
+} // namespace ardufreertos
+
+#endif // ARDUPROF_COROUTINE_IO
@@ -0,0 +1,265 @@
+/* Copyright 2024 teamprof.net@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#pragma once
+#include <stdint.h>
+#include <utility>
+#include "./MessageQueue.h"
+
+#if defined ARDUPROF_FREERTOS
+
+#ifndef ARDUPROF_BROKER_TOPICS
+#define ARDUPROF_BROKER_TOPICS 16 // number of distinct topics of a MessageBroker
+#endif
+
+// subscribers are bits of a uint32_t bitmap
+#define ARDUPROF_BROKER_SUBSCRIBERS 32
+
+// iParam wildcard of subscribe(): every iParam of the event
+#define ARDUPROF_TOPIC_ANY INT16_MIN
+
+namespace ardufreertos
+{
+    /////////////////////////////////////////////////////////////////////////////
+    // Topic-based publish / subscribe between message queues.
+    // A topic is (event, iParam), e.g. (EventApp, AppDeviceUpdate). Each topic keeps a precomputed
+    // bitmap of its subscribers, so publish() is one table lookup plus one post per subscriber,
+    // without allocation. subscribe() and unsubscribe() are meant for start-up, publish() is safe
+    // from any task or ISR.
+    /////////////////////////////////////////////////////////////////////////////
+    class MessageBroker
+    {
+    public:
+        MessageBroker() : _subscribers(),
+                          _topics(),
+                          _topicCount(0)
+        {
+            portMUX_INITIALIZE(&_mux);
+        }
+
+        // deliver messages of (event, iParam) to "queue", iParam ARDUPROF_TOPIC_ANY subscribes to all of them.
+        // Returns false if the subscriber or topic table is full
+        bool subscribe(MessageQueue *queue, int16_t event, int16_t iParam = ARDUPROF_TOPIC_ANY)
+        {
+            bool isDone = false;
+            portENTER_CRITICAL(&_mux);
+            int index = subscriberIndex(queue, true);
+            Topic *topic = index >= 0 ? findTopic(event, iParam, true) : nullptr;
+            if (topic)
+            {
+                uint32_t bit = 1UL << index;
+                topic->bitmap |= bit;
+                if (iParam == ARDUPROF_TOPIC_ANY)
+                {
+                    // precompute: a wildcard subscriber is part of every topic of the event
+                    for (int i = 0; i < _topicCount; i++)
+                    {
+                        if (_topics[i].event == event)
+                        {
+                            _topics[i].bitmap |= bit;
+                        }
+                    }
+                }
+                isDone = true;
+            }
+            portEXIT_CRITICAL(&_mux);
+            return isDone;
+        }
+
+        // remove "queue" from all topics
+        void unsubscribe(MessageQueue *queue)
+        {
+            portENTER_CRITICAL(&_mux);
+            int index = subscriberIndex(queue, false);
+            if (index >= 0)
+            {
+                uint32_t mask = ~(1UL << index);
+                for (int i = 0; i < _topicCount; i++)
+                {
+                    _topics[i].bitmap &= mask;
+                }
+                _subscribers[index] = nullptr;
+            }
+            portEXIT_CRITICAL(&_mux);
+        }
+
+        // post "msg" to every subscriber of its topic, returns the number of subscribers which accepted it
+        int publish(const Message &msg, MessagePriority priority = PriorityNormal, TickType_t xTicksToWait = 0)
+        {
+            QueueItem item = {
+                .msg = msg,
+                .postUs = clockUs(),
+            };
+            int count = 0;
+            uint32_t bitmap = subscribers(msg);
+            while (bitmap)
+            {
+                MessageQueue *queue = _subscribers[__builtin_ctz(bitmap)];
+                bitmap &= bitmap - 1;
+                if (queue && queue->postItem(queue, priority, item, xTicksToWait))
+                {
+                    count++;
+                }
+            }
+            return count;
+        }
+        int publish(int16_t event, int16_t iParam = 0, uint16_t uParam = 0, uint32_t lParam = 0L)
+        {
+            Message msg = {
+                .event = event,
+                .iParam = iParam,
+                .uParam = uParam,
+                .lParam = lParam,
+            };
+            return publish(msg);
+        }
+
+        // latest-value publish, see MessageQueue::postCoalesced()
+        void publishCoalesced(const Message &msg, CoalesceKey key = CoalesceByParams)
+        {
+            uint32_t bitmap = subscribers(msg);
+            while (bitmap)
+            {
+                MessageQueue *queue = _subscribers[__builtin_ctz(bitmap)];
+                bitmap &= bitmap - 1;
+                if (queue)
+                {
+                    queue->postCoalesced(queue, PriorityNormal, msg, key);
+                }
+            }
+        }
+
+        void publishCoalesced(int16_t event, int16_t iParam = 0, uint16_t uParam = 0, uint32_t lParam = 0L, CoalesceKey key = CoalesceByParams)
+        {
+            Message msg = {
+                .event = event,
+                .iParam = iParam,
+                .uParam = uParam,
+                .lParam = lParam,
+            };
+            publishCoalesced(msg, key);
+        }
+
+        // post a pool block to every subscriber: one reference per subscriber, the caller's reference is consumed
+        int publishBuffer(int16_t event, int16_t iParam, uint16_t uParam, BufferRef &&buffer, MessagePriority priority = PriorityNormal)
+        {
+            Message msg = {
+                .event = event,
+                .iParam = iParam,
+                .uParam = uParam,
+                .lParam = buffer.handle(),
+            };
+            int count = 0;
+            uint32_t bitmap = subscribers(msg);
+            while (bitmap)
+            {
+                MessageQueue *queue = _subscribers[__builtin_ctz(bitmap)];
+                bitmap &= bitmap - 1;
+                BufferRef reference(buffer); // retained for this subscriber
+                if (queue && queue->postBuffer(queue, priority, event, iParam, uParam, std::move(reference)))
+                {
+                    count++;
+                }
+            }
+            buffer.reset();
+            return count;
+        }
+
+        // subscriber bitmap of the topic of "msg"
+        uint32_t subscribers(const Message &msg)
+        {
+            uint32_t bitmap = 0;
+            portENTER_CRITICAL_SAFE(&_mux);
+            Topic *topic = findTopic(msg.event, msg.iParam, false);
+            if (topic == nullptr)
+            {
+                topic = findTopic(msg.event, ARDUPROF_TOPIC_ANY, false);
+            }
+            if (topic)
+            {
+                bitmap = topic->bitmap;
+            }
+            portEXIT_CRITICAL_SAFE(&_mux);
+            return bitmap;
+        }
+
+    private:
+        typedef struct _Topic
+        {
+            int16_t event;
+            int16_t iParam; // ARDUPROF_TOPIC_ANY for the wildcard entry of the event
+            uint32_t bitmap;
+        } Topic;
+
+        portMUX_TYPE _mux;
+        MessageQueue *_subscribers[ARDUPROF_BROKER_SUBSCRIBERS];
+        Topic _topics[ARDUPROF_BROKER_TOPICS];
+        int _topicCount;
+
+        int subscriberIndex(MessageQueue *queue, bool isCreate)
+        {
+            int freeIndex = -1;
+            for (int i = 0; i < ARDUPROF_BROKER_SUBSCRIBERS; i++)
+            {
+                if (_subscribers[i] == queue)
+                {
+                    return i;
+                }
+                if (_subscribers[i] == nullptr && freeIndex < 0)
+                {
+                    freeIndex = i;
+                }
+            }
+            if (isCreate && freeIndex >= 0)
+            {
+                _subscribers[freeIndex] = queue;
+                return freeIndex;
+            }
+            return -1;
+        }
+
+        Topic *findTopic(int16_t event, int16_t iParam, bool isCreate)
+        {
+            for (int i = 0; i < _topicCount; i++)
+            {
+                if (_topics[i].event == event && _topics[i].iParam == iParam)
+                {
+                    return &_topics[i];
+                }
+            }
+            if (!isCreate || _topicCount >= ARDUPROF_BROKER_TOPICS)
+            {
+                return nullptr;
+            }
+
+            // a new topic inherits the wildcard subscribers of its event
+            Topic *wildcard = (iParam == ARDUPROF_TOPIC_ANY) ? nullptr : findTopic(event, ARDUPROF_TOPIC_ANY, false);
+            Topic &topic = _topics[_topicCount++];
+            topic = {
+                .event = event,
+                .iParam = iParam,
+                .bitmap = wildcard ? wildcard->bitmap : 0,
+            };
+            return &topic;
+        }
+    };
+
+} // namespace ardufreertos
+
+#endif // ARDUPROF_FREERTOS
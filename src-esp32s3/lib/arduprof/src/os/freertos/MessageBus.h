@@ -21,9 +21,21 @@
 #include <stdint.h>
 // #include <Arduino.h>
 #include "./MessageQueue.h"
+#include "./MessageScheduler.h"
+#include "./MessageCoroutine.h"
+#include "./IoPoller.h"
+#include "./StallWatchdog.h"
+#include "../../type/MessageStats.h"
 
 #if defined ARDUPROF_FREERTOS
 
+// events below ARDUPROF_EVENT_RESERVED belong to the framework and go to onReservedMessage() instead of onMessage()
+#define ARDUPROF_EVENT_RESERVED (INT16_MIN + 16)
+
+#ifndef ARDUPROF_LANE_STARVATION_LIMIT
+#define ARDUPROF_LANE_STARVATION_LIMIT 8 // a waiting lane is served after being passed over this many times
+#endif
+
 namespace ardufreertos
 {
     class MessageBus : public MessageQueue
@@ -31,8 +43,32 @@ namespace ardufreertos
     public:
         MessageBus(QueueHandle_t queue) : MessageQueue(queue),
                                           _context(nullptr),
-                                          _isDone(false)
+                                          _isDone(false),
+                                          _batchSize(1),
+                                          _batchStats(),
+                                          _starvationLimit(ARDUPROF_LANE_STARVATION_LIMIT),
+                                          _laneSkips(),
+                                          _laneStats(),
+                                          _handlerStats(),
+                                          _callIndex(-1),
+                                          _callResult(0),
+                                          _isReplied(false)
+
+        {
+        }
 
+        MessageBus(MessageRing *ring) : MessageQueue(ring),
+                                        _context(nullptr),
+                                        _isDone(false),
+                                        _batchSize(1),
+                                        _batchStats(),
+                                        _starvationLimit(ARDUPROF_LANE_STARVATION_LIMIT),
+                                        _laneSkips(),
+                                        _laneStats(),
+                                        _handlerStats(),
+                                        _callIndex(-1),
+                                        _callResult(0),
+                                        _isReplied(false)
         {
         }
 
@@ -42,8 +78,43 @@ namespace ardufreertos
                                                                           pucQueueStorageBuffer,
                                                                           pxQueueBuffer),
                                                              _context(nullptr),
-                                                             _isDone(false)
+                                                             _isDone(false),
+                                                             _batchSize(1),
+                                                             _batchStats(),
+                                                             _starvationLimit(ARDUPROF_LANE_STARVATION_LIMIT),
+                                                             _laneSkips(),
+                                                             _laneStats(),
+                                                             _handlerStats(),
+                                                             _callIndex(-1),
+                                                             _callResult(0),
+                                                             _isReplied(false)
+        {
+        }
+
+        ~MessageBus()
         {
+            MessageScheduler *scheduler = MessageScheduler::existing();
+            if (scheduler)
+            {
+                scheduler->cancelAll(this);
+            }
+#if ARDUPROF_COROUTINE
+#if ARDUPROF_COROUTINE_IO
+            IoPoller *poller = IoPoller::existing();
+            if (poller && _awaits)
+            {
+                poller->cancel(_awaits);
+            }
+#endif
+            delete _awaits;
+            _awaits = nullptr;
+#endif
+#if ARDUPROF_STALL_WATCHDOG
+            if (_stallProbe)
+            {
+                StallWatchdog::instance().unwatch(this);
+            }
+#endif
         }
 
         virtual void start(void *context)
@@ -53,21 +124,152 @@ namespace ardufreertos
 
         virtual void onMessage(const Message &msg) = 0;
 
+        // called before the first / after the last message of each batch dispatched by messageLoop()
+        virtual void onBatchBegin(void) {}
+        virtual void onBatchEnd(uint16_t /*count*/) {}
+
+        // answer the call() being handled, the first reply counts
+        void reply(uint32_t result)
+        {
+            if (_callIndex >= 0 && !_isReplied)
+            {
+                _callResult = result;
+                _isReplied = true;
+            }
+        }
+        // true while the handler runs for a call() rather than a posted message
+        bool isCall(void)
+        {
+            return _callIndex >= 0;
+        }
+
+        // framework events (below ARDUPROF_EVENT_RESERVED), e.g. the delayed init of ThreadBase
+        virtual void onReservedMessage(const Message & /*msg*/) {}
+
+        // wait up to "ms" for a message, then dispatch it and up to (batchSize - 1) messages already queued
         virtual void messageLoop(int ms = -1)
         // virtual void messageLoop(TickType_t xTicksToWait = portMAX_DELAY)
         {
-            configASSERT(_queue);
+            configASSERT(_queue || _ring);
+#if ARDUPROF_TRACE
+            if (_traceTrack)
+            {
+                MessageTrace::instance().bindTask(_traceTrack); // posts of handlers run by this task
+            }
+#endif
+#if ARDUPROF_STALL_WATCHDOG
+            if (_stallProbe && _stallProbe->task == nullptr)
+            {
+                _stallProbe->task = xTaskGetCurrentTaskHandle();
+            }
+#endif
 
             TickType_t xTicksToWait = (ms < 0) ? portMAX_DELAY : pdMS_TO_TICKS(ms);
-            Message msg;
-            if (xQueueReceive(_queue, (void *)&msg, xTicksToWait) == pdTRUE)
+            QueueItem item;
+            if (receiveMessage(item, xTicksToWait))
             {
-                onMessage(msg);
+                onBatchBegin();
+                uint16_t count = 0;
+                do
+                {
+                    dispatchMessage(item);
+                    count++;
+                } while (count < _batchSize && receiveMessage(item, 0));
+                onBatchEnd(count);
+                _batchStats.update(count);
             }
             else
             {
                 // LOG_TRACE("xQueueReceive() timeout");
             }
+#if ARDUPROF_COROUTINE
+            if (_awaits && _awaits->pending())
+            {
+                resumeAwaits();
+            }
+#endif
+        }
+
+#if ARDUPROF_COROUTINE
+        // awaitables of coroutine handlers (see Coroutine). Each resumes the coroutine in the task of this bus,
+        // which keeps dispatching messages meanwhile; use them from that task only, not for ring backed buses.
+        // Up to ARDUPROF_AWAIT_SLOTS awaits at the same time, more complete at once as timed out
+        SleepAwaiter sleep(uint32_t ms)
+        {
+            return SleepAwaiter(this, awaitSlots(), ms);
+        }
+        // the next message with "event" (and "iParam"), std::nullopt after timeoutMs (< 0 waits forever)
+        EventAwaiter nextEvent(int16_t event, int16_t iParam = ARDUPROF_AWAIT_ANY, int32_t timeoutMs = -1)
+        {
+            return EventAwaiter(this, awaitSlots(), event, iParam, timeoutMs);
+        }
+#if ARDUPROF_COROUTINE_IO
+        // socket I/O without a task of its own, see IoPoller
+        RecvAwaiter recvAsync(int sock, void *buffer, size_t length, int32_t timeoutMs = -1)
+        {
+            return RecvAwaiter(this, awaitSlots(), sock, buffer, length, timeoutMs);
+        }
+        SendAwaiter sendAsync(int sock, const void *data, size_t length, int32_t timeoutMs = -1)
+        {
+            return SendAwaiter(this, awaitSlots(), sock, data, length, timeoutMs);
+        }
+        SendAwaiter sendvAsync(int sock, const struct iovec *iov, int count, int32_t timeoutMs = -1)
+        {
+            return SendAwaiter(this, awaitSlots(), sock, iov, count, timeoutMs);
+        }
+        ConnectAwaiter connectAsync(int sock, const struct sockaddr *addr, socklen_t addrlen, int32_t timeoutMs = -1)
+        {
+            return ConnectAwaiter(this, awaitSlots(), sock, addr, addrlen, timeoutMs);
+        }
+#endif
+#endif
+
+        // post to "msgQueue" after "ms" / at "tick" / every "periodMs", without blocking the caller.
+        // All use the shared MessageScheduler; the returned id (0 on failure) is for cancelScheduled()
+        ScheduleId postEventDelayed(MessageQueue *msgQueue, uint32_t ms, int16_t event, int16_t iParam = 0, uint16_t uParam = 0, uint32_t lParam = 0L)
+        {
+            return postEventAt(msgQueue, xTaskGetTickCount() + pdMS_TO_TICKS(ms), event, iParam, uParam, lParam);
+        }
+        ScheduleId postEventAt(MessageQueue *msgQueue, TickType_t tick, int16_t event, int16_t iParam = 0, uint16_t uParam = 0, uint32_t lParam = 0L)
+        {
+            Message msg = {
+                .event = event,
+                .iParam = iParam,
+                .uParam = uParam,
+                .lParam = lParam,
+            };
+            return MessageScheduler::instance().schedule(msgQueue, msg, tick, 0);
+        }
+        ScheduleId postEventPeriodic(MessageQueue *msgQueue, uint32_t periodMs, int16_t event, int16_t iParam = 0, uint16_t uParam = 0, uint32_t lParam = 0L)
+        {
+            TickType_t period = pdMS_TO_TICKS(periodMs) ? pdMS_TO_TICKS(periodMs) : 1;
+            Message msg = {
+                .event = event,
+                .iParam = iParam,
+                .uParam = uParam,
+                .lParam = lParam,
+            };
+            return MessageScheduler::instance().schedule(msgQueue, msg, xTaskGetTickCount() + period, period);
+        }
+
+        inline ScheduleId postEventDelayed(uint32_t ms, int16_t event, int16_t iParam = 0, uint16_t uParam = 0, uint32_t lParam = 0L)
+        {
+            return postEventDelayed(this, ms, event, iParam, uParam, lParam);
+        }
+        inline ScheduleId postEventAt(TickType_t tick, int16_t event, int16_t iParam = 0, uint16_t uParam = 0, uint32_t lParam = 0L)
+        {
+            return postEventAt(this, tick, event, iParam, uParam, lParam);
+        }
+        inline ScheduleId postEventPeriodic(uint32_t periodMs, int16_t event, int16_t iParam = 0, uint16_t uParam = 0, uint32_t lParam = 0L)
+        {
+            return postEventPeriodic(this, periodMs, event, iParam, uParam, lParam);
+        }
+
+        // returns false if the post already happened or the id is unknown
+        bool cancelScheduled(ScheduleId id)
+        {
+            MessageScheduler *scheduler = MessageScheduler::existing();
+            return scheduler ? scheduler->cancel(id) : false;
         }
 
         virtual void messageLoopForever(void)
@@ -83,11 +285,375 @@ namespace ardufreertos
             return _context;
         }
 
+        // maximum number of messages dispatched per wake-up, 1 (default) dispatches one message per wake-up
+        void setBatchSize(uint16_t batchSize)
+        {
+            _batchSize = batchSize ? batchSize : 1;
+        }
+        uint16_t batchSize(void)
+        {
+            return _batchSize;
+        }
+
+        const BatchStats &batchStats(void)
+        {
+            return _batchStats;
+        }
+        void resetBatchStats(void)
+        {
+            _batchStats.reset();
+        }
+
+        // a non-empty lane passed over "limit" times in a row is served ahead of higher lanes once
+        void setStarvationLimit(uint16_t limit)
+        {
+            _starvationLimit = limit ? limit : 1;
+        }
+
+        const LaneStats &laneStats(MessagePriority priority)
+        {
+            return _laneStats[priority < PriorityLaneCount ? priority : PriorityNormal];
+        }
+        void resetLaneStats(void)
+        {
+            for (int i = 0; i < PriorityLaneCount; i++)
+            {
+                _laneStats[i].reset();
+            }
+        }
+
+        // wall-time budget of every handler, or of the handlers of one event (ARDUPROF_HANDLER_BUDGET_SIZE events).
+        // A handler over its budget counts in HandlerStats::overruns and is recorded on a watched bus; 0 disables
+        void setHandlerBudget(uint32_t us)
+        {
+            _handlerBudgetUs = us;
+        }
+        bool setHandlerBudget(int16_t event, uint32_t us)
+        {
+            int i = 0;
+            while (i < _handlerBudgetCount && _handlerBudgets[i].event != event)
+            {
+                i++;
+            }
+            if (i == ARDUPROF_HANDLER_BUDGET_SIZE)
+            {
+                return false;
+            }
+            _handlerBudgets[i] = {event, us};
+            _handlerBudgetCount = i < _handlerBudgetCount ? _handlerBudgetCount : i + 1;
+            return true;
+        }
+        uint32_t handlerBudgetUs(int16_t event)
+        {
+            for (int i = 0; i < _handlerBudgetCount; i++)
+            {
+                if (_handlerBudgets[i].event == event)
+                {
+                    return _handlerBudgets[i].us;
+                }
+            }
+            return _handlerBudgetUs;
+        }
+
+#if ARDUPROF_STALL_WATCHDOG
+        // record handler overruns, handlers stuck past their budget and a queue which stopped draining, see StallWatchdog
+        bool watchStalls(const char *name, uint32_t drainTimeoutMs = ARDUPROF_STALL_DRAIN_MS)
+        {
+            if (_stallProbe == nullptr)
+            {
+                _stallProbe = StallWatchdog::instance().watch(this, name, drainTimeoutMs);
+            }
+            return _stallProbe != nullptr;
+        }
+#endif
+
+        // handler time of the first ARDUPROF_HANDLER_STATS_SIZE events dispatched, unused entries have calls == 0
+        const HandlerStats *handlerStats(void)
+        {
+            return _handlerStats;
+        }
+        void resetHandlerStats(void)
+        {
+            for (int i = 0; i < ARDUPROF_HANDLER_STATS_SIZE; i++)
+            {
+                _handlerStats[i] = {};
+            }
+        }
+
     protected:
         void *_context;
 
         // private:
         bool _isDone;
+
+        uint16_t _batchSize;
+        BatchStats _batchStats;
+
+        uint16_t _starvationLimit;
+        uint16_t _laneSkips[PriorityLaneCount];
+        LaneStats _laneStats[PriorityLaneCount];
+        HandlerStats _handlerStats[ARDUPROF_HANDLER_STATS_SIZE];
+
+        typedef struct _HandlerBudget
+        {
+            int16_t event;
+            uint32_t us;
+        } HandlerBudget;
+        uint32_t _handlerBudgetUs = ARDUPROF_HANDLER_BUDGET_US;
+        HandlerBudget _handlerBudgets[ARDUPROF_HANDLER_BUDGET_SIZE] = {};
+        uint8_t _handlerBudgetCount = 0;
+#if ARDUPROF_STALL_WATCHDOG
+        StallProbe *_stallProbe = nullptr;
+#endif
+
+        int _callIndex; // call slot of the request being handled, -1 for posted messages
+        uint32_t _callResult;
+        bool _isReplied;
+
+#if ARDUPROF_COROUTINE
+        AwaitSlots *_awaits = nullptr; // suspended coroutines, created by the first co_await
+
+        AwaitSlots *awaitSlots(void)
+        {
+            if (_awaits == nullptr)
+            {
+                _awaits = new AwaitSlots();
+            }
+            return _awaits;
+        }
+
+        // resume the coroutines whose I/O is ready or whose deadline passed
+        void resumeAwaits(void)
+        {
+            if (_awaits == nullptr)
+            {
+                return;
+            }
+            TickType_t now = xTaskGetTickCount();
+            for (int i = 0; i < ARDUPROF_AWAIT_SLOTS; i++)
+            {
+                AwaitKind kind = _awaits->slot(i).kind;
+                std::coroutine_handle<> handle = _awaits->takeDue(i, now);
+                if (handle)
+                {
+#if ARDUPROF_COROUTINE_IO
+                    if (_awaits->slot(i).isTimeout && (kind == AwaitRead || kind == AwaitWrite))
+                    {
+                        IoPoller::instance().cancel(_awaits, i);
+                    }
+#endif
+                    handle.resume();
+                }
+            }
+        }
+#endif
+
+        void dispatchMessage(const QueueItem &item)
+        {
+#if ARDUPROF_COROUTINE
+            if (item.msg.event == ARDUPROF_EVENT_RESUME)
+            {
+                resumeAwaits();
+                return;
+            }
+            if (_awaits && _awaits->pending())
+            {
+                std::coroutine_handle<> handle = _awaits->takeEvent(item.msg); // awaited by nextEvent()
+                if (handle)
+                {
+                    handle.resume();
+                    return;
+                }
+            }
+#endif
+            if (item.msg.event == ARDUPROF_EVENT_CALL)
+            {
+                dispatchCall(item.msg.iParam, item.postUs);
+                return;
+            }
+            if (item.msg.event < ARDUPROF_EVENT_RESERVED)
+            {
+                onReservedMessage(item.msg);
+                return;
+            }
+            handleMessage(item.msg, item.postUs);
+        }
+
+        void handleMessage(const Message &msg, uint32_t postUs)
+        {
+            uint32_t beginUs = clockUs();
+            uint32_t budgetUs = handlerBudgetUs(msg.event);
+#if ARDUPROF_STALL_WATCHDOG
+            StallProbe *probe = _stallProbe;
+            if (probe)
+            {
+                probe->begin(msg, beginUs, budgetUs);
+            }
+#endif
+#if ARDUPROF_TRACE
+            MessageTrace &trace = MessageTrace::instance();
+            trace.record(TraceBegin, beginUs, postUs, msg, _traceTrack, _traceTrack);
+#endif
+            onMessage(msg);
+            uint32_t endUs = clockUs();
+#if ARDUPROF_TRACE
+            trace.record(TraceEnd, endUs, postUs, msg, _traceTrack, _traceTrack);
+#endif
+            uint32_t elapsedUs = endUs - beginUs;
+            bool isOverrun = budgetUs && elapsedUs > budgetUs;
+#if ARDUPROF_STALL_WATCHDOG
+            if (probe)
+            {
+                probe->end();
+                if (isOverrun)
+                {
+                    StallWatchdog::instance().recordOverrun(*probe, msg, elapsedUs, budgetUs);
+                }
+            }
+#endif
+
+            for (int i = 0; i < ARDUPROF_HANDLER_STATS_SIZE; i++)
+            {
+                HandlerStats &stats = _handlerStats[i];
+                if (stats.calls == 0 || stats.event == msg.event)
+                {
+                    stats.event = msg.event;
+                    stats.update(elapsedUs);
+                    stats.overruns += isOverrun ? 1 : 0;
+                    break;
+                }
+            }
+        }
+
+        // run the request of a call() token through onMessage() and send the reply straight to the caller task
+        void dispatchCall(int index, uint32_t postUs)
+        {
+            CallSlots &slots = CallSlots::instance();
+            Message request;
+            if (!slots.begin(index, request))
+            {
+                return; // caller timed out before the request was handled
+            }
+            _callIndex = index;
+            _callResult = 0;
+            _isReplied = false;
+            handleMessage(request, postUs);
+            _callIndex = -1;
+            slots.end(index, _isReplied ? CallOk : CallNoReply, _callResult);
+        }
+
+        // receive the next message and account its latency and the backlog left behind it
+        bool receiveMessage(QueueItem &item, TickType_t xTicksToWait)
+        {
+            unsigned long depth = 0;
+            if (!receiveItem(item, depth, xTicksToWait))
+            {
+                return false;
+            }
+            // a mailbox token is replaced by the latest message stored in its slot
+            if (item.msg.event == ARDUPROF_EVENT_MAILBOX && !(_mailbox && _mailbox->take(item.msg.iParam, item)))
+            {
+                return false;
+            }
+            _queueStats.update(clockUs() - item.postUs, depth);
+            return true;
+        }
+
+        bool receiveItem(QueueItem &item, unsigned long &depth, TickType_t xTicksToWait)
+        {
+            if (_ring)
+            {
+                if (!receiveRing(item, xTicksToWait))
+                {
+                    return false;
+                }
+                depth = _ring->count();
+                return true;
+            }
+            if (_queueSet == nullptr)
+            {
+                if (xQueueReceive(_queue, (void *)&item, xTicksToWait) != pdTRUE)
+                {
+                    return false;
+                }
+                depth = uxQueueMessagesWaiting(_queue);
+                return true;
+            }
+
+            // each set entry stands for one message in some lane: take it from the lane chosen by selectLane()
+            if (xQueueSelectFromSet(_queueSet, xTicksToWait) == nullptr)
+            {
+                return false;
+            }
+
+            bool isPromoted = false;
+            int lane = selectLane(isPromoted);
+            if (lane < 0)
+            {
+                return false;
+            }
+
+            QueueHandle_t queue = laneQueue((MessagePriority)lane);
+            UBaseType_t laneDepth = uxQueueMessagesWaiting(queue);
+            if (xQueueReceive(queue, (void *)&item, 0) != pdTRUE)
+            {
+                return false;
+            }
+            _laneStats[lane].update(laneDepth, isPromoted);
+            depth = laneDepth - 1;
+            return true;
+        }
+
+        // drain the ring first, sleep on ARDUPROF_NOTIFY_RING only when it is empty
+        bool receiveRing(QueueItem &item, TickType_t xTicksToWait)
+        {
+            if (_ring->consumer() == nullptr)
+            {
+                _ring->setConsumer(xTaskGetCurrentTaskHandle());
+            }
+
+            TickType_t startTick = xTaskGetTickCount();
+            while (!_ring->pop(item))
+            {
+                TickType_t waited = xTaskGetTickCount() - startTick;
+                if (xTicksToWait != portMAX_DELAY && waited >= xTicksToWait)
+                {
+                    return false;
+                }
+                // other notification bits only cause another look at the ring
+                xTaskNotifyWait(0, ARDUPROF_NOTIFY_RING, nullptr, xTicksToWait == portMAX_DELAY ? portMAX_DELAY : xTicksToWait - waited);
+            }
+            return true;
+        }
+
+        // highest non-empty lane, unless a lower lane has waited for _starvationLimit dispatches
+        int selectLane(bool &isPromoted)
+        {
+            int lane = -1;
+            for (int i = 0; i < PriorityLaneCount; i++)
+            {
+                if (uxQueueMessagesWaiting(laneQueue((MessagePriority)i)) == 0)
+                {
+                    _laneSkips[i] = 0;
+                    continue;
+                }
+                if (lane < 0)
+                {
+                    lane = i;
+                }
+                else if (++_laneSkips[i] >= _starvationLimit)
+                {
+                    lane = i;
+                    isPromoted = true;
+                    break;
+                }
+            }
+            if (lane >= 0)
+            {
+                _laneSkips[lane] = 0;
+            }
+            return lane;
+        }
     };
 
 } // namespace ardufreertos
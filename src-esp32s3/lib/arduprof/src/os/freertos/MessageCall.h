@@ -0,0 +1,272 @@
+/* Copyright 2024 teamprof.net@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#pragma once
+#include <stdint.h>
+#include "../../type/Message.h"
+
+#if defined ARDUPROF_FREERTOS
+
+#ifndef ARDUPROF_CALL_SLOTS
+#define ARDUPROF_CALL_SLOTS 8 // number of call() requests in flight at the same time, all threads
+#endif
+
+#ifndef ARDUPROF_CALL_TIMEOUT_MS
+#define ARDUPROF_CALL_TIMEOUT_MS 1000 // default timeout of call()
+#endif
+
+// task notification bit set when the reply of a call() is ready
+#define ARDUPROF_NOTIFY_CALL (1UL << 1)
+
+// reserved event: queued in place of a call() request, iParam=<call slot>, never reaches onMessage() as such
+#define ARDUPROF_EVENT_CALL (INT16_MIN + 2)
+
+namespace ardufreertos
+{
+    enum CallStatus : int8_t
+    {
+        CallOk = 0,  // the handler replied
+        CallNoReply, // the handler returned without reply()
+        CallTimeout, // no reply in time, a late reply is discarded
+        CallFailed,  // no free call slot, request queue full or ring backed target
+    };
+
+    /////////////////////////////////////////////////////////////////////////////
+    // Reply slots of call(), shared by all threads.
+    // The caller claims a slot holding the request, queues an ARDUPROF_EVENT_CALL token and waits for
+    // ARDUPROF_NOTIFY_CALL. The receiver dispatches the request from the slot, stores the reply and
+    // notifies the caller task directly: no reply queue and no second queue round trip.
+    /////////////////////////////////////////////////////////////////////////////
+    class CallSlots
+    {
+    public:
+        typedef enum _SlotState : uint8_t
+        {
+            SlotFree = 0,
+            SlotPending,   // request queued
+            SlotRunning,   // request being handled
+            SlotDone,      // reply stored, caller notified
+            SlotAbandoned, // caller timed out, the receiver frees the slot
+        } SlotState;
+
+        static CallSlots &instance(void)
+        {
+            static CallSlots slots;
+            return slots;
+        }
+
+        // caller: claim a slot for "request", returns -1 if none is free
+        int claim(const Message &request)
+        {
+            int index = -1;
+            TaskHandle_t caller = xTaskGetCurrentTaskHandle();
+            portENTER_CRITICAL(&_mux);
+            for (int i = 0; i < ARDUPROF_CALL_SLOTS; i++)
+            {
+                if (_slots[i].state == SlotFree)
+                {
+                    Slot &slot = _slots[i];
+                    slot.state = SlotPending;
+                    slot.caller = caller;
+                    slot.request = request;
+                    slot.result = 0;
+                    slot.status = CallNoReply;
+                    index = i;
+                    break;
+                }
+            }
+            portEXIT_CRITICAL(&_mux);
+            return index;
+        }
+
+        // caller: the request token could not be queued
+        void unclaim(int index)
+        {
+            portENTER_CRITICAL(&_mux);
+            _slots[index].state = SlotFree;
+            portEXIT_CRITICAL(&_mux);
+        }
+
+        // caller: wait for the reply, frees the slot unless it times out (then the receiver frees it)
+        CallStatus wait(int index, uint32_t &result, TickType_t xTicksToWait)
+        {
+            TickType_t startTick = xTaskGetTickCount();
+            while (true)
+            {
+                portENTER_CRITICAL(&_mux);
+                Slot &slot = _slots[index];
+                if (slot.state == SlotDone)
+                {
+                    CallStatus status = slot.status;
+                    result = slot.result;
+                    slot.state = SlotFree;
+                    portEXIT_CRITICAL(&_mux);
+                    return status;
+                }
+                TickType_t waited = xTaskGetTickCount() - startTick;
+                if (xTicksToWait != portMAX_DELAY && waited >= xTicksToWait)
+                {
+                    slot.state = SlotAbandoned;
+                    portEXIT_CRITICAL(&_mux);
+                    return CallTimeout;
+                }
+                portEXIT_CRITICAL(&_mux);
+
+                // a bit left over from an earlier call only causes another look at the slot
+                xTaskNotifyWait(0, ARDUPROF_NOTIFY_CALL, nullptr, xTicksToWait == portMAX_DELAY ? portMAX_DELAY : xTicksToWait - waited);
+            }
+        }
+
+        // receiver: take the request of a token, false if the caller already gave up (the slot is freed)
+        bool begin(int index, Message &request)
+        {
+            if (index < 0 || index >= ARDUPROF_CALL_SLOTS)
+            {
+                return false;
+            }
+            bool isRunning = false;
+            portENTER_CRITICAL(&_mux);
+            Slot &slot = _slots[index];
+            if (slot.state == SlotPending)
+            {
+                slot.state = SlotRunning;
+                request = slot.request;
+                isRunning = true;
+            }
+            else if (slot.state == SlotAbandoned)
+            {
+                slot.state = SlotFree;
+            }
+            portEXIT_CRITICAL(&_mux);
+            return isRunning;
+        }
+
+        // receiver: store the reply and wake the caller
+        void end(int index, CallStatus status, uint32_t result)
+        {
+            TaskHandle_t caller = nullptr;
+            portENTER_CRITICAL(&_mux);
+            Slot &slot = _slots[index];
+            if (slot.state == SlotRunning)
+            {
+                slot.status = status;
+                slot.result = result;
+                slot.state = SlotDone;
+                caller = slot.caller;
+            }
+            else if (slot.state == SlotAbandoned)
+            {
+                slot.state = SlotFree;
+            }
+            portEXIT_CRITICAL(&_mux);
+
+            if (caller)
+            {
+                xTaskNotify(caller, ARDUPROF_NOTIFY_CALL, eSetBits);
+            }
+        }
+
+    private:
+        typedef struct _Slot
+        {
+            SlotState state;
+            CallStatus status;
+            TaskHandle_t caller;
+            Message request;
+            uint32_t result;
+        } Slot;
+
+        portMUX_TYPE _mux;
+        Slot _slots[ARDUPROF_CALL_SLOTS];
+
+        CallSlots() : _slots()
+        {
+            portMUX_INITIALIZE(&_mux);
+        }
+    };
+
+    /////////////////////////////////////////////////////////////////////////////
+    // Pending reply of MessageQueue::callAsync(), to be waited for by the task which made the call.
+    // Destroying a future without wait() abandons the call.
+    /////////////////////////////////////////////////////////////////////////////
+    class CallFuture
+    {
+    public:
+        CallFuture() : _index(-1)
+        {
+        }
+        explicit CallFuture(int index) : _index(index)
+        {
+        }
+        CallFuture(CallFuture &&other) : _index(other._index)
+        {
+            other._index = -1;
+        }
+        CallFuture &operator=(CallFuture &&other)
+        {
+            if (this != &other)
+            {
+                abandon();
+                _index = other._index;
+                other._index = -1;
+            }
+            return *this;
+        }
+        CallFuture(const CallFuture &) = delete;
+        CallFuture &operator=(const CallFuture &) = delete;
+
+        ~CallFuture()
+        {
+            abandon();
+        }
+
+        // false if the request could not be queued, wait() then returns CallFailed
+        bool isValid(void)
+        {
+            return _index >= 0;
+        }
+
+        CallStatus wait(uint32_t &result, uint32_t timeoutMs = ARDUPROF_CALL_TIMEOUT_MS)
+        {
+            if (_index < 0)
+            {
+                return CallFailed;
+            }
+            int index = _index;
+            _index = -1;
+            return CallSlots::instance().wait(index, result, pdMS_TO_TICKS(timeoutMs));
+        }
+
+    private:
+        int _index; // call slot, -1 once waited for
+
+        void abandon(void)
+        {
+            if (_index >= 0)
+            {
+                uint32_t result;
+                CallSlots::instance().wait(_index, result, 0);
+                _index = -1;
+            }
+        }
+    };
+
+} // namespace ardufreertos
+
+#endif // ARDUPROF_FREERTOS
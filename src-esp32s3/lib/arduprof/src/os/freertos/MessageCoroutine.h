@@ -0,0 +1,345 @@
+/* Copyright 2024 teamprof.net@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#pragma once
+#include <stdint.h>
+#include "../../type/Message.h"
+
+// coroutine handlers need C++20 (-std=gnu++20)
+#if !defined ARDUPROF_COROUTINE && defined __cpp_impl_coroutine
+#define ARDUPROF_COROUTINE 1
+#endif
+
+#if defined ARDUPROF_FREERTOS && ARDUPROF_COROUTINE
+#include <coroutine>
+#include <optional>
+#include "./MessageScheduler.h"
+
+#ifndef ARDUPROF_AWAIT_SLOTS
+#define ARDUPROF_AWAIT_SLOTS 8 // co_await in progress at the same time, per MessageBus
+#endif
+
+// reserved event: a suspended coroutine of the bus may be due, iParam=<slot>, uParam=<generation>
+#define ARDUPROF_EVENT_RESUME (INT16_MIN + 3)
+
+// nextEvent() filter matching every iParam
+#define ARDUPROF_AWAIT_ANY INT16_MIN
+
+namespace ardufreertos
+{
+    /////////////////////////////////////////////////////////////////////////////
+    // Return type of a coroutine handler, e.g. "Coroutine ThreadApp::connect(void)".
+    // The coroutine starts at once in the calling handler and runs up to its first co_await;
+    // the frame (heap) is freed when it returns. Nobody waits for it: report results with messages.
+    /////////////////////////////////////////////////////////////////////////////
+    class Coroutine
+    {
+    public:
+        struct promise_type
+        {
+            Coroutine get_return_object(void) { return Coroutine(); }
+            std::suspend_never initial_suspend(void) noexcept { return {}; }
+            std::suspend_never final_suspend(void) noexcept { return {}; }
+            void return_void(void) {}
+            void unhandled_exception(void) { configASSERT(false); }
+        };
+    };
+
+    enum AwaitKind : uint8_t
+    {
+        AwaitFree = 0,
+        AwaitSleep,
+        AwaitEvent,
+        AwaitRead,  // socket readable, see IoPoller
+        AwaitWrite, // socket writable (connect, send), see IoPoller
+    };
+
+    typedef struct _AwaitSlot
+    {
+        std::coroutine_handle<> handle;
+        AwaitKind kind;
+        bool isReady;        // I/O ready, set by IoPoller
+        bool isTimeout;      // resumed by the deadline
+        bool hasDeadline;
+        uint16_t generation; // changes on release: late hints and I/O results for an older await are ignored
+        int16_t event;       // AwaitEvent filter
+        int16_t iParam;      // AwaitEvent filter, ARDUPROF_AWAIT_ANY for any
+        TickType_t deadline;
+        ScheduleId resumeId; // resume hint of the deadline in MessageScheduler, 0 if none
+        Message msg;         // AwaitEvent: the message taken
+    } AwaitSlot;
+
+    /////////////////////////////////////////////////////////////////////////////
+    // Suspended coroutines of one MessageBus.
+    // Only the task of the bus claims and resumes; IoPoller marks I/O slots ready from its own task.
+    // A slot is resumed by MessageBus when it is ready, its deadline passed or (AwaitEvent) its message
+    // arrives. ARDUPROF_EVENT_RESUME messages are hints only: a dropped hint delays a resume until the
+    // next message of the bus, it never loses it.
+    /////////////////////////////////////////////////////////////////////////////
+    class AwaitSlots
+    {
+    public:
+        AwaitSlots() : _slots(), _pending(0)
+        {
+            portMUX_INITIALIZE(&_mux);
+        }
+
+        // frees the frames of coroutines still suspended, without resuming them
+        ~AwaitSlots()
+        {
+            for (int i = 0; i < ARDUPROF_AWAIT_SLOTS; i++)
+            {
+                if (_slots[i].kind != AwaitFree)
+                {
+                    _slots[i].handle.destroy();
+                }
+            }
+        }
+
+        // returns -1 if all slots are in use
+        int claim(std::coroutine_handle<> handle, AwaitKind kind, int32_t timeoutMs)
+        {
+            for (int i = 0; i < ARDUPROF_AWAIT_SLOTS; i++)
+            {
+                AwaitSlot &slot = _slots[i];
+                if (slot.kind == AwaitFree)
+                {
+                    portENTER_CRITICAL(&_mux);
+                    slot.handle = handle;
+                    slot.kind = kind;
+                    slot.isReady = false;
+                    slot.isTimeout = false;
+                    slot.hasDeadline = timeoutMs >= 0;
+                    slot.deadline = xTaskGetTickCount() + (timeoutMs > 0 ? pdMS_TO_TICKS(timeoutMs) : 0);
+                    slot.resumeId = 0;
+                    _pending++;
+                    portEXIT_CRITICAL(&_mux);
+                    return i;
+                }
+            }
+            return -1;
+        }
+
+        void setResume(int index, ScheduleId id)
+        {
+            _slots[index].resumeId = id;
+        }
+
+        void setFilter(int index, int16_t event, int16_t iParam)
+        {
+            _slots[index].event = event;
+            _slots[index].iParam = iParam;
+        }
+
+        // any task: the I/O of slot "index" is ready, unless that await is already over
+        bool setReady(int index, uint16_t generation)
+        {
+            bool isSet = false;
+            portENTER_CRITICAL(&_mux);
+            AwaitSlot &slot = _slots[index];
+            if (slot.kind != AwaitFree && slot.generation == generation)
+            {
+                slot.isReady = true;
+                isSet = true;
+            }
+            portEXIT_CRITICAL(&_mux);
+            return isSet;
+        }
+
+        // a slot which is ready or past its deadline: release it and return its coroutine, null otherwise
+        std::coroutine_handle<> takeDue(int index, TickType_t now)
+        {
+            AwaitSlot &slot = _slots[index];
+            if (slot.kind == AwaitFree)
+            {
+                return nullptr;
+            }
+            portENTER_CRITICAL(&_mux);
+            bool isReady = slot.isReady;
+            portEXIT_CRITICAL(&_mux);
+            bool isExpired = slot.hasDeadline && (int32_t)(now - slot.deadline) >= 0;
+            if (!isReady && !isExpired)
+            {
+                return nullptr;
+            }
+            slot.isTimeout = !isReady && slot.kind != AwaitSleep;
+            return release(index);
+        }
+
+        // the first coroutine waiting for "msg" takes it: release its slot and return the coroutine
+        std::coroutine_handle<> takeEvent(const Message &msg)
+        {
+            for (int i = 0; i < ARDUPROF_AWAIT_SLOTS; i++)
+            {
+                AwaitSlot &slot = _slots[i];
+                if (slot.kind == AwaitEvent && slot.event == msg.event &&
+                    (slot.iParam == ARDUPROF_AWAIT_ANY || slot.iParam == msg.iParam))
+                {
+                    slot.msg = msg;
+                    return release(i);
+                }
+            }
+            return nullptr;
+        }
+
+        // release without resume; the result fields stay readable until the slot is claimed again.
+        // The resume hint of an await over before its deadline is cancelled: it would hold a scheduler entry
+        std::coroutine_handle<> release(int index)
+        {
+            AwaitSlot &slot = _slots[index];
+            portENTER_CRITICAL(&_mux);
+            std::coroutine_handle<> handle = slot.handle;
+            ScheduleId resumeId = slot.resumeId;
+            slot.resumeId = 0;
+            slot.kind = AwaitFree;
+            slot.generation++;
+            _pending--;
+            portEXIT_CRITICAL(&_mux);
+            if (resumeId)
+            {
+                MessageScheduler::instance().cancel(resumeId);
+            }
+            return handle;
+        }
+
+        const AwaitSlot &slot(int index)
+        {
+            return _slots[index];
+        }
+        uint8_t pending(void)
+        {
+            return _pending;
+        }
+
+    private:
+        AwaitSlot _slots[ARDUPROF_AWAIT_SLOTS];
+        uint8_t _pending;
+        portMUX_TYPE _mux;
+    };
+
+    /////////////////////////////////////////////////////////////////////////////
+    // base of the awaitables of MessageBus: claims a slot on suspend and schedules a resume hint
+    // for the deadline. Without a free slot, or if the hint cannot be scheduled (MessageScheduler full),
+    // the await completes at once, as timed out.
+    /////////////////////////////////////////////////////////////////////////////
+    class AwaitBase
+    {
+    public:
+        bool await_ready(void) { return false; }
+
+    protected:
+        AwaitBase(MessageQueue *bus, AwaitSlots *slots, AwaitKind kind, int32_t timeoutMs) : _bus(bus),
+                                                                                             _slots(slots),
+                                                                                             _kind(kind),
+                                                                                             _timeoutMs(timeoutMs),
+                                                                                             _index(-1)
+        {
+        }
+
+        MessageQueue *_bus;
+        AwaitSlots *_slots;
+        AwaitKind _kind;
+        int32_t _timeoutMs;
+        int _index;
+
+        bool suspend(std::coroutine_handle<> handle)
+        {
+            _index = _slots ? _slots->claim(handle, _kind, _timeoutMs) : -1;
+            if (_index < 0)
+            {
+                return false;
+            }
+            if (_timeoutMs >= 0)
+            {
+                const AwaitSlot &slot = _slots->slot(_index);
+                Message hint = {
+                    .event = ARDUPROF_EVENT_RESUME,
+                    .iParam = (int16_t)_index,
+                    .uParam = slot.generation,
+                    .lParam = 0,
+                };
+                ScheduleId id = MessageScheduler::instance().schedule(_bus, hint, slot.deadline, 0);
+                if (id == 0)
+                {
+                    // nothing would resume the coroutine on an idle bus
+                    _slots->release(_index);
+                    _index = -1;
+                    return false;
+                }
+                _slots->setResume(_index, id);
+            }
+            return true;
+        }
+
+        bool isTimeout(void)
+        {
+            return _index < 0 || _slots->slot(_index).isTimeout;
+        }
+    };
+
+    // co_await sleep(ms): the bus keeps dispatching messages meanwhile
+    class SleepAwaiter : public AwaitBase
+    {
+    public:
+        SleepAwaiter(MessageQueue *bus, AwaitSlots *slots, uint32_t ms) : AwaitBase(bus, slots, AwaitSleep, (int32_t)ms)
+        {
+        }
+        bool await_suspend(std::coroutine_handle<> handle)
+        {
+            return suspend(handle);
+        }
+        void await_resume(void) {}
+    };
+
+    // co_await nextEvent(event, iParam, timeoutMs): the next message matching the filter, std::nullopt on timeout.
+    // The message is taken by the coroutine and does not reach onMessage()
+    class EventAwaiter : public AwaitBase
+    {
+    public:
+        EventAwaiter(MessageQueue *bus, AwaitSlots *slots, int16_t event, int16_t iParam, int32_t timeoutMs) : AwaitBase(bus, slots, AwaitEvent, timeoutMs),
+                                                                                                                _event(event),
+                                                                                                                _iParam(iParam)
+        {
+        }
+        bool await_suspend(std::coroutine_handle<> handle)
+        {
+            if (!suspend(handle))
+            {
+                return false;
+            }
+            _slots->setFilter(_index, _event, _iParam);
+            return true;
+        }
+        std::optional<Message> await_resume(void)
+        {
+            if (isTimeout())
+            {
+                return std::nullopt;
+            }
+            return _slots->slot(_index).msg;
+        }
+
+    private:
+        int16_t _event;
+        int16_t _iParam;
+    };
+
+} // namespace ardufreertos
+
+#endif // ARDUPROF_COROUTINE
@@ -0,0 +1,161 @@
+/* Copyright 2024 teamprof.net@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#pragma once
+#include <stdint.h>
+#include "./QueueItem.h"
+
+#if defined ARDUPROF_FREERTOS
+
+#ifndef ARDUPROF_MAILBOX_SIZE
+#define ARDUPROF_MAILBOX_SIZE 8 // number of coalesced messages which can be pending at the same time
+#endif
+
+// reserved event: queued in place of a coalesced message, iParam=<mailbox slot>, never reaches onMessage()
+#define ARDUPROF_EVENT_MAILBOX INT16_MIN
+
+namespace ardufreertos
+{
+    // which fields identify a coalesced message, the remaining fields are its value
+    enum CoalesceKey : uint8_t
+    {
+        CoalesceByParams = 0, // (event, iParam, uParam), value is lParam
+        CoalesceBySource,     // (event, iParam), value is uParam and lParam, e.g. SysNetworkAvailable
+    };
+
+    /////////////////////////////////////////////////////////////////////////////
+    // Latest-value mailbox of a MessageQueue.
+    // A coalesced post stores the message in a slot and queues an ARDUPROF_EVENT_MAILBOX token;
+    // further posts with the same key overwrite the pending slot instead of queueing again.
+    // The receiver swaps the token for the latest message of its slot and frees the slot.
+    /////////////////////////////////////////////////////////////////////////////
+    class MessageMailbox
+    {
+    public:
+        MessageMailbox() : _slots()
+        {
+            portMUX_INITIALIZE(&_mux);
+        }
+
+        // returns true if "item" overwrote a pending message with the same key.
+        // Otherwise "slot" is the newly claimed slot whose token the caller must queue, or -1 if all slots are pending.
+        bool store(const QueueItem &item, CoalesceKey key, int &slot)
+        {
+            bool isMerged = false;
+            slot = -1;
+            portENTER_CRITICAL_SAFE(&_mux);
+            for (int i = 0; i < ARDUPROF_MAILBOX_SIZE; i++)
+            {
+                Slot &entry = _slots[i];
+                if (!entry.isPending)
+                {
+                    if (slot < 0)
+                    {
+                        slot = i;
+                    }
+                }
+                else if (isSameKey(entry, item.msg, key))
+                {
+                    entry.item.msg = item.msg; // keep the post time of the first message for the latency statistics
+                    isMerged = true;
+                    slot = -1;
+                    break;
+                }
+            }
+            if (slot >= 0)
+            {
+                _slots[slot] = {
+                    .item = item,
+                    .key = key,
+                    .isPending = true,
+                };
+            }
+            portEXIT_CRITICAL_SAFE(&_mux);
+            return isMerged;
+        }
+
+        // overwrite a pending message with the same key, never claims a slot (OverflowCoalesce of a full queue)
+        bool merge(const QueueItem &item, CoalesceKey key)
+        {
+            bool isMerged = false;
+            portENTER_CRITICAL_SAFE(&_mux);
+            for (int i = 0; i < ARDUPROF_MAILBOX_SIZE; i++)
+            {
+                Slot &entry = _slots[i];
+                if (entry.isPending && isSameKey(entry, item.msg, key))
+                {
+                    entry.item.msg = item.msg;
+                    isMerged = true;
+                    break;
+                }
+            }
+            portEXIT_CRITICAL_SAFE(&_mux);
+            return isMerged;
+        }
+
+        // free a slot whose token could not be queued
+        void release(int slot)
+        {
+            portENTER_CRITICAL_SAFE(&_mux);
+            _slots[slot].isPending = false;
+            portEXIT_CRITICAL_SAFE(&_mux);
+        }
+
+        // receiver side: latest message of "slot", the slot is free again afterwards
+        bool take(int slot, QueueItem &item)
+        {
+            if (slot < 0 || slot >= ARDUPROF_MAILBOX_SIZE)
+            {
+                return false;
+            }
+            portENTER_CRITICAL_SAFE(&_mux);
+            bool isPending = _slots[slot].isPending;
+            if (isPending)
+            {
+                item = _slots[slot].item;
+                _slots[slot].isPending = false;
+            }
+            portEXIT_CRITICAL_SAFE(&_mux);
+            return isPending;
+        }
+
+    private:
+        typedef struct _Slot
+        {
+            QueueItem item;
+            CoalesceKey key;
+            bool isPending;
+        } Slot;
+
+        portMUX_TYPE _mux;
+        Slot _slots[ARDUPROF_MAILBOX_SIZE];
+
+        static inline bool isSameKey(const Slot &entry, const Message &msg, CoalesceKey key)
+        {
+            const Message &pending = entry.item.msg;
+            return entry.key == key &&
+                   pending.event == msg.event &&
+                   pending.iParam == msg.iParam &&
+                   (key == CoalesceBySource || pending.uParam == msg.uParam);
+        }
+    };
+
+} // namespace ardufreertos
+
+#endif // ARDUPROF_FREERTOS
@@ -21,6 +21,14 @@
 #include <stdint.h>
 // #include <Arduino.h>
 #include "../../type/Message.h"
+#include "./QueueItem.h"
+#include "./MessageRing.h"
+#include "./MessageMailbox.h"
+#include "./BufferPool.h"
+#include "./MessageCall.h"
+#include "./MessageTrace.h"
+#include "../../type/MessageStats.h"
+#include "../../type/TypedMessage.h"
 
 // #include "../../../../FreeRTOS-Kernel/include/FreeRTOS.h"
 // #include "../../../../FreeRTOS-Kernel/include/queue.h"
@@ -29,33 +37,116 @@
 
 namespace ardufreertos
 {
+    // message lanes, MessageBus::messageLoop() services the highest non-empty lane first
+    enum MessagePriority : uint8_t
+    {
+        PriorityUrgent = 0, // e.g. button click, timer tick
+        PriorityNormal,     // default lane, the queue given to the constructor
+        PriorityBulk,       // e.g. network-originated commands
+        PriorityLaneCount
+    };
+
+    // what a post does when the lane of the target queue is full
+    enum OverflowPolicy : uint8_t
+    {
+        OverflowDefault = 0, // per post: the policy of the target queue
+        OverflowDropNewest,  // drop the new message, default policy of a queue
+        OverflowBlock,       // wait for room, up to xTicksToWait of the post or the block time of the queue
+        OverflowDropOldest,  // discard the oldest message of the lane to make room, OverflowDropNewest once postBuffer() was used
+        OverflowCoalesce,    // overwrite a pending coalesced message with the same (event, iParam, uParam), else drop
+        OverflowReject,      // drop the new message and return PostRejected, for callers which handle it
+    };
+
+    // outcome of a post, see OverflowPolicy
+    enum PostResult : int8_t
+    {
+        PostOk = 0,
+        PostCoalesced,     // merged into a pending message with the same key
+        PostDroppedOldest, // queued after the oldest message of the lane was discarded
+        PostDropped,       // queue full, the new message was dropped
+        PostTimeout,       // queue still full after waiting
+        PostRejected,      // queue full and OverflowReject
+        PostInvalid,       // no target queue
+    };
+
+    // the message will be dispatched (possibly merged with a pending one)
+    inline bool isPosted(PostResult result)
+    {
+        return result <= PostDroppedOldest;
+    }
+
+    class MessageBroker;
+    class MessageScheduler;
+    class WorkerPool;
+
     class MessageQueue
     {
+        friend class MessageBroker;
+        friend class MessageScheduler;
+        friend class WorkerPool;
+
     public:
         MessageQueue(QueueHandle_t queue) : _queue(queue),
-                                            _isStaticQueue(true) // queue is allocated outside, no to to delete in destructor
+                                            _isStaticQueue(true), // queue is allocated outside, no to to delete in destructor
+                                            _lanes(),
+                                            _queueSet(nullptr),
+                                            _ring(nullptr),
+                                            _mailbox(nullptr),
+                                            _overflowPolicy(OverflowDropNewest),
+                                            _blockTicks(0),
+                                            _hasBuffers(false),
+                                            _queueStats(),
+                                            _traceTrack(0)
         {
         }
 
+        // lock-free ring backend: messages bypass FreeRTOS queues, see MessageRing for the single-producer rule
+        MessageQueue(MessageRing *ring) : _queue(nullptr),
+                                          _isStaticQueue(true),
+                                          _lanes(),
+                                          _queueSet(nullptr),
+                                          _ring(ring),
+                                          _mailbox(nullptr),
+                                          _overflowPolicy(OverflowDropNewest),
+                                          _blockTicks(0),
+                                          _hasBuffers(false),
+                                          _queueStats(),
+                                          _traceTrack(0)
+        {
+            configASSERT(_ring != NULL);
+        }
+
         MessageQueue(uint16_t queueLength,
                      uint8_t *pucQueueStorageBuffer = nullptr,
-                     StaticQueue_t *pxQueueBuffer = nullptr)
+                     StaticQueue_t *pxQueueBuffer = nullptr) : _lanes(),
+                                                               _queueSet(nullptr),
+                                                               _ring(nullptr),
+                                                               _mailbox(nullptr),
+                                                               _overflowPolicy(OverflowDropNewest),
+                                                               _blockTicks(0),
+                                                               _hasBuffers(false),
+                                                               _queueStats(),
+                                                               _traceTrack(0)
         {
             if (pucQueueStorageBuffer != nullptr && pxQueueBuffer != nullptr)
             {
                 _isStaticQueue = true;
-                _queue = xQueueCreateStatic(queueLength, sizeof(Message), pucQueueStorageBuffer, pxQueueBuffer);
+                _queue = xQueueCreateStatic(queueLength, sizeof(QueueItem), pucQueueStorageBuffer, pxQueueBuffer);
             }
             else
             {
                 _isStaticQueue = false;
-                _queue = xQueueCreate(queueLength, sizeof(Message));
+                _queue = xQueueCreate(queueLength, sizeof(QueueItem));
             }
             configASSERT(_queue != NULL);
         }
 
         ~MessageQueue()
         {
+            deleteLanes();
+            delete _mailbox;
+            _mailbox = nullptr;
+
             QueueHandle_t queue = _queue;
             _queue = nullptr;
             if (!_isStaticQueue)
@@ -65,7 +156,93 @@ namespace ardufreertos
             }
         }
 
-        void postEvent(MessageQueue *msgQueue, int16_t event, int16_t iParam = 0, uint16_t uParam = 0, uint32_t lParam = 0L, TickType_t xTicksToWait = 0)
+        // create urgent and bulk lanes next to the normal lane (the default queue).
+        // Must be called before any message is posted, e.g. in the constructor of the derived class.
+        bool createLanes(uint16_t urgentLength, uint16_t bulkLength)
+        {
+            configASSERT(_queue && !_queueSet && !_ring);
+
+            uint16_t lengths[PriorityLaneCount] = {};
+            lengths[PriorityUrgent] = urgentLength;
+            lengths[PriorityBulk] = bulkLength;
+
+            UBaseType_t setLength = uxQueueMessagesWaiting(_queue) + uxQueueSpacesAvailable(_queue);
+            for (int i = 0; i < PriorityLaneCount; i++)
+            {
+                if (lengths[i])
+                {
+                    _lanes[i] = xQueueCreate(lengths[i], sizeof(QueueItem));
+                    if (_lanes[i] == nullptr)
+                    {
+                        deleteLanes();
+                        return false;
+                    }
+                    setLength += lengths[i];
+                }
+            }
+
+            _queueSet = xQueueCreateSet(setLength);
+            if (_queueSet == nullptr || xQueueAddToSet(_queue, _queueSet) != pdPASS)
+            {
+                deleteLanes();
+                return false;
+            }
+            for (int i = 0; i < PriorityLaneCount; i++)
+            {
+                if (_lanes[i])
+                {
+                    xQueueAddToSet(_lanes[i], _queueSet);
+                }
+            }
+            return true;
+        }
+
+        // enable postCoalesced() to this queue, must be called before any message is posted
+        bool createMailbox(void)
+        {
+            if (_mailbox == nullptr)
+            {
+                _mailbox = new MessageMailbox();
+            }
+            return _mailbox != nullptr;
+        }
+
+        // what posts to this queue do when it is full, unless a post names its own policy.
+        // "blockTicks" is the wait of OverflowBlock for posts without xTicksToWait
+        void setOverflowPolicy(OverflowPolicy policy, TickType_t blockTicks = 0)
+        {
+            _overflowPolicy = policy == OverflowDefault ? OverflowDropNewest : policy;
+            _blockTicks = blockTicks;
+        }
+        OverflowPolicy overflowPolicy(void)
+        {
+            return _overflowPolicy;
+        }
+
+        // name the track of this queue in the message-flow trace, see MessageTrace. The first name counts
+        void setTraceName(const char *name)
+        {
+            if (_traceTrack == 0)
+            {
+                _traceTrack = MessageTrace::instance().addTrack(name);
+            }
+        }
+        uint8_t traceTrack(void)
+        {
+            return _traceTrack;
+        }
+
+        // a non-zero xTicksToWait blocks for room (OverflowBlock), 0 applies the policy of the target queue
+        PostResult postEvent(MessageQueue *msgQueue, int16_t event, int16_t iParam = 0, uint16_t uParam = 0, uint32_t lParam = 0L, TickType_t xTicksToWait = 0)
+        {
+            return postEvent(msgQueue, PriorityNormal, event, iParam, uParam, lParam, xTicksToWait);
+        }
+        PostResult postEvent(MessageQueue *msgQueue, const Message &msg, TickType_t xTicksToWait = 0)
+        {
+            return postEvent(msgQueue, PriorityNormal, msg, xTicksToWait);
+        }
+
+        PostResult postEvent(MessageQueue *msgQueue, MessagePriority priority, int16_t event, int16_t iParam = 0, uint16_t uParam = 0, uint32_t lParam = 0L, TickType_t xTicksToWait = 0)
         {
             Message msg = {
                 .event = event,
@@ -73,97 +250,538 @@ namespace ardufreertos
                 .uParam = uParam,
                 .lParam = lParam,
             };
-            postEvent(msgQueue, msg);
-        }
-        void postEvent(MessageQueue *msgQueue, const Message &msg, TickType_t xTicksToWait = 0)
-        {
-            if (msgQueue && msgQueue->_queue)
-            {
-                // if (xPortIsInsideInterrupt())
-                // {
-                //     BaseType_t xHigherPriorityTaskWoken = pdFALSE;
-                //     if (xQueueSendFromISR(msgQueue->_queue, &msg, &xHigherPriorityTaskWoken) != pdTRUE)
-                //     {
-                //         // LOG_ERROR("xQueueSend failed!");
-                //     }
-                //     portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
-                // }
-                if (xPortInIsrContext())
+            return postEvent(msgQueue, priority, msg, xTicksToWait);
+        }
+        // a queue without lanes receives every priority in its normal lane, a ring backend ignores priority and never blocks
+        PostResult postEvent(MessageQueue *msgQueue, MessagePriority priority, const Message &msg, TickType_t xTicksToWait = 0)
+        {
+            return post(msgQueue, priority, msg, xTicksToWait ? OverflowBlock : OverflowDefault, xTicksToWait);
+        }
+
+        // post with an overflow policy of its own, e.g. OverflowBlock for a user command which must not be lost.
+        // OverflowBlock waits xTicksToWait, or the block time of the target queue if 0
+        PostResult post(MessageQueue *msgQueue, MessagePriority priority, const Message &msg, OverflowPolicy policy = OverflowDefault, TickType_t xTicksToWait = 0)
+        {
+            QueueItem item = {
+                .msg = msg,
+                .postUs = clockUs(),
+            };
+            return postItem(msgQueue, priority, item, policy, xTicksToWait);
+        }
+        PostResult post(MessageQueue *msgQueue, const Message &msg, OverflowPolicy policy = OverflowDefault, TickType_t xTicksToWait = 0)
+        {
+            return post(msgQueue, PriorityNormal, msg, policy, xTicksToWait);
+        }
+
+        // typed message, see type/TypedMessage.h. A pooled type gets PostDropped when typedMessagePool() is exhausted
+        template <typename T, typename = typename std::enable_if<IsTypedMessage<T>::value>::type>
+        PostResult post(MessageQueue *msgQueue, MessagePriority priority, const T &value, OverflowPolicy policy = OverflowDefault, TickType_t xTicksToWait = 0)
+        {
+            Message msg = {};
+            if (!encodeMessage(value, msg))
+            {
+                return PostDropped;
+            }
+            PostResult result = post(msgQueue, priority, msg, policy, xTicksToWait);
+            if (!isPosted(result))
+            {
+                discardMessage<T>(msg);
+            }
+            return result;
+        }
+        template <typename T, typename = typename std::enable_if<IsTypedMessage<T>::value>::type>
+        PostResult post(MessageQueue *msgQueue, const T &value, OverflowPolicy policy = OverflowDefault, TickType_t xTicksToWait = 0)
+        {
+            return post(msgQueue, PriorityNormal, value, policy, xTicksToWait);
+        }
+
+        // latest-value post: while a message with the same key is still queued, overwrite it instead of queueing another one.
+        // The message keeps the queue position (and lane) of the first post; a queue without mailbox gets a plain postEvent()
+        void postCoalesced(MessageQueue *msgQueue, int16_t event, int16_t iParam = 0, uint16_t uParam = 0, uint32_t lParam = 0L, CoalesceKey key = CoalesceByParams)
+        {
+            Message msg = {
+                .event = event,
+                .iParam = iParam,
+                .uParam = uParam,
+                .lParam = lParam,
+            };
+            postCoalesced(msgQueue, PriorityNormal, msg, key);
+        }
+        void postCoalesced(MessageQueue *msgQueue, MessagePriority priority, const Message &msg, CoalesceKey key = CoalesceByParams)
+        {
+            if (msgQueue == nullptr)
+            {
+                return;
+            }
+
+            QueueItem item = {
+                .msg = msg,
+                .postUs = clockUs(),
+            };
+            MessageMailbox *mailbox = msgQueue->_mailbox;
+            int slot = -1;
+            if (mailbox && mailbox->store(item, key, slot))
+            {
+                msgQueue->_queueStats.countCoalesced();
+                traceItem(msgQueue, item, PostCoalesced);
+                return;
+            }
+            if (slot < 0)
+            {
+                postItem(msgQueue, priority, item, 0); // no mailbox or all slots pending: queue the message itself
+                return;
+            }
+
+            item.msg = {
+                .event = ARDUPROF_EVENT_MAILBOX,
+                .iParam = (int16_t)slot,
+                .uParam = 0,
+                .lParam = 0,
+            };
+            if (!postItem(msgQueue, priority, item, 0))
+            {
+                mailbox->release(slot);
+            }
+        }
+
+        // post a pool block: the message carries the reference of "handle" in lParam, also when it is dropped.
+        // The handler adopts it with "BufferRef payload(msg.lParam)". From then on OverflowDropOldest
+        // drops the new message on "msgQueue": a discarded one could not be told from a plain message
+        bool postBuffer(MessageQueue *msgQueue, MessagePriority priority, int16_t event, int16_t iParam, uint16_t uParam, BufferHandle handle, TickType_t xTicksToWait = 0)
+        {
+            msgQueue->_hasBuffers = true; // before the message can be queued
+            QueueItem item = {
+                .msg = {
+                    .event = event,
+                    .iParam = iParam,
+                    .uParam = uParam,
+                    .lParam = handle,
+                },
+                .postUs = clockUs(),
+            };
+            if (postItem(msgQueue, priority, item, xTicksToWait))
+            {
+                return true;
+            }
+            BufferRef dropped(handle);
+            return false;
+        }
+        bool postBuffer(MessageQueue *msgQueue, MessagePriority priority, int16_t event, int16_t iParam, uint16_t uParam, BufferRef &&buffer, TickType_t xTicksToWait = 0)
+        {
+            return postBuffer(msgQueue, priority, event, iParam, uParam, buffer.detach(), xTicksToWait);
+        }
+        bool postBuffer(MessageQueue *msgQueue, int16_t event, int16_t iParam, uint16_t uParam, BufferRef &&buffer, TickType_t xTicksToWait = 0)
+        {
+            return postBuffer(msgQueue, PriorityNormal, event, iParam, uParam, buffer.detach(), xTicksToWait);
+        }
+
+        // request / response: the handler of "request" in the thread of "msgQueue" answers with MessageBus::reply().
+        // Blocks the calling task (never an ISR, never the thread of msgQueue) until the reply or the timeout
+        CallStatus call(MessageQueue *msgQueue, const Message &request, uint32_t &result, uint32_t timeoutMs = ARDUPROF_CALL_TIMEOUT_MS, MessagePriority priority = PriorityNormal)
+        {
+            return callAsync(msgQueue, request, priority).wait(result, timeoutMs);
+        }
+        CallStatus call(MessageQueue *msgQueue, int16_t event, int16_t iParam, uint16_t uParam, uint32_t lParam, uint32_t &result, uint32_t timeoutMs = ARDUPROF_CALL_TIMEOUT_MS)
+        {
+            Message request = {
+                .event = event,
+                .iParam = iParam,
+                .uParam = uParam,
+                .lParam = lParam,
+            };
+            return call(msgQueue, request, result, timeoutMs);
+        }
+
+        // queue the request and return at once, wait for the reply later with CallFuture::wait() in the same task
+        CallFuture callAsync(MessageQueue *msgQueue, const Message &request, MessagePriority priority = PriorityNormal)
+        {
+            configASSERT(!xPortInIsrContext());
+            if (msgQueue == nullptr || msgQueue->_ring)
+            {
+                return CallFuture();
+            }
+
+            CallSlots &slots = CallSlots::instance();
+            int index = slots.claim(request);
+            if (index < 0)
+            {
+                return CallFuture();
+            }
+            QueueItem item = {
+                .msg = {
+                    .event = ARDUPROF_EVENT_CALL,
+                    .iParam = (int16_t)index,
+                    .uParam = 0,
+                    .lParam = 0,
+                },
+                .postUs = clockUs(),
+            };
+            if (!postItem(msgQueue, priority, item, 0))
+            {
+                slots.unclaim(index);
+                return CallFuture();
+            }
+            return CallFuture(index);
+        }
+
+        inline PostResult postEvent(int16_t event, int16_t iParam = 0, uint16_t uParam = 0, uint32_t lParam = 0L, TickType_t xTicksToWait = 0)
+        {
+            return postEvent(this, event, iParam, uParam, lParam, xTicksToWait);
+        }
+        inline PostResult postEvent(const Message &msg, TickType_t xTicksToWait = 0)
+        {
+            return postEvent(this, msg, xTicksToWait);
+        }
+        inline PostResult postEvent(MessagePriority priority, int16_t event, int16_t iParam = 0, uint16_t uParam = 0, uint32_t lParam = 0L, TickType_t xTicksToWait = 0)
+        {
+            return postEvent(this, priority, event, iParam, uParam, lParam, xTicksToWait);
+        }
+        inline PostResult postEvent(MessagePriority priority, const Message &msg, TickType_t xTicksToWait = 0)
+        {
+            return postEvent(this, priority, msg, xTicksToWait);
+        }
+        inline void postCoalesced(int16_t event, int16_t iParam = 0, uint16_t uParam = 0, uint32_t lParam = 0L, CoalesceKey key = CoalesceByParams)
+        {
+            postCoalesced(this, event, iParam, uParam, lParam, key);
+        }
+
+        // counters of this queue, see QueueStats
+        const QueueStats &queueStats(void)
+        {
+            return _queueStats;
+        }
+        void resetQueueStats(void)
+        {
+            _queueStats.reset();
+        }
+
+        // number of messages waiting in a lane
+        UBaseType_t laneDepth(MessagePriority priority)
+        {
+            if (_ring)
+            {
+                return priority == PriorityNormal ? _ring->count() : 0;
+            }
+            QueueHandle_t queue = laneQueue(priority);
+            return queue ? uxQueueMessagesWaiting(queue) : 0;
+        }
+        // number of messages waiting in all lanes
+        UBaseType_t queueDepth(void)
+        {
+            if (_ring)
+            {
+                return _ring->count();
+            }
+            UBaseType_t depth = _queue ? uxQueueMessagesWaiting(_queue) : 0;
+            for (int i = 0; i < PriorityLaneCount; i++)
+            {
+                depth += _lanes[i] ? uxQueueMessagesWaiting(_lanes[i]) : 0;
+            }
+            return depth;
+        }
+
+    protected:
+        QueueHandle_t _queue;
+        bool _isStaticQueue;
+
+        QueueHandle_t _lanes[PriorityLaneCount]; // urgent and bulk lanes, normal lane is _queue
+        QueueSetHandle_t _queueSet;              // set of all lanes, nullptr without lanes
+
+        MessageRing *_ring; // lock-free backend, nullptr for FreeRTOS queue backend
+
+        MessageMailbox *_mailbox; // pending coalesced messages, nullptr unless createMailbox() is called
+
+        OverflowPolicy _overflowPolicy; // policy of posts with OverflowDefault
+        TickType_t _blockTicks;         // wait of OverflowBlock posts without xTicksToWait
+        volatile bool _hasBuffers;      // a postBuffer() message may be queued: the oldest is not discarded
+
+        QueueStats _queueStats;
+
+        uint8_t _traceTrack; // track in MessageTrace, 0 if unnamed
+
+        // queue an item to the lane of "priority" under the policy of the target queue (OverflowBlock if xTicksToWait),
+        // returns false if the message is lost
+        bool postItem(MessageQueue *msgQueue, MessagePriority priority, const QueueItem &item, TickType_t xTicksToWait)
+        {
+            return isPosted(postItem(msgQueue, priority, item, xTicksToWait ? OverflowBlock : OverflowDefault, xTicksToWait));
+        }
+
+        // queue an item under "policy" and record the post in the trace
+        PostResult postItem(MessageQueue *msgQueue, MessagePriority priority, const QueueItem &item, OverflowPolicy policy, TickType_t xTicksToWait)
+        {
+            PostResult result = queueItem(msgQueue, priority, item, policy, xTicksToWait);
+            traceItem(msgQueue, item, result);
+            return result;
+        }
+
+        static inline void traceItem(MessageQueue *msgQueue, const QueueItem &item, PostResult result)
+        {
+#if ARDUPROF_TRACE
+            MessageTrace &trace = MessageTrace::instance();
+            if (trace.isEnabled())
+            {
+                trace.record(TracePost, item.postUs, item.postUs, item.msg, trace.currentTrack(), msgQueue ? msgQueue->_traceTrack : 0, result);
+            }
+#endif
+        }
+
+        // the ring backend never blocks and drops the new message when full, whatever the policy.
+        // From an ISR OverflowBlock and OverflowDropOldest fall back to OverflowDropNewest
+        PostResult queueItem(MessageQueue *msgQueue, MessagePriority priority, const QueueItem &item, OverflowPolicy policy, TickType_t xTicksToWait)
+        {
+            if (msgQueue && msgQueue->_ring)
+            {
+                return msgQueue->pushRing(item) ? PostOk : PostDropped;
+            }
+
+            QueueHandle_t queue = msgQueue ? msgQueue->laneQueue(priority) : nullptr;
+            if (queue == nullptr)
+            {
+                return PostInvalid;
+            }
+
+            bool isIsr = xPortInIsrContext();
+            if (sendItem(queue, item, isIsr))
+            {
+                msgQueue->_queueStats.countPosted();
+                return PostOk;
+            }
+
+            // lane full
+            QueueStats &stats = msgQueue->_queueStats;
+            switch (policy == OverflowDefault ? msgQueue->_overflowPolicy : policy)
+            {
+            case OverflowBlock:
+                if (!isIsr)
                 {
-                    BaseType_t xHigherPriorityTaskWoken = pdFALSE;
-                    if (xQueueSendFromISR(msgQueue->_queue, &msg, &xHigherPriorityTaskWoken) != pdTRUE)
+                    if (xQueueSend(queue, &item, xTicksToWait ? xTicksToWait : msgQueue->_blockTicks) == pdTRUE)
                     {
-                        // LOG_ERROR("xQueueSend failed!");
+                        stats.countPosted();
+                        stats.countBlocked();
+                        return PostOk;
                     }
-                    portYIELD_FROM_ISR();
+                    stats.countTimedOut();
+                    return PostTimeout;
                 }
-                else
+                break;
+            case OverflowDropOldest:
+                // another producer may take the room first: try once more, then drop the new message
+                for (int i = 0; !isIsr && i < 2; i++)
                 {
-                    if (xQueueSend(msgQueue->_queue, &msg, xTicksToWait) != pdTRUE)
-                    // if (xQueueSend(msgQueue->queue, &msg, portMAX_DELAY) != pdTRUE)
+                    if (msgQueue->discardOldest(queue) && sendItem(queue, item, false))
                     {
-                        // LOG_ERROR("xQueueSend failed!");
+                        stats.countPosted();
+                        return PostDroppedOldest;
                     }
                 }
+                break;
+            case OverflowCoalesce:
+                if (msgQueue->_mailbox && msgQueue->_mailbox->merge(item, CoalesceByParams))
+                {
+                    stats.countCoalesced();
+                    return PostCoalesced;
+                }
+                break;
+            case OverflowReject:
+                stats.countRejected();
+                return PostRejected;
+            default:
+                break;
+            }
+            stats.countDropped();
+            return PostDropped;
+        }
+
+        // non-blocking send from task or ISR
+        static bool sendItem(QueueHandle_t queue, const QueueItem &item, bool isIsr)
+        {
+            if (isIsr)
+            {
+                BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+                BaseType_t result = xQueueSendFromISR(queue, &item, &xHigherPriorityTaskWoken);
+                portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+                return result == pdTRUE;
+            }
+            return xQueueSend(queue, &item, 0) == pdTRUE;
+        }
+
+        // OverflowDropOldest: discard the oldest message of "queue" (one of the lanes of this queue), task context only.
+        // False on a queue which carries postBuffer() messages: the reference of a discarded one would leak
+        bool discardOldest(QueueHandle_t queue)
+        {
+            if (_hasBuffers)
+            {
+                return false;
+            }
+            QueueItem oldest;
+            if (xQueueReceive(queue, &oldest, 0) != pdTRUE)
+            {
+                return false;
+            }
+            if (_queueSet)
+            {
+                // a set entry only counts a message, messageLoop() picks the lane itself: remove the entry of the discarded one
+                xQueueSelectFromSet(_queueSet, 0);
+            }
+            _queueStats.countDroppedOldest();
+
+            // free what a discarded token holds
+            if (oldest.msg.event == ARDUPROF_EVENT_MAILBOX && _mailbox)
+            {
+                _mailbox->take(oldest.msg.iParam, oldest);
+            }
+            else if (oldest.msg.event == ARDUPROF_EVENT_CALL)
+            {
+                CallSlots &slots = CallSlots::instance();
+                Message request;
+                if (slots.begin(oldest.msg.iParam, request))
+                {
+                    slots.end(oldest.msg.iParam, CallFailed, 0);
+                }
             }
+            return true;
         }
 
-        inline void postEvent(int16_t event, int16_t iParam = 0, uint16_t uParam = 0, uint32_t lParam = 0L, TickType_t xTicksToWait = 0)
+        inline void countPost(bool isPosted)
         {
-            postEvent(this, event, iParam, uParam, lParam, xTicksToWait);
+            if (isPosted)
+            {
+                _queueStats.countPosted();
+            }
+            else
+            {
+                _queueStats.countDropped();
+            }
         }
-        inline void postEvent(const Message &msg, TickType_t xTicksToWait = 0)
+
+        // the consumer drains the ring before it waits, so only a push to an empty ring needs a wake-up
+        bool pushRing(const QueueItem &item)
         {
-            postEvent(this, msg, xTicksToWait);
+            bool wasEmpty = false;
+            bool isPosted = _ring->push(item, wasEmpty);
+            countPost(isPosted);
+            if (!isPosted || !wasEmpty)
+            {
+                return isPosted;
+            }
+            TaskHandle_t consumer = _ring->consumer();
+            if (consumer == nullptr)
+            {
+                return true; // consumer not started yet, it drains the ring before its first wait
+            }
+            if (xPortInIsrContext())
+            {
+                BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+                xTaskNotifyFromISR(consumer, ARDUPROF_NOTIFY_RING, eSetBits, &xHigherPriorityTaskWoken);
+                portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+            }
+            else
+            {
+                xTaskNotify(consumer, ARDUPROF_NOTIFY_RING, eSetBits);
+            }
+            return true;
         }
 
-    protected:
-        QueueHandle_t _queue;
-        bool _isStaticQueue;
+        inline bool isLaneFull(MessagePriority priority)
+        {
+            QueueHandle_t queue = laneQueue(priority);
+            return queue && uxQueueSpacesAvailable(queue) == 0;
+        }
 
-        void sendMessageToTask(int16_t event, int16_t iParam = 0, uint16_t uParam = 0, uint32_t lParam = 0L)
+        inline QueueHandle_t laneQueue(MessagePriority priority)
         {
-            if (_queue == nullptr)
+            return (priority < PriorityLaneCount && _lanes[priority]) ? _lanes[priority] : _queue;
+        }
+
+        void deleteLanes(void)
+        {
+            QueueSetHandle_t queueSet = _queueSet;
+            _queueSet = nullptr;
+            if (queueSet && _queue)
             {
-                return;
+                xQueueRemoveFromSet(_queue, queueSet);
+            }
+            for (int i = 0; i < PriorityLaneCount; i++)
+            {
+                QueueHandle_t lane = _lanes[i];
+                _lanes[i] = nullptr;
+                if (lane)
+                {
+                    vQueueDelete(lane);
+                }
+            }
+            if (queueSet)
+            {
+                vQueueDelete(queueSet);
             }
+        }
 
+        void sendMessageToTask(int16_t event, int16_t iParam = 0, uint16_t uParam = 0, uint32_t lParam = 0L)
+        {
             Message msg = {
                 .event = event,
                 .iParam = iParam,
                 .uParam = uParam,
                 .lParam = lParam,
             };
-            if (xQueueSend(_queue, &msg, 0) != pdTRUE)
-            // if (xQueueSend(queue, &msg, portMAX_DELAY) != pdTRUE)
+            QueueItem item = {
+                .msg = msg,
+                .postUs = clockUs(),
+            };
+            if (_ring)
             {
-                // DBGLOG(Debug, "%s - sendMessageToTask failed!", TAG);
+                traceItem(this, item, pushRing(item) ? PostOk : PostDropped);
+                return;
             }
-        }
-
-        void sendMessageFromIsrToTask(int16_t event, int16_t iParam = 0, uint16_t uParam = 0, uint32_t lParam = 0L)
-        {
             if (_queue == nullptr)
             {
                 return;
             }
 
+            bool isPosted = xQueueSend(_queue, &item, 0) == pdTRUE;
+            countPost(isPosted);
+            traceItem(this, item, isPosted ? PostOk : PostDropped);
+            // countPost(xQueueSend(queue, &item, portMAX_DELAY) == pdTRUE);
+        }
+
+        void sendMessageFromIsrToTask(int16_t event, int16_t iParam = 0, uint16_t uParam = 0, uint32_t lParam = 0L)
+        {
             Message msg = {
                 .event = event,
                 .iParam = iParam,
                 .uParam = uParam,
                 .lParam = lParam,
             };
+            QueueItem item = {
+                .msg = msg,
+                .postUs = clockUs(),
+            };
+            if (_ring)
+            {
+                traceItem(this, item, pushRing(item) ? PostOk : PostDropped);
+                return;
+            }
+            if (_queue == nullptr)
+            {
+                return;
+            }
+
             BaseType_t xHigherPriorityTaskWoken = pdFALSE;
-            xQueueSendFromISR(_queue, &msg, &xHigherPriorityTaskWoken);
-            portYIELD_FROM_ISR();
-            // portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+            bool isPosted = xQueueSendFromISR(_queue, &item, &xHigherPriorityTaskWoken) == pdTRUE;
+            countPost(isPosted);
+            traceItem(this, item, isPosted ? PostOk : PostDropped);
+            portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
         }
 
         inline QueueHandle_t queue(void)
         {
             return _queue;
         }
+
+        inline MessageRing *ring(void)
+        {
+            return _ring;
+        }
     };
 
 } // namespace ardufreertos
@@ -0,0 +1,129 @@
+/* Copyright 2024 teamprof.net@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include "./QueueItem.h"
+
+#if defined ARDUPROF_FREERTOS
+
+// task notification bit set when a message is pushed to an empty MessageRing
+#define ARDUPROF_NOTIFY_RING (1UL << 0)
+
+namespace ardufreertos
+{
+    /////////////////////////////////////////////////////////////////////////////
+    // Single-producer / single-consumer lock-free ring of QueueItem.
+    // Exactly one context (e.g. one GPIO or timer ISR) may push and exactly one task may pop.
+    // The consumer task is woken by a task notification (ARDUPROF_NOTIFY_RING) instead of a queue.
+    /////////////////////////////////////////////////////////////////////////////
+    class MessageRing
+    {
+    public:
+        // "length" must be a power of 2, "storage" (length items) is allocated if nullptr
+        MessageRing(uint16_t length, QueueItem *storage = nullptr) : _storage(storage ? storage : new QueueItem[length]),
+                                                                     _isStaticStorage(storage != nullptr),
+                                                                     _mask(length - 1),
+                                                                     _head(0),
+                                                                     _tail(0),
+                                                                     _consumer(nullptr),
+                                                                     _dropped(0)
+        {
+            configASSERT(length && (length & (length - 1)) == 0);
+        }
+
+        ~MessageRing()
+        {
+            if (!_isStaticStorage)
+            {
+                delete[] _storage;
+            }
+        }
+
+        // producer side: returns false (and counts a drop) if the ring is full.
+        // "wasEmpty" tells whether the consumer may be asleep and needs a notification.
+        bool push(const QueueItem &item, bool &wasEmpty)
+        {
+            uint32_t tail = _tail.load(std::memory_order_relaxed);
+            uint32_t head = _head.load(std::memory_order_acquire);
+            if (tail - head > _mask)
+            {
+                _dropped++;
+                wasEmpty = false;
+                return false;
+            }
+            _storage[tail & _mask] = item;
+            _tail.store(tail + 1, std::memory_order_seq_cst);
+
+            // re-read head after publishing: the consumer re-checks tail after publishing head,
+            // so at least one side sees the other and no wake-up is lost
+            wasEmpty = (_head.load(std::memory_order_seq_cst) == tail);
+            return true;
+        }
+
+        // consumer side
+        bool pop(QueueItem &item)
+        {
+            uint32_t head = _head.load(std::memory_order_relaxed);
+            if (_tail.load(std::memory_order_seq_cst) == head)
+            {
+                return false;
+            }
+            item = _storage[head & _mask];
+            _head.store(head + 1, std::memory_order_seq_cst);
+            return true;
+        }
+
+        uint16_t count(void) const
+        {
+            return (uint16_t)(_tail.load(std::memory_order_acquire) - _head.load(std::memory_order_acquire));
+        }
+        uint16_t capacity(void) const
+        {
+            return (uint16_t)(_mask + 1);
+        }
+        uint32_t dropped(void) const
+        {
+            return _dropped;
+        }
+
+        void setConsumer(TaskHandle_t task)
+        {
+            _consumer.store(task, std::memory_order_release);
+        }
+        TaskHandle_t consumer(void) const
+        {
+            return _consumer.load(std::memory_order_acquire);
+        }
+
+    private:
+        QueueItem *_storage;
+        bool _isStaticStorage;
+        uint32_t _mask;
+
+        std::atomic<uint32_t> _head; // next slot to pop, written by consumer only
+        std::atomic<uint32_t> _tail; // next slot to push, written by producer only
+        std::atomic<TaskHandle_t> _consumer;
+        uint32_t _dropped; // written by producer only
+    };
+
+} // namespace ardufreertos
+
+#endif // ARDUPROF_FREERTOS
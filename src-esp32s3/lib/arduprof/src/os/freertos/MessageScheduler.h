@@ -0,0 +1,406 @@
+/* Copyright 2024 teamprof.net@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#pragma once
+#include <stdint.h>
+#include "./MessageQueue.h"
+
+#if defined ARDUPROF_FREERTOS
+
+#ifndef ARDUPROF_SCHEDULER_SIZE
+#define ARDUPROF_SCHEDULER_SIZE 16 // number of delayed or periodic posts pending at the same time
+#endif
+#ifndef ARDUPROF_SCHEDULER_REARM_WAIT_MS
+#define ARDUPROF_SCHEDULER_REARM_WAIT_MS 10 // longest wait for room in the timer command queue
+#endif
+
+namespace ardufreertos
+{
+    // identifies a scheduled post for cancelScheduled(), 0 if scheduling failed
+    typedef uint32_t ScheduleId;
+
+    /////////////////////////////////////////////////////////////////////////////
+    // Deadlines of delayed and periodic posts of all queues.
+    // Entries sit in one binary min-heap ordered by deadline tick. A single one-shot FreeRTOS timer
+    // is armed for the earliest deadline; its callback (timer service task) posts what is due,
+    // re-inserts periodic entries and re-arms itself. The timer is only touched from the timer
+    // service task, requests from other tasks are forwarded with xTimerPendFunctionCall().
+    // schedule() and cancel() are for task context, including software timer callbacks.
+    /////////////////////////////////////////////////////////////////////////////
+    class MessageScheduler
+    {
+    public:
+        static MessageScheduler &instance(void)
+        {
+            static MessageScheduler scheduler;
+            existing() = &scheduler;
+            return scheduler;
+        }
+        // the scheduler if it was ever used, nullptr otherwise
+        static MessageScheduler *&existing(void)
+        {
+            static MessageScheduler *scheduler = nullptr;
+            return scheduler;
+        }
+
+        // post "msg" to "queue" at "deadline", then every "period" ticks if period > 0
+        // a ring backed queue is rejected: its single producer is the ISR
+        ScheduleId schedule(MessageQueue *queue, const Message &msg, TickType_t deadline, TickType_t period)
+        {
+            configASSERT(queue && !xPortInIsrContext());
+            if (queue->_ring)
+            {
+                return 0;
+            }
+
+            ScheduleId id = 0;
+            bool isEarliest = false;
+            portENTER_CRITICAL(&_mux);
+            int index = allocEntry();
+            if (index >= 0)
+            {
+                Entry &entry = _entries[index];
+                entry.queue = queue;
+                entry.msg = msg;
+                entry.deadline = deadline;
+                entry.period = period;
+                heapPush((uint8_t)index);
+                isEarliest = (_heap[0] == index);
+                id = makeId(index);
+                if (_count > _maxPending)
+                {
+                    _maxPending = _count;
+                }
+            }
+            portEXIT_CRITICAL(&_mux);
+
+            if (isEarliest && !requestRearm())
+            {
+                // the timer would not see the new deadline: fail rather than post late or never
+                if (cancel(id))
+                {
+                    return 0;
+                }
+            }
+            return id;
+        }
+
+        // returns false if the post already happened (one-shot) or the id is unknown
+        bool cancel(ScheduleId id)
+        {
+            bool isCancelled = false;
+            portENTER_CRITICAL(&_mux);
+            int index = indexOf(id);
+            if (index >= 0)
+            {
+                heapRemove(index);
+                freeEntry(index);
+                isCancelled = true;
+            }
+            portEXIT_CRITICAL(&_mux);
+            return isCancelled; // the timer may fire once more for nothing
+        }
+
+        // cancel every post to "queue", e.g. before the queue is deleted.
+        // A post already taken by the timer service task is still delivered: stop the consumer first.
+        void cancelAll(MessageQueue *queue)
+        {
+            if (queue == nullptr)
+            {
+                return;
+            }
+            portENTER_CRITICAL(&_mux);
+            for (int i = 0; i < ARDUPROF_SCHEDULER_SIZE; i++)
+            {
+                if (_entries[i].queue == queue)
+                {
+                    heapRemove(i);
+                    freeEntry(i);
+                }
+            }
+            portEXIT_CRITICAL(&_mux);
+        }
+
+        uint16_t pending(void)
+        {
+            return _count;
+        }
+        uint16_t maxPending(void)
+        {
+            return _maxPending;
+        }
+        // periodic posts skipped because the lane of the queue was full
+        uint32_t skipped(void)
+        {
+            return _skipped;
+        }
+
+    private:
+        typedef struct _Entry
+        {
+            MessageQueue *queue; // nullptr when the entry is free
+            Message msg;
+            TickType_t deadline;
+            TickType_t period; // 0 for one-shot
+            uint16_t generation;
+            int16_t heapIndex;
+        } Entry;
+
+        portMUX_TYPE _mux;
+        TimerHandle_t _timer;
+        Entry _entries[ARDUPROF_SCHEDULER_SIZE];
+        uint8_t _heap[ARDUPROF_SCHEDULER_SIZE]; // entry indices, earliest deadline first
+        uint16_t _count;
+        uint16_t _maxPending;
+        uint32_t _skipped;
+
+        MessageScheduler() : _entries(),
+                             _heap(),
+                             _count(0),
+                             _maxPending(0),
+                             _skipped(0)
+        {
+            portMUX_INITIALIZE(&_mux);
+            _timer = xTimerCreate("MessageScheduler", 1, pdFALSE, this,
+                                  [](TimerHandle_t xTimer)
+                                  {
+                                      static_cast<MessageScheduler *>(pvTimerGetTimerID(xTimer))->onTimer();
+                                  });
+            configASSERT(_timer != NULL);
+        }
+
+        static inline bool isBefore(TickType_t a, TickType_t b)
+        {
+            return (int32_t)(a - b) < 0; // tick counter wraps
+        }
+
+        // false if the timer command queue stayed full
+        bool requestRearm(void)
+        {
+            if (xTaskGetCurrentTaskHandle() == xTimerGetTimerDaemonTaskHandle())
+            {
+                // a software timer callback: waiting on the command queue would block its own consumer
+                rearm();
+                return true;
+            }
+            return xTimerPendFunctionCall(
+                       [](void *param1, uint32_t /*param2*/)
+                       {
+                           static_cast<MessageScheduler *>(param1)->rearm();
+                       },
+                       this,
+                       (uint32_t)0,
+                       pdMS_TO_TICKS(ARDUPROF_SCHEDULER_REARM_WAIT_MS)) == pdPASS;
+        }
+
+        // timer service task: post every due entry, then re-arm for the next deadline
+        void onTimer(void)
+        {
+            while (true)
+            {
+                portENTER_CRITICAL(&_mux);
+                TickType_t now = xTaskGetTickCount();
+                if (_count == 0 || isBefore(now, _entries[_heap[0]].deadline))
+                {
+                    portEXIT_CRITICAL(&_mux);
+                    break;
+                }
+                int index = _heap[0];
+                Entry &entry = _entries[index];
+                MessageQueue *queue = entry.queue;
+                if (queue->isLaneFull(PriorityNormal))
+                {
+                    // the timer service task must not block: a one-shot post tries again on the next tick,
+                    // a periodic one skips this period and keeps its phase
+                    heapRemove(index);
+                    if (entry.period)
+                    {
+                        _skipped++;
+                        advance(entry, now);
+                    }
+                    else
+                    {
+                        entry.deadline = now + 1;
+                    }
+                    heapPush((uint8_t)index);
+                    portEXIT_CRITICAL(&_mux);
+                    continue;
+                }
+                QueueItem item = {
+                    .msg = entry.msg,
+                    .postUs = clockUs(),
+                };
+                heapRemove(index);
+                if (entry.period)
+                {
+                    advance(entry, now);
+                    heapPush((uint8_t)index);
+                }
+                else
+                {
+                    freeEntry(index);
+                }
+                portEXIT_CRITICAL(&_mux);
+
+                queue->postItem(queue, PriorityNormal, item, OverflowDropNewest, 0); // the timer service task never blocks, whatever the queue policy
+            }
+            rearm();
+        }
+
+        // next deadline of a periodic entry after "now", in phase: missed periods are skipped, not queued up
+        static void advance(Entry &entry, TickType_t now)
+        {
+            TickType_t periods = isBefore(now, entry.deadline) ? 1 : (TickType_t)(now - entry.deadline) / entry.period + 1;
+            entry.deadline += periods * entry.period;
+        }
+
+        // timer service task only
+        void rearm(void)
+        {
+            portENTER_CRITICAL(&_mux);
+            bool isEmpty = (_count == 0);
+            TickType_t delay = 1;
+            if (!isEmpty)
+            {
+                TickType_t deadline = _entries[_heap[0]].deadline;
+                TickType_t now = xTaskGetTickCount();
+                delay = isBefore(now, deadline) ? deadline - now : 1;
+            }
+            portEXIT_CRITICAL(&_mux);
+
+            if (isEmpty)
+            {
+                xTimerStop(_timer, 0);
+            }
+            else
+            {
+                xTimerChangePeriod(_timer, delay, 0); // also starts the timer
+            }
+        }
+
+        inline ScheduleId makeId(int index)
+        {
+            // bit 31..8: generation + 1 (never 0), bit 7..0: entry index
+            return ((ScheduleId)(_entries[index].generation + 1) << 8) | (ScheduleId)index;
+        }
+        int indexOf(ScheduleId id)
+        {
+            int index = (int)(id & 0xFF);
+            if (id == 0 || index >= ARDUPROF_SCHEDULER_SIZE || _entries[index].queue == nullptr ||
+                makeId(index) != id)
+            {
+                return -1;
+            }
+            return index;
+        }
+
+        int allocEntry(void)
+        {
+            for (int i = 0; i < ARDUPROF_SCHEDULER_SIZE; i++)
+            {
+                if (_entries[i].queue == nullptr)
+                {
+                    return i;
+                }
+            }
+            return -1;
+        }
+        void freeEntry(int index)
+        {
+            _entries[index].queue = nullptr;
+            _entries[index].generation++;
+        }
+
+        /////////////////////////////////////////////////////////////////////////
+        // binary min-heap of entry indices, caller holds _mux
+        /////////////////////////////////////////////////////////////////////////
+        void heapPush(uint8_t index)
+        {
+            _heap[_count] = index;
+            _entries[index].heapIndex = (int16_t)_count;
+            siftUp(_count++);
+        }
+
+        void heapRemove(int index)
+        {
+            int position = _entries[index].heapIndex;
+            if (position < 0)
+            {
+                return;
+            }
+            _entries[index].heapIndex = -1;
+            _count--;
+            if (position == _count)
+            {
+                return;
+            }
+            _heap[position] = _heap[_count];
+            _entries[_heap[position]].heapIndex = (int16_t)position;
+            siftDown(position);
+            siftUp(position);
+        }
+
+        void siftUp(int position)
+        {
+            while (position > 0)
+            {
+                int parent = (position - 1) / 2;
+                if (!isBefore(_entries[_heap[position]].deadline, _entries[_heap[parent]].deadline))
+                {
+                    break;
+                }
+                swap(position, parent);
+                position = parent;
+            }
+        }
+
+        void siftDown(int position)
+        {
+            while (true)
+            {
+                int earliest = position;
+                for (int child = 2 * position + 1; child <= 2 * position + 2 && child < _count; child++)
+                {
+                    if (isBefore(_entries[_heap[child]].deadline, _entries[_heap[earliest]].deadline))
+                    {
+                        earliest = child;
+                    }
+                }
+                if (earliest == position)
+                {
+                    break;
+                }
+                swap(position, earliest);
+                position = earliest;
+            }
+        }
+
+        inline void swap(int a, int b)
+        {
+            uint8_t index = _heap[a];
+            _heap[a] = _heap[b];
+            _heap[b] = index;
+            _entries[_heap[a]].heapIndex = (int16_t)a;
+            _entries[_heap[b]].heapIndex = (int16_t)b;
+        }
+    };
+
+} // namespace ardufreertos
+
+#endif // ARDUPROF_FREERTOS
@@ -0,0 +1,267 @@
+/* Copyright 2024 teamprof.net@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include "../../type/Message.h"
+
+#if defined ARDUPROF_FREERTOS
+
+#ifndef ARDUPROF_TRACE
+#define ARDUPROF_TRACE 1 // always-on message-flow trace, 0 compiles the hooks out
+#endif
+
+#ifndef ARDUPROF_TRACE_SIZE
+#define ARDUPROF_TRACE_SIZE 256 // records kept in the trace ring, power of 2
+#endif
+
+#ifndef ARDUPROF_TRACE_TRACKS
+#define ARDUPROF_TRACE_TRACKS 8 // named tracks (buses and plain tasks), track 0 is every other task
+#endif
+
+#define ARDUPROF_TRACE_NAME_SIZE 16
+#define ARDUPROF_TRACE_ISR 0xff // source track of posts from an ISR
+
+#define ARDUPROF_TRACE_MAGIC "APTR"
+#define ARDUPROF_TRACE_VERSION 1
+
+namespace ardufreertos
+{
+    enum TraceType : uint8_t
+    {
+        TraceNone = 0,
+        TracePost,  // src posted to dst, result=<PostResult>
+        TraceBegin, // dst starts the handler of a message posted at postUs
+        TraceEnd,   // dst returns from that handler
+    };
+
+    // one trace record, 20 bytes. seq is written last: a record being overwritten has seq 0
+    typedef struct _TraceRecord
+    {
+        uint32_t seq;    // 1 + index of the record since boot
+        uint32_t timeUs; // clockUs()
+        uint32_t postUs; // post time of the message, links a post to its dispatch
+        int16_t event;
+        int16_t iParam;
+        uint8_t type; // TraceType
+        uint8_t src;  // track of the posting task, ARDUPROF_TRACE_ISR from an ISR
+        uint8_t dst;  // track of the receiving bus
+        uint8_t result;
+    } TraceRecord;
+
+    // header of a dump, followed by "count" records oldest first
+    typedef struct _TraceHeader
+    {
+        char magic[4]; // ARDUPROF_TRACE_MAGIC
+        uint16_t version;
+        uint16_t recordSize;
+        uint16_t tracks;   // ARDUPROF_TRACE_TRACKS
+        uint16_t nameSize; // ARDUPROF_TRACE_NAME_SIZE
+        uint32_t count;
+        uint32_t lost; // records overwritten before the dump
+        char names[ARDUPROF_TRACE_TRACKS][ARDUPROF_TRACE_NAME_SIZE];
+    } TraceHeader;
+
+    // sink of dump(), e.g. a file, a socket or a hex logger
+    typedef void (*TraceWriter)(const void *data, size_t size, void *arg);
+
+    /////////////////////////////////////////////////////////////////////////////
+    // Lock-free ring of the last ARDUPROF_TRACE_SIZE posts and dispatches, shared by all tasks and ISRs.
+    // A writer claims a slot with one atomic increment and fills it in place, older records are overwritten.
+    // Tracks name the tasks: a bus gets one with MessageQueue::setTraceName() (StaticThread uses its task name),
+    // a plain task which posts, e.g. a socket reader, with nameTask().
+    // Convert a dump with extras/trace/trace2chrome.py and open it in Perfetto or chrome://tracing.
+    /////////////////////////////////////////////////////////////////////////////
+    class MessageTrace
+    {
+    public:
+        static MessageTrace &instance(void)
+        {
+            static MessageTrace trace;
+            return trace;
+        }
+
+        inline void record(TraceType type, uint32_t timeUs, uint32_t postUs, const Message &msg, uint8_t src, uint8_t dst, uint8_t result = 0)
+        {
+            if (!_isEnabled.load(std::memory_order_relaxed))
+            {
+                return;
+            }
+            uint32_t index = _head.fetch_add(1, std::memory_order_relaxed);
+            TraceRecord &r = _records[index & (ARDUPROF_TRACE_SIZE - 1)];
+            __atomic_store_n(&r.seq, 0, __ATOMIC_RELAXED);
+            std::atomic_thread_fence(std::memory_order_release);
+            r.timeUs = timeUs;
+            r.postUs = postUs;
+            r.event = msg.event;
+            r.iParam = msg.iParam;
+            r.type = type;
+            r.src = src;
+            r.dst = dst;
+            r.result = result;
+            __atomic_store_n(&r.seq, index + 1, __ATOMIC_RELEASE);
+        }
+
+        // track of the calling task (ARDUPROF_TRACE_ISR in an ISR, 0 if unnamed)
+        inline uint8_t currentTrack(void)
+        {
+            if (xPortInIsrContext())
+            {
+                return ARDUPROF_TRACE_ISR;
+            }
+            TaskHandle_t task = xTaskGetCurrentTaskHandle();
+            for (int i = 1; i < _trackCount.load(std::memory_order_acquire); i++)
+            {
+                if (_tasks[i].load(std::memory_order_relaxed) == task)
+                {
+                    return (uint8_t)i;
+                }
+            }
+            return 0;
+        }
+
+        // new track named "name", 0 if all ARDUPROF_TRACE_TRACKS are taken
+        uint8_t addTrack(const char *name)
+        {
+            uint8_t track = 0;
+            portENTER_CRITICAL(&_mux);
+            int count = _trackCount.load(std::memory_order_relaxed);
+            if (count < ARDUPROF_TRACE_TRACKS)
+            {
+                strncpy(_names[count], name, ARDUPROF_TRACE_NAME_SIZE - 1);
+                _trackCount.store(count + 1, std::memory_order_release);
+                track = (uint8_t)count;
+            }
+            portEXIT_CRITICAL(&_mux);
+            return track;
+        }
+
+        // posts of the calling task are recorded on "track" from now on
+        void bindTask(uint8_t track)
+        {
+            if (track && track < ARDUPROF_TRACE_TRACKS)
+            {
+                _tasks[track].store(xTaskGetCurrentTaskHandle(), std::memory_order_relaxed);
+            }
+        }
+
+        // name the calling task, for tasks which post without a bus of their own
+        uint8_t nameTask(const char *name)
+        {
+            uint8_t track = currentTrack();
+            if (track == 0)
+            {
+                track = addTrack(name);
+                bindTask(track);
+            }
+            return track;
+        }
+
+        void setEnabled(bool isEnabled)
+        {
+            _isEnabled.store(isEnabled, std::memory_order_relaxed);
+        }
+        bool isEnabled(void)
+        {
+            return _isEnabled.load(std::memory_order_relaxed);
+        }
+
+        // records written since boot (or clear())
+        uint32_t written(void)
+        {
+            return _head.load(std::memory_order_relaxed);
+        }
+
+        // stop recording and forget the records; tracks are kept
+        void clear(void)
+        {
+            bool isEnabled = _isEnabled.exchange(false);
+            for (int i = 0; i < ARDUPROF_TRACE_SIZE; i++)
+            {
+                __atomic_store_n(&_records[i].seq, 0, __ATOMIC_RELAXED);
+            }
+            _head.store(0);
+            _isEnabled.store(isEnabled);
+        }
+
+        // write a TraceHeader and the records, oldest first; returns the number of records.
+        // Recording pauses during the dump, records being written meanwhile are skipped
+        uint32_t dump(TraceWriter writer, void *arg)
+        {
+            bool isEnabled = _isEnabled.exchange(false);
+
+            uint32_t head = _head.load(std::memory_order_acquire);
+            uint32_t first = head > ARDUPROF_TRACE_SIZE ? head - ARDUPROF_TRACE_SIZE : 0;
+            uint32_t count = 0;
+            for (uint32_t i = first; i < head; i++)
+            {
+                if (__atomic_load_n(&_records[i & (ARDUPROF_TRACE_SIZE - 1)].seq, __ATOMIC_ACQUIRE) == i + 1)
+                {
+                    count++;
+                }
+            }
+
+            TraceHeader header = {};
+            memcpy(header.magic, ARDUPROF_TRACE_MAGIC, sizeof(header.magic));
+            header.version = ARDUPROF_TRACE_VERSION;
+            header.recordSize = sizeof(TraceRecord);
+            header.tracks = ARDUPROF_TRACE_TRACKS;
+            header.nameSize = ARDUPROF_TRACE_NAME_SIZE;
+            header.count = count;
+            header.lost = first;
+            memcpy(header.names, _names, sizeof(header.names));
+            writer(&header, sizeof(header), arg);
+
+            for (uint32_t i = first; i < head; i++)
+            {
+                const TraceRecord &r = _records[i & (ARDUPROF_TRACE_SIZE - 1)];
+                if (__atomic_load_n(&r.seq, __ATOMIC_ACQUIRE) == i + 1)
+                {
+                    writer(&r, sizeof(r), arg);
+                }
+            }
+
+            _isEnabled.store(isEnabled);
+            return count;
+        }
+
+    private:
+        TraceRecord _records[ARDUPROF_TRACE_SIZE];
+        std::atomic<uint32_t> _head;
+        std::atomic<bool> _isEnabled;
+
+        char _names[ARDUPROF_TRACE_TRACKS][ARDUPROF_TRACE_NAME_SIZE];
+        std::atomic<TaskHandle_t> _tasks[ARDUPROF_TRACE_TRACKS];
+        std::atomic<int> _trackCount;
+        portMUX_TYPE _mux;
+
+        MessageTrace() : _records(), _head(0), _isEnabled(ARDUPROF_TRACE != 0), _names(), _tasks(), _trackCount(1)
+        {
+            static_assert((ARDUPROF_TRACE_SIZE & (ARDUPROF_TRACE_SIZE - 1)) == 0, "ARDUPROF_TRACE_SIZE must be a power of 2");
+            static_assert(sizeof(TraceRecord) == 20, "sizeof(TraceRecord) == 20");
+            strncpy(_names[0], "other", ARDUPROF_TRACE_NAME_SIZE - 1);
+            portMUX_INITIALIZE(&_mux);
+        }
+    };
+
+} // namespace ardufreertos
+
+#endif // ARDUPROF_FREERTOS
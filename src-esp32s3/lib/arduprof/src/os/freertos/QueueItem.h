@@ -0,0 +1,53 @@
+/* Copyright 2024 teamprof.net@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#pragma once
+#include <stdint.h>
+#include "../../type/Message.h"
+
+#if defined ARDUPROF_FREERTOS
+
+#if defined ESP_PLATFORM && !defined ARDUPROF_POSIX
+#include <esp_timer.h>
+#endif
+
+namespace ardufreertos
+{
+    // free-running microsecond clock for queue statistics, wraps after ~71 minutes
+    inline uint32_t clockUs(void)
+    {
+#if defined ARDUPROF_POSIX
+        return (uint32_t)posix::monotonicUs();
+#elif defined ESP_PLATFORM
+        return (uint32_t)esp_timer_get_time();
+#else
+        return (uint32_t)(xTaskGetTickCount() * portTICK_PERIOD_MS * 1000UL);
+#endif
+    }
+
+    // item stored in message queues and rings: the message plus its post time
+    typedef struct _QueueItem
+    {
+        Message msg;
+        uint32_t postUs; // clockUs() when posted
+    } QueueItem;
+
+} // namespace ardufreertos
+
+#endif // ARDUPROF_FREERTOS
@@ -0,0 +1,517 @@
+/* Copyright 2024 teamprof.net@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include "./MessageQueue.h"
+
+#ifndef ARDUPROF_STALL_WATCHDOG
+#define ARDUPROF_STALL_WATCHDOG 1 // record handler overruns and stalled buses, 0 compiles it out
+#endif
+
+#ifndef ARDUPROF_HANDLER_BUDGET_US
+#define ARDUPROF_HANDLER_BUDGET_US 50000 // default wall-time budget of a handler, 0 disables the check
+#endif
+
+#ifndef ARDUPROF_HANDLER_BUDGET_SIZE
+#define ARDUPROF_HANDLER_BUDGET_SIZE 4 // events with a budget of their own, per bus
+#endif
+
+#if defined ARDUPROF_FREERTOS && ARDUPROF_STALL_WATCHDOG
+
+#ifndef ARDUPROF_STALL_BUSES
+#define ARDUPROF_STALL_BUSES 8 // buses watched at the same time
+#endif
+
+#ifndef ARDUPROF_STALL_LOG_SIZE
+#define ARDUPROF_STALL_LOG_SIZE 16 // records kept, oldest overwritten first
+#endif
+
+#ifndef ARDUPROF_STALL_BACKTRACE_DEPTH
+#define ARDUPROF_STALL_BACKTRACE_DEPTH 8 // program counters per record
+#endif
+
+#ifndef ARDUPROF_STALL_NAME_SIZE
+#define ARDUPROF_STALL_NAME_SIZE 12 // bytes of a bus name, with the terminating '\0'
+#endif
+
+#ifndef ARDUPROF_STALL_CHECK_MS
+#define ARDUPROF_STALL_CHECK_MS 100 // period of the watchdog task
+#endif
+
+#ifndef ARDUPROF_STALL_DRAIN_MS
+#define ARDUPROF_STALL_DRAIN_MS 1000 // default time a bus may leave messages waiting without dispatching one
+#endif
+
+#ifndef ARDUPROF_STALL_STACK
+#define ARDUPROF_STALL_STACK 3072 // the callback runs on this stack
+#endif
+
+#ifndef ARDUPROF_STALL_PRIORITY
+#define ARDUPROF_STALL_PRIORITY (configMAX_PRIORITIES - 2) // above the buses it watches
+#endif
+
+#define ARDUPROF_STALL_MAGIC 0x54535041 // "APST"
+
+#if defined ESP_PLATFORM
+#include "esp_attr.h"
+// storage of StallLog which keeps its content across a soft reset (esp_restart(), panic, watchdog)
+#define ARDUPROF_STALL_NOINIT RTC_NOINIT_ATTR
+#if __has_include("esp_private/freertos_debug.h")
+#include "esp_private/freertos_debug.h"
+#elif __has_include("freertos/task_snapshot.h")
+#include "freertos/task_snapshot.h"
+#endif
+#if defined __XTENSA__
+#include "xtensa_context.h"
+#elif defined __riscv
+#include "riscv/rvruntime-frames.h"
+#endif
+#else
+#define ARDUPROF_STALL_NOINIT
+#endif
+
+namespace ardufreertos
+{
+    enum StallKind : uint8_t
+    {
+        StallNone = 0,
+        StallOverrun,     // a handler returned after more than its budget
+        StallStuck,       // a handler is still running past its budget, backtrace of the bus task
+        StallNotDraining, // messages waiting and none dispatched for the drain timeout, no handler running
+    };
+
+    /////////////////////////////////////////////////////////////////////////////
+    // one entry of StallLog
+    /////////////////////////////////////////////////////////////////////////////
+    typedef struct _StallRecord
+    {
+        uint16_t boot;      // StallLog::boot when recorded: a lower value is from before a reset
+        uint8_t kind;       // StallKind
+        uint8_t depth;      // valid entries of backtrace
+        int16_t event;      // running handler, or the last one for StallNotDraining
+        int16_t iParam;
+        uint32_t timeMs;    // since boot, of the latest repeat
+        uint32_t elapsedUs; // handler time, or time without dispatch; the largest of the repeats
+        uint32_t budgetUs;  // handler budget, or drain timeout
+        uint16_t queued;    // messages waiting in the bus
+        uint16_t repeats;   // identical records folded into this one
+        char name[ARDUPROF_STALL_NAME_SIZE];
+        uint32_t backtrace[ARDUPROF_STALL_BACKTRACE_DEPTH]; // PCs of the bus task, innermost first
+    } StallRecord;
+
+    /////////////////////////////////////////////////////////////////////////////
+    // ring of StallRecord, in memory which survives a soft reset when defined with ARDUPROF_STALL_NOINIT
+    /////////////////////////////////////////////////////////////////////////////
+    typedef struct _StallLog
+    {
+        uint32_t magic;      // ARDUPROF_STALL_MAGIC once initialized
+        uint16_t size;       // ARDUPROF_STALL_LOG_SIZE and sizeof(StallRecord) of the build which wrote it
+        uint16_t recordSize;
+        uint16_t boot;       // incremented by each StallWatchdog::begin()
+        uint16_t reserved;
+        uint32_t written;    // records ever written, the last ARDUPROF_STALL_LOG_SIZE are kept
+        StallRecord records[ARDUPROF_STALL_LOG_SIZE];
+    } StallLog;
+
+    /////////////////////////////////////////////////////////////////////////////
+    // handler state published by a watched bus. The bus task writes it around each handler,
+    // the watchdog task reads it without locking: "seq" is odd while a handler runs
+    /////////////////////////////////////////////////////////////////////////////
+    typedef struct _StallProbe
+    {
+        MessageQueue *bus; // nullptr if free
+        TaskHandle_t task; // task of the message loop, set by its first messageLoop()
+        uint32_t drainTimeoutMs;
+        char name[ARDUPROF_STALL_NAME_SIZE];
+
+        volatile uint32_t seq;
+        volatile uint32_t beginUs;
+        volatile uint32_t budgetUs;
+        volatile int16_t event;
+        volatile int16_t iParam;
+
+        // watchdog task only
+        uint32_t stuckSeq;       // handler already reported as stuck
+        uint32_t dispatched;     // dispatched count at the last progress
+        TickType_t progressTick; // last check which saw progress, or nothing waiting
+        bool isDrainReported;
+
+        inline void begin(const Message &msg, uint32_t us, uint32_t budget)
+        {
+            event = msg.event;
+            iParam = msg.iParam;
+            beginUs = us;
+            budgetUs = budget;
+            __atomic_store_n(&seq, seq + 1, __ATOMIC_RELEASE);
+        }
+        inline void end(void)
+        {
+            __atomic_store_n(&seq, seq + 1, __ATOMIC_RELEASE);
+        }
+    } StallProbe;
+
+    // called for each new record (not for repeats), in the bus task for StallOverrun, else in the watchdog task
+    typedef void (*StallCallback)(const StallRecord &record, void *arg);
+
+    /////////////////////////////////////////////////////////////////////////////
+    // Handler watchdog of all watched buses.
+    // A bus times each handler against its budget (MessageBus::setHandlerBudget()) and records an overrun
+    // when the handler returns. One shared task checks every ARDUPROF_STALL_CHECK_MS for what the bus
+    // cannot report itself: a handler still running past its budget (with the backtrace of the bus task,
+    // ESP-IDF only, when the task is not running at that instant) and a queue which stopped draining.
+    // Records go to a StallLog ring; attach one defined with ARDUPROF_STALL_NOINIT by begin() to read
+    // them again after a soft reset:
+    //     static ARDUPROF_STALL_NOINIT StallLog stallLog;
+    //     StallWatchdog::instance().begin(&stallLog);
+    //     queueMain.watchStalls("QueueMain");
+    /////////////////////////////////////////////////////////////////////////////
+    class StallWatchdog
+    {
+    public:
+        static StallWatchdog &instance(void)
+        {
+            static StallWatchdog watchdog;
+            existing() = &watchdog;
+            return watchdog;
+        }
+        // the watchdog if it was ever used, nullptr otherwise
+        static StallWatchdog *&existing(void)
+        {
+            static StallWatchdog *watchdog = nullptr;
+            return watchdog;
+        }
+
+        // keep the records in "log" from now on: records of earlier boots are kept if it holds a valid ring,
+        // otherwise it is cleared. Call once at boot, before watch(); returns the number of records kept
+        uint16_t begin(StallLog *log)
+        {
+            configASSERT(log);
+            if (log->magic != ARDUPROF_STALL_MAGIC || log->size != ARDUPROF_STALL_LOG_SIZE || log->recordSize != sizeof(StallRecord))
+            {
+                memset(log, 0, sizeof(StallLog));
+                log->magic = ARDUPROF_STALL_MAGIC;
+                log->size = ARDUPROF_STALL_LOG_SIZE;
+                log->recordSize = sizeof(StallRecord);
+            }
+            log->boot++;
+            portENTER_CRITICAL(&_mux);
+            _log = log;
+            portEXIT_CRITICAL(&_mux);
+            return count();
+        }
+
+        // start checking "bus", returns the probe the bus updates, nullptr if ARDUPROF_STALL_BUSES are watched
+        StallProbe *watch(MessageQueue *bus, const char *name, uint32_t drainTimeoutMs = ARDUPROF_STALL_DRAIN_MS)
+        {
+            StallProbe *probe = nullptr;
+            portENTER_CRITICAL(&_mux);
+            for (int i = 0; i < ARDUPROF_STALL_BUSES; i++)
+            {
+                if (_probes[i].bus == nullptr)
+                {
+                    probe = &_probes[i];
+                    *probe = {};
+                    probe->bus = bus;
+                    probe->drainTimeoutMs = drainTimeoutMs;
+                    strncpy(probe->name, name ? name : "", ARDUPROF_STALL_NAME_SIZE - 1);
+                    probe->progressTick = xTaskGetTickCount();
+                    break;
+                }
+            }
+            bool isStarting = probe && !_isStarted;
+            _isStarted = _isStarted || isStarting;
+            portEXIT_CRITICAL(&_mux);
+
+            if (isStarting && xTaskCreate([](void *instance)
+                                          { static_cast<StallWatchdog *>(instance)->run(); },
+                                          "StallWatchdog", ARDUPROF_STALL_STACK, this, ARDUPROF_STALL_PRIORITY, nullptr) != pdPASS)
+            {
+                portENTER_CRITICAL(&_mux);
+                _isStarted = false;
+                probe->bus = nullptr;
+                portEXIT_CRITICAL(&_mux);
+                return nullptr;
+            }
+            return probe;
+        }
+
+        void unwatch(MessageQueue *bus)
+        {
+            portENTER_CRITICAL(&_mux);
+            for (int i = 0; i < ARDUPROF_STALL_BUSES; i++)
+            {
+                if (_probes[i].bus == bus)
+                {
+                    _probes[i].bus = nullptr;
+                }
+            }
+            portEXIT_CRITICAL(&_mux);
+        }
+
+        void setCallback(StallCallback callback, void *arg = nullptr)
+        {
+            portENTER_CRITICAL(&_mux);
+            _callback = callback;
+            _callbackArg = arg;
+            portEXIT_CRITICAL(&_mux);
+        }
+
+        // called by the bus task when a handler returned over its budget
+        void recordOverrun(StallProbe &probe, const Message &msg, uint32_t elapsedUs, uint32_t budgetUs)
+        {
+            record(StallOverrun, probe, msg.event, msg.iParam, elapsedUs, budgetUs, nullptr, 0);
+        }
+
+        // records in the log, of this and of earlier boots
+        uint16_t count(void)
+        {
+            return _log->written < ARDUPROF_STALL_LOG_SIZE ? (uint16_t)_log->written : ARDUPROF_STALL_LOG_SIZE;
+        }
+        // record "index" of count(), oldest first
+        bool read(uint16_t index, StallRecord &entry)
+        {
+            bool isValid = false;
+            portENTER_CRITICAL(&_mux);
+            uint16_t n = count();
+            if (index < n)
+            {
+                entry = _log->records[(_log->written - n + index) % ARDUPROF_STALL_LOG_SIZE];
+                isValid = true;
+            }
+            portEXIT_CRITICAL(&_mux);
+            return isValid;
+        }
+        // boot number of records written since begin()
+        uint16_t boot(void)
+        {
+            return _log->boot;
+        }
+        void clear(void)
+        {
+            portENTER_CRITICAL(&_mux);
+            _log->written = 0;
+            portEXIT_CRITICAL(&_mux);
+        }
+
+    private:
+        StallProbe _probes[ARDUPROF_STALL_BUSES];
+        StallLog _ramLog; // until begin()
+        StallLog *_log;
+        StallCallback _callback;
+        void *_callbackArg;
+        bool _isStarted;
+        portMUX_TYPE _mux;
+
+        StallWatchdog() : _probes(), _ramLog(), _log(&_ramLog), _callback(nullptr), _callbackArg(nullptr), _isStarted(false)
+        {
+            portMUX_INITIALIZE(&_mux);
+            _ramLog.magic = ARDUPROF_STALL_MAGIC;
+            _ramLog.size = ARDUPROF_STALL_LOG_SIZE;
+            _ramLog.recordSize = sizeof(StallRecord);
+            _ramLog.boot = 1;
+        }
+
+        void run(void)
+        {
+            MessageTrace::instance().nameTask("StallWatchdog");
+            while (true)
+            {
+                vTaskDelay(pdMS_TO_TICKS(ARDUPROF_STALL_CHECK_MS));
+                TickType_t now = xTaskGetTickCount();
+                for (int i = 0; i < ARDUPROF_STALL_BUSES; i++)
+                {
+                    if (_probes[i].bus)
+                    {
+                        check(_probes[i], now);
+                    }
+                }
+            }
+        }
+
+        void check(StallProbe &probe, TickType_t now)
+        {
+            uint32_t seq = __atomic_load_n(&probe.seq, __ATOMIC_ACQUIRE);
+            if (seq & 1)
+            {
+                int16_t event = probe.event;
+                int16_t iParam = probe.iParam;
+                uint32_t beginUs = probe.beginUs;
+                uint32_t budgetUs = probe.budgetUs;
+                uint32_t elapsedUs = clockUs() - beginUs;
+                if (__atomic_load_n(&probe.seq, __ATOMIC_ACQUIRE) == seq && seq != probe.stuckSeq && budgetUs && elapsedUs > budgetUs)
+                {
+                    probe.stuckSeq = seq;
+                    uint32_t backtrace[ARDUPROF_STALL_BACKTRACE_DEPTH];
+                    uint8_t depth = captureBacktrace(probe.task, backtrace, ARDUPROF_STALL_BACKTRACE_DEPTH);
+                    record(StallStuck, probe, event, iParam, elapsedUs, budgetUs, backtrace, depth);
+                }
+                probe.progressTick = now; // a long handler is reported as stuck, not as a queue which stopped draining
+                return;
+            }
+
+            uint32_t dispatched = probe.bus->queueStats().dispatched;
+            if (dispatched != probe.dispatched || queued(probe.bus) == 0)
+            {
+                probe.dispatched = dispatched;
+                probe.progressTick = now;
+                probe.isDrainReported = false;
+                return;
+            }
+            uint32_t waitedMs = (uint32_t)(now - probe.progressTick) * portTICK_PERIOD_MS;
+            if (!probe.isDrainReported && waitedMs >= probe.drainTimeoutMs)
+            {
+                probe.isDrainReported = true;
+                uint32_t backtrace[ARDUPROF_STALL_BACKTRACE_DEPTH];
+                uint8_t depth = captureBacktrace(probe.task, backtrace, ARDUPROF_STALL_BACKTRACE_DEPTH);
+                record(StallNotDraining, probe, probe.event, probe.iParam, waitedMs * 1000, probe.drainTimeoutMs * 1000, backtrace, depth);
+            }
+        }
+
+        static uint16_t queued(MessageQueue *bus)
+        {
+            UBaseType_t count = bus->queueDepth();
+            return count < UINT16_MAX ? (uint16_t)count : UINT16_MAX;
+        }
+
+        void record(StallKind kind, StallProbe &probe, int16_t event, int16_t iParam, uint32_t elapsedUs, uint32_t budgetUs, const uint32_t *backtrace, uint8_t depth)
+        {
+            StallRecord entry = {};
+            entry.kind = kind;
+            entry.depth = depth;
+            entry.event = event;
+            entry.iParam = iParam;
+            entry.timeMs = xTaskGetTickCount() * portTICK_PERIOD_MS;
+            entry.elapsedUs = elapsedUs;
+            entry.budgetUs = budgetUs;
+            entry.queued = queued(probe.bus);
+            memcpy(entry.name, probe.name, ARDUPROF_STALL_NAME_SIZE);
+            if (depth)
+            {
+                memcpy(entry.backtrace, backtrace, depth * sizeof(uint32_t));
+            }
+
+            // a handler over budget at every call folds into one record instead of flushing the ring
+            bool isNew = true;
+            portENTER_CRITICAL(&_mux);
+            StallLog *log = _log;
+            entry.boot = log->boot;
+            if (log->written)
+            {
+                StallRecord &last = log->records[(log->written - 1) % ARDUPROF_STALL_LOG_SIZE];
+                if (last.boot == entry.boot && last.kind == kind && last.event == event && last.iParam == iParam &&
+                    memcmp(last.name, entry.name, ARDUPROF_STALL_NAME_SIZE) == 0)
+                {
+                    isNew = false;
+                    last.timeMs = entry.timeMs;
+                    last.repeats += (last.repeats < UINT16_MAX) ? 1 : 0;
+                    if (elapsedUs > last.elapsedUs)
+                    {
+                        last.elapsedUs = elapsedUs;
+                    }
+                }
+            }
+            if (isNew)
+            {
+                log->records[log->written % ARDUPROF_STALL_LOG_SIZE] = entry;
+                log->written++;
+            }
+            StallCallback callback = _callback;
+            void *arg = _callbackArg;
+            portEXIT_CRITICAL(&_mux);
+
+            if (isNew && callback)
+            {
+                callback(entry, arg);
+            }
+        }
+
+        // PCs of "task" from the frame saved by its last context switch. A running task has no saved
+        // frame: nothing is captured, and each step stays inside the stack of the task
+        static uint8_t captureBacktrace(TaskHandle_t task, uint32_t *backtrace, uint8_t size)
+        {
+#if defined ESP_PLATFORM && (defined __XTENSA__ || defined __riscv)
+            if (task == nullptr || task == xTaskGetCurrentTaskHandle() || eTaskGetState(task) == eRunning)
+            {
+                return 0;
+            }
+            TaskSnapshot_t snapshot = {};
+            vTaskGetSnapshot(task, &snapshot);
+            uint32_t low = (uint32_t)snapshot.pxTopOfStack;
+            uint32_t high = (uint32_t)snapshot.pxEndOfStack;
+            if (low == 0 || high <= low)
+            {
+                return 0;
+            }
+            uint8_t depth = 0;
+#if defined __XTENSA__
+            uint32_t pc, sp, next;
+            XtExcFrame *frame = (XtExcFrame *)snapshot.pxTopOfStack;
+            if (frame->exit) // interrupted
+            {
+                pc = frame->pc;
+                sp = frame->a1;
+                next = frame->a0;
+            }
+            else // yielded
+            {
+                XtSolFrame *solicited = (XtSolFrame *)snapshot.pxTopOfStack;
+                pc = solicited->pc;
+                sp = solicited->a1;
+                next = solicited->a0;
+            }
+            backtrace[depth++] = stackPc(pc);
+            // windowed ABI: the caller's pc and sp sit in the base save area below sp
+            while (depth < size && next != 0 && sp - 16 >= low && sp <= high)
+            {
+                backtrace[depth++] = stackPc(next);
+                next = *(uint32_t *)(sp - 16);
+                sp = *(uint32_t *)(sp - 12);
+            }
+#else
+            RvExcFrame *frame = (RvExcFrame *)snapshot.pxTopOfStack;
+            backtrace[depth++] = frame->mepc;
+            if (depth < size)
+            {
+                backtrace[depth++] = frame->ra; // no frame pointers: the return address only
+            }
+#endif
+            // the task ran meanwhile: the frame may be stale
+            return eTaskGetState(task) == eRunning ? 0 : depth;
+#else
+            (void)task;
+            (void)backtrace;
+            (void)size;
+            return 0;
+#endif
+        }
+
+#if defined ESP_PLATFORM && defined __XTENSA__
+        // a return address holds the window increment in bits 31..30
+        static inline uint32_t stackPc(uint32_t pc)
+        {
+            return (pc & 0x80000000) ? ((pc & 0x3fffffff) | 0x40000000) : pc;
+        }
+#endif
+    };
+
+} // namespace ardufreertos
+
+#endif // ARDUPROF_FREERTOS && ARDUPROF_STALL_WATCHDOG
@@ -0,0 +1,482 @@
+/* Copyright 2024 teamprof.net@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include "./MessageQueue.h"
+
+#ifndef ARDUPROF_SYSTEM_SAMPLER
+#define ARDUPROF_SYSTEM_SAMPLER 1 // per-task, heap and queue sampling, 0 compiles it out
+#endif
+
+#if defined ARDUPROF_FREERTOS && ARDUPROF_SYSTEM_SAMPLER
+
+#ifndef ARDUPROF_SAMPLER_TASKS
+#define ARDUPROF_SAMPLER_TASKS 32 // tasks of the system, none is sampled if there are more
+#endif
+
+#ifndef ARDUPROF_SAMPLER_QUEUES
+#define ARDUPROF_SAMPLER_QUEUES 8 // queues registered by addQueue()
+#endif
+
+#ifndef ARDUPROF_SAMPLER_METRICS
+#define ARDUPROF_SAMPLER_METRICS 8 // metrics registered by addMetric()
+#endif
+
+#ifndef ARDUPROF_SAMPLER_NAME_SIZE
+#define ARDUPROF_SAMPLER_NAME_SIZE 12 // bytes of a task, queue or metric name, with the terminating '\0'
+#endif
+
+#ifndef ARDUPROF_SAMPLER_CORES
+#define ARDUPROF_SAMPLER_CORES 2 // busy shares in a sample
+#endif
+
+#ifndef ARDUPROF_SAMPLER_PERIOD_MS
+#define ARDUPROF_SAMPLER_PERIOD_MS 1000 // default sampling period
+#endif
+
+#ifndef ARDUPROF_SAMPLER_STACK
+#define ARDUPROF_SAMPLER_STACK 3072 // the metric callbacks run on this stack
+#endif
+
+#ifndef ARDUPROF_SAMPLER_PRIORITY
+#define ARDUPROF_SAMPLER_PRIORITY 1 // just above idle: sampling must not delay what it measures
+#endif
+
+#define ARDUPROF_SAMPLE_MAGIC 0x53535041 // "APSS"
+#define ARDUPROF_SAMPLE_VERSION 1
+
+#if defined ESP_PLATFORM
+#include "esp_heap_caps.h"
+#include "esp_idf_version.h"
+#endif
+
+namespace ardufreertos
+{
+    /////////////////////////////////////////////////////////////////////////////
+    // entries of a sample. A snapshot is SampleHeader followed by "tasks" TaskSample,
+    // "queues" QueueSample and "metrics" MetricSample, little-endian and without padding
+    /////////////////////////////////////////////////////////////////////////////
+    typedef struct _TaskSample
+    {
+        char name[ARDUPROF_SAMPLER_NAME_SIZE];
+        uint32_t stackFree; // bytes of stack never used (high-water mark)
+        uint16_t cpu;       // permille of one core over the last period
+        uint8_t priority;
+        uint8_t core; // pinned core, 0xff if the task runs on any core
+    } TaskSample;
+
+    typedef struct _HeapSample
+    {
+        uint32_t free;          // bytes
+        uint32_t minFree;       // lowest "free" since boot
+        uint32_t largest;       // largest free block
+        uint16_t fragmentation; // permille of "free" not in the largest block
+        uint16_t reserved;
+    } HeapSample;
+
+    typedef struct _QueueSample
+    {
+        char name[ARDUPROF_SAMPLER_NAME_SIZE];
+        uint16_t depth;      // messages waiting in all lanes
+        uint16_t highWater;  // QueueStats::highWater
+        uint32_t dispatched; // QueueStats::dispatched
+        uint32_t lost;       // QueueStats::lost()
+    } QueueSample;
+
+    typedef struct _MetricSample
+    {
+        char name[ARDUPROF_SAMPLER_NAME_SIZE];
+        int32_t value;
+    } MetricSample;
+
+    typedef struct _SampleHeader
+    {
+        uint32_t magic;  // ARDUPROF_SAMPLE_MAGIC
+        uint8_t version; // ARDUPROF_SAMPLE_VERSION
+        uint8_t cores;   // valid entries of corePermille, 0 if not measured
+        uint8_t tasks;   // entries which follow the header
+        uint8_t queues;
+        uint8_t metrics;
+        uint8_t nameSize;   // ARDUPROF_SAMPLER_NAME_SIZE
+        uint16_t taskCount; // tasks of the system, above "tasks" if ARDUPROF_SAMPLER_TASKS is too small
+        uint32_t seq;       // samples taken since start()
+        uint32_t timeMs;    // since boot
+        uint32_t periodMs;  // measured interval of the cpu shares
+        uint16_t corePermille[ARDUPROF_SAMPLER_CORES]; // busy share of each core
+        HeapSample heap;
+    } SampleHeader;
+
+    typedef struct _SystemSample
+    {
+        SampleHeader header;
+        TaskSample tasks[ARDUPROF_SAMPLER_TASKS];
+        QueueSample queues[ARDUPROF_SAMPLER_QUEUES];
+        MetricSample metrics[ARDUPROF_SAMPLER_METRICS];
+    } SystemSample;
+
+    // value of a registered metric, called by the sampler task: it must not block
+    typedef int32_t (*SampleMetric)(void *arg);
+
+    /////////////////////////////////////////////////////////////////////////////
+    // Periodic system sampler.
+    // A low-priority task takes a sample every period: stack high-water mark, priority and cpu
+    // share of each task (uxTaskGetSystemState(), needs configUSE_TRACE_FACILITY and
+    // configGENERATE_RUN_TIME_STATS), busy share of each core (1 - share of its idle task,
+    // ESP-IDF only), heap free / minimum / largest block, the depth and counters of registered
+    // queues and the value of registered metrics. The latest sample is read with latest(), or
+    // copied as a compact binary snapshot by snapshot() for a shell command or a TCP peer:
+    //     SystemSampler::instance().addQueue(&queueMain, "QueueMain");
+    //     SystemSampler::instance().addMetric("poolInUse", readPool, &pool);
+    //     SystemSampler::instance().start(1000);
+    /////////////////////////////////////////////////////////////////////////////
+    class SystemSampler
+    {
+    public:
+        static constexpr size_t SnapshotSize = sizeof(SystemSample); // largest snapshot
+
+        static SystemSampler &instance(void)
+        {
+            static SystemSampler sampler;
+            existing() = &sampler;
+            return sampler;
+        }
+        // the sampler if it was ever used, nullptr otherwise
+        static SystemSampler *&existing(void)
+        {
+            static SystemSampler *sampler = nullptr;
+            return sampler;
+        }
+
+        // sample every "periodMs" from now on, starts the sampler task on the first call
+        bool start(uint32_t periodMs = ARDUPROF_SAMPLER_PERIOD_MS)
+        {
+            portENTER_CRITICAL(&_mux);
+            _periodMs = periodMs ? periodMs : ARDUPROF_SAMPLER_PERIOD_MS;
+            bool isStarting = !_isStarted;
+            _isStarted = true;
+            portEXIT_CRITICAL(&_mux);
+
+            if (isStarting && xTaskCreate([](void *instance)
+                                          { static_cast<SystemSampler *>(instance)->run(); },
+                                          "SystemSampler", ARDUPROF_SAMPLER_STACK, this, ARDUPROF_SAMPLER_PRIORITY, nullptr) != pdPASS)
+            {
+                portENTER_CRITICAL(&_mux);
+                _isStarted = false;
+                portEXIT_CRITICAL(&_mux);
+                return false;
+            }
+            return true;
+        }
+
+        // sample the depth and counters of "queue" (a MessageBus as well), false if ARDUPROF_SAMPLER_QUEUES are registered
+        bool addQueue(MessageQueue *queue, const char *name)
+        {
+            bool isAdded = false;
+            portENTER_CRITICAL(&_mux);
+            for (int i = 0; i < ARDUPROF_SAMPLER_QUEUES; i++)
+            {
+                if (_queues[i].queue == nullptr)
+                {
+                    _queues[i].queue = queue;
+                    strncpy(_queues[i].name, name ? name : "", ARDUPROF_SAMPLER_NAME_SIZE - 1);
+                    _queues[i].name[ARDUPROF_SAMPLER_NAME_SIZE - 1] = '\0';
+                    isAdded = true;
+                    break;
+                }
+            }
+            portEXIT_CRITICAL(&_mux);
+            return isAdded;
+        }
+        // before "queue" is destroyed
+        void removeQueue(MessageQueue *queue)
+        {
+            portENTER_CRITICAL(&_mux);
+            for (int i = 0; i < ARDUPROF_SAMPLER_QUEUES; i++)
+            {
+                if (_queues[i].queue == queue)
+                {
+                    _queues[i].queue = nullptr;
+                }
+            }
+            portEXIT_CRITICAL(&_mux);
+        }
+
+        // sample "read(arg)" as metric "name", false if ARDUPROF_SAMPLER_METRICS are registered
+        bool addMetric(const char *name, SampleMetric read, void *arg = nullptr)
+        {
+            bool isAdded = false;
+            portENTER_CRITICAL(&_mux);
+            for (int i = 0; i < ARDUPROF_SAMPLER_METRICS; i++)
+            {
+                if (_metrics[i].read == nullptr)
+                {
+                    _metrics[i].read = read;
+                    _metrics[i].arg = arg;
+                    strncpy(_metrics[i].name, name ? name : "", ARDUPROF_SAMPLER_NAME_SIZE - 1);
+                    _metrics[i].name[ARDUPROF_SAMPLER_NAME_SIZE - 1] = '\0';
+                    isAdded = true;
+                    break;
+                }
+            }
+            portEXIT_CRITICAL(&_mux);
+            return isAdded;
+        }
+
+        // copy of the latest sample, false before the first one
+        bool latest(SystemSample &sample)
+        {
+            portENTER_CRITICAL(&_mux);
+            bool isValid = _latest.header.seq != 0;
+            if (isValid)
+            {
+                sample = _latest;
+            }
+            portEXIT_CRITICAL(&_mux);
+            return isValid;
+        }
+
+        // copy the latest sample to "buffer" as a snapshot, returns its size: 0 before the first
+        // sample or if "size" is too small (SnapshotSize always fits)
+        size_t snapshot(void *buffer, size_t size)
+        {
+            size_t length = 0;
+            portENTER_CRITICAL(&_mux);
+            const SampleHeader &header = _latest.header;
+            size_t tasks = header.tasks * sizeof(TaskSample);
+            size_t queues = header.queues * sizeof(QueueSample);
+            size_t metrics = header.metrics * sizeof(MetricSample);
+            size_t required = sizeof(SampleHeader) + tasks + queues + metrics;
+            if (header.seq != 0 && required <= size)
+            {
+                uint8_t *out = static_cast<uint8_t *>(buffer);
+                memcpy(out, &header, sizeof(SampleHeader));
+                memcpy(out + sizeof(SampleHeader), _latest.tasks, tasks);
+                memcpy(out + sizeof(SampleHeader) + tasks, _latest.queues, queues);
+                memcpy(out + sizeof(SampleHeader) + tasks + queues, _latest.metrics, metrics);
+                length = required;
+            }
+            portEXIT_CRITICAL(&_mux);
+            return length;
+        }
+
+    private:
+        typedef struct _QueueSource
+        {
+            MessageQueue *queue; // nullptr if free
+            char name[ARDUPROF_SAMPLER_NAME_SIZE];
+        } QueueSource;
+
+        typedef struct _MetricSource
+        {
+            SampleMetric read; // nullptr if free
+            void *arg;
+            char name[ARDUPROF_SAMPLER_NAME_SIZE];
+        } MetricSource;
+
+        typedef struct _TaskRunTime
+        {
+            TaskHandle_t task;
+            uint32_t runTime;
+        } TaskRunTime;
+
+        QueueSource _queues[ARDUPROF_SAMPLER_QUEUES];
+        MetricSource _metrics[ARDUPROF_SAMPLER_METRICS];
+        SystemSample _latest;
+        uint32_t _periodMs;
+        bool _isStarted;
+        portMUX_TYPE _mux;
+
+        // sampler task only
+        SystemSample _next;
+#if configUSE_TRACE_FACILITY && configGENERATE_RUN_TIME_STATS
+        TaskStatus_t _status[ARDUPROF_SAMPLER_TASKS];
+        TaskRunTime _runTimes[ARDUPROF_SAMPLER_TASKS]; // of the previous sample
+        uint16_t _runTimeCount;
+        uint32_t _totalRunTime;
+#endif
+        uint32_t _seq;
+
+        SystemSampler() : _queues(), _metrics(), _latest(), _periodMs(ARDUPROF_SAMPLER_PERIOD_MS), _isStarted(false), _next(), _seq(0)
+        {
+            portMUX_INITIALIZE(&_mux);
+#if configUSE_TRACE_FACILITY && configGENERATE_RUN_TIME_STATS
+            _runTimeCount = 0;
+            _totalRunTime = 0;
+#endif
+        }
+
+        void run(void)
+        {
+            MessageTrace::instance().nameTask("SystemSampler");
+            while (true)
+            {
+                sample();
+                portENTER_CRITICAL(&_mux);
+                _latest = _next;
+                uint32_t periodMs = _periodMs;
+                portEXIT_CRITICAL(&_mux);
+                vTaskDelay(pdMS_TO_TICKS(periodMs)); // the cpu shares are over the measured interval
+            }
+        }
+
+        void sample(void)
+        {
+            SampleHeader &header = _next.header;
+            header = {};
+            header.magic = ARDUPROF_SAMPLE_MAGIC;
+            header.version = ARDUPROF_SAMPLE_VERSION;
+            header.nameSize = ARDUPROF_SAMPLER_NAME_SIZE;
+            header.seq = ++_seq;
+            header.timeMs = xTaskGetTickCount() * portTICK_PERIOD_MS;
+            sampleTasks();
+            sampleHeap(header.heap);
+
+            // queues are read in the critical section, removeQueue() cannot overlap
+            portENTER_CRITICAL(&_mux);
+            for (int i = 0; i < ARDUPROF_SAMPLER_QUEUES; i++)
+            {
+                if (_queues[i].queue)
+                {
+                    QueueSample &entry = _next.queues[header.queues++];
+                    const QueueStats &stats = _queues[i].queue->queueStats();
+                    UBaseType_t depth = _queues[i].queue->queueDepth();
+                    memcpy(entry.name, _queues[i].name, ARDUPROF_SAMPLER_NAME_SIZE);
+                    entry.depth = depth < UINT16_MAX ? (uint16_t)depth : UINT16_MAX;
+                    entry.highWater = stats.highWater;
+                    entry.dispatched = stats.dispatched;
+                    entry.lost = stats.lost();
+                }
+            }
+            MetricSource metrics[ARDUPROF_SAMPLER_METRICS];
+            memcpy(metrics, _metrics, sizeof(metrics));
+            portEXIT_CRITICAL(&_mux);
+
+            // outside of the critical section: a metric may take locks of its own
+            for (int i = 0; i < ARDUPROF_SAMPLER_METRICS; i++)
+            {
+                if (metrics[i].read)
+                {
+                    MetricSample &entry = _next.metrics[header.metrics++];
+                    memcpy(entry.name, metrics[i].name, ARDUPROF_SAMPLER_NAME_SIZE);
+                    entry.value = metrics[i].read(metrics[i].arg);
+                }
+            }
+        }
+
+        void sampleTasks(void)
+        {
+            SampleHeader &header = _next.header;
+            header.taskCount = (uint16_t)uxTaskGetNumberOfTasks();
+#if configUSE_TRACE_FACILITY && configGENERATE_RUN_TIME_STATS
+            uint32_t totalRunTime = 0;
+            UBaseType_t count = uxTaskGetSystemState(_status, ARDUPROF_SAMPLER_TASKS, &totalRunTime);
+            uint32_t elapsed = totalRunTime - _totalRunTime; // run-time counter units, us on ESP-IDF and on host
+            bool isPeriodValid = _totalRunTime != 0 && elapsed != 0;
+            header.periodMs = isPeriodValid ? elapsed / 1000 : 0;
+
+            TaskHandle_t idle[ARDUPROF_SAMPLER_CORES] = {};
+#if defined ESP_PLATFORM
+            header.cores = portNUM_PROCESSORS < ARDUPROF_SAMPLER_CORES ? portNUM_PROCESSORS : ARDUPROF_SAMPLER_CORES;
+            for (int core = 0; core < header.cores; core++)
+            {
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 3, 0)
+                idle[core] = xTaskGetIdleTaskHandleForCore(core);
+#else
+                idle[core] = xTaskGetIdleTaskHandleForCPU(core);
+#endif
+                header.corePermille[core] = 1000;
+            }
+#endif
+            for (UBaseType_t i = 0; i < count; i++)
+            {
+                const TaskStatus_t &status = _status[i];
+                uint32_t cpu = 0;
+                if (isPeriodValid)
+                {
+                    uint32_t delta = status.ulRunTimeCounter - previousRunTime(status.xHandle, status.ulRunTimeCounter);
+                    cpu = (uint32_t)((uint64_t)delta * 1000 / elapsed);
+                }
+                for (int core = 0; core < header.cores; core++)
+                {
+                    if (status.xHandle == idle[core])
+                    {
+                        header.corePermille[core] = cpu < 1000 ? (uint16_t)(1000 - cpu) : 0;
+                    }
+                }
+
+                TaskSample &entry = _next.tasks[header.tasks++];
+                strncpy(entry.name, status.pcTaskName ? status.pcTaskName : "", ARDUPROF_SAMPLER_NAME_SIZE - 1);
+                entry.name[ARDUPROF_SAMPLER_NAME_SIZE - 1] = '\0';
+                entry.stackFree = status.usStackHighWaterMark * sizeof(StackType_t);
+                entry.cpu = cpu < UINT16_MAX ? (uint16_t)cpu : UINT16_MAX;
+                entry.priority = status.uxCurrentPriority < UINT8_MAX ? (uint8_t)status.uxCurrentPriority : UINT8_MAX;
+#if configTASKLIST_INCLUDE_COREID
+                entry.core = (status.xCoreID >= 0 && status.xCoreID < portNUM_PROCESSORS) ? (uint8_t)status.xCoreID : 0xff;
+#else
+                entry.core = 0xff;
+#endif
+            }
+
+            // run times of this sample, for the next one
+            for (UBaseType_t i = 0; i < count; i++)
+            {
+                _runTimes[i] = {_status[i].xHandle, _status[i].ulRunTimeCounter};
+            }
+            _runTimeCount = (uint16_t)count;
+            _totalRunTime = totalRunTime;
+#endif
+        }
+
+#if configUSE_TRACE_FACILITY && configGENERATE_RUN_TIME_STATS
+        // run time of "task" at the previous sample, "current" for a task created since
+        uint32_t previousRunTime(TaskHandle_t task, uint32_t current)
+        {
+            for (uint16_t i = 0; i < _runTimeCount; i++)
+            {
+                if (_runTimes[i].task == task)
+                {
+                    return _runTimes[i].runTime;
+                }
+            }
+            return current;
+        }
+#endif
+
+        static void sampleHeap(HeapSample &heap)
+        {
+#if defined ESP_PLATFORM
+            multi_heap_info_t info;
+            heap_caps_get_info(&info, MALLOC_CAP_8BIT);
+            heap.free = info.total_free_bytes;
+            heap.minFree = info.minimum_free_bytes;
+            heap.largest = info.largest_free_block;
+#else
+            heap.free = xPortGetFreeHeapSize(); // 0 on host: not tracked
+            heap.minFree = heap.free;
+            heap.largest = heap.free;
+#endif
+            heap.fragmentation = heap.free ? (uint16_t)(1000 - (uint64_t)heap.largest * 1000 / heap.free) : 0;
+        }
+    };
+
+} // namespace ardufreertos
+
+#endif // ARDUPROF_FREERTOS && ARDUPROF_SYSTEM_SAMPLER
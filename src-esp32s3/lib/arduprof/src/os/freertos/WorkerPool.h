@@ -0,0 +1,381 @@
+/* Copyright 2024 teamprof.net@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#pragma once
+#include <stdint.h>
+#include "../../type/MessageStats.h"
+#include "./MessageQueue.h"
+
+#if defined ARDUPROF_FREERTOS
+
+#ifndef ARDUPROF_WORKER_MAX
+#define ARDUPROF_WORKER_MAX 4 // most workers of one WorkerPool
+#endif
+
+#ifndef ARDUPROF_WORKER_DEQUE_SIZE
+#define ARDUPROF_WORKER_DEQUE_SIZE 16 // jobs per worker deque, power of 2
+#endif
+
+#ifndef ARDUPROF_WORKER_STACK_SIZE
+#define ARDUPROF_WORKER_STACK_SIZE 4096
+#endif
+
+#ifndef ARDUPROF_WORKER_PRIORITY
+#define ARDUPROF_WORKER_PRIORITY 2 // below the MessageBus threads which submit jobs
+#endif
+
+namespace ardufreertos
+{
+    // CPU-heavy job run by a worker, e.g. JSON encode, LED frame rendering, OTA decrypt
+    typedef void (*WorkFunc)(void *arg);
+
+    /////////////////////////////////////////////////////////////////////////////
+    // Work-stealing executor, one worker task pinned per core.
+    // Each worker owns a deque: submit() pushes to the deque of the worker on the core of the caller
+    // (or of the worker itself for nested jobs), the owner pops the newest job, an idle worker steals
+    // the oldest job of another deque. A job may post a "done" message to a MessageQueue, so a
+    // MessageBus handler can offload work and receive the result as a normal message.
+    // submit() is for task context, never from an ISR.
+    /////////////////////////////////////////////////////////////////////////////
+    class WorkerPool
+    {
+    public:
+        WorkerPool() : _workers(),
+                       _workerCount(0),
+                       _idleMask(0),
+                       _rejected(0),
+                       _isStopping(false)
+        {
+            portMUX_INITIALIZE(&_mux);
+            for (int i = 0; i < ARDUPROF_WORKER_MAX; i++)
+            {
+                portMUX_INITIALIZE(&_workers[i].mux);
+            }
+        }
+
+        ~WorkerPool()
+        {
+            stop();
+        }
+
+        // start "count" workers, worker i is pinned to core (i % portNUM_PROCESSORS)
+        bool start(uint8_t count = portNUM_PROCESSORS,
+                   uint32_t stackSize = ARDUPROF_WORKER_STACK_SIZE,
+                   UBaseType_t priority = ARDUPROF_WORKER_PRIORITY,
+                   const char *name = "worker")
+        {
+            configASSERT(_workerCount == 0 && count > 0 && count <= ARDUPROF_WORKER_MAX);
+            _isStopping = false;
+            for (uint8_t i = 0; i < count; i++)
+            {
+                Worker &worker = _workers[i];
+                worker.pool = this;
+                worker.index = i;
+                worker.top = 0;
+                worker.bottom = 0;
+                worker.stats = {};
+                BaseType_t result = xTaskCreatePinnedToCore(
+                    [](void *instance)
+                    {
+                        Worker *worker = static_cast<Worker *>(instance);
+                        worker->pool->run(*worker);
+                    },
+                    name,
+                    stackSize,
+                    &worker,
+                    priority,
+                    &worker.handle,
+                    i % portNUM_PROCESSORS);
+                if (result != pdPASS)
+                {
+                    break;
+                }
+                _workerCount = i + 1;
+            }
+            return _workerCount == count;
+        }
+
+        // run the queued jobs and end the workers, blocks until they are gone
+        void stop(void)
+        {
+            if (_workerCount == 0)
+            {
+                return;
+            }
+            _isStopping = true;
+            for (uint8_t i = 0; i < _workerCount; i++)
+            {
+                if (_workers[i].handle)
+                {
+                    xTaskNotifyGive(_workers[i].handle);
+                }
+            }
+            for (uint8_t i = 0; i < _workerCount; i++)
+            {
+                while (_workers[i].handle)
+                {
+                    vTaskDelay(1);
+                }
+            }
+            _workerCount = 0;
+            _idleMask = 0;
+        }
+
+        // queue "func(arg)", returns false (and counts a rejected job) if the deque is full
+        bool submit(WorkFunc func, void *arg)
+        {
+            Job job = {
+                .func = func,
+                .arg = arg,
+                .doneQueue = nullptr,
+                .done = {},
+            };
+            return push(job);
+        }
+
+        // as above, then post "done" to "doneQueue" (normal lane) once func(arg) returned
+        bool submit(WorkFunc func, void *arg, MessageQueue *doneQueue, const Message &done)
+        {
+            Job job = {
+                .func = func,
+                .arg = arg,
+                .doneQueue = doneQueue,
+                .done = done,
+            };
+            return push(job);
+        }
+        bool submit(WorkFunc func, void *arg, MessageQueue *doneQueue, int16_t event, int16_t iParam = 0, uint16_t uParam = 0, uint32_t lParam = 0L)
+        {
+            Message done = {
+                .event = event,
+                .iParam = iParam,
+                .uParam = uParam,
+                .lParam = lParam,
+            };
+            return submit(func, arg, doneQueue, done);
+        }
+
+        uint8_t workerCount(void)
+        {
+            return _workerCount;
+        }
+
+        const WorkerStats &stats(uint8_t worker)
+        {
+            configASSERT(worker < ARDUPROF_WORKER_MAX);
+            return _workers[worker].stats;
+        }
+
+        // jobs refused by submit() because the deque was full
+        uint32_t rejected(void)
+        {
+            return _rejected;
+        }
+
+        void resetStats(void)
+        {
+            for (uint8_t i = 0; i < _workerCount; i++)
+            {
+                _workers[i].stats.resetCounters();
+            }
+            _rejected = 0;
+        }
+
+    private:
+        typedef struct _Job
+        {
+            WorkFunc func;
+            void *arg;
+            MessageQueue *doneQueue; // nullptr: no completion message
+            Message done;
+        } Job;
+
+        // ring of jobs: the owner pushes and pops at "bottom", thieves take from "top"
+        typedef struct _Worker
+        {
+            WorkerPool *pool;
+            TaskHandle_t handle;
+            uint8_t index;
+            portMUX_TYPE mux;
+            uint16_t top;
+            uint16_t bottom;
+            Job jobs[ARDUPROF_WORKER_DEQUE_SIZE];
+            WorkerStats stats;
+        } Worker;
+
+        portMUX_TYPE _mux; // guards _idleMask
+        Worker _workers[ARDUPROF_WORKER_MAX];
+        uint8_t _workerCount;
+        uint32_t _idleMask; // bit i: worker i waits for a job
+        volatile uint32_t _rejected;
+        volatile bool _isStopping;
+
+        static_assert((ARDUPROF_WORKER_DEQUE_SIZE & (ARDUPROF_WORKER_DEQUE_SIZE - 1)) == 0, "ARDUPROF_WORKER_DEQUE_SIZE must be a power of 2");
+
+        // the worker running the caller, or the worker pinned to the core of the caller
+        int ownerIndex(void)
+        {
+            TaskHandle_t self = xTaskGetCurrentTaskHandle();
+            for (uint8_t i = 0; i < _workerCount; i++)
+            {
+                if (_workers[i].handle == self)
+                {
+                    return i;
+                }
+            }
+            return xPortGetCoreID() % _workerCount;
+        }
+
+        bool push(const Job &job)
+        {
+            if (_workerCount == 0 || job.func == nullptr)
+            {
+                return false;
+            }
+            int index = ownerIndex();
+            Worker &worker = _workers[index];
+
+            bool isPushed = false;
+            portENTER_CRITICAL(&worker.mux);
+            uint16_t depth = worker.bottom - worker.top;
+            if (depth < ARDUPROF_WORKER_DEQUE_SIZE)
+            {
+                worker.jobs[worker.bottom & (ARDUPROF_WORKER_DEQUE_SIZE - 1)] = job;
+                worker.bottom++;
+                isPushed = true;
+                if (depth + 1 > worker.stats.highWater)
+                {
+                    worker.stats.highWater = depth + 1;
+                }
+            }
+            portEXIT_CRITICAL(&worker.mux);
+
+            if (!isPushed)
+            {
+                _rejected = _rejected + 1; // C++20 deprecates ++ on volatile
+                return false;
+            }
+
+            // the owner always gets a (counting) notification, so its job is never missed;
+            // one idle worker is woken as well to steal it if the owner is busy
+            xTaskNotifyGive(worker.handle);
+            portENTER_CRITICAL(&_mux);
+            uint32_t idle = _idleMask & ~(1UL << index);
+            int thief = idle ? __builtin_ctz(idle) : -1;
+            if (thief >= 0)
+            {
+                _idleMask &= ~(1UL << thief);
+            }
+            portEXIT_CRITICAL(&_mux);
+            if (thief >= 0)
+            {
+                xTaskNotifyGive(_workers[thief].handle);
+            }
+            return true;
+        }
+
+        // owner side: newest job first, it is most likely still in cache
+        bool popLocal(Worker &worker, Job &job)
+        {
+            bool isPopped = false;
+            portENTER_CRITICAL(&worker.mux);
+            if (worker.bottom != worker.top)
+            {
+                worker.bottom--;
+                job = worker.jobs[worker.bottom & (ARDUPROF_WORKER_DEQUE_SIZE - 1)];
+                isPopped = true;
+            }
+            portEXIT_CRITICAL(&worker.mux);
+            return isPopped;
+        }
+
+        // thief side: oldest job of the first other worker which has one
+        bool steal(Worker &thief, Job &job)
+        {
+            for (uint8_t n = 1; n < _workerCount; n++)
+            {
+                Worker &victim = _workers[(thief.index + n) % _workerCount];
+                bool isStolen = false;
+                portENTER_CRITICAL(&victim.mux);
+                if (victim.bottom != victim.top)
+                {
+                    job = victim.jobs[victim.top & (ARDUPROF_WORKER_DEQUE_SIZE - 1)];
+                    victim.top++;
+                    isStolen = true;
+                }
+                portEXIT_CRITICAL(&victim.mux);
+                if (isStolen)
+                {
+                    thief.stats.stolen++;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void setIdle(Worker &worker, bool isIdle)
+        {
+            portENTER_CRITICAL(&_mux);
+            if (isIdle)
+            {
+                _idleMask |= 1UL << worker.index;
+            }
+            else
+            {
+                _idleMask &= ~(1UL << worker.index);
+            }
+            portEXIT_CRITICAL(&_mux);
+        }
+
+        void run(Worker &worker)
+        {
+            while (true)
+            {
+                Job job;
+                if (popLocal(worker, job) || steal(worker, job))
+                {
+                    job.func(job.arg);
+                    worker.stats.executed++;
+                    if (job.doneQueue)
+                    {
+                        QueueItem item = {
+                            .msg = job.done,
+                            .postUs = clockUs(),
+                        };
+                        job.doneQueue->postItem(job.doneQueue, PriorityNormal, item, portMAX_DELAY);
+                    }
+                    continue;
+                }
+                if (_isStopping)
+                {
+                    break;
+                }
+                setIdle(worker, true);
+                ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+                setIdle(worker, false);
+            }
+            setIdle(worker, false);
+            worker.handle = nullptr;
+            vTaskDelete(nullptr);
+        }
+    };
+
+} // namespace ardufreertos
+
+#endif // ARDUPROF_FREERTOS
@@ -0,0 +1,99 @@
+/* Copyright 2024 teamprof.net@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "./ThreadBase.h"
+
+#if defined ARDUPROF_FREERTOS
+
+namespace ardufreertos
+{
+#if defined ARDUPROF_REPORT_STATIC_RAM
+    // build with -DARDUPROF_REPORT_STATIC_RAM: each StaticThread in use prints a deprecation warning
+    // whose template arguments are its static RAM (queue, stack + TCB, total bytes)
+    template <size_t QueueBytes, size_t TaskBytes, size_t TotalBytes>
+    [[deprecated("ARDUPROF_REPORT_STATIC_RAM: static RAM of a StaticThread in the template arguments")]] inline void reportStaticRam(void)
+    {
+    }
+#endif
+
+    // storage of a StaticThread. A base class, not members, so it exists before ThreadBase creates the queue
+    template <uint16_t QueueLength, uint32_t StackBytes>
+    struct StaticThreadStorage
+    {
+        uint8_t _queueStorage[QueueLength * sizeof(QueueItem)];
+        StaticQueue_t _queueBuffer;
+        StackType_t _stack[StackBytes / sizeof(StackType_t)];
+        StaticTask_t _taskBuffer;
+    };
+
+    /////////////////////////////////////////////////////////////////////////////
+    // ThreadBase which owns its queue storage, stack and TCB, sized at compile time.
+    // The queue is created once by the constructor and the task once by createTask(), without heap.
+    // StackBytes is in bytes as on ESP-IDF; "StaticRamBytes" is the footprint of the owned storage.
+    /////////////////////////////////////////////////////////////////////////////
+    template <uint16_t QueueLength, uint32_t StackBytes>
+    class StaticThread : private StaticThreadStorage<QueueLength, StackBytes>, public ThreadBase
+    {
+        typedef StaticThreadStorage<QueueLength, StackBytes> Storage;
+
+        static_assert(QueueLength > 0, "StaticThread: QueueLength must not be 0");
+        static_assert(StackBytes >= configMINIMAL_STACK_SIZE * sizeof(StackType_t), "StaticThread: StackBytes below configMINIMAL_STACK_SIZE");
+
+    public:
+        static constexpr size_t QueueBytes = sizeof(Storage::_queueStorage) + sizeof(StaticQueue_t);
+        static constexpr size_t TaskBytes = sizeof(Storage::_stack) + sizeof(StaticTask_t);
+        static constexpr size_t StaticRamBytes = sizeof(Storage);
+
+        StaticThread() : ThreadBase(QueueLength, this->_queueStorage, &this->_queueBuffer)
+        {
+#if defined ARDUPROF_REPORT_STATIC_RAM
+            reportStaticRam<QueueBytes, TaskBytes, StaticRamBytes>();
+#endif
+        }
+
+    protected:
+        // create the task running run(), typically from start(); returns false if it already exists
+        bool createTask(const char *name, UBaseType_t priority, BaseType_t coreId = tskNO_AFFINITY)
+        {
+            if (_taskHandle)
+            {
+                return false;
+            }
+            setTraceName(name);
+            _taskHandle = xTaskCreateStaticPinnedToCore(
+                [](void *instance)
+                { static_cast<ThreadBase *>(instance)->run(); },
+                name,
+                StackBytes / sizeof(StackType_t), // bytes on ESP-IDF, words on other FreeRTOS ports
+                static_cast<ThreadBase *>(this),  // ThreadBase is not the first base class
+                priority,
+                this->_stack,
+                &this->_taskBuffer,
+                coreId);
+            configASSERT(_taskHandle != NULL);
+            return _taskHandle != nullptr;
+        }
+    };
+
+} // namespace ardufreertos
+
+#endif // ARDUPROF_FREERTOS
@@ -25,6 +25,13 @@
 
 #if defined ARDUPROF_FREERTOS
 
+// reserved event: calls delayInit() on the thread itself
+#define ARDUPROF_EVENT_DELAY_INIT (INT16_MIN + 1)
+
+#ifndef ARDUPROF_DELAY_INIT_MS
+#define ARDUPROF_DELAY_INIT_MS 200 // delay between setup() and delayInit()
+#endif
+
 namespace ardufreertos
 {
     class ThreadBase : public MessageBus
@@ -34,18 +41,14 @@ namespace ardufreertos
                    uint8_t *pucQueueStorageBuffer = nullptr,
                    StaticQueue_t *pxQueueBuffer = nullptr) : MessageBus(queueLength, pucQueueStorageBuffer, pxQueueBuffer),
                                                              _taskHandle(nullptr)
+        {
+            // the queue is created by MessageQueue
+        }
 
+        ThreadBase(MessageRing *ring) : MessageBus(ring),
+                                        _taskHandle(nullptr)
         {
-            if (pucQueueStorageBuffer != nullptr && pxQueueBuffer != nullptr)
-            {
-                _queue = xQueueCreateStatic(queueLength, sizeof(Message), pucQueueStorageBuffer, pxQueueBuffer);
-            }
-            else
-            {
-                _queue = xQueueCreate(queueLength, sizeof(Message));
-            }
-            configASSERT(_queue != NULL);
-        };
+        }
 
         virtual void start(void *ctx)
         {
@@ -64,22 +67,25 @@ namespace ardufreertos
         }
 
     protected:
+        // delayInit() runs in this thread ARDUPROF_DELAY_INIT_MS after setup(), as a scheduled message.
+        // A ring backed thread only accepts messages from its ISR: it calls delayInit() right away
         virtual void setup(void)
         {
-            BaseType_t result = xTimerPendFunctionCall(
-                [](void *param1, uint32_t param2)
-                {
-                    // LOG_TRACE("xTimerPendFunctionCall()");
-                    static_cast<ThreadBase *>(param1)->delayInit();
-                },
-                this,        // param1
-                (uint32_t)0, // param2
-                pdMS_TO_TICKS(200));
-            UNUSED(result);
-            // LOG_TRACE("xTimerPendFunctionCall() returns ", result);
+            if (_ring || postEventDelayed(ARDUPROF_DELAY_INIT_MS, ARDUPROF_EVENT_DELAY_INIT) == 0)
+            {
+                delayInit();
+            }
         }
         virtual void delayInit(void) {}
 
+        virtual void onReservedMessage(const Message &msg)
+        {
+            if (msg.event == ARDUPROF_EVENT_DELAY_INIT)
+            {
+                delayInit();
+            }
+        }
+
         TaskHandle_t _taskHandle;
     };
 
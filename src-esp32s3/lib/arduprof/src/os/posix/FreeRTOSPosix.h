@@ -0,0 +1,1146 @@
+/* Copyright 2024 teamprof.net@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#pragma once
+/////////////////////////////////////////////////////////////////////////////
+// FreeRTOS API subset on POSIX threads (host backend)
+//
+// Lets the ardufreertos classes (MessageQueue, MessageBus, ThreadBase,
+// SoftwareTimer, PeriodicTimer) build and run unchanged on Linux, so event
+// flow can be measured off-device. Select it by defining ARDUPROF_POSIX
+// before including ArduProf.h.
+//
+// Mapping:
+//   tick              1 ms (configTICK_RATE_HZ = 1000), CLOCK_MONOTONIC
+//   task              detached pthread, priority and core are recorded only
+//   run-time stats    thread CPU time against CLOCK_MONOTONIC, in us
+//   queue / queue set mutex + condition variables, FIFO ring of fixed items
+//   task notification per-task value/state guarded by a condition variable
+//   software timer    one timer service thread, like the FreeRTOS daemon task
+//   critical section  portMUX_TYPE is a recursive mutex
+//   ISR context       a thread marks itself with PosixIsrScope
+/////////////////////////////////////////////////////////////////////////////
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/////////////////////////////////////////////////////////////////////////////
+// types and constants
+/////////////////////////////////////////////////////////////////////////////
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+typedef uint32_t TickType_t;
+typedef uint8_t StackType_t; // stack depth in bytes, as on ESP-IDF
+
+#define pdFALSE ((BaseType_t)0)
+#define pdTRUE ((BaseType_t)1)
+#define pdPASS (pdTRUE)
+#define pdFAIL (pdFALSE)
+#define errQUEUE_EMPTY ((BaseType_t)0)
+#define errQUEUE_FULL ((BaseType_t)0)
+
+#define portMAX_DELAY ((TickType_t)0xffffffffUL)
+#define configTICK_RATE_HZ 1000
+#define portTICK_PERIOD_MS ((TickType_t)1000 / configTICK_RATE_HZ)
+#define pdMS_TO_TICKS(xTimeInMs) ((TickType_t)(((uint64_t)(xTimeInMs) * (uint64_t)configTICK_RATE_HZ) / (uint64_t)1000U))
+#define pdTICKS_TO_MS(xTicks) ((TickType_t)(((uint64_t)(xTicks) * (uint64_t)1000U) / (uint64_t)configTICK_RATE_HZ))
+#define configMAX_PRIORITIES 25
+#define configMINIMAL_STACK_SIZE 768 // as ESP-IDF, in bytes
+#define tskNO_AFFINITY ((BaseType_t)0x7FFFFFFF)
+#define configUSE_TRACE_FACILITY 1       // uxTaskGetSystemState()
+#define configGENERATE_RUN_TIME_STATS 1  // TaskStatus_t::ulRunTimeCounter
+#define configTASKLIST_INCLUDE_COREID 1 // TaskStatus_t::xCoreID, the core a task is pinned to
+
+#define configASSERT(x) assert(x)
+
+typedef struct QueueDefinition *QueueHandle_t;
+typedef struct QueueDefinition *QueueSetHandle_t;
+typedef struct QueueDefinition *QueueSetMemberHandle_t;
+typedef struct tskTaskControlBlock *TaskHandle_t;
+typedef struct tmrTimerControl *TimerHandle_t;
+
+typedef void (*TaskFunction_t)(void *);
+typedef void (*TimerCallbackFunction_t)(TimerHandle_t xTimer);
+typedef void (*PendedFunction_t)(void *, uint32_t);
+
+// control blocks are allocated on the heap, static buffers only keep the API shape
+typedef struct
+{
+    void *dummy[4];
+} StaticQueue_t;
+typedef struct
+{
+    void *dummy[4];
+} StaticTask_t;
+
+typedef enum
+{
+    eNoAction = 0,
+    eSetBits,
+    eIncrement,
+    eSetValueWithOverwrite,
+    eSetValueWithoutOverwrite
+} eNotifyAction;
+
+typedef enum
+{
+    eRunning = 0,
+    eReady,
+    eBlocked,
+    eSuspended,
+    eDeleted,
+    eInvalid
+} eTaskState;
+
+typedef struct xTASK_STATUS
+{
+    TaskHandle_t xHandle;
+    const char *pcTaskName;
+    UBaseType_t xTaskNumber;
+    eTaskState eCurrentState;        // eReady on host: the state of a thread is not known
+    UBaseType_t uxCurrentPriority;
+    UBaseType_t uxBasePriority;
+    uint32_t ulRunTimeCounter;       // CPU time of the thread, us
+    StackType_t *pxStackBase;
+    uint32_t usStackHighWaterMark;   // stack depth: not measured on host
+    BaseType_t xCoreID;
+} TaskStatus_t;
+
+/////////////////////////////////////////////////////////////////////////////
+// internals
+/////////////////////////////////////////////////////////////////////////////
+namespace ardufreertos
+{
+    namespace posix
+    {
+        inline uint64_t monotonicUs(void)
+        {
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000ULL;
+        }
+
+        inline uint64_t startUs(void)
+        {
+            static const uint64_t us = monotonicUs();
+            return us;
+        }
+
+        inline TickType_t tickCount(void)
+        {
+            uint64_t start = startUs(); // first call must latch the start before reading the clock
+            return (TickType_t)((monotonicUs() - start) / (1000000ULL / configTICK_RATE_HZ));
+        }
+
+        // absolute CLOCK_MONOTONIC deadline "ticks" from now
+        inline struct timespec deadline(TickType_t ticks)
+        {
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            uint64_t ns = (uint64_t)pdTICKS_TO_MS(ticks) * 1000000ULL;
+            ts.tv_sec += (time_t)(ns / 1000000000ULL);
+            ts.tv_nsec += (long)(ns % 1000000000ULL);
+            if (ts.tv_nsec >= 1000000000L)
+            {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000L;
+            }
+            return ts;
+        }
+
+        inline void condInit(pthread_cond_t *cond)
+        {
+            pthread_condattr_t attr;
+            pthread_condattr_init(&attr);
+            pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+            pthread_cond_init(cond, &attr);
+            pthread_condattr_destroy(&attr);
+        }
+
+        // wait on "cond" until "ready()" or timeout; mutex must be held. returns ready()
+        template <typename Pred>
+        inline bool condWait(pthread_cond_t *cond, pthread_mutex_t *mutex, TickType_t ticks, Pred ready)
+        {
+            if (ticks == portMAX_DELAY)
+            {
+                while (!ready())
+                {
+                    pthread_cond_wait(cond, mutex);
+                }
+                return true;
+            }
+            if (ticks == 0)
+            {
+                return ready();
+            }
+            struct timespec ts = deadline(ticks);
+            while (!ready())
+            {
+                if (pthread_cond_timedwait(cond, mutex, &ts) == ETIMEDOUT)
+                {
+                    return ready();
+                }
+            }
+            return true;
+        }
+
+        inline bool &isrContext(void)
+        {
+            static thread_local bool isr = false;
+            return isr;
+        }
+    } // namespace posix
+} // namespace ardufreertos
+
+// marks the calling thread as interrupt context while in scope (ISR simulation)
+class PosixIsrScope
+{
+public:
+    PosixIsrScope()
+    {
+        ardufreertos::posix::isrContext() = true;
+    }
+    ~PosixIsrScope()
+    {
+        ardufreertos::posix::isrContext() = false;
+    }
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// critical section
+/////////////////////////////////////////////////////////////////////////////
+typedef struct
+{
+    pthread_mutex_t mutex;
+} portMUX_TYPE;
+
+inline void vPortMuxInitialize(portMUX_TYPE *mux)
+{
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&mux->mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+#define portMUX_INITIALIZER_UNLOCKED {PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP}
+#define portMUX_INITIALIZE(mux) vPortMuxInitialize(mux)
+#define portENTER_CRITICAL(mux) pthread_mutex_lock(&(mux)->mutex)
+#define portEXIT_CRITICAL(mux) pthread_mutex_unlock(&(mux)->mutex)
+#define portENTER_CRITICAL_ISR(mux) portENTER_CRITICAL(mux)
+#define portEXIT_CRITICAL_ISR(mux) portEXIT_CRITICAL(mux)
+#define portENTER_CRITICAL_SAFE(mux) portENTER_CRITICAL(mux)
+#define portEXIT_CRITICAL_SAFE(mux) portEXIT_CRITICAL(mux)
+#define taskENTER_CRITICAL(mux) portENTER_CRITICAL(mux)
+#define taskEXIT_CRITICAL(mux) portEXIT_CRITICAL(mux)
+#define taskENTER_CRITICAL_ISR(mux) portENTER_CRITICAL(mux)
+#define taskEXIT_CRITICAL_ISR(mux) portEXIT_CRITICAL(mux)
+
+inline BaseType_t xPortInIsrContext(void)
+{
+    return ardufreertos::posix::isrContext() ? pdTRUE : pdFALSE;
+}
+#define xPortIsInsideInterrupt() xPortInIsrContext()
+
+// the host scheduler preempts by itself: yield requests are hints only
+#define portYIELD() sched_yield()
+#define portYIELD_FROM_ISR(...) ((void)0)
+#define portEND_SWITCHING_ISR(x) ((void)(x))
+
+#ifndef portNUM_PROCESSORS
+#define portNUM_PROCESSORS 2 // as the dual-core ESP32-S3, pinning to a core is ignored on the host
+#endif
+
+inline BaseType_t xPortGetCoreID(void)
+{
+    int cpu = sched_getcpu();
+    return cpu < 0 ? 0 : cpu;
+}
+
+inline size_t xPortGetFreeHeapSize(void)
+{
+    return 0; // not tracked on host
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// task
+/////////////////////////////////////////////////////////////////////////////
+struct tskTaskControlBlock
+{
+    pthread_t thread;
+    TaskFunction_t function;
+    void *param;
+    char name[16];
+    UBaseType_t priority;
+    uint32_t stackDepth;
+    BaseType_t coreID;
+    UBaseType_t number;
+    tskTaskControlBlock *next; // list of live tasks, for uxTaskGetSystemState()
+
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    uint32_t notifyValue;
+    bool notifyPending;
+};
+
+namespace ardufreertos
+{
+    namespace posix
+    {
+        inline TaskHandle_t &currentTask(void)
+        {
+            static thread_local TaskHandle_t task = nullptr;
+            return task;
+        }
+
+        // live tasks, guarded by taskListMutex()
+        inline TaskHandle_t &taskList(void)
+        {
+            static TaskHandle_t list = nullptr;
+            return list;
+        }
+        inline pthread_mutex_t *taskListMutex(void)
+        {
+            static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+            return &mutex;
+        }
+
+        inline void addTask(TaskHandle_t task)
+        {
+            static UBaseType_t number = 0;
+            pthread_mutex_lock(taskListMutex());
+            task->number = ++number;
+            task->next = taskList();
+            taskList() = task;
+            pthread_mutex_unlock(taskListMutex());
+        }
+        inline void removeTask(TaskHandle_t task)
+        {
+            pthread_mutex_lock(taskListMutex());
+            for (TaskHandle_t *link = &taskList(); *link; link = &(*link)->next)
+            {
+                if (*link == task)
+                {
+                    *link = task->next;
+                    break;
+                }
+            }
+            pthread_mutex_unlock(taskListMutex());
+        }
+
+        inline TaskHandle_t newTask(TaskFunction_t function, const char *name, uint32_t stackDepth, void *param, UBaseType_t priority, BaseType_t coreID)
+        {
+            TaskHandle_t task = new tskTaskControlBlock();
+            task->function = function;
+            task->param = param;
+            strncpy(task->name, name ? name : "", sizeof(task->name) - 1);
+            task->priority = priority;
+            task->stackDepth = stackDepth;
+            task->coreID = coreID;
+            pthread_mutex_init(&task->mutex, nullptr);
+            condInit(&task->cond);
+            task->notifyValue = 0;
+            task->notifyPending = false;
+            return task;
+        }
+
+        // a thread not created by xTaskCreate (e.g. main) gets a control block on first use
+        inline TaskHandle_t selfTask(void)
+        {
+            TaskHandle_t &task = currentTask();
+            if (!task)
+            {
+                task = newTask(nullptr, "main", 0, nullptr, 1, tskNO_AFFINITY);
+                task->thread = pthread_self();
+                addTask(task);
+                // leaves the list when the thread exits
+                struct Adopted
+                {
+                    TaskHandle_t task;
+                    ~Adopted() { removeTask(task); }
+                };
+                static thread_local Adopted adopted = {task};
+            }
+            return task;
+        }
+
+        inline void *taskEntry(void *arg)
+        {
+            TaskHandle_t task = static_cast<TaskHandle_t>(arg);
+            currentTask() = task;
+            pthread_setname_np(pthread_self(), task->name);
+            // leaves the list on return, vTaskDelete(NULL) and cancellation alike
+            pthread_cleanup_push([](void *arg)
+                                 { removeTask(static_cast<TaskHandle_t>(arg)); },
+                                 task);
+            task->function(task->param);
+            pthread_cleanup_pop(1);
+            return nullptr;
+        }
+
+        inline BaseType_t startTask(TaskFunction_t function, const char *name, uint32_t stackDepth, void *param,
+                                    UBaseType_t priority, TaskHandle_t *created, BaseType_t coreID = tskNO_AFFINITY)
+        {
+            TaskHandle_t task = newTask(function, name, stackDepth, param, priority, coreID);
+            if (created)
+            {
+                *created = task; // published before the task runs, as FreeRTOS does
+            }
+            pthread_attr_t attr;
+            pthread_attr_init(&attr);
+            pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+            addTask(task); // before the thread runs, so that its cleanup finds it
+            int err = pthread_create(&task->thread, &attr, taskEntry, task);
+            pthread_attr_destroy(&attr);
+            if (err)
+            {
+                removeTask(task);
+                if (created)
+                {
+                    *created = nullptr;
+                }
+                delete task;
+                return pdFAIL;
+            }
+            return pdPASS;
+        }
+    } // namespace posix
+} // namespace ardufreertos
+
+inline BaseType_t xTaskCreate(TaskFunction_t pxTaskCode, const char *pcName, uint32_t usStackDepth, void *pvParameters,
+                              UBaseType_t uxPriority, TaskHandle_t *pxCreatedTask)
+{
+    return ardufreertos::posix::startTask(pxTaskCode, pcName, usStackDepth, pvParameters, uxPriority, pxCreatedTask);
+}
+
+inline BaseType_t xTaskCreatePinnedToCore(TaskFunction_t pxTaskCode, const char *pcName, uint32_t usStackDepth, void *pvParameters,
+                                          UBaseType_t uxPriority, TaskHandle_t *pxCreatedTask, BaseType_t xCoreID)
+{
+    return ardufreertos::posix::startTask(pxTaskCode, pcName, usStackDepth, pvParameters, uxPriority, pxCreatedTask, xCoreID);
+}
+
+inline TaskHandle_t xTaskCreateStaticPinnedToCore(TaskFunction_t pxTaskCode, const char *pcName, uint32_t ulStackDepth, void *pvParameters,
+                                                  UBaseType_t uxPriority, StackType_t *puxStackBuffer, StaticTask_t *pxTaskBuffer, BaseType_t xCoreID)
+{
+    (void)puxStackBuffer;
+    (void)pxTaskBuffer;
+    TaskHandle_t task = nullptr;
+    ardufreertos::posix::startTask(pxTaskCode, pcName, ulStackDepth, pvParameters, uxPriority, &task, xCoreID);
+    return task;
+}
+
+inline TaskHandle_t xTaskCreateStatic(TaskFunction_t pxTaskCode, const char *pcName, uint32_t ulStackDepth, void *pvParameters,
+                                      UBaseType_t uxPriority, StackType_t *puxStackBuffer, StaticTask_t *pxTaskBuffer)
+{
+    return xTaskCreateStaticPinnedToCore(pxTaskCode, pcName, ulStackDepth, pvParameters, uxPriority, puxStackBuffer, pxTaskBuffer, tskNO_AFFINITY);
+}
+
+inline TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return ardufreertos::posix::selfTask();
+}
+
+inline void vTaskDelete(TaskHandle_t xTaskToDelete)
+{
+    if (xTaskToDelete == nullptr || xTaskToDelete == ardufreertos::posix::currentTask())
+    {
+        pthread_exit(nullptr);
+    }
+    pthread_cancel(xTaskToDelete->thread);
+}
+
+inline void vTaskDelay(const TickType_t xTicksToDelay)
+{
+    uint64_t us = (uint64_t)pdTICKS_TO_MS(xTicksToDelay) * 1000ULL;
+    struct timespec ts = {(time_t)(us / 1000000ULL), (long)(us % 1000000ULL) * 1000L};
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR)
+    {
+    }
+}
+
+inline TickType_t xTaskGetTickCount(void)
+{
+    return ardufreertos::posix::tickCount();
+}
+inline TickType_t xTaskGetTickCountFromISR(void)
+{
+    return ardufreertos::posix::tickCount();
+}
+
+inline UBaseType_t uxTaskPriorityGet(TaskHandle_t xTask)
+{
+    return (xTask ? xTask : ardufreertos::posix::selfTask())->priority;
+}
+
+inline UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t xTask)
+{
+    return (xTask ? xTask : ardufreertos::posix::selfTask())->stackDepth; // not measured on host
+}
+
+inline char *pcTaskGetName(TaskHandle_t xTaskToQuery)
+{
+    return (xTaskToQuery ? xTaskToQuery : ardufreertos::posix::selfTask())->name;
+}
+
+inline UBaseType_t uxTaskGetNumberOfTasks(void)
+{
+    UBaseType_t count = 0;
+    pthread_mutex_lock(ardufreertos::posix::taskListMutex());
+    for (TaskHandle_t task = ardufreertos::posix::taskList(); task; task = task->next)
+    {
+        count++;
+    }
+    pthread_mutex_unlock(ardufreertos::posix::taskListMutex());
+    return count;
+}
+
+// as FreeRTOS, fills nothing and returns 0 if "uxArraySize" is below the number of tasks
+inline UBaseType_t uxTaskGetSystemState(TaskStatus_t *const pxTaskStatusArray, const UBaseType_t uxArraySize, uint32_t *const pulTotalRunTime)
+{
+    UBaseType_t count = 0;
+    pthread_mutex_lock(ardufreertos::posix::taskListMutex());
+    for (TaskHandle_t task = ardufreertos::posix::taskList(); task; task = task->next)
+    {
+        count++;
+    }
+    if (count > uxArraySize)
+    {
+        count = 0;
+    }
+    else
+    {
+        TaskStatus_t *status = pxTaskStatusArray;
+        for (TaskHandle_t task = ardufreertos::posix::taskList(); task; task = task->next, status++)
+        {
+            clockid_t clock;
+            struct timespec ts = {};
+            if (pthread_getcpuclockid(task->thread, &clock) == 0)
+            {
+                clock_gettime(clock, &ts);
+            }
+            *status = {};
+            status->xHandle = task;
+            status->pcTaskName = task->name;
+            status->xTaskNumber = task->number;
+            status->eCurrentState = (task == ardufreertos::posix::currentTask()) ? eRunning : eReady;
+            status->uxCurrentPriority = task->priority;
+            status->uxBasePriority = task->priority;
+            status->ulRunTimeCounter = (uint32_t)((uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000ULL);
+            status->usStackHighWaterMark = task->stackDepth;
+            status->xCoreID = task->coreID;
+        }
+    }
+    pthread_mutex_unlock(ardufreertos::posix::taskListMutex());
+    if (pulTotalRunTime)
+    {
+        *pulTotalRunTime = (uint32_t)ardufreertos::posix::monotonicUs();
+    }
+    return count;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// task notification
+/////////////////////////////////////////////////////////////////////////////
+inline BaseType_t xTaskNotify(TaskHandle_t xTaskToNotify, uint32_t ulValue, eNotifyAction eAction)
+{
+    BaseType_t result = pdPASS;
+    pthread_mutex_lock(&xTaskToNotify->mutex);
+    switch (eAction)
+    {
+    case eSetBits:
+        xTaskToNotify->notifyValue |= ulValue;
+        break;
+    case eIncrement:
+        xTaskToNotify->notifyValue++;
+        break;
+    case eSetValueWithOverwrite:
+        xTaskToNotify->notifyValue = ulValue;
+        break;
+    case eSetValueWithoutOverwrite:
+        if (xTaskToNotify->notifyPending)
+        {
+            result = pdFAIL;
+        }
+        else
+        {
+            xTaskToNotify->notifyValue = ulValue;
+        }
+        break;
+    case eNoAction:
+    default:
+        break;
+    }
+    if (result == pdPASS)
+    {
+        xTaskToNotify->notifyPending = true;
+        pthread_cond_signal(&xTaskToNotify->cond);
+    }
+    pthread_mutex_unlock(&xTaskToNotify->mutex);
+    return result;
+}
+
+inline BaseType_t xTaskNotifyFromISR(TaskHandle_t xTaskToNotify, uint32_t ulValue, eNotifyAction eAction, BaseType_t *pxHigherPriorityTaskWoken)
+{
+    if (pxHigherPriorityTaskWoken)
+    {
+        *pxHigherPriorityTaskWoken = pdTRUE;
+    }
+    return xTaskNotify(xTaskToNotify, ulValue, eAction);
+}
+
+#define xTaskNotifyGive(xTaskToNotify) xTaskNotify((xTaskToNotify), 0, eIncrement)
+
+inline void vTaskNotifyGiveFromISR(TaskHandle_t xTaskToNotify, BaseType_t *pxHigherPriorityTaskWoken)
+{
+    xTaskNotifyFromISR(xTaskToNotify, 0, eIncrement, pxHigherPriorityTaskWoken);
+}
+
+inline BaseType_t xTaskNotifyWait(uint32_t ulBitsToClearOnEntry, uint32_t ulBitsToClearOnExit, uint32_t *pulNotificationValue, TickType_t xTicksToWait)
+{
+    TaskHandle_t task = ardufreertos::posix::selfTask();
+    pthread_mutex_lock(&task->mutex);
+    if (!task->notifyPending)
+    {
+        task->notifyValue &= ~ulBitsToClearOnEntry;
+    }
+    bool notified = ardufreertos::posix::condWait(&task->cond, &task->mutex, xTicksToWait, [task]()
+                                                  { return task->notifyPending; });
+    if (pulNotificationValue)
+    {
+        *pulNotificationValue = task->notifyValue;
+    }
+    if (notified)
+    {
+        task->notifyValue &= ~ulBitsToClearOnExit;
+        task->notifyPending = false;
+    }
+    pthread_mutex_unlock(&task->mutex);
+    return notified ? pdTRUE : pdFALSE;
+}
+
+inline uint32_t ulTaskNotifyTake(BaseType_t xClearCountOnExit, TickType_t xTicksToWait)
+{
+    TaskHandle_t task = ardufreertos::posix::selfTask();
+    pthread_mutex_lock(&task->mutex);
+    ardufreertos::posix::condWait(&task->cond, &task->mutex, xTicksToWait, [task]()
+                                  { return task->notifyValue != 0; });
+    uint32_t value = task->notifyValue;
+    if (value)
+    {
+        task->notifyValue = xClearCountOnExit ? 0 : value - 1;
+    }
+    task->notifyPending = false;
+    pthread_mutex_unlock(&task->mutex);
+    return value;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// queue and queue set
+/////////////////////////////////////////////////////////////////////////////
+struct QueueDefinition
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t notEmpty;
+    pthread_cond_t notFull;
+    uint8_t *storage;
+    bool isStaticStorage;
+    UBaseType_t length;
+    UBaseType_t itemSize;
+    UBaseType_t head;
+    UBaseType_t count;
+    QueueDefinition *set; // queue set this queue belongs to
+};
+
+namespace ardufreertos
+{
+    namespace posix
+    {
+        inline QueueHandle_t newQueue(UBaseType_t length, UBaseType_t itemSize, uint8_t *storage)
+        {
+            QueueHandle_t queue = new QueueDefinition();
+            pthread_mutex_init(&queue->mutex, nullptr);
+            condInit(&queue->notEmpty);
+            condInit(&queue->notFull);
+            queue->isStaticStorage = (storage != nullptr);
+            queue->storage = storage ? storage : new uint8_t[length * itemSize];
+            queue->length = length;
+            queue->itemSize = itemSize;
+            queue->head = 0;
+            queue->count = 0;
+            queue->set = nullptr;
+            return queue;
+        }
+
+        inline BaseType_t queueSend(QueueHandle_t queue, const void *item, TickType_t ticks, bool toFront, bool overwrite)
+        {
+            pthread_mutex_lock(&queue->mutex);
+            if (overwrite && queue->count == queue->length)
+            {
+                queue->count--; // drop newest, like xQueueOverwrite on a length-1 queue
+            }
+            if (!condWait(&queue->notFull, &queue->mutex, ticks, [queue]()
+                          { return queue->count < queue->length; }))
+            {
+                pthread_mutex_unlock(&queue->mutex);
+                return errQUEUE_FULL;
+            }
+            UBaseType_t index;
+            if (toFront)
+            {
+                queue->head = (queue->head + queue->length - 1) % queue->length;
+                index = queue->head;
+            }
+            else
+            {
+                index = (queue->head + queue->count) % queue->length;
+            }
+            memcpy(queue->storage + index * queue->itemSize, item, queue->itemSize);
+            queue->count++;
+            pthread_cond_signal(&queue->notEmpty);
+            QueueDefinition *set = queue->set;
+            pthread_mutex_unlock(&queue->mutex);
+
+            if (set)
+            {
+                queueSend(set, &queue, portMAX_DELAY, false, false);
+            }
+            return pdPASS;
+        }
+
+        inline BaseType_t queueReceive(QueueHandle_t queue, void *item, TickType_t ticks, bool peek)
+        {
+            pthread_mutex_lock(&queue->mutex);
+            if (!condWait(&queue->notEmpty, &queue->mutex, ticks, [queue]()
+                          { return queue->count > 0; }))
+            {
+                pthread_mutex_unlock(&queue->mutex);
+                return errQUEUE_EMPTY;
+            }
+            memcpy(item, queue->storage + queue->head * queue->itemSize, queue->itemSize);
+            if (!peek)
+            {
+                queue->head = (queue->head + 1) % queue->length;
+                queue->count--;
+                pthread_cond_signal(&queue->notFull);
+            }
+            pthread_mutex_unlock(&queue->mutex);
+            return pdPASS;
+        }
+    } // namespace posix
+} // namespace ardufreertos
+
+inline QueueHandle_t xQueueCreate(UBaseType_t uxQueueLength, UBaseType_t uxItemSize)
+{
+    return ardufreertos::posix::newQueue(uxQueueLength, uxItemSize, nullptr);
+}
+
+inline QueueHandle_t xQueueCreateStatic(UBaseType_t uxQueueLength, UBaseType_t uxItemSize, uint8_t *pucQueueStorage, StaticQueue_t *pxStaticQueue)
+{
+    (void)pxStaticQueue;
+    return ardufreertos::posix::newQueue(uxQueueLength, uxItemSize, pucQueueStorage);
+}
+
+inline void vQueueDelete(QueueHandle_t xQueue)
+{
+    if (!xQueue->isStaticStorage)
+    {
+        delete[] xQueue->storage;
+    }
+    pthread_cond_destroy(&xQueue->notEmpty);
+    pthread_cond_destroy(&xQueue->notFull);
+    pthread_mutex_destroy(&xQueue->mutex);
+    delete xQueue;
+}
+
+inline BaseType_t xQueueSend(QueueHandle_t xQueue, const void *pvItemToQueue, TickType_t xTicksToWait)
+{
+    return ardufreertos::posix::queueSend(xQueue, pvItemToQueue, xTicksToWait, false, false);
+}
+#define xQueueSendToBack(xQueue, pvItemToQueue, xTicksToWait) xQueueSend((xQueue), (pvItemToQueue), (xTicksToWait))
+
+inline BaseType_t xQueueSendToFront(QueueHandle_t xQueue, const void *pvItemToQueue, TickType_t xTicksToWait)
+{
+    return ardufreertos::posix::queueSend(xQueue, pvItemToQueue, xTicksToWait, true, false);
+}
+
+inline BaseType_t xQueueOverwrite(QueueHandle_t xQueue, const void *pvItemToQueue)
+{
+    return ardufreertos::posix::queueSend(xQueue, pvItemToQueue, 0, false, true);
+}
+
+inline BaseType_t xQueueSendFromISR(QueueHandle_t xQueue, const void *pvItemToQueue, BaseType_t *pxHigherPriorityTaskWoken)
+{
+    BaseType_t result = ardufreertos::posix::queueSend(xQueue, pvItemToQueue, 0, false, false);
+    if (pxHigherPriorityTaskWoken && result == pdPASS)
+    {
+        *pxHigherPriorityTaskWoken = pdTRUE;
+    }
+    return result;
+}
+#define xQueueSendToBackFromISR(xQueue, pvItemToQueue, pxHigherPriorityTaskWoken) xQueueSendFromISR((xQueue), (pvItemToQueue), (pxHigherPriorityTaskWoken))
+
+inline BaseType_t xQueueReceive(QueueHandle_t xQueue, void *pvBuffer, TickType_t xTicksToWait)
+{
+    return ardufreertos::posix::queueReceive(xQueue, pvBuffer, xTicksToWait, false);
+}
+
+inline BaseType_t xQueueReceiveFromISR(QueueHandle_t xQueue, void *pvBuffer, BaseType_t *pxHigherPriorityTaskWoken)
+{
+    if (pxHigherPriorityTaskWoken)
+    {
+        *pxHigherPriorityTaskWoken = pdFALSE;
+    }
+    return ardufreertos::posix::queueReceive(xQueue, pvBuffer, 0, false);
+}
+
+inline BaseType_t xQueuePeek(QueueHandle_t xQueue, void *pvBuffer, TickType_t xTicksToWait)
+{
+    return ardufreertos::posix::queueReceive(xQueue, pvBuffer, xTicksToWait, true);
+}
+
+inline UBaseType_t uxQueueMessagesWaiting(QueueHandle_t xQueue)
+{
+    pthread_mutex_lock(&xQueue->mutex);
+    UBaseType_t count = xQueue->count;
+    pthread_mutex_unlock(&xQueue->mutex);
+    return count;
+}
+#define uxQueueMessagesWaitingFromISR(xQueue) uxQueueMessagesWaiting(xQueue)
+
+inline UBaseType_t uxQueueSpacesAvailable(QueueHandle_t xQueue)
+{
+    pthread_mutex_lock(&xQueue->mutex);
+    UBaseType_t spaces = xQueue->length - xQueue->count;
+    pthread_mutex_unlock(&xQueue->mutex);
+    return spaces;
+}
+
+inline BaseType_t xQueueReset(QueueHandle_t xQueue)
+{
+    pthread_mutex_lock(&xQueue->mutex);
+    xQueue->head = 0;
+    xQueue->count = 0;
+    pthread_cond_broadcast(&xQueue->notFull);
+    pthread_mutex_unlock(&xQueue->mutex);
+    return pdPASS;
+}
+
+inline QueueSetHandle_t xQueueCreateSet(const UBaseType_t uxEventQueueLength)
+{
+    return xQueueCreate(uxEventQueueLength, sizeof(QueueSetMemberHandle_t));
+}
+
+inline BaseType_t xQueueAddToSet(QueueSetMemberHandle_t xQueueOrSemaphore, QueueSetHandle_t xQueueSet)
+{
+    if (xQueueOrSemaphore->set || uxQueueMessagesWaiting(xQueueOrSemaphore))
+    {
+        return pdFAIL;
+    }
+    xQueueOrSemaphore->set = xQueueSet;
+    return pdPASS;
+}
+
+inline BaseType_t xQueueRemoveFromSet(QueueSetMemberHandle_t xQueueOrSemaphore, QueueSetHandle_t xQueueSet)
+{
+    if (xQueueOrSemaphore->set != xQueueSet || uxQueueMessagesWaiting(xQueueOrSemaphore))
+    {
+        return pdFAIL;
+    }
+    xQueueOrSemaphore->set = nullptr;
+    return pdPASS;
+}
+
+inline QueueSetMemberHandle_t xQueueSelectFromSet(QueueSetHandle_t xQueueSet, const TickType_t xTicksToWait)
+{
+    QueueSetMemberHandle_t member = nullptr;
+    xQueueReceive(xQueueSet, &member, xTicksToWait);
+    return member;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// software timer (timer service thread)
+/////////////////////////////////////////////////////////////////////////////
+struct tmrTimerControl
+{
+    const char *name;
+    TickType_t period;
+    UBaseType_t autoReload;
+    void *id;
+    TimerCallbackFunction_t callback;
+    bool isActive;
+    uint64_t expiryUs;
+    tmrTimerControl *next;
+};
+
+namespace ardufreertos
+{
+    namespace posix
+    {
+        class TimerService
+        {
+        public:
+            static TimerService &instance(void)
+            {
+                static TimerService service;
+                return service;
+            }
+
+            void add(TimerHandle_t timer)
+            {
+                pthread_mutex_lock(&_mutex);
+                timer->next = _timers;
+                _timers = timer;
+                pthread_mutex_unlock(&_mutex);
+            }
+
+            void remove(TimerHandle_t timer)
+            {
+                pthread_mutex_lock(&_mutex);
+                for (TimerHandle_t *p = &_timers; *p; p = &(*p)->next)
+                {
+                    if (*p == timer)
+                    {
+                        *p = timer->next;
+                        break;
+                    }
+                }
+                pthread_mutex_unlock(&_mutex);
+            }
+
+            void start(TimerHandle_t timer, TickType_t period)
+            {
+                pthread_mutex_lock(&_mutex);
+                timer->period = period;
+                timer->expiryUs = monotonicUs() + (uint64_t)pdTICKS_TO_MS(period) * 1000ULL;
+                timer->isActive = true;
+                pthread_cond_signal(&_cond);
+                pthread_mutex_unlock(&_mutex);
+            }
+
+            void stop(TimerHandle_t timer)
+            {
+                pthread_mutex_lock(&_mutex);
+                timer->isActive = false;
+                pthread_mutex_unlock(&_mutex);
+            }
+
+            bool isActive(TimerHandle_t timer)
+            {
+                pthread_mutex_lock(&_mutex);
+                bool active = timer->isActive;
+                pthread_mutex_unlock(&_mutex);
+                return active;
+            }
+
+            TaskHandle_t task(void)
+            {
+                return _task;
+            }
+
+            bool pend(PendedFunction_t function, void *param1, uint32_t param2)
+            {
+                pthread_mutex_lock(&_mutex);
+                bool ok = _pendedCount < PENDED_SIZE;
+                if (ok)
+                {
+                    _pended[(_pendedHead + _pendedCount) % PENDED_SIZE] = {function, param1, param2};
+                    _pendedCount++;
+                    pthread_cond_signal(&_cond);
+                }
+                pthread_mutex_unlock(&_mutex);
+                return ok;
+            }
+
+        private:
+            static constexpr int PENDED_SIZE = 16;
+            typedef struct
+            {
+                PendedFunction_t function;
+                void *param1;
+                uint32_t param2;
+            } Pended;
+
+            pthread_mutex_t _mutex;
+            pthread_cond_t _cond;
+            TimerHandle_t _timers;
+            TaskHandle_t _task;
+            Pended _pended[PENDED_SIZE];
+            int _pendedHead;
+            int _pendedCount;
+
+            TimerService() : _timers(nullptr), _task(nullptr), _pendedHead(0), _pendedCount(0)
+            {
+                pthread_mutex_init(&_mutex, nullptr);
+                condInit(&_cond);
+                startTask(run, "Tmr Svc", 0, this, configMAX_PRIORITIES - 1, &_task);
+            }
+
+            static void run(void *param)
+            {
+                static_cast<TimerService *>(param)->loop();
+            }
+
+            void loop(void)
+            {
+                pthread_mutex_lock(&_mutex);
+                while (true)
+                {
+                    if (_pendedCount)
+                    {
+                        Pended pended = _pended[_pendedHead];
+                        _pendedHead = (_pendedHead + 1) % PENDED_SIZE;
+                        _pendedCount--;
+                        pthread_mutex_unlock(&_mutex);
+                        pended.function(pended.param1, pended.param2);
+                        pthread_mutex_lock(&_mutex);
+                        continue;
+                    }
+
+                    uint64_t now = monotonicUs();
+                    TimerHandle_t expired = nullptr;
+                    uint64_t nextUs = UINT64_MAX;
+                    for (TimerHandle_t timer = _timers; timer; timer = timer->next)
+                    {
+                        if (!timer->isActive)
+                        {
+                            continue;
+                        }
+                        if (timer->expiryUs <= now)
+                        {
+                            expired = timer;
+                            break;
+                        }
+                        if (timer->expiryUs < nextUs)
+                        {
+                            nextUs = timer->expiryUs;
+                        }
+                    }
+
+                    if (expired)
+                    {
+                        if (expired->autoReload)
+                        {
+                            expired->expiryUs += (uint64_t)pdTICKS_TO_MS(expired->period) * 1000ULL;
+                        }
+                        else
+                        {
+                            expired->isActive = false;
+                        }
+                        pthread_mutex_unlock(&_mutex);
+                        expired->callback(expired);
+                        pthread_mutex_lock(&_mutex);
+                    }
+                    else if (nextUs == UINT64_MAX)
+                    {
+                        pthread_cond_wait(&_cond, &_mutex);
+                    }
+                    else
+                    {
+                        struct timespec ts;
+                        clock_gettime(CLOCK_MONOTONIC, &ts);
+                        uint64_t waitNs = (nextUs - now) * 1000ULL;
+                        ts.tv_sec += (time_t)(waitNs / 1000000000ULL);
+                        ts.tv_nsec += (long)(waitNs % 1000000000ULL);
+                        if (ts.tv_nsec >= 1000000000L)
+                        {
+                            ts.tv_sec++;
+                            ts.tv_nsec -= 1000000000L;
+                        }
+                        pthread_cond_timedwait(&_cond, &_mutex, &ts);
+                    }
+                }
+            }
+        };
+    } // namespace posix
+} // namespace ardufreertos
+
+inline TimerHandle_t xTimerCreate(const char *const pcTimerName, const TickType_t xTimerPeriodInTicks, const UBaseType_t uxAutoReload,
+                                  void *const pvTimerID, TimerCallbackFunction_t pxCallbackFunction)
+{
+    TimerHandle_t timer = new tmrTimerControl();
+    timer->name = pcTimerName;
+    timer->period = xTimerPeriodInTicks;
+    timer->autoReload = uxAutoReload;
+    timer->id = pvTimerID;
+    timer->callback = pxCallbackFunction;
+    timer->isActive = false;
+    timer->expiryUs = 0;
+    timer->next = nullptr;
+    ardufreertos::posix::TimerService::instance().add(timer);
+    return timer;
+}
+
+inline BaseType_t xTimerStart(TimerHandle_t xTimer, TickType_t xTicksToWait)
+{
+    (void)xTicksToWait;
+    ardufreertos::posix::TimerService::instance().start(xTimer, xTimer->period);
+    return pdPASS;
+}
+#define xTimerReset(xTimer, xTicksToWait) xTimerStart((xTimer), (xTicksToWait))
+#define xTimerStartFromISR(xTimer, pxHigherPriorityTaskWoken) xTimerStart((xTimer), 0)
+
+inline BaseType_t xTimerStop(TimerHandle_t xTimer, TickType_t xTicksToWait)
+{
+    (void)xTicksToWait;
+    ardufreertos::posix::TimerService::instance().stop(xTimer);
+    return pdPASS;
+}
+
+inline BaseType_t xTimerChangePeriod(TimerHandle_t xTimer, TickType_t xNewPeriod, TickType_t xTicksToWait)
+{
+    (void)xTicksToWait;
+    ardufreertos::posix::TimerService::instance().start(xTimer, xNewPeriod);
+    return pdPASS;
+}
+
+inline BaseType_t xTimerDelete(TimerHandle_t xTimer, TickType_t xTicksToWait)
+{
+    (void)xTicksToWait;
+    ardufreertos::posix::TimerService::instance().remove(xTimer);
+    delete xTimer;
+    return pdPASS;
+}
+
+inline BaseType_t xTimerIsTimerActive(TimerHandle_t xTimer)
+{
+    return ardufreertos::posix::TimerService::instance().isActive(xTimer) ? pdTRUE : pdFALSE;
+}
+
+inline void *pvTimerGetTimerID(const TimerHandle_t xTimer)
+{
+    return xTimer->id;
+}
+
+inline TaskHandle_t xTimerGetTimerDaemonTaskHandle(void)
+{
+    return ardufreertos::posix::TimerService::instance().task();
+}
+
+inline BaseType_t xTimerPendFunctionCall(PendedFunction_t xFunctionToPend, void *pvParameter1, uint32_t ulParameter2, TickType_t xTicksToWait)
+{
+    (void)xTicksToWait;
+    return ardufreertos::posix::TimerService::instance().pend(xFunctionToPend, pvParameter1, ulParameter2) ? pdPASS : pdFAIL;
+}
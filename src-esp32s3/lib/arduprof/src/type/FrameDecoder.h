@@ -0,0 +1,292 @@
+/* Copyright 2024 teamprof.net@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/////////////////////////////////////////////////////////////////////////////
+// Framing of a message stream (e.g. JSON over TCP), which TCP splits and coalesces at will.
+//   FrameLine:   payload '\n', for text without newlines (json.dumps() output); '\r' before '\n'
+//                and empty lines are ignored
+//   FrameLength: 2-byte big-endian payload length, payload; for any payload (e.g. CBOR)
+// The values are bits of the set of formats offered at connect, see ThreadPanel::runTcpClient()
+/////////////////////////////////////////////////////////////////////////////
+enum FrameFormat : uint8_t
+{
+    FrameLine = 1,
+    FrameLength = 2,
+};
+
+#define FRAME_HEADER_MAX 2           // bytes before a payload
+#define FRAME_LENGTH_MAX UINT16_MAX  // payload limit of FrameLength
+
+// header of a "length" bytes payload in "header" (FRAME_HEADER_MAX bytes), returns its size
+inline size_t frameHeader(FrameFormat format, size_t length, char *header)
+{
+    if (format != FrameLength)
+    {
+        return 0;
+    }
+    header[0] = (char)(length >> 8);
+    header[1] = (char)length;
+    return 2;
+}
+
+// bytes after a payload
+inline const char *frameTrailer(FrameFormat format)
+{
+    return format == FrameLine ? "\n" : "";
+}
+
+// one frame of FrameDecoder, "tail" is the part of a frame which wraps around the end of the ring
+typedef struct _StreamFrame
+{
+    const char *data;
+    size_t length;
+    const char *tail; // nullptr if the frame is contiguous
+    size_t tailLength;
+
+    size_t size(void) const
+    {
+        return length + tailLength;
+    }
+    // copy the whole payload to "buffer" (at least size() bytes), for a frame with a tail
+    void copyTo(char *buffer) const
+    {
+        memcpy(buffer, data, length);
+        memcpy(buffer + length, tail, tailLength);
+    }
+} StreamFrame;
+
+typedef struct _FrameStats
+{
+    uint32_t frames;    // frames decoded
+    uint32_t bytes;     // bytes committed
+    uint32_t oversize;  // frames larger than the ring: skipped (FrameLine) or the stream is broken (FrameLength)
+    uint32_t wrapped;   // frames returned in two parts
+    uint16_t maxFrame;  // largest payload decoded
+    uint16_t maxFill;   // most bytes buffered at a time
+
+    void reset(void)
+    {
+        *this = {};
+    }
+} FrameStats;
+
+/////////////////////////////////////////////////////////////////////////////
+// Incremental decoder of a framed stream over a ring of "Capacity" bytes (a power of 2).
+// recv() writes into the ring (writable() / commit()) and next() returns the complete frames
+// in place, however the stream was split: several per read, or one over several reads. A line
+// is scanned once, where the previous next() stopped. A frame stays valid until the next writable().
+//     size_t room;
+//     char *buffer = decoder.writable(room);
+//     int len = co_await recvAsync(sock, buffer, room);
+//     decoder.commit(len);
+//     StreamFrame frame;
+//     while (decoder.next(frame)) { ... }
+/////////////////////////////////////////////////////////////////////////////
+template <size_t Capacity>
+class FrameDecoder
+{
+    static_assert(Capacity >= 16 && (Capacity & (Capacity - 1)) == 0, "FrameDecoder: Capacity must be a power of 2");
+
+public:
+    FrameDecoder(FrameFormat format = FrameLine) : _format(format),
+                                                   _buffer(),
+                                                   _head(0),
+                                                   _tail(0),
+                                                   _scan(0),
+                                                   _isSkipping(false),
+                                                   _isBroken(false),
+                                                   _stats()
+    {
+    }
+
+    // drop buffered bytes, e.g. for a new connection
+    void reset(FrameFormat format = FrameLine)
+    {
+        _format = format;
+        _head = _tail = _scan = 0;
+        _isSkipping = false;
+        _isBroken = false;
+    }
+
+    // decode the bytes after the frame returned last in "format", e.g. once negotiated
+    void setFormat(FrameFormat format)
+    {
+        _format = format;
+        _scan = _head;
+    }
+    FrameFormat format(void) const
+    {
+        return _format;
+    }
+
+    // contiguous free space of the ring for recv(), "length" is 0 if the ring is full
+    char *writable(size_t &length)
+    {
+        if (_head == _tail)
+        {
+            _head = _tail = _scan = 0; // all taken: the next frames start at the beginning, unwrapped
+        }
+        size_t free = Capacity - (size_t)(_tail - _head);
+        size_t end = Capacity - (_tail & (Capacity - 1));
+        length = free < end ? free : end;
+        return _buffer + (_tail & (Capacity - 1));
+    }
+    // "length" bytes were written at writable()
+    void commit(size_t length)
+    {
+        _tail += length;
+        _stats.bytes += length;
+        size_t fill = (size_t)(_tail - _head);
+        if (fill > _stats.maxFill)
+        {
+            _stats.maxFill = (uint16_t)(fill < UINT16_MAX ? fill : UINT16_MAX);
+        }
+    }
+
+    // the next complete frame, false if none is complete yet
+    bool next(StreamFrame &frame)
+    {
+        return _format == FrameLength ? nextLength(frame) : nextLine(frame);
+    }
+
+    // a FrameLength frame larger than the ring was announced: the stream cannot be resynchronized
+    bool isBroken(void) const
+    {
+        return _isBroken;
+    }
+    size_t buffered(void) const
+    {
+        return (size_t)(_tail - _head);
+    }
+    const FrameStats &stats(void) const
+    {
+        return _stats;
+    }
+    void resetStats(void)
+    {
+        _stats.reset();
+    }
+
+private:
+    FrameFormat _format;
+    char _buffer[Capacity];
+    uint32_t _head; // first byte not returned yet, free running
+    uint32_t _tail; // end of the committed bytes, free running
+    uint32_t _scan; // FrameLine: bytes before it hold no '\n'
+    bool _isSkipping; // FrameLine: dropping the rest of an oversize line
+    bool _isBroken;
+    FrameStats _stats;
+
+    inline char at(uint32_t index) const
+    {
+        return _buffer[index & (Capacity - 1)];
+    }
+
+    bool nextLine(StreamFrame &frame)
+    {
+        while (true)
+        {
+            uint32_t end = _scan > _head ? _scan : _head;
+            while (end != _tail && at(end) != '\n')
+            {
+                end++;
+            }
+            if (end == _tail)
+            {
+                _scan = end;
+                if (_tail - _head == Capacity) // a line longer than the ring: drop it up to its '\n'
+                {
+                    _stats.oversize += _isSkipping ? 0 : 1;
+                    _isSkipping = true;
+                    _head = _scan = _tail;
+                }
+                return false;
+            }
+
+            uint32_t begin = _head;
+            _head = _scan = end + 1;
+            if (_isSkipping)
+            {
+                _isSkipping = false;
+                continue;
+            }
+            if (end != begin && at(end - 1) == '\r')
+            {
+                end--;
+            }
+            if (end != begin)
+            {
+                setFrame(frame, begin, end - begin);
+                return true;
+            }
+        }
+    }
+
+    bool nextLength(StreamFrame &frame)
+    {
+        if (_isBroken || _tail - _head < 2)
+        {
+            return false;
+        }
+        size_t length = ((size_t)(uint8_t)at(_head) << 8) | (uint8_t)at(_head + 1);
+        if (length > Capacity - 2)
+        {
+            _stats.oversize++;
+            _isBroken = true;
+            return false;
+        }
+        if (_tail - _head < 2 + length)
+        {
+            return false;
+        }
+        setFrame(frame, _head + 2, length);
+        _head += 2 + length;
+        _scan = _head;
+        return true;
+    }
+
+    void setFrame(StreamFrame &frame, uint32_t begin, size_t length)
+    {
+        size_t offset = begin & (Capacity - 1);
+        frame.data = _buffer + offset;
+        if (offset + length <= Capacity)
+        {
+            frame.length = length;
+            frame.tail = nullptr;
+            frame.tailLength = 0;
+        }
+        else
+        {
+            frame.length = Capacity - offset;
+            frame.tail = _buffer;
+            frame.tailLength = length - frame.length;
+            _stats.wrapped++;
+        }
+        _stats.frames++;
+        if (length > _stats.maxFrame)
+        {
+            _stats.maxFrame = (uint16_t)(length < UINT16_MAX ? length : UINT16_MAX);
+        }
+    }
+};
@@ -0,0 +1,264 @@
+/* Copyright 2024 teamprof.net@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#pragma once
+#include <stdint.h>
+
+#ifndef ARDUPROF_BATCH_HISTOGRAM_SIZE
+#define ARDUPROF_BATCH_HISTOGRAM_SIZE 6 // batch size buckets: 1, 2-3, 4-7, 8-15, 16-31, 32+
+#endif
+
+#ifndef ARDUPROF_LATENCY_HISTOGRAM_SIZE
+#define ARDUPROF_LATENCY_HISTOGRAM_SIZE 16 // latency buckets: 0-1us, 2-3us, 4-7us, ... 32ms+
+#endif
+
+#ifndef ARDUPROF_HANDLER_STATS_SIZE
+#define ARDUPROF_HANDLER_STATS_SIZE 8 // number of events whose handler time is tracked
+#endif
+
+// index of the log2 bucket of "value", clamped to "size" buckets
+inline uint16_t log2Bucket(uint32_t value, uint16_t size)
+{
+    uint16_t bucket = 0;
+    while ((value >>= 1) != 0 && bucket < size - 1)
+    {
+        bucket++;
+    }
+    return bucket;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// statistics of MessageBus::messageLoop() batches
+/////////////////////////////////////////////////////////////////////////////
+typedef struct _BatchStats
+{
+    uint32_t batches;  // number of wake-ups which dispatched at least one message
+    uint32_t messages; // number of dispatched messages
+    uint16_t maxBatch; // largest batch seen
+    uint32_t histogram[ARDUPROF_BATCH_HISTOGRAM_SIZE];
+
+    void reset(void)
+    {
+        *this = {};
+    }
+
+    void update(uint16_t count)
+    {
+        batches++;
+        messages += count;
+        if (count > maxBatch)
+        {
+            maxBatch = count;
+        }
+
+        histogram[log2Bucket(count, ARDUPROF_BATCH_HISTOGRAM_SIZE)]++;
+    }
+
+    // average batch size x 100
+    uint32_t average100(void) const
+    {
+        return batches ? (uint32_t)(((uint64_t)messages * 100) / batches) : 0;
+    }
+} BatchStats;
+
+/////////////////////////////////////////////////////////////////////////////
+// statistics of a message lane
+/////////////////////////////////////////////////////////////////////////////
+typedef struct _LaneStats
+{
+    uint32_t dispatched; // number of messages dispatched from the lane
+    uint32_t promoted;   // dispatched ahead of a higher lane by the starvation guard
+    uint16_t maxDepth;   // deepest backlog seen on dispatch
+
+    void reset(void)
+    {
+        *this = {};
+    }
+
+    void update(unsigned long depth, bool isPromoted)
+    {
+        dispatched++;
+        if (isPromoted)
+        {
+            promoted++;
+        }
+        if (depth > maxDepth)
+        {
+            maxDepth = (uint16_t)depth;
+        }
+    }
+} LaneStats;
+
+/////////////////////////////////////////////////////////////////////////////
+// statistics of a message queue (all lanes)
+// "posted" and "dropped" are counted by producers of any task or ISR, the rest by the consumer
+/////////////////////////////////////////////////////////////////////////////
+typedef struct _QueueStats
+{
+    uint32_t posted;        // messages accepted
+    uint32_t dropped;       // new messages dropped because the queue was full (OverflowDropNewest)
+    uint32_t coalesced;     // messages merged into a pending message by postCoalesced() or OverflowCoalesce
+    uint32_t blocked;       // messages accepted after waiting for room (OverflowBlock)
+    uint32_t timedOut;      // messages dropped after waiting for room in vain (OverflowBlock)
+    uint32_t droppedOldest; // queued messages discarded to make room (OverflowDropOldest)
+    uint32_t rejected;      // messages refused with PostRejected (OverflowReject)
+    uint32_t dispatched;   // messages dispatched by messageLoop()
+    uint16_t highWater;    // most messages left queued behind a dispatched one
+    uint32_t maxLatencyUs; // longest enqueue-to-dispatch latency
+    uint32_t latencyHistogram[ARDUPROF_LATENCY_HISTOGRAM_SIZE]; // bucket i: latency in [2^i, 2^(i+1)) us
+
+    void reset(void)
+    {
+        *this = {};
+    }
+
+    void countPosted(void)
+    {
+        __atomic_fetch_add(&posted, 1, __ATOMIC_RELAXED);
+    }
+    void countDropped(void)
+    {
+        __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+    }
+    void countCoalesced(void)
+    {
+        __atomic_fetch_add(&coalesced, 1, __ATOMIC_RELAXED);
+    }
+    void countBlocked(void)
+    {
+        __atomic_fetch_add(&blocked, 1, __ATOMIC_RELAXED);
+    }
+    void countTimedOut(void)
+    {
+        __atomic_fetch_add(&timedOut, 1, __ATOMIC_RELAXED);
+    }
+    void countDroppedOldest(void)
+    {
+        __atomic_fetch_add(&droppedOldest, 1, __ATOMIC_RELAXED);
+    }
+    void countRejected(void)
+    {
+        __atomic_fetch_add(&rejected, 1, __ATOMIC_RELAXED);
+    }
+
+    // messages lost to a full queue, whatever the overflow policy
+    uint32_t lost(void) const
+    {
+        return dropped + timedOut + droppedOldest + rejected;
+    }
+
+    void update(uint32_t latencyUs, unsigned long depth)
+    {
+        dispatched++;
+        if (depth > highWater)
+        {
+            highWater = (uint16_t)depth;
+        }
+        if (latencyUs > maxLatencyUs)
+        {
+            maxLatencyUs = latencyUs;
+        }
+        latencyHistogram[log2Bucket(latencyUs, ARDUPROF_LATENCY_HISTOGRAM_SIZE)]++;
+    }
+
+    // upper bound (us) of the histogram bucket holding the "percent" percentile, capped by maxLatencyUs
+    uint32_t latencyPercentileUs(uint8_t percent) const
+    {
+        uint32_t total = 0;
+        for (int i = 0; i < ARDUPROF_LATENCY_HISTOGRAM_SIZE; i++)
+        {
+            total += latencyHistogram[i];
+        }
+        uint32_t rank = (uint32_t)(((uint64_t)total * percent + 99) / 100);
+        uint32_t count = 0;
+        for (int i = 0; i < ARDUPROF_LATENCY_HISTOGRAM_SIZE; i++)
+        {
+            count += latencyHistogram[i];
+            if (count && count >= rank)
+            {
+                uint32_t upperUs = (2UL << i) - 1;
+                return (i < ARDUPROF_LATENCY_HISTOGRAM_SIZE - 1 && upperUs < maxLatencyUs) ? upperUs : maxLatencyUs;
+            }
+        }
+        return 0;
+    }
+} QueueStats;
+
+/////////////////////////////////////////////////////////////////////////////
+// execution time of the handler of one event, measured around onMessage()
+/////////////////////////////////////////////////////////////////////////////
+typedef struct _HandlerStats
+{
+    int16_t event;
+    uint32_t calls;
+    uint32_t totalUs;
+    uint32_t maxUs;
+    uint32_t overruns; // calls over the handler budget, see MessageBus::setHandlerBudget()
+
+    void update(uint32_t us)
+    {
+        calls++;
+        totalUs += us;
+        if (us > maxUs)
+        {
+            maxUs = us;
+        }
+    }
+
+    uint32_t averageUs(void) const
+    {
+        return calls ? totalUs / calls : 0;
+    }
+} HandlerStats;
+
+/////////////////////////////////////////////////////////////////////////////
+// occupancy of a BufferPool, updated by alloc() and release() of any task or ISR
+/////////////////////////////////////////////////////////////////////////////
+typedef struct _PoolStats
+{
+    uint16_t blocks;    // number of blocks in the pool
+    uint16_t inUse;     // blocks currently allocated
+    uint16_t highWater; // most blocks allocated at the same time
+    uint32_t allocs;    // successful alloc() calls
+    uint32_t failures;  // alloc() calls which found the pool exhausted
+
+    void resetCounters(void)
+    {
+        highWater = inUse;
+        allocs = 0;
+        failures = 0;
+    }
+} PoolStats;
+
+/////////////////////////////////////////////////////////////////////////////
+// activity of one WorkerPool worker, updated by the worker itself
+/////////////////////////////////////////////////////////////////////////////
+typedef struct _WorkerStats
+{
+    uint32_t executed;  // jobs run by this worker
+    uint32_t stolen;    // jobs taken from the deque of another worker
+    uint16_t highWater; // deepest own deque seen by submit()
+
+    void resetCounters(void)
+    {
+        executed = 0;
+        stolen = 0;
+        highWater = 0;
+    }
+} WorkerStats;
@@ -0,0 +1,166 @@
+/* Copyright 2024 teamprof.net@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+typedef struct _SendRingStats
+{
+    uint32_t frames;    // frames queued
+    uint32_t bytes;     // bytes queued
+    uint32_t flushes;   // consume() calls, e.g. one per send() or writev()
+    uint32_t dropped;   // frames refused: no room
+    uint16_t maxFill;   // most bytes buffered at a time
+    uint16_t reserved;
+
+    void reset(void)
+    {
+        *this = {};
+    }
+} SendRingStats;
+
+/////////////////////////////////////////////////////////////////////////////
+// Output of a connection: frames are appended whole (header, payload and trailer at once, or
+// nothing) to a ring of "Capacity" bytes (a power of 2), and whatever was queued meanwhile
+// leaves in one send, the one or two parts of the ring as a writev() / sendmsg() vector:
+//     sendRing.append(header, headerLength, payload, length, trailer, trailerLength);
+//     const char *part[2];
+//     size_t length[2];
+//     int count = sendRing.peek(part, length);
+//     ... sendmsg() of "count" iovecs
+//     sendRing.consume(sent);
+// Partial writes just leave the rest queued. Not thread safe: used by the task of the connection
+/////////////////////////////////////////////////////////////////////////////
+template <size_t Capacity>
+class SendRing
+{
+    static_assert(Capacity >= 16 && (Capacity & (Capacity - 1)) == 0, "SendRing: Capacity must be a power of 2");
+
+public:
+    SendRing() : _buffer(),
+                 _head(0),
+                 _tail(0),
+                 _stats()
+    {
+    }
+
+    // append the parts as one frame, false if they do not fit
+    bool append(const void *part0, size_t length0, const void *part1 = nullptr, size_t length1 = 0, const void *part2 = nullptr, size_t length2 = 0)
+    {
+        size_t length = length0 + length1 + length2;
+        if (length > room())
+        {
+            _stats.dropped++;
+            return false;
+        }
+        copy(part0, length0);
+        copy(part1, length1);
+        copy(part2, length2);
+        _stats.frames++;
+        _stats.bytes += length;
+        size_t fill = size();
+        if (fill > _stats.maxFill)
+        {
+            _stats.maxFill = (uint16_t)(fill < UINT16_MAX ? fill : UINT16_MAX);
+        }
+        return true;
+    }
+
+    // the queued bytes in order, as 0 to 2 contiguous parts; returns the number of parts
+    int peek(const char *part[2], size_t length[2]) const
+    {
+        size_t fill = size();
+        if (fill == 0)
+        {
+            return 0;
+        }
+        size_t offset = _head & (Capacity - 1);
+        size_t end = Capacity - offset;
+        part[0] = _buffer + offset;
+        if (fill <= end)
+        {
+            length[0] = fill;
+            return 1;
+        }
+        length[0] = end;
+        part[1] = _buffer;
+        length[1] = fill - end;
+        return 2;
+    }
+
+    // "length" bytes of peek() were sent
+    void consume(size_t length)
+    {
+        _head += length;
+        _stats.flushes++;
+        if (_head == _tail)
+        {
+            _head = _tail = 0; // empty: the next frames start at the beginning, in one part
+        }
+    }
+
+    // drop the queued bytes, e.g. for a new connection
+    void clear(void)
+    {
+        _head = _tail = 0;
+    }
+
+    size_t size(void) const
+    {
+        return (size_t)(_tail - _head);
+    }
+    size_t room(void) const
+    {
+        return Capacity - size();
+    }
+    bool isEmpty(void) const
+    {
+        return _head == _tail;
+    }
+    const SendRingStats &stats(void) const
+    {
+        return _stats;
+    }
+    void resetStats(void)
+    {
+        _stats.reset();
+    }
+
+private:
+    char _buffer[Capacity];
+    uint32_t _head; // first byte not sent yet, free running
+    uint32_t _tail; // end of the queued bytes, free running
+    SendRingStats _stats;
+
+    void copy(const void *data, size_t length)
+    {
+        if (length == 0)
+        {
+            return;
+        }
+        size_t offset = _tail & (Capacity - 1);
+        size_t end = Capacity - offset;
+        size_t first = length < end ? length : end;
+        memcpy(_buffer + offset, data, first);
+        memcpy(_buffer, static_cast<const char *>(data) + first, length - first);
+        _tail += length;
+    }
+};
@@ -0,0 +1,233 @@
+/* Copyright 2024 teamprof.net@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <type_traits>
+#include "./Message.h"
+
+#if defined ARDUPROF_FREERTOS
+#include "../os/freertos/BufferPool.h"
+#endif
+
+/////////////////////////////////////////////////////////////////////////////
+// Typed messages: a struct names its (event, iParam) pair at compile time and
+// carries named fields instead of raw uParam / lParam.
+//
+//     struct TimerTick
+//     {
+//         static constexpr int16_t eventId = EventSystem;
+//         static constexpr int16_t sourceId = SysSoftwareTimer;
+//         TimerHandle_t timer;
+//     };
+//
+// A type of up to ARDUPROF_TYPED_INLINE_SIZE (6) bytes is packed into lParam,
+// then uParam: it is the same 16-byte QueueItem (Message and post time) as a
+// raw post, and a lone 32-bit field is exactly the old lParam. A larger type is
+// copied into a block of typedMessagePool() and the message carries the
+// BufferHandle (FreeRTOS only).
+// Types must be trivially copyable; sizeof(T) counts the padding, e.g.
+// {uint32_t, uint16_t} is 8 bytes.
+//
+// post:
+//     post(queue, TimerTick{xTimer});
+//
+// receive: one "on(const T &)" overload per type, dispatched before the EventTable
+//     typedef MessageTypes<TimerTick, TcpConnection> TypedHandlers;
+//     friend TypedHandlers; // if the on() handlers are private
+//
+//     if (TypedHandlers::dispatch(this, msg)) { return; }
+//
+// dispatch() is two compares per type and inlines into onMessage().
+/////////////////////////////////////////////////////////////////////////////
+
+#ifndef ARDUPROF_TYPED_BLOCK_SIZE
+#define ARDUPROF_TYPED_BLOCK_SIZE 32 // largest pooled message type, bytes
+#endif
+#ifndef ARDUPROF_TYPED_BLOCKS
+#define ARDUPROF_TYPED_BLOCKS 8 // pooled typed messages in flight at the same time
+#endif
+
+// bytes of a typed message packed into the message itself: lParam, then uParam
+#define ARDUPROF_TYPED_INLINE_SIZE (sizeof(uint32_t) + sizeof(uint16_t))
+
+template <typename T, typename = void>
+struct IsTypedMessage : std::false_type
+{
+};
+template <typename T>
+struct IsTypedMessage<T, decltype((void)T::eventId, (void)T::sourceId)> : std::true_type
+{
+};
+
+template <typename T>
+struct TypedMessageTraits
+{
+    static_assert(IsTypedMessage<T>::value, "typed message needs static constexpr int16_t eventId and sourceId");
+    static_assert(std::is_trivially_copyable<T>::value, "typed message must be trivially copyable");
+
+    static constexpr bool isInline = sizeof(T) <= ARDUPROF_TYPED_INLINE_SIZE;
+    static constexpr uint32_t key = ((uint32_t)(uint16_t)T::eventId << 16) | (uint16_t)T::sourceId;
+};
+
+template <typename T>
+inline bool isMessageOf(const Message &msg)
+{
+    return msg.event == T::eventId && msg.iParam == T::sourceId;
+}
+
+#if defined ARDUPROF_FREERTOS
+// blocks of the typed messages which do not fit a Message, first used from a task
+inline ardufreertos::BufferPool &typedMessagePool(void)
+{
+    static uint8_t storage[ARDUPROF_TYPED_BLOCK_SIZE * ARDUPROF_TYPED_BLOCKS];
+    static ardufreertos::BufferPool pool(ARDUPROF_TYPED_BLOCK_SIZE, ARDUPROF_TYPED_BLOCKS, storage);
+    return pool;
+}
+#endif
+
+// fill "msg" with "value", false if a pooled type finds the pool exhausted
+template <typename T>
+inline bool encodeMessage(const T &value, Message &msg)
+{
+    msg.event = T::eventId;
+    msg.iParam = T::sourceId;
+    if constexpr (TypedMessageTraits<T>::isInline)
+    {
+        uint8_t bytes[ARDUPROF_TYPED_INLINE_SIZE] = {};
+        memcpy(bytes, &value, sizeof(T));
+        memcpy(&msg.lParam, bytes, sizeof(msg.lParam));
+        memcpy(&msg.uParam, bytes + sizeof(msg.lParam), sizeof(msg.uParam));
+        return true;
+    }
+    else
+    {
+#if defined ARDUPROF_FREERTOS
+        static_assert(sizeof(T) <= ARDUPROF_TYPED_BLOCK_SIZE, "typed message larger than ARDUPROF_TYPED_BLOCK_SIZE");
+        ardufreertos::BufferPool &pool = typedMessagePool();
+        ardufreertos::BufferHandle handle = pool.alloc();
+        if (handle == 0)
+        {
+            return false;
+        }
+        memcpy(pool.data(handle), &value, sizeof(T));
+        pool.setLength(handle, sizeof(T));
+        msg.uParam = sizeof(T);
+        msg.lParam = handle;
+        return true;
+#else
+        static_assert(TypedMessageTraits<T>::isInline, "typed message larger than ARDUPROF_TYPED_INLINE_SIZE needs ARDUPROF_FREERTOS");
+        return false;
+#endif
+    }
+}
+
+// read "value" back from a message of type T. The block of a pooled type is released: decode once
+template <typename T>
+inline bool decodeMessage(const Message &msg, T &value)
+{
+    if (!isMessageOf<T>(msg))
+    {
+        return false;
+    }
+    if constexpr (TypedMessageTraits<T>::isInline)
+    {
+        uint8_t bytes[ARDUPROF_TYPED_INLINE_SIZE];
+        memcpy(bytes, &msg.lParam, sizeof(msg.lParam));
+        memcpy(bytes + sizeof(msg.lParam), &msg.uParam, sizeof(msg.uParam));
+        memcpy(&value, bytes, sizeof(T));
+        return true;
+    }
+    else
+    {
+#if defined ARDUPROF_FREERTOS
+        ardufreertos::BufferRef payload(msg.lParam);
+        if (payload.length() != sizeof(T))
+        {
+            return false; // stale handle
+        }
+        memcpy(&value, payload.data(), sizeof(T));
+        return true;
+#else
+        static_assert(TypedMessageTraits<T>::isInline, "typed message larger than ARDUPROF_TYPED_INLINE_SIZE needs ARDUPROF_FREERTOS");
+        return false;
+#endif
+    }
+}
+
+// give back the block of a pooled message which was not posted
+template <typename T>
+inline void discardMessage(const Message &msg)
+{
+#if defined ARDUPROF_FREERTOS
+    if constexpr (!TypedMessageTraits<T>::isInline)
+    {
+        ardufreertos::BufferRef dropped(msg.lParam);
+    }
+#endif
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Dispatch of typed messages to "handler->on(const T &)" overloads
+/////////////////////////////////////////////////////////////////////////////
+template <typename... Types>
+struct MessageTypes
+{
+    // true if "msg" is one of Types, also when a pooled payload turned out stale
+    template <typename Handler>
+    static inline bool dispatch(Handler *handler, const Message &msg)
+    {
+        static_assert(isUnique(), "MessageTypes: two types with the same (eventId, sourceId)");
+        return (dispatchAs<Types>(handler, msg) || ...);
+    }
+
+private:
+    template <typename T, typename Handler>
+    static inline bool dispatchAs(Handler *handler, const Message &msg)
+    {
+        if (!isMessageOf<T>(msg))
+        {
+            return false;
+        }
+        T value;
+        if (decodeMessage(msg, value))
+        {
+            handler->on(value);
+        }
+        return true;
+    }
+
+    static constexpr bool isUnique(void)
+    {
+        const uint32_t keys[] = {TypedMessageTraits<Types>::key...};
+        for (size_t i = 0; i < sizeof...(Types); i++)
+        {
+            for (size_t j = i + 1; j < sizeof...(Types); j++)
+            {
+                if (keys[i] == keys[j])
+                {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+};
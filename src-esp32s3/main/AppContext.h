@@ -23,10 +23,12 @@ namespace ardufreertos
 {
     class MessageQueue;
     class ThreadBase;
+    class MessageBroker;
 };
 
 typedef struct _AppContext
 {
     ardufreertos::MessageQueue *queueMain;
     ardufreertos::ThreadBase *threadPanel;
+    ardufreertos::MessageBroker *broker; // topics: (EventApp, AppDeviceUpdate), (EventSystem, SysNetworkAvailable)
 } AppContext;
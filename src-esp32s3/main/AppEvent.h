@@ -40,7 +40,7 @@ enum AppEvent : int16_t
 enum SystemTriggerSource
 {
     SysNull = 0,
-    SysSoftwareTimer,    // lParam=xTimer:uint32_t
+    SysSoftwareTimer,    // SoftwareTimerTick
     SysButtonClick,      // uParam=pin number
     SysNetworkAvailable, // uParam=<true/false>
 };
@@ -48,12 +48,15 @@ enum SystemTriggerSource
 enum AppTriggerSource
 {
     AppNull = 0,
-    AppTcpConnection, // uParam=<connection result>
-    AppUserCommand,   // uParam=<UserCommand>
-    AppDeviceUpdate,  // uParam=<DeviceType>, lParam=<DeviceState>
+    AppTcpConnection,   // TcpConnection
+    AppUserCommand,     // uParam=<UserCommand>
+    AppDeviceUpdate,    // uParam=<DeviceType>, lParam=<DeviceState>
+    AppTcpRetry,        // scheduled reconnect after a failed or lost connection
+    AppAddressRefresh,  // periodic renewal of the cached server address
+    AppAddressResolved, // an mDNS query of AddressCache ended
 };
 
-enum AppError
+enum AppError : uint8_t
 {
     ErrNone = 0,
     ErrTaskCreate,    // error in create task
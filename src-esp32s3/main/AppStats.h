@@ -0,0 +1,171 @@
+/* Copyright 2024 teamprof.net@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#pragma once
+#include <stdio.h>
+#include <esp_log.h>
+#include "ArduProfFreeRTOS.h"
+
+// log the runtime counters of a MessageBus: queue, lanes, batches and handler time
+inline void logBusStats(const char *tag, const char *name, ardufreertos::MessageBus *bus)
+{
+    auto &queue = bus->queueStats();
+    ESP_LOGI(tag, "%s: posted=%lu, dropped=%lu, coalesced=%lu, dispatched=%lu, highWater=%u, latency p50<%luus p99<%luus max=%luus", name,
+             queue.posted, queue.dropped, queue.coalesced, queue.dispatched, queue.highWater,
+             queue.latencyPercentileUs(50), queue.latencyPercentileUs(99), queue.maxLatencyUs);
+    if (queue.lost() != queue.dropped || queue.blocked)
+    {
+        ESP_LOGI(tag, "%s: overflow: blocked=%lu, timedOut=%lu, droppedOldest=%lu, rejected=%lu", name,
+                 queue.blocked, queue.timedOut, queue.droppedOldest, queue.rejected);
+    }
+
+    auto &batch = bus->batchStats();
+    ESP_LOGI(tag, "%s: batches=%lu, maxBatch=%u, avgBatch=%lu.%02lu", name,
+             batch.batches, batch.maxBatch, batch.average100() / 100, batch.average100() % 100);
+
+    for (int i = 0; i < ardufreertos::PriorityLaneCount; i++)
+    {
+        auto priority = static_cast<ardufreertos::MessagePriority>(i);
+        auto &lane = bus->laneStats(priority);
+        if (lane.dispatched)
+        {
+            ESP_LOGI(tag, "%s: lane%d: depth=%u, maxDepth=%u, dispatched=%lu, promoted=%lu", name,
+                     i, bus->laneDepth(priority), lane.maxDepth, lane.dispatched, lane.promoted);
+        }
+    }
+
+    auto handlers = bus->handlerStats();
+    for (int i = 0; i < ARDUPROF_HANDLER_STATS_SIZE && handlers[i].calls; i++)
+    {
+        ESP_LOGI(tag, "%s: event=%d: calls=%lu, avg=%luus, max=%luus, overruns=%lu", name,
+                 handlers[i].event, handlers[i].calls, handlers[i].averageUs(), handlers[i].maxUs, handlers[i].overruns);
+    }
+}
+
+// log the occupancy of a BufferPool
+inline void logPoolStats(const char *tag, const char *name, ardufreertos::BufferPool &pool)
+{
+    auto &stats = pool.stats();
+    ESP_LOGI(tag, "%s: blocks=%u, inUse=%u, highWater=%u, allocs=%lu, failures=%lu", name,
+             stats.blocks, stats.inUse, stats.highWater, stats.allocs, stats.failures);
+}
+
+// dump the message-flow trace as "APTR:<hex>" lines, see extras/trace/trace2chrome.py of ArduProf
+inline void logMessageTrace(const char *tag)
+{
+    auto count = ardufreertos::MessageTrace::instance().dump(
+        [](const void *data, size_t size, void *arg)
+        {
+            static const char digits[] = "0123456789abcdef";
+            auto bytes = static_cast<const uint8_t *>(data);
+            char line[2 * 32 + 1];
+            for (size_t offset = 0; offset < size; offset += 32)
+            {
+                size_t n = (size - offset < 32) ? size - offset : 32;
+                for (size_t i = 0; i < n; i++)
+                {
+                    line[2 * i] = digits[bytes[offset + i] >> 4];
+                    line[2 * i + 1] = digits[bytes[offset + i] & 0x0f];
+                }
+                line[2 * n] = '\0';
+                ESP_LOGI(static_cast<const char *>(arg), "APTR:%s", line);
+            }
+        },
+        (void *)tag);
+    ESP_LOGI(tag, "%s: %lu trace records", __func__, count);
+}
+
+// log one record of the stall watchdog, the PCs are decoded by idf.py monitor
+inline void logStallRecord(const char *tag, const ardufreertos::StallRecord &record)
+{
+    static const char *kinds[] = {"none", "overrun", "stuck", "not draining"};
+    auto watchdog = ardufreertos::StallWatchdog::existing();
+    ESP_LOGW(tag, "%s: %s%s: event=%d, iParam=%d, elapsed=%luus, budget=%luus, queued=%u, repeats=%u, at %lums", record.name,
+             kinds[record.kind < 4 ? record.kind : 0], (watchdog && record.boot != watchdog->boot()) ? " (before reset)" : "",
+             record.event, record.iParam, record.elapsedUs, record.budgetUs, record.queued, record.repeats, record.timeMs);
+    if (record.depth)
+    {
+        char line[ARDUPROF_STALL_BACKTRACE_DEPTH * 11 + 1];
+        int length = 0;
+        for (int i = 0; i < record.depth; i++)
+        {
+            length += snprintf(line + length, sizeof(line) - length, " 0x%08lx", record.backtrace[i]);
+        }
+        ESP_LOGW(tag, "%s: Backtrace:%s", record.name, line);
+    }
+}
+
+// log the stall records kept by the watchdog, of this boot and of boots before a soft reset
+inline void logStallLog(const char *tag)
+{
+    auto &watchdog = ardufreertos::StallWatchdog::instance();
+    for (uint16_t i = 0; i < watchdog.count(); i++)
+    {
+        ardufreertos::StallRecord record;
+        if (watchdog.read(i, record))
+        {
+            logStallRecord(tag, record);
+        }
+    }
+    ESP_LOGI(tag, "%s: %u stall records, boot %u", __func__, watchdog.count(), watchdog.boot());
+}
+
+// log the latest sample of the SystemSampler: cores, heap, tasks, queues and metrics
+inline void logSystemSample(const char *tag)
+{
+    static ardufreertos::SystemSample sample; // too large for the console stack
+    if (!ardufreertos::SystemSampler::instance().latest(sample))
+    {
+        ESP_LOGI(tag, "%s: no sample yet", __func__);
+        return;
+    }
+    auto &header = sample.header;
+    ESP_LOGI(tag, "sample %lu at %lums: period=%lums, core0=%u.%u%%, core1=%u.%u%%", header.seq, header.timeMs, header.periodMs,
+             header.corePermille[0] / 10, header.corePermille[0] % 10, header.corePermille[1] / 10, header.corePermille[1] % 10);
+    ESP_LOGI(tag, "heap: free=%lu, minFree=%lu, largest=%lu, fragmentation=%u.%u%%",
+             header.heap.free, header.heap.minFree, header.heap.largest, header.heap.fragmentation / 10, header.heap.fragmentation % 10);
+    if (header.tasks < header.taskCount)
+    {
+        ESP_LOGW(tag, "%u tasks, above ARDUPROF_SAMPLER_TASKS", header.taskCount);
+    }
+    for (int i = 0; i < header.tasks; i++)
+    {
+        auto &task = sample.tasks[i];
+        ESP_LOGI(tag, "task %-12s cpu=%2u.%u%%, stackFree=%5lu, priority=%2u, core=%c", task.name,
+                 task.cpu / 10, task.cpu % 10, task.stackFree, task.priority, task.core == 0xff ? '*' : '0' + task.core);
+    }
+    for (int i = 0; i < header.queues; i++)
+    {
+        auto &queue = sample.queues[i];
+        ESP_LOGI(tag, "queue %s: depth=%u, highWater=%u, dispatched=%lu, lost=%lu", queue.name,
+                 queue.depth, queue.highWater, queue.dispatched, queue.lost);
+    }
+    for (int i = 0; i < header.metrics; i++)
+    {
+        ESP_LOGI(tag, "metric %s=%ld", sample.metrics[i].name, sample.metrics[i].value);
+    }
+}
+
+inline void resetBusStats(ardufreertos::MessageBus *bus)
+{
+    bus->resetQueueStats();
+    bus->resetBatchStats();
+    bus->resetLaneStats();
+    bus->resetHandlerStats();
+}
@@ -22,6 +22,7 @@
 #include "./thread/QueueMain.h"
 #include "./thread/ThreadPanel.h"
 #include "AppContext.h"
+#include "AppStats.h"
 
 ///////////////////////////////////////////////////////////////////////////////
 static const char *TAG = "app_main";
@@ -35,6 +36,32 @@ AppContext *getContext(void)
     return &context;
 }
 
+// stall records survive a soft reset (panic, task watchdog, esp_restart) in RTC memory
+static ARDUPROF_STALL_NOINIT ardufreertos::StallLog stallLog;
+
+static void startStallWatchdog(void)
+{
+    auto &watchdog = ardufreertos::StallWatchdog::instance();
+    if (watchdog.begin(&stallLog))
+    {
+        logStallLog(TAG); // what stalled before the reset
+    }
+    watchdog.setCallback([](const ardufreertos::StallRecord &record, void *arg)
+                         { logStallRecord(TAG, record); });
+}
+
+#define SAMPLER_PERIOD_MS 1000 // period of task, heap and queue samples
+
+static void startSystemSampler(void)
+{
+    auto &sampler = ardufreertos::SystemSampler::instance();
+    sampler.addQueue(context.queueMain, "QueueMain");
+    sampler.addQueue(context.threadPanel, "ThreadPanel");
+    sampler.addMetric("typedInUse", [](void *arg) -> int32_t
+                      { return typedMessagePool().stats().inUse; });
+    sampler.start(SAMPLER_PERIOD_MS);
+}
+
 static void createTask(void)
 {
     // define variable "queueMain" for Arduino thred to interact with ArduProf framework.
@@ -43,9 +70,12 @@ static void createTask(void)
     // define variable "threadPanel" for application thread. (Define other thread as you need)
     static ThreadPanel threadPanel;
 
+    static ardufreertos::MessageBroker broker;
+
     // initialize application context
     context.queueMain = &queueMain;
     context.threadPanel = &threadPanel;
+    context.broker = &broker;
 
     // start threadPanel
     ESP_LOGI(TAG, "%s: threadPanel.start()", __func__);
@@ -61,7 +91,9 @@ extern "C" void app_main()
     // Initialize the ESP NVS layer
     nvs_flash_init();
 
+    startStallWatchdog();
     createTask();
+    startSystemSampler();
 
     auto ctx = getContext();
     auto pQueueMain = static_cast<QueueMain *>(ctx->queueMain);
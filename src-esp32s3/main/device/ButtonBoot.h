@@ -43,7 +43,7 @@ public:
                                    auto instance = static_cast<ButtonBoot *>(usr_data);
                                    if (instance && instance->_queue)
                                    {
-                                       instance->_queue->postEvent(EventSystem, SysButtonClick, instance->_pin);
+                                       instance->_queue->postEvent(ardufreertos::PriorityUrgent, EventSystem, SysButtonClick, instance->_pin);
                                    }
                                    //
                                },
@@ -0,0 +1,151 @@
+/* Copyright 2024 teamprof.net@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include <string.h>
+#include <cbor.h> // tinycbor, espressif/cbor component
+#include "LampCbor.h"
+#include "LampModel.h"
+
+// codes on the wire are indexes of these tables: append only
+static const char *const DEVICES[] = {
+    LampModel::NAME,
+};
+static const char *const EVENTS[] = {
+    LampModel::REQ_UPDATE,
+    LampModel::USER_CLICK,
+    LampModel::UPDATE,
+    LampModel::REQ_SAMPLE,
+    LampModel::SAMPLE,
+    LampModel::HELLO,
+};
+#define COUNT_OF(x) (sizeof(x) / sizeof((x)[0]))
+
+LampCbor::LampCbor() : _device(-1), _event(-1), _arg0(0), _arg1(0)
+{
+}
+
+int LampCbor::codeOf(const char *const *names, size_t count, const char *name)
+{
+    for (size_t i = 0; name && i < count; i++)
+    {
+        if (!strcmp(names[i], name))
+        {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+size_t LampCbor::build(uint8_t *buffer, size_t size, const char *device, const char *event, int arg0, int arg1,
+                       const void *data, size_t dataSize)
+{
+    _device = codeOf(DEVICES, COUNT_OF(DEVICES), device);
+    _event = codeOf(EVENTS, COUNT_OF(EVENTS), event);
+    _arg0 = arg0;
+    _arg1 = arg1;
+    if (_device < 0 || _event < 0)
+    {
+        return 0;
+    }
+
+    CborEncoder encoder, map;
+    cbor_encoder_init(&encoder, buffer, size, 0);
+    // errors are sticky: the encoder keeps counting the size needed, checked once at the end
+    int err = cbor_encoder_create_map(&encoder, &map, data ? 5 : 4);
+    err |= cbor_encode_uint(&map, KeyDevice);
+    err |= cbor_encode_uint(&map, _device);
+    err |= cbor_encode_uint(&map, KeyEvent);
+    err |= cbor_encode_uint(&map, _event);
+    err |= cbor_encode_uint(&map, KeyArg0);
+    err |= cbor_encode_int(&map, arg0);
+    err |= cbor_encode_uint(&map, KeyArg1);
+    err |= cbor_encode_int(&map, arg1);
+    if (data)
+    {
+        err |= cbor_encode_uint(&map, KeyData);
+        err |= cbor_encode_byte_string(&map, static_cast<const uint8_t *>(data), dataSize);
+    }
+    err |= cbor_encoder_close_container(&encoder, &map);
+    return err == CborNoError ? cbor_encoder_get_buffer_size(&encoder, buffer) : 0;
+}
+
+// unknown keys are skipped, "data" too: the panel sends none
+bool LampCbor::parse(const uint8_t *buffer, size_t size)
+{
+    _device = _event = -1;
+    _arg0 = _arg1 = 0;
+
+    CborParser parser;
+    CborValue it, map;
+    if (cbor_parser_init(buffer, size, 0, &parser, &it) != CborNoError || !cbor_value_is_map(&it) ||
+        cbor_value_enter_container(&it, &map) != CborNoError)
+    {
+        return false;
+    }
+    while (!cbor_value_at_end(&map))
+    {
+        uint64_t key;
+        if (!cbor_value_is_unsigned_integer(&map) || cbor_value_get_uint64(&map, &key) != CborNoError ||
+            cbor_value_advance_fixed(&map) != CborNoError || cbor_value_at_end(&map))
+        {
+            return false;
+        }
+        int value = 0;
+        bool isInt = cbor_value_is_integer(&map) && cbor_value_get_int_checked(&map, &value) == CborNoError;
+        switch (key)
+        {
+        case KeyDevice:
+            _device = isInt ? value : -1;
+            break;
+        case KeyEvent:
+            _event = isInt ? value : -1;
+            break;
+        case KeyArg0:
+            _arg0 = isInt ? value : 0;
+            break;
+        case KeyArg1:
+            _arg1 = isInt ? value : 0;
+            break;
+        default:
+            break;
+        }
+        if (cbor_value_advance(&map) != CborNoError)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+const char *LampCbor::device(void)
+{
+    return _device >= 0 && (size_t)_device < COUNT_OF(DEVICES) ? DEVICES[_device] : NULL;
+}
+const char *LampCbor::event(void)
+{
+    return _event >= 0 && (size_t)_event < COUNT_OF(EVENTS) ? EVENTS[_event] : NULL;
+}
+int LampCbor::arg0(void)
+{
+    return _arg0;
+}
+int LampCbor::arg1(void)
+{
+    return _arg1;
+}
@@ -0,0 +1,68 @@
+/* Copyright 2024 teamprof.net@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+/////////////////////////////////////////////////////////////////////////////
+// CBOR encoding of the LampModel messages: a map with integer keys and the device and event
+// names as codes, e.g. user-click of button 2 is 9 bytes instead of 60 of JSON. A sample carries
+// "data" as a byte string instead of hex digits. Used once negotiated by the hello (arg1),
+// over FrameLength frames only, since CBOR may hold any byte
+/////////////////////////////////////////////////////////////////////////////
+class LampCbor
+{
+public:
+    // bits of hello arg1: encodings offered by the lamp, the one chosen by the panel, then confirmed by the lamp
+    static constexpr int EncodingJson = 1;
+    static constexpr int EncodingCbor = 2;
+
+    static constexpr size_t OVERHEAD = 24; // map, keys and arguments around "data", at most
+
+    LampCbor();
+
+    // encode into "buffer", returns the bytes used, 0 if an argument is unknown or "size" too small
+    size_t build(uint8_t *buffer, size_t size, const char *device, const char *event, int arg0 = 0, int arg1 = 0,
+                 const void *data = nullptr, size_t dataSize = 0);
+    bool parse(const uint8_t *buffer, size_t size);
+
+    // same accessors as LampModel: the names of the codes, NULL if unknown
+    const char *device(void);
+    const char *event(void);
+    int arg0(void);
+    int arg1(void);
+
+private:
+    enum Key
+    {
+        KeyDevice = 0,
+        KeyEvent = 1,
+        KeyArg0 = 2,
+        KeyArg1 = 3,
+        KeyData = 4,
+    };
+
+    static int codeOf(const char *const *names, size_t count, const char *name);
+
+    int _device;
+    int _event;
+    int _arg0;
+    int _arg1;
+};
@@ -17,6 +17,7 @@
  * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
+#include <string.h>
 #include <cJSON.h> // ref: https://github.com/DaveGamble/cJSON/blob/master/tests/readme_examples.c
 #include "LampModel.h"
 #include "ArduProfFreeRTOS.h"
@@ -66,7 +67,39 @@ bool LampModel::build(const char *device, const char *event, int arg0, int arg1)
     return root != NULL;
 }
 
+// add "data" to the built model, as a string of hex digits
+bool LampModel::addData(const void *data, size_t size)
+{
+    if (!_root)
+    {
+        return false;
+    }
+
+    char *hex = (char *)cJSON_malloc(2 * size + 1);
+    if (!hex)
+    {
+        return false;
+    }
+    static const char digits[] = "0123456789abcdef";
+    auto bytes = static_cast<const uint8_t *>(data);
+    for (size_t i = 0; i < size; i++)
+    {
+        hex[2 * i] = digits[bytes[i] >> 4];
+        hex[2 * i + 1] = digits[bytes[i] & 0x0f];
+    }
+    hex[2 * size] = '\0';
+
+    cJSON *item = cJSON_AddStringToObject(_root, DATA, hex);
+    cJSON_free(hex);
+    return item != NULL;
+}
+
 bool LampModel::parse(const char *str)
+{
+    return str && parse(str, strlen(str));
+}
+
+bool LampModel::parse(const char *str, size_t length)
 {
     if (!str)
     {
@@ -76,9 +109,10 @@ bool LampModel::parse(const char *str)
     if (_root)
     {
         cJSON_Delete(_root);
+        _root = NULL;
     }
 
-    cJSON *root = cJSON_Parse(str);
+    cJSON *root = cJSON_ParseWithLength(str, length);
     if (!root)
     {
         const char *error_ptr = cJSON_GetErrorPtr();
@@ -91,9 +125,12 @@ bool LampModel::parse(const char *str)
 
     _device = cJSON_GetObjectItem(root, DEVICE);
     _event = cJSON_GetObjectItem(root, EVENT);
-    _arg0 = cJSON_GetObjectItem(root, ARG0)->valueint;
-    _arg1 = cJSON_GetObjectItem(root, ARG1)->valueint;
+    cJSON *arg0 = cJSON_GetObjectItem(root, ARG0);
+    cJSON *arg1 = cJSON_GetObjectItem(root, ARG1);
+    _arg0 = arg0 ? arg0->valueint : 0;
+    _arg1 = arg1 ? arg1->valueint : 0;
 
+    _root = root; // freed by the next parse() or build(), or the destructor
     return true;
 }
 
@@ -18,6 +18,7 @@
  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 #pragma once
+#include <stddef.h>
 #include <stdint.h>
 #include <cJSON.h>
 
@@ -28,6 +29,9 @@ public:
     static constexpr char REQ_UPDATE[] = "req-update";
     static constexpr char USER_CLICK[] = "user-click";
     static constexpr char UPDATE[] = "update";
+    static constexpr char REQ_SAMPLE[] = "req-sample";
+    static constexpr char SAMPLE[] = "sample"; // arg0: bytes of "data", a SystemSampler snapshot in hex
+    static constexpr char HELLO[] = "hello";   // arg0: FrameFormat bits offered by the lamp, the one chosen by the panel, then confirmed by the lamp
 
     LampModel();
     ~LampModel();
@@ -35,7 +39,9 @@ public:
     void reset(void);
 
     bool build(const char *device, const char *event, int arg0 = 0, int arg1 = 0);
+    bool addData(const void *data, size_t size);
     bool parse(const char *str);
+    bool parse(const char *str, size_t length); // not '\0' terminated, e.g. a frame in the receive ring
 
     const char *stringnify(void);
     void stringDelete(void *str);
@@ -50,6 +56,7 @@ private:
     static constexpr char EVENT[] = "event";
     static constexpr char ARG0[] = "arg0";
     static constexpr char ARG1[] = "arg1";
+    static constexpr char DATA[] = "data";
 
     cJSON *_root;
 
@@ -0,0 +1,240 @@
+/* Copyright 2024 teamprof.net@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include <string.h>
+#include <mdns.h>
+#include "AddressCache.h"
+#include "ArduProfFreeRTOS.h"
+
+static const char *TAG = "AddressCache";
+
+static constexpr char MDNS_SUFFIX[] = ".local";
+
+static uint32_t nowMs(void)
+{
+    return (uint32_t)(xTaskGetTickCount() * portTICK_PERIOD_MS);
+}
+
+AddressCache::NotifyFunc AddressCache::_notify = nullptr;
+void *AddressCache::_notifyArg = nullptr;
+
+AddressCache::AddressCache() : _entries(),
+                               _isStarted(false),
+                               _stats()
+{
+}
+
+bool AddressCache::begin(NotifyFunc notify, void *arg)
+{
+    _notify = notify;
+    _notifyArg = arg;
+    if (!_isStarted)
+    {
+        esp_err_t err = mdns_init();
+        _isStarted = err == ESP_OK || err == ESP_ERR_INVALID_STATE; // started already
+        if (!_isStarted)
+        {
+            ESP_LOGE(TAG, "%s: mdns_init() failed: %s", __func__, esp_err_to_name(err));
+        }
+    }
+    return _isStarted;
+}
+
+void AddressCache::onQueryEnd(mdns_search_once_t *search)
+{
+    if (_notify)
+    {
+        _notify(_notifyArg);
+    }
+}
+
+AddressCache::Entry *AddressCache::find(const char *host)
+{
+    for (auto &entry : _entries)
+    {
+        if (entry.host[0] && !strcmp(entry.host, host))
+        {
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+// the entry of "host", a free one or the oldest without a pending query if none
+AddressCache::Entry *AddressCache::add(const char *host)
+{
+    Entry *entry = find(host);
+    if (entry)
+    {
+        return entry;
+    }
+    if (strlen(host) >= ADDRESS_HOST_MAX)
+    {
+        return nullptr;
+    }
+    for (auto &candidate : _entries)
+    {
+        if (candidate.search)
+        {
+            continue;
+        }
+        if (!candidate.host[0])
+        {
+            entry = &candidate;
+            break;
+        }
+        if (!entry || candidate.resolvedMs < entry->resolvedMs)
+        {
+            entry = &candidate;
+        }
+    }
+    if (entry)
+    {
+        *entry = {};
+        strcpy(entry->host, host);
+    }
+    return entry;
+}
+
+bool AddressCache::lookup(const char *host, uint32_t &addr)
+{
+    Entry *entry = find(host);
+    if (!entry || !entry->isValid)
+    {
+        _stats.misses++;
+        return false;
+    }
+    _stats.hits++;
+    if (nowMs() - entry->resolvedMs >= entry->ttlMs)
+    {
+        _stats.stale++;
+    }
+    addr = entry->addr;
+    return true;
+}
+
+void AddressCache::store(const char *host, uint32_t addr, uint32_t ttlS)
+{
+    Entry *entry = add(host);
+    if (entry)
+    {
+        entry->addr = addr;
+        entry->resolvedMs = nowMs();
+        entry->ttlMs = (ttlS ? ttlS : ADDRESS_TTL_DEFAULT_S) * 1000;
+        entry->isValid = true;
+    }
+}
+
+void AddressCache::invalidate(const char *host)
+{
+    Entry *entry = find(host);
+    if (entry)
+    {
+        entry->isValid = false;
+        resolve(host);
+    }
+}
+
+bool AddressCache::resolve(const char *host)
+{
+    size_t length = strlen(host);
+    size_t suffixLength = sizeof(MDNS_SUFFIX) - 1;
+    if (!_isStarted || length <= suffixLength || strcmp(host + length - suffixLength, MDNS_SUFFIX))
+    {
+        return false;
+    }
+    Entry *entry = add(host);
+    if (!entry)
+    {
+        return false;
+    }
+    if (entry->search)
+    {
+        return true; // pending
+    }
+
+    // mDNS names the host without ".local"
+    char name[ADDRESS_HOST_MAX];
+    memcpy(name, host, length - suffixLength);
+    name[length - suffixLength] = '\0';
+    entry->search = mdns_query_async_new(name, NULL, NULL, MDNS_TYPE_A, ADDRESS_QUERY_TIMEOUT_MS, 1, onQueryEnd);
+    if (!entry->search)
+    {
+        ESP_LOGW(TAG, "%s: mdns_query_async_new(%s) failed", __func__, name);
+        return false;
+    }
+    return true;
+}
+
+bool AddressCache::isResolving(const char *host)
+{
+    Entry *entry = find(host);
+    return entry && entry->search;
+}
+
+void AddressCache::refresh(void)
+{
+    uint32_t now = nowMs();
+    for (auto &entry : _entries)
+    {
+        if (entry.host[0] && !entry.search && (!entry.isValid || now - entry.resolvedMs >= entry.ttlMs / 2))
+        {
+            resolve(entry.host);
+        }
+    }
+}
+
+void AddressCache::poll(void)
+{
+    for (auto &entry : _entries)
+    {
+        mdns_result_t *results = NULL;
+        uint8_t count = 0;
+        if (!entry.search || !mdns_query_async_get_results(entry.search, 0, &results, &count))
+        {
+            continue; // none or pending
+        }
+        mdns_query_async_delete(entry.search);
+        entry.search = nullptr;
+
+        bool isFound = false;
+        for (mdns_result_t *result = results; result && !isFound; result = result->next)
+        {
+            for (mdns_ip_addr_t *addr = result->addr; addr; addr = addr->next)
+            {
+                if (addr->addr.type == ESP_IPADDR_TYPE_V4)
+                {
+                    store(entry.host, addr->addr.u_addr.ip4.addr, result->ttl);
+                    isFound = true;
+                    break;
+                }
+            }
+        }
+        if (isFound)
+        {
+            _stats.resolved++;
+        }
+        else
+        {
+            _stats.failed++;
+            ESP_LOGW(TAG, "%s: %s not resolved", __func__, entry.host);
+        }
+        mdns_query_results_free(results);
+    }
+}
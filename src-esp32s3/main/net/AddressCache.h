@@ -0,0 +1,97 @@
+/* Copyright 2024 teamprof.net@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#define ADDRESS_CACHE_SIZE 4          // host names cached
+#define ADDRESS_HOST_MAX 32           // host name length, with '\0'
+#define ADDRESS_TTL_DEFAULT_S 120     // of a store() or an mDNS answer without TTL
+#define ADDRESS_QUERY_TIMEOUT_MS 3000 // an mDNS query not answered by then fails
+
+typedef struct mdns_search_once_s mdns_search_once_t;
+
+/////////////////////////////////////////////////////////////////////////////
+// IPv4 addresses by host name, so a reconnect starts connect() at once instead of after a
+// name lookup. "name.local" hosts are resolved in the background by mDNS queries
+// (mdns_query_async_new()) and renewed by refresh() before their TTL ends. Not thread safe:
+// used by the thread which owns it; the mDNS task only calls the NotifyFunc given to begin()
+/////////////////////////////////////////////////////////////////////////////
+class AddressCache
+{
+public:
+    // called on the mDNS task when a query ends: post a message to the owner, which calls poll()
+    typedef void (*NotifyFunc)(void *arg);
+
+    typedef struct _AddressStats
+    {
+        uint32_t hits;     // lookup() answered, "stale" included
+        uint32_t stale;    // lookup() answered past the TTL, renewal pending
+        uint32_t misses;   // lookup() without an address
+        uint32_t resolved; // mDNS answers
+        uint32_t failed;   // mDNS queries without an answer
+    } AddressStats;
+
+    AddressCache();
+
+    // start mDNS (mdns_init()), once the network is up; true if it runs, e.g. started by another component
+    bool begin(NotifyFunc notify, void *arg);
+
+    // the address of "host" (network byte order), also past its TTL: a failed connect() invalidates it
+    bool lookup(const char *host, uint32_t &addr);
+    void store(const char *host, uint32_t addr, uint32_t ttlS = ADDRESS_TTL_DEFAULT_S);
+    // drop the address of "host" and query it again
+    void invalidate(const char *host);
+
+    // start an mDNS query for "host" ("name.local"), false if it is no mDNS name or mDNS is down
+    bool resolve(const char *host);
+    bool isResolving(const char *host);
+    // query the hosts past half their TTL or without an address
+    void refresh(void);
+    // take the answers of the queries ended, after a NotifyFunc
+    void poll(void);
+
+    const AddressStats &stats(void)
+    {
+        return _stats;
+    }
+
+private:
+    typedef struct _Entry
+    {
+        char host[ADDRESS_HOST_MAX]; // "" if the entry is free
+        uint32_t addr;
+        uint32_t resolvedMs;
+        uint32_t ttlMs;
+        mdns_search_once_t *search; // query pending
+        bool isValid;
+    } Entry;
+
+    static NotifyFunc _notify;
+    static void *_notifyArg;
+    static void onQueryEnd(mdns_search_once_t *search);
+
+    Entry _entries[ADDRESS_CACHE_SIZE];
+    bool _isStarted;
+    AddressStats _stats;
+
+    Entry *find(const char *host);
+    Entry *add(const char *host);
+};
@@ -37,6 +37,7 @@
 
 #include "./QueueMain.h"
 #include "../AppContext.h"
+#include "../AppStats.h"
 #include "../ButtonID.h"
 #include "../inc/ConnectivityManagerImpl.h"
 
@@ -88,8 +89,10 @@ QueueMain *QueueMain::getInstance(void)
 ////////////////////////////////////////////////////////////////////////////////////////////
 // Thread for ESP32
 ////////////////////////////////////////////////////////////////////////////////////////////
-#define TASK_QUEUE_SIZE 128 // message queue size for app task
-static uint8_t ucQueueStorageArea[TASK_QUEUE_SIZE * sizeof(Message)];
+#define TASK_QUEUE_SIZE 128       // message queue size for app task
+#define TASK_URGENT_QUEUE_SIZE 8  // urgent lane: button clicks
+#define TASK_BULK_QUEUE_SIZE 32   // bulk lane: user commands from the panel
+static uint8_t ucQueueStorageArea[TASK_QUEUE_SIZE * sizeof(ardufreertos::QueueItem)];
 static StaticQueue_t xStaticQueue;
 
 ////////////////////////////////////////////////////////////////////////////////////////////
@@ -139,27 +142,29 @@ void QueueMain::printAppInfo(void)
 }
 
 QueueMain::QueueMain() : ardufreertos::MessageBus(TASK_QUEUE_SIZE, ucQueueStorageArea, &xStaticQueue),
-                         handlerMap(),
                          //  _fanDevice(),
                          _lightDevice(),
                          _buttonBoot(this)
 {
     _instance = this;
-
-    handlerMap = {
-        __EVENT_MAP(QueueMain, EventApp),
-        __EVENT_MAP(QueueMain, EventSystem),
-        __EVENT_MAP(QueueMain, EventNull), // {EventNull, &QueueMain::handlerEventNull},
-    };
+    createLanes(TASK_URGENT_QUEUE_SIZE, TASK_BULK_QUEUE_SIZE);
+    setTraceName(TAG);
 }
 #endif
 
+// setup event handlers
+__EVENT_TABLE_DEFINITION(QueueMain,
+                         __EVENT_MAP(QueueMain, EventApp),
+                         __EVENT_MAP(QueueMain, EventSystem),
+                         __EVENT_MAP(QueueMain, EventNull)); // {EventNull, &QueueMain::handlerEventNull},
+
 void QueueMain::start(void *ctx)
 {
     ESP_LOGI(TAG, "%s: core%d: uxTaskPriorityGet(nullptr)=%d, xPortGetFreeHeapSize()=%u, minimum free stack=%u",
              __func__, uxTaskPriorityGet(nullptr), xPortGetCoreID(), xPortGetFreeHeapSize(), uxTaskGetStackHighWaterMark(nullptr));
     // LOG_TRACE("on core ", xPortGetCoreID(), ", xPortGetFreeHeapSize()=", xPortGetFreeHeapSize());
     MessageBus::start(ctx);
+    watchStalls(TAG);
 
     printAppInfo();
 
@@ -207,6 +212,14 @@ void QueueMain::start(void *ctx)
 #endif // CONFIG_ENABLE_ENCRYPTED_OTA
 
 #if CONFIG_ENABLE_CHIP_SHELL
+    static const esp_matter::console::command_t commands[] = {
+        {
+            .name = "arduprof",
+            .description = "Dump message queue statistics, the message-flow trace, the stall records or the latest system sample. Usage: matter arduprof [reset|trace|stalls|sample]",
+            .handler = onConsoleStats,
+        },
+    };
+    esp_matter::console::add_commands(commands, sizeof(commands) / sizeof(commands[0]));
     esp_matter::console::diagnostics_register_commands();
     esp_matter::console::wifi_register_commands();
     esp_matter::console::init();
@@ -215,12 +228,7 @@ void QueueMain::start(void *ctx)
 
 void QueueMain::onMessage(const Message &msg)
 {
-    auto func = handlerMap[msg.event];
-    if (func)
-    {
-        (this->*func)(msg);
-    }
-    else
+    if (!handlerTable.dispatch(this, msg))
     {
         ESP_LOGW(TAG, "%s: Unsupported event=%d, iParam=%d, uParam=%u, lParam=%lu", __func__, msg.event, msg.iParam, msg.uParam, msg.lParam);
         // LOG_TRACE("Unsupported event=", msg.event, ", iParam=", msg.iParam, ", uParam=", msg.uParam, ", lParam=", msg.lParam);
@@ -277,7 +285,7 @@ void QueueMain::handlerUserCommand(const Message &msg)
         // ESP_LOGW(TAG, "%s: UsrReqUpdate", __func__);
         auto ctx = static_cast<AppContext *>(context());
         auto state = (uint32_t)(_lightDevice.getState());
-        postEvent(ctx->threadPanel, EventApp, AppDeviceUpdate, DeviceLamp, state);
+        ctx->broker->publishCoalesced(EventApp, AppDeviceUpdate, DeviceLamp, state);
         break;
     }
     case UsrClick:
@@ -289,7 +297,7 @@ void QueueMain::handlerUserCommand(const Message &msg)
             _lightDevice.clickButtonOn();
             auto ctx = static_cast<AppContext *>(context());
             auto state = (uint32_t)(_lightDevice.getState());
-            postEvent(ctx->threadPanel, EventApp, AppDeviceUpdate, DeviceLamp, state);
+            ctx->broker->publishCoalesced(EventApp, AppDeviceUpdate, DeviceLamp, state);
         }
         else
         {
@@ -310,7 +318,17 @@ void QueueMain::handlerButtonClick(const Message &msg)
     {
         ESP_LOGI(TAG, "%s: ButtonClick: buttonBoot", __func__);
         auto ctx = static_cast<AppContext *>(context());
-        postEvent(ctx->queueMain, EventApp, AppUserCommand, UsrClick, ButtonLampEspOn);
+        // posted to itself: blocking would deadlock, so a full queue is reported instead
+        Message click = {
+            .event = EventApp,
+            .iParam = AppUserCommand,
+            .uParam = UsrClick,
+            .lParam = ButtonLampEspOn,
+        };
+        if (post(ctx->queueMain, click, ardufreertos::OverflowReject) != ardufreertos::PostOk)
+        {
+            ESP_LOGE(TAG, "%s: ButtonClick lost, queueMain full", __func__);
+        }
     }
     else
     {
@@ -318,6 +336,42 @@ void QueueMain::handlerButtonClick(const Message &msg)
     }
 }
 
+esp_err_t QueueMain::onConsoleStats(int argc, char **argv)
+{
+    auto ctx = static_cast<AppContext *>(getInstance()->context());
+    ardufreertos::MessageBus *buses[] = {static_cast<QueueMain *>(ctx->queueMain), ctx->threadPanel};
+    const char *names[] = {"queueMain", "threadPanel"};
+    if (argc > 0 && strcmp(argv[0], "trace") == 0)
+    {
+        logMessageTrace(TAG);
+        return ESP_OK;
+    }
+    if (argc > 0 && strcmp(argv[0], "stalls") == 0)
+    {
+        logStallLog(TAG);
+        return ESP_OK;
+    }
+    if (argc > 0 && strcmp(argv[0], "sample") == 0)
+    {
+        logSystemSample(TAG);
+        return ESP_OK;
+    }
+
+    bool isReset = (argc > 0 && strcmp(argv[0], "reset") == 0);
+    for (size_t i = 0; i < sizeof(buses) / sizeof(buses[0]); i++)
+    {
+        if (isReset)
+        {
+            resetBusStats(buses[i]);
+        }
+        else
+        {
+            logBusStats(TAG, names[i], buses[i]);
+        }
+    }
+    return ESP_OK;
+}
+
 void QueueMain::onPublicEvent(const ChipDeviceEvent *event, intptr_t arg)
 {
     ESP_LOGI(TAG, "%s: event->Type=0x%04x (%u)", __func__, event->Type, event->Type);
@@ -335,7 +389,7 @@ void QueueMain::onPlatformSpecificEvent(const ChipDeviceEvent *event, intptr_t a
         {
             ESP_LOGI(TAG, "%s: IP_EVENT_STA_GOT_IP", __func__);
             auto ctx = static_cast<AppContext *>(context());
-            postEvent(ctx->threadPanel, EventSystem, SysNetworkAvailable, true);
+            ctx->broker->publishCoalesced(EventSystem, SysNetworkAvailable, true, 0, ardufreertos::CoalesceBySource);
             break;
         }
 
@@ -347,7 +401,7 @@ void QueueMain::onPlatformSpecificEvent(const ChipDeviceEvent *event, intptr_t a
         {
             ESP_LOGI(TAG, "%s: IP_EVENT_STA_LOST_IP", __func__);
             auto ctx = static_cast<AppContext *>(context());
-            postEvent(ctx->threadPanel, EventSystem, SysNetworkAvailable, false);
+            ctx->broker->publishCoalesced(EventSystem, SysNetworkAvailable, false, 0, ardufreertos::CoalesceBySource);
             break;
         }
 
@@ -405,6 +459,7 @@ void QueueMain::onPlatformSpecificEvent(const ChipDeviceEvent *event, intptr_t a
 
 void QueueMain::onMatterEvent(const ChipDeviceEvent *event, intptr_t arg)
 {
+    ardufreertos::MessageTrace::instance().nameTask("Matter"); // posts of the Matter callbacks
     // ESP_LOGI(TAG, "event->Type=0x%04x (%d)", event->Type, event->Type);
     switch (event->Type)
     {
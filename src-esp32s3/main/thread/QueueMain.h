@@ -18,7 +18,6 @@
  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 #pragma once
-#include <map>
 #include <esp_err.h>
 #include <esp_matter.h>
 #include <esp_matter_identify.h>
@@ -43,8 +42,7 @@ public:
     static void printAppInfo(void);
 
 protected:
-    typedef void (QueueMain::*funcPtr)(const Message &);
-    std::map<int16_t, funcPtr> handlerMap;
+    __EVENT_TABLE_DECLARATION(QueueMain, EventApp)
 
 private:
     static QueueMain *_instance;
@@ -59,6 +57,7 @@ private:
     esp_err_t onLightPreUpdate(uint32_t cluster_id, uint32_t attribute_id, esp_matter_attr_val_t *val, void *priv_data);
 
     static void onMatterEvent(const ChipDeviceEvent *event, intptr_t arg);
+    static esp_err_t onConsoleStats(int argc, char **argv);
     static esp_err_t onIdentification(identification::callback_type_t type, uint16_t endpoint_id, uint8_t effect_id,
                                       uint8_t effect_variant, void *priv_data);
     static esp_err_t onAttributeUpdate(attribute::callback_type_t type, uint16_t endpoint_id, uint32_t cluster_id,
@@ -18,12 +18,16 @@
  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/tcp.h>
+#include <lwip/netdb.h>
 
 #include "ArduProfFreeRTOS.h"
 #include "./ThreadPanel.h"
-#include "./TaskTcpClient.h"
 #include "../AppContext.h"
+#include "../AppStats.h"
 #include "../model/LampModel.h"
+#include "../model/LampCbor.h"
 
 static const char *TAG = "ThreadPanel";
 
@@ -51,44 +55,60 @@ ThreadPanel *ThreadPanel::getInstance(void)
 // #define RUNNING_CORE ARDUINO_RUNNING_CORE
 
 #define TASK_NAME "ThreadPanel"
-#define TASK_STACK_SIZE 4096
 #define TASK_PRIORITY 3
-#define TASK_QUEUE_SIZE 128 // message queue size for app task
+#define TASK_URGENT_QUEUE_SIZE 8 // urgent lane: timer ticks
+#define TASK_BULK_QUEUE_SIZE 32  // bulk lane: user commands from the panel
+#define TASK_BATCH_SIZE 16       // max messages dispatched per wake-up
+
+#define TCP_RETRY_DELAY_MS 3000       // first reconnect delay, doubled on each failure
+#define TCP_RETRY_MAX_DELAY_MS 60000  // reconnect delay limit
+#define USER_COMMAND_RETRY_MS 20      // a user command which finds queueMain full is posted again after this, by the MessageScheduler
+
+#define SERVER_NAME "unihiker.local"
+#define SERVER_PORT 8080
+#define TCP_CONNECT_TIMEOUT_MS 10000  // connect is awaited, the event loop keeps running
+#define TCP_SEND_TIMEOUT_MS 5000      // a server which takes no data for this long is disconnected
+#define TCP_KEEPALIVE_IDLE_S 15       // a silent link is probed after this, lost after the probes below
+#define TCP_KEEPALIVE_INTERVAL_S 5
+#define TCP_KEEPALIVE_COUNT 3
+#define TCP_HELLO_TIMEOUT_MS 2000     // a panel which does not answer the hello is an old one: FrameLine
+#define ADDRESS_REFRESH_MS 30000      // period of AddressCache::refresh(), well within the mDNS TTL (120 s)
+#define ADDRESS_ANSWER_MARGIN_MS 500  // the end of an mDNS query is awaited for ADDRESS_QUERY_TIMEOUT_MS plus this
 
 #define TASK_INIT_NAME "taskDelayInit"
 #define TASK_INIT_STACK_SIZE 4096
 #define TASK_INIT_PRIORITY 0
 
-static uint8_t ucQueueStorageArea[TASK_QUEUE_SIZE * sizeof(Message)];
-static StaticQueue_t xStaticQueue;
-
-static StackType_t xStack[TASK_STACK_SIZE];
-static StaticTask_t xTaskBuffer;
-
 ////////////////////////////////////////////////////////////////////////////////////////////
-ThreadPanel::ThreadPanel() : ardufreertos::ThreadBase(TASK_QUEUE_SIZE, ucQueueStorageArea, &xStaticQueue),
-                             handlerMap(),
-                             _timer1Hz("Timer 1Hz",
+ThreadPanel::ThreadPanel() : _timer1Hz("Timer 1Hz",
                                        pdMS_TO_TICKS(1000),
                                        [](TimerHandle_t xTimer)
                                        {
                                            auto instance = ThreadPanel::getInstance();
-                                           instance->postEvent(EventSystem, SysSoftwareTimer, 0, (uint32_t)xTimer);
+                                           instance->post(instance, ardufreertos::PriorityUrgent, SoftwareTimerTick{xTimer});
                                            //
                                        }),
                              _isNetworkAvailable(false),
                              _connectionState(ConnectionState::Disconnect),
                              _sock(-1),
-                             _hTaskConnect(NULL)
+                             _connection(0),
+                             _retryId(0),
+                             _retryDelayMs(TCP_RETRY_DELAY_MS),
+                             _addresses(),
+                             _refreshId(0),
+                             _isLampStatePending(false),
+                             _lampState(0),
+                             _txRing(),
+                             _isFlushing(false),
+                             _rxFrames(FrameLine),
+                             _txFormat(FrameLine),
+                             _isHelloAnswered(false),
+                             _isCbor(false)
 {
     _instance = this;
-
-    // setup event handlers
-    handlerMap = {
-        __EVENT_MAP(ThreadPanel, EventApp),
-        __EVENT_MAP(ThreadPanel, EventSystem),
-        __EVENT_MAP(ThreadPanel, EventNull), // {EventNull, &ThreadPanel::handlerEventNull},
-    };
+    createLanes(TASK_URGENT_QUEUE_SIZE, TASK_BULK_QUEUE_SIZE);
+    createMailbox(); // AppDeviceUpdate and SysNetworkAvailable are published coalesced
+    setBatchSize(TASK_BATCH_SIZE);
 }
 
 void ThreadPanel::start(void *ctx)
@@ -98,16 +118,17 @@ void ThreadPanel::start(void *ctx)
     // LOG_TRACE("on core ", xPortGetCoreID(), ", xPortGetFreeHeapSize()=", xPortGetFreeHeapSize());
     ThreadBase::start(ctx);
 
-    _taskHandle = xTaskCreateStaticPinnedToCore(
-        [](void *instance)
-        { static_cast<ThreadBase *>(instance)->run(); },
-        TASK_NAME,
-        TASK_STACK_SIZE, // This stack size can be checked & adjusted by reading the Stack Highwater
-        this,
-        TASK_PRIORITY, // Priority, with 3 (configMAX_PRIORITIES - 1) being the highest, and 0 being the lowest.
-        xStack,
-        &xTaskBuffer,
-        RUNNING_CORE);
+    auto context = static_cast<AppContext *>(ctx);
+    context->broker->subscribe(this, EventApp, AppDeviceUpdate);
+    context->broker->subscribe(this, EventSystem, SysNetworkAvailable);
+    watchStalls(TASK_NAME); // e.g. a slow handler or a large JSON build blocking the bus
+
+    // queue storage, stack and TCB are members: StaticRamBytes in .bss, no heap.
+    // PANEL_STACK_SIZE can be checked & adjusted by reading the Stack Highwater
+    ESP_LOGI(TAG, "%s: static RAM: queue=%u, task=%u bytes", __func__, QueueBytes, TaskBytes);
+    createTask(TASK_NAME,
+               TASK_PRIORITY, // Priority, with 3 (configMAX_PRIORITIES - 1) being the highest, and 0 being the lowest.
+               RUNNING_CORE);
 }
 #endif
 
@@ -118,22 +139,43 @@ void ThreadPanel::setup(void)
 }
 
 /////////////////////////////////////////////////////////////////////////////
+// setup event handlers
+__EVENT_TABLE_DEFINITION(ThreadPanel,
+                         __EVENT_MAP(ThreadPanel, EventApp),
+                         __EVENT_MAP(ThreadPanel, EventSystem),
+                         __EVENT_MAP(ThreadPanel, EventNull)); // {EventNull, &ThreadPanel::handlerEventNull},
+
 void ThreadPanel::onMessage(const Message &msg)
 {
     // ESP_LOGI(TAG, "%s: event=%d, iParam=%d, uParam=%u, lParam=%lu", __func__,, msg.event, msg.iParam, msg.uParam, msg.lParam);
     // LOG_TRACE("event=", msg.event, ", iParam=", msg.iParam, ", uParam=", msg.uParam, ", lParam=", msg.lParam);
-    auto func = handlerMap[msg.event];
-    if (func)
+    if (TypedHandlers::dispatch(this, msg))
     {
-        (this->*func)(msg);
+        return;
     }
-    else
+    if (!handlerTable.dispatch(this, msg))
     {
         ESP_LOGW(TAG, "%s: Unsupported event=%d, iParam=%d, uParam=%u, lParam=%lu", __func__, msg.event, msg.iParam, msg.uParam, msg.lParam);
         // LOG_TRACE("Unsupported event=", msg.event, ", iParam=", msg.iParam, ", uParam=", msg.uParam, ", lParam=", msg.lParam);
     }
 }
 
+void ThreadPanel::onBatchEnd(uint16_t count)
+{
+    // only the latest lamp state of a batch matters: send it once, or later if the panel is behind
+    if (_isLampStatePending && _txRing.size() < PANEL_TX_HIGH_WATERMARK)
+    {
+        _isLampStatePending = false;
+        sendLampState(_lampState);
+    }
+
+    // what the handlers of the batch queued leaves in one writev()
+    if (!_txRing.isEmpty() && !_isFlushing && _sock >= 0)
+    {
+        flushTcp(_sock);
+    }
+}
+
 /////////////////////////////////////////////////////////////////////////////
 __EVENT_FUNC_DEFINITION(ThreadPanel, EventApp, msg) // void ThreadPanel::handlerEventApp(const Message &msg)
 {
@@ -144,12 +186,16 @@ __EVENT_FUNC_DEFINITION(ThreadPanel, EventApp, msg) // void ThreadPanel::handler
     case AppDeviceUpdate:
         handlerUpdateDevice(msg);
         break;
-    case AppTcpConnection:
-        handlerTcpConnection(msg);
-        break;
     case AppUserCommand:
         handlerUserCommand(msg);
         break;
+    case AppTcpRetry:
+        handlerTcpRetry(msg);
+        break;
+    case AppAddressRefresh:
+    case AppAddressResolved:
+        handlerAddressCache(msg);
+        break;
     default:
         ESP_LOGW(TAG, "unsupported AppTriggerSource=%d", src);
         break;
@@ -161,9 +207,6 @@ __EVENT_FUNC_DEFINITION(ThreadPanel, EventSystem, msg) // void ThreadPanel::hand
     enum SystemTriggerSource src = static_cast<enum SystemTriggerSource>(msg.iParam);
     switch (src)
     {
-    case SysSoftwareTimer:
-        handlerSoftwareTimer((TimerHandle_t)(msg.lParam));
-        break;
     case SysNetworkAvailable:
     {
         handlerNetworkAvailable(msg);
@@ -189,41 +232,10 @@ void ThreadPanel::handlerUpdateDevice(const Message &msg)
     switch (device)
     {
     case DeviceLamp:
-        {
-            auto sock = _sock;
-            if (sock < 0)
-            {
-                ESP_LOGW(TAG, "%s: invalid socket", __func__);
-                return;
-            }
-
-            auto state = (int)msg.lParam;
-            LampModel model;
-            if (model.build(LampModel::NAME, LampModel::UPDATE, 0, state))
-            {
-                const char *str = model.stringnify();
-                if (str)
-                {
-                    ESP_LOGI(TAG, "%s: model.stringnify() returns %s", __func__, str);
-
-                    int err = send(sock, str, strlen(str), 0);
-                    if (err < 0)
-                    {
-                        ESP_LOGW(TAG, "%s: send() failed", __func__);
-                    }
-                }
-                else
-                {
-                    ESP_LOGI(TAG, "%s: model.stringnify() returns NULL", __func__);
-                }
-                model.stringDelete((void *)str);
-            }
-            else
-            {
-                ESP_LOGW(TAG, "%s: model.build() failed", __func__);
-            }
-            break;
-        }
+        // sent by onBatchEnd()
+        _lampState = (int)msg.lParam;
+        _isLampStatePending = true;
+        break;
     default:
         ESP_LOGW(TAG, "%s: unsupported device=%d", __func__, device);
         break;
@@ -236,82 +248,533 @@ void ThreadPanel::handlerUserCommand(const Message &msg)
     {
     case UsrReqUpdate:
     case UsrClick:
-    {
-        auto ctx = static_cast<AppContext *>(context());
-        postEvent(ctx->queueMain, msg);
+        postUserCommand(usrCmd, msg.lParam);
         break;
-    }
     default:
         ESP_LOGW(TAG, "%s: unsupported user command=%d", __func__, usrCmd);
         break;
     }
 }
-void ThreadPanel::handlerTcpConnection(const Message &msg)
+// a user command must survive a burst without blocking this thread: if queueMain is full, the
+// MessageScheduler posts it later (and again on each tick while the queue stays full)
+void ThreadPanel::postUserCommand(uint16_t command, uint32_t arg)
+{
+    auto ctx = static_cast<AppContext *>(context());
+    Message msg = {
+        .event = EventApp,
+        .iParam = AppUserCommand,
+        .uParam = command,
+        .lParam = arg,
+    };
+    auto result = post(ctx->queueMain, ardufreertos::PriorityBulk, msg, ardufreertos::OverflowReject, 0);
+    if (result == ardufreertos::PostRejected)
+    {
+        ESP_LOGW(TAG, "%s: queueMain full, user command=%u retried in %d ms", __func__, command, USER_COMMAND_RETRY_MS);
+        if (postEventDelayed(ctx->queueMain, USER_COMMAND_RETRY_MS, EventApp, AppUserCommand, command, arg))
+        {
+            return;
+        }
+    }
+    if (!ardufreertos::isPosted(result))
+    {
+        ESP_LOGE(TAG, "%s: user command=%u lost, result=%d", __func__, command, result);
+    }
+}
+ardufreertos::Coroutine ThreadPanel::runTcpClient(void)
+{
+    // TCP client as a coroutine of this thread: connect(), recv() and send() (flushTcp()) are
+    // awaited on the shared IoPoller task, no task or stack of its own and none created per connection
+
+    ///////////////////////////////////////////////////////////////////////////
+    // connect to server: the cached address at once. Only without one, or if it fails (invalidated),
+    // the answer of an mDNS query of _addresses is awaited: no blocking lookup, and a failed
+    // connection is reported as ErrDnsLookup only if that query fails
+    int sock = -1;
+    for (int attempt = 0;; attempt++)
+    {
+        struct sockaddr_in server = {};
+        server.sin_family = AF_INET;
+        server.sin_port = htons(SERVER_PORT);
+        bool isCached = attempt == 0 && _addresses.lookup(SERVER_NAME, server.sin_addr.s_addr);
+        if (isCached)
+        {
+            ESP_LOGI(TAG, "%s: cached IP=%s", __func__, inet_ntoa(server.sin_addr));
+        }
+        else
+        {
+            // a query may be running already (network up, invalidate()): its end is awaited, the event loop keeps running.
+            // AppAddressResolved of other hosts are taken too, and polled
+            bool isResolving = _addresses.isResolving(SERVER_NAME) || _addresses.resolve(SERVER_NAME);
+            while (isResolving)
+            {
+                auto notified = co_await nextEvent(EventApp, AppAddressResolved, ADDRESS_QUERY_TIMEOUT_MS + ADDRESS_ANSWER_MARGIN_MS);
+                _addresses.poll();
+                isResolving = notified && _addresses.isResolving(SERVER_NAME);
+            }
+            if (!_addresses.lookup(SERVER_NAME, server.sin_addr.s_addr))
+            {
+                // a query still pending goes on: its answer is cached for the next attempt
+                ESP_LOGE(TAG, "%s: mDNS query of %s failed", __func__, SERVER_NAME);
+                post(this, TcpConnection{false, ErrDnsLookup});
+                co_return;
+            }
+            ESP_LOGI(TAG, "%s: mDNS answer: IP=%s", __func__, inet_ntoa(server.sin_addr));
+        }
+
+        sock = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+        if (sock < 0)
+        {
+            ESP_LOGE(TAG, "%s: Unable to create socket: errno %d", __func__, errno);
+            post(this, TcpConnection{false, ErrCreateSocket});
+            co_return;
+        }
+        _sock = sock;
+        ESP_LOGI(TAG, "%s: Socket created: sock=%d", __func__, sock);
+
+        int err = co_await connectAsync(sock, (struct sockaddr *)&server, sizeof(server), TCP_CONNECT_TIMEOUT_MS);
+        if (err == 0)
+        {
+            break;
+        }
+        if (!isCached)
+        {
+            ESP_LOGE(TAG, "%s: Socket unable to connect: errno %d", __func__, -err);
+            post(this, TcpConnection{false, ErrConnect});
+            co_return;
+        }
+
+        // the server may have a new address: resolve it, with a new socket (a failed one cannot connect again)
+        ESP_LOGW(TAG, "%s: cached IP=%s failed: errno %d", __func__, inet_ntoa(server.sin_addr), -err);
+        _addresses.invalidate(SERVER_NAME);
+        closeSocket();
+    }
+    ESP_LOGI(TAG, "%s: connected %s:%d", __func__, SERVER_NAME, SERVER_PORT);
+
+    // a server gone without a FIN (power loss, Wi-Fi roaming) ends recvAsync() with an error
+    int keepAlive = 1, idle = TCP_KEEPALIVE_IDLE_S, interval = TCP_KEEPALIVE_INTERVAL_S, count = TCP_KEEPALIVE_COUNT;
+    setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, &keepAlive, sizeof(keepAlive));
+    setsockopt(sock, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+    setsockopt(sock, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval));
+    setsockopt(sock, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count));
+    // the frames of a batch are coalesced by _txRing already: Nagle would only delay them
+    int noDelay = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    ///////////////////////////////////////////////////////////////////////////
+
+    ///////////////////////////////////////////////////////////////////////////
+    // receiver: other messages are handled while waiting for data. The stream is framed
+    // (FrameDecoder), a read may hold several messages or a part of one. The format is negotiated
+    // by a hello: the connection is reported once the panel answers, or it times out
+    _rxFrames.reset(FrameLine);
+    _txFormat = FrameLine;
+    _isHelloAnswered = false;
+    _isCbor = false;
+    sendHello(FrameLine | FrameLength, LampCbor::EncodingJson | LampCbor::EncodingCbor);
+
+    bool isReported = false;
+    while (true)
+    {
+        size_t room;
+        char *buffer = _rxFrames.writable(room);
+        if (room == 0)
+        {
+            ESP_LOGW(TAG, "%s: receive buffer full", __func__);
+            break;
+        }
+        int len = co_await recvAsync(sock, buffer, room, isReported ? -1 : TCP_HELLO_TIMEOUT_MS);
+        if (len == -ETIMEDOUT && !isReported)
+        {
+            ESP_LOGI(TAG, "%s: no hello answer, FrameLine", __func__);
+            isReported = true;
+            post(this, TcpConnection{true, ErrNone});
+            continue;
+        }
+        if (len <= 0)
+        {
+            break;
+        }
+        _rxFrames.commit(len);
+
+        StreamFrame frame;
+        while (_rxFrames.next(frame))
+        {
+            processTcpFrame(frame);
+        }
+        if (_rxFrames.isBroken())
+        {
+            ESP_LOGW(TAG, "%s: frame larger than %u bytes, stream lost", __func__, PANEL_RX_BUF_SIZE);
+            break;
+        }
+        if (_isHelloAnswered && !isReported)
+        {
+            isReported = true;
+            post(this, TcpConnection{true, ErrNone});
+        }
+    }
+    ///////////////////////////////////////////////////////////////////////////
+
+    post(this, TcpConnection{false, ErrDisconnect});
+}
+void ThreadPanel::processTcpFrame(const StreamFrame &frame)
 {
-    bool isSuccess = (bool)msg.uParam;
-    if (isSuccess)
+    const char *data = frame.data;
+    if (frame.tail)
+    {
+        frame.copyTo(_rxScratch);
+        data = _rxScratch;
+    }
+
+    if (_isCbor)
+    {
+        ESP_LOGI(TAG, "%s: received %u bytes of CBOR", __func__, frame.size());
+        LampCbor cborModel;
+        if (cborModel.parse((const uint8_t *)data, frame.size()))
+        {
+            processLampEvent(cborModel.device(), cborModel.event(), cborModel.arg0(), cborModel.arg1());
+        }
+        else
+        {
+            ESP_LOGW(TAG, "%s: cborModel.parse() failed", __func__);
+        }
+        return;
+    }
+
+    ESP_LOGI(TAG, "%s: received %u bytes: %.*s", __func__, frame.size(), (int)frame.size(), data);
+    LampModel jsonModel;
+    if (jsonModel.parse(data, frame.size()))
+    {
+        processLampEvent(jsonModel.device(), jsonModel.event(), jsonModel.arg0(), jsonModel.arg1());
+    }
+    else
+    {
+        ESP_LOGW(TAG, "%s: jsonModel.parse() failed", __func__);
+    }
+}
+void ThreadPanel::processLampEvent(const char *device, const char *event, int arg0, int arg1)
+{
+    if (!device || !event)
+    {
+        ESP_LOGW(TAG, "%s: device or event missing", __func__);
+        return;
+    }
+    ESP_LOGI(TAG, "%s: device=%s, event=%s, arg0=%d, arg1=%d", __func__, device, event, arg0, arg1);
+    if (strcmp(device, LampModel::NAME))
+    {
+        ESP_LOGW(TAG, "%s: unsupported device=%s, event=%s, arg0=%d, arg1=%d", __func__, device, event, arg0, arg1);
+    }
+
+    // process lamp device event
+    if (!strcmp(event, LampModel::HELLO))
+    {
+        if (_isHelloAnswered)
+        {
+            ESP_LOGW(TAG, "%s: hello answered twice, ignored", __func__);
+            return;
+        }
+        // the panel chose one of the formats and encodings offered: its frames after this one are in them.
+        // The answer may come after TCP_HELLO_TIMEOUT_MS, with lines sent meanwhile: the panel reads
+        // lines until the confirmation, the last one, and the frames of this side after it are in them too
+        FrameFormat format = arg0 == FrameLength ? FrameLength : FrameLine;
+        int encoding = format == FrameLength && arg1 == LampCbor::EncodingCbor ? LampCbor::EncodingCbor : LampCbor::EncodingJson;
+        ESP_LOGI(TAG, "%s: hello: format=%d, encoding=%d", __func__, format, encoding);
+        _isHelloAnswered = true;
+        _rxFrames.setFormat(format);
+        _isCbor = encoding == LampCbor::EncodingCbor;
+        if (!sendHello(format, encoding))
+        {
+            // the panel would wait for the confirmation forever: start over (reported by runTcpClient())
+            ESP_LOGW(TAG, "%s: hello confirmation not queued, disconnect", __func__);
+            shutdown(_sock, SHUT_RDWR);
+            return;
+        }
+        _txFormat = format;
+    }
+    else if (!strcmp(event, LampModel::REQ_UPDATE))
+    {
+        ESP_LOGI(TAG, "%s: req-update event", __func__);
+        // posted, not call(): QueueMain publishes the state (AppDeviceUpdate), sent by onBatchEnd(),
+        // and this thread keeps dispatching while the device answers
+        postUserCommand(UsrReqUpdate, 0);
+    }
+    else if (!strcmp(event, LampModel::USER_CLICK))
+    {
+        auto buttonID = arg0;
+        ESP_LOGI(TAG, "%s: user-click event: buttonID=%d", __func__, buttonID);
+        postUserCommand(UsrClick, (uint32_t)buttonID);
+    }
+    else if (!strcmp(event, LampModel::REQ_SAMPLE))
+    {
+        sendSystemSample();
+    }
+    else
+    {
+        ESP_LOGW(TAG, "%s: unsupported lamp event=%s, arg0=%d, arg1=%d", __func__, event, arg0, arg1);
+    }
+}
+void ThreadPanel::on(const TcpConnection &connection)
+{
+    if (connection.isConnected)
     {
         ESP_LOGI(TAG, "%s: Connect success", __func__);
         _connectionState = ConnectionState::Connect;
+        _retryDelayMs = TCP_RETRY_DELAY_MS;
         // _timer1Hz.start();
     }
     else
     {
-        ESP_LOGI(TAG, "%s: %s", __func__, msg.lParam == ErrDisconnect ? "Disconnect" : "Connect failed");
+        ESP_LOGI(TAG, "%s: %s", __func__, connection.error == ErrDisconnect ? "Disconnect" : "Connect failed");
         _connectionState = ConnectionState::Disconnect;
         // _timer1Hz.stop();
+        auto &stats = _txRing.stats();
+        ESP_LOGI(TAG, "%s: tx: frames=%lu, bytes=%lu, flushes=%lu, dropped=%lu, maxFill=%u", __func__,
+                 stats.frames, stats.bytes, stats.flushes, stats.dropped, stats.maxFill);
+        _txRing.resetStats();
 
         closeSocket();
 
-        TaskHandle_t handle = _hTaskConnect;
-        _hTaskConnect = NULL;
-        if (handle)
+        // reconnect later as a scheduled message, the event loop keeps running meanwhile
+        if (_isNetworkAvailable)
+        {
+            ESP_LOGI(TAG, "%s: reconnect in %lu ms", __func__, _retryDelayMs);
+            cancelScheduled(_retryId);
+            _retryId = postEventDelayed(_retryDelayMs, EventApp, AppTcpRetry);
+            _retryDelayMs = _retryDelayMs * 2 < TCP_RETRY_MAX_DELAY_MS ? _retryDelayMs * 2 : TCP_RETRY_MAX_DELAY_MS;
+        }
+    }
+}
+ardufreertos::Coroutine ThreadPanel::flushTcp(int sock)
+{
+    // the connection, not the fd: a socket of the next connection may get the same number
+    uint32_t connection = _connection;
+    _isFlushing = true;
+    while (!_txRing.isEmpty() && connection == _connection)
+    {
+        // all queued, the part at the end of the ring and the one wrapped around, in one sendmsg()
+        const char *part[2];
+        size_t length[2];
+        int count = _txRing.peek(part, length);
+        struct iovec iov[2];
+        for (int i = 0; i < count; i++)
+        {
+            iov[i].iov_base = (void *)part[i];
+            iov[i].iov_len = length[i];
+        }
+        int len = co_await sendvAsync(sock, iov, count, TCP_SEND_TIMEOUT_MS);
+        if (connection != _connection)
         {
-            // ESP_LOGI(TAG, "%s: delete taskTcpClient", __func__);
-            vTaskDelete(handle);
+            break; // closed meanwhile, _txRing belongs to the next connection
         }
+        if (len < 0 && len != -EAGAIN)
+        {
+            // ends recvAsync() of runTcpClient(), which reports the disconnection
+            ESP_LOGW(TAG, "%s: send failed: errno %d, %u bytes discarded", __func__, -len, _txRing.size());
+            _txRing.clear();
+            shutdown(sock, SHUT_RDWR);
+            break;
+        }
+        if (len > 0)
+        {
+            _txRing.consume(len); // a partial write leaves the rest queued
+        }
+    }
+    _isFlushing = false;
+    if (!_txRing.isEmpty() && _sock >= 0)
+    {
+        flushTcp(_sock); // queued for a new connection while this one was ending
+    }
+}
 
-        vTaskDelay(pdMS_TO_TICKS(3000));
-        if (_isNetworkAvailable)
+// queue a message without blocking this thread, sent at the end of the batch (onBatchEnd())
+bool ThreadPanel::sendTcpFrame(const char *data, size_t length)
+{
+    if (_sock < 0 || _connectionState != ConnectionState::Connect)
+    {
+        ESP_LOGW(TAG, "%s: not connected", __func__);
+        return false;
+    }
+    return queueTcpFrame(data, length);
+}
+
+// a frame is queued whole or not at all, the stream stays in sync if the ring is full
+bool ThreadPanel::queueTcpFrame(const char *data, size_t length)
+{
+    char header[FRAME_HEADER_MAX];
+    size_t headerLength = frameHeader(_txFormat, length, header);
+    const char *trailer = frameTrailer(_txFormat);
+    size_t trailerLength = strlen(trailer);
+    if (length > FRAME_LENGTH_MAX || !_txRing.append(header, headerLength, data, length, trailer, trailerLength))
+    {
+        ESP_LOGW(TAG, "%s: %u bytes dropped, %u bytes waiting", __func__, headerLength + length + trailerLength, _txRing.size());
+        return false;
+    }
+    return true;
+}
+
+// offer the frame formats of FrameDecoder and the encodings, or confirm the ones answered, as a JSON line
+// in the current format: an old panel reads lines only and ignores the event
+bool ThreadPanel::sendHello(int formats, int encodings)
+{
+    bool isQueued = false;
+    LampModel model;
+    if (model.build(LampModel::NAME, LampModel::HELLO, formats, encodings))
+    {
+        const char *str = model.stringnify();
+        if (str)
         {
-            _connectionState = ConnectionState::Connecting;
-            TaskTcpClient::start(this);
+            isQueued = queueTcpFrame(str, strlen(str));
         }
+        model.stringDelete((void *)str);
+    }
+    return isQueued;
+}
+
+void ThreadPanel::handlerTcpRetry(const Message &msg)
+{
+    _retryId = 0;
+    if (_isNetworkAvailable && _connectionState == ConnectionState::Disconnect)
+    {
+        _connectionState = ConnectionState::Connecting;
+        runTcpClient();
     }
 }
 void ThreadPanel::handlerNetworkAvailable(const Message &msg)
 {
     bool isAvailable = (bool)msg.uParam;
     ESP_LOGI(TAG, "%s: isAvailable=%d, _connectionState=%d", __func__, isAvailable, _connectionState);
+    cancelScheduled(_refreshId);
+    _refreshId = 0;
+    if (isAvailable && _addresses.begin([](void *arg)
+                                        {
+                                            // on the mDNS task
+                                            auto instance = static_cast<ThreadPanel *>(arg);
+                                            instance->postEvent(instance, EventApp, AppAddressResolved);
+                                            //
+                                        },
+                                        this))
+    {
+        // resolve ahead of the connection, and again before the TTL ends
+        _addresses.resolve(SERVER_NAME);
+        _refreshId = postEventPeriodic(ADDRESS_REFRESH_MS, EventApp, AppAddressRefresh);
+    }
+
     if (isAvailable && _connectionState == ConnectionState::Disconnect)
     {
+        cancelScheduled(_retryId); // connect now instead
+        _retryId = 0;
+        _retryDelayMs = TCP_RETRY_DELAY_MS;
 
         _connectionState = ConnectionState::Connecting;
-        TaskTcpClient::start(this);
+        runTcpClient();
     }
-    else
+    else if (!isAvailable && _sock >= 0)
     {
-        closeSocket();
+        // ends the awaits of runTcpClient(), which reports the disconnection: the socket is closed by
+        // on(TcpConnection) once the coroutine is done with it, not while the IoPoller still waits on it
+        shutdown(_sock, SHUT_RDWR);
     }
     _isNetworkAvailable = isAvailable;
 }
 
-void ThreadPanel::handlerSoftwareTimer(TimerHandle_t xTimer)
+void ThreadPanel::handlerAddressCache(const Message &msg)
 {
-    if (xTimer == _timer1Hz.timer())
+    if (msg.iParam == AppAddressResolved)
     {
-        ESP_LOGI(TAG, "%s: _timer1Hz", __func__);
+        _addresses.poll();
     }
     else
     {
-        ESP_LOGI(TAG, "%s: unsupported timer handle=0x%08lx", __func__, (uint32_t)(xTimer));
+        _addresses.refresh();
     }
+    auto &stats = _addresses.stats();
+    ESP_LOGD(TAG, "%s: hits=%lu (stale %lu), misses=%lu, resolved=%lu, failed=%lu", __func__,
+             stats.hits, stats.stale, stats.misses, stats.resolved, stats.failed);
+}
+
+void ThreadPanel::on(const SoftwareTimerTick &tick)
+{
+    if (tick.timer == _timer1Hz.timer())
+    {
+        logBusStats(TAG, "_timer1Hz", this);
+    }
+    else
+    {
+        ESP_LOGI(TAG, "%s: unsupported timer handle=%p", __func__, tick.timer);
+    }
+}
+
+// encoded as negotiated by the hello, LampCbor or LampModel (JSON)
+bool ThreadPanel::sendLampEvent(const char *event, int arg0, int arg1, const void *data, size_t size)
+{
+    if (_isCbor)
+    {
+        static uint8_t buffer[PANEL_TX_BUF_SIZE]; // too large for the task stack
+        LampCbor cborModel;
+        size_t length = cborModel.build(buffer, sizeof(buffer), LampModel::NAME, event, arg0, arg1, data, size);
+        if (!length)
+        {
+            ESP_LOGW(TAG, "%s: cborModel.build() failed", __func__);
+            return false;
+        }
+        return sendTcpFrame((const char *)buffer, length);
+    }
+
+    LampModel model;
+    if (!model.build(LampModel::NAME, event, arg0, arg1) || (data && !model.addData(data, size)))
+    {
+        ESP_LOGW(TAG, "%s: model.build() failed", __func__);
+        return false;
+    }
+    bool isSent = false;
+    const char *str = model.stringnify();
+    if (str)
+    {
+        isSent = sendTcpFrame(str, strlen(str));
+    }
+    else
+    {
+        ESP_LOGI(TAG, "%s: model.stringnify() returns NULL", __func__);
+    }
+    model.stringDelete((void *)str);
+    return isSent;
+}
+
+void ThreadPanel::sendLampState(int state)
+{
+    if (_sock < 0)
+    {
+        ESP_LOGW(TAG, "%s: invalid socket", __func__);
+        return;
+    }
+    ESP_LOGI(TAG, "%s: state=%d", __func__, state);
+    sendLampEvent(LampModel::UPDATE, 0, state);
+}
+
+void ThreadPanel::sendSystemSample(void)
+{
+    if (_sock < 0)
+    {
+        ESP_LOGW(TAG, "%s: invalid socket", __func__);
+        return;
+    }
+
+    if (_txRing.size() >= PANEL_TX_HIGH_WATERMARK)
+    {
+        // a slow panel gets the next one: the lamp state and user commands go first
+        ESP_LOGW(TAG, "%s: panel behind, %u bytes waiting: sample skipped", __func__, _txRing.size());
+        return;
+    }
+
+    static uint8_t snapshot[ardufreertos::SystemSampler::SnapshotSize]; // too large for the task stack
+    size_t size = ardufreertos::SystemSampler::instance().snapshot(snapshot, sizeof(snapshot));
+    sendLampEvent(LampModel::SAMPLE, (int)size, 0, snapshot, size);
 }
 
 void ThreadPanel::closeSocket(void)
 {
     int sock = _sock;
     _sock = -1;
+    _connection++; // ends flushTcp() of this socket
+    _txRing.clear();
     if (sock != -1)
     {
         // ESP_LOGI(TAG, "%s: shutdown and close socket: sock=%d", __func__, sock);
@@ -18,13 +18,20 @@
  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 #pragma once
-#include <map>
 #include "ArduProfFreeRTOS.h"
 #include "./AppEvent.h"
+#include "../AppMessage.h"
+#include "../net/AddressCache.h"
 
-class TaskTcpClient;
+class LampModel;
 
-class ThreadPanel : public ardufreertos::ThreadBase
+#define PANEL_QUEUE_SIZE 128  // message queue size (normal lane) for app task
+#define PANEL_STACK_SIZE 4096 // bytes
+#define PANEL_TX_BUF_SIZE 4096 // output ring waiting for the socket to become writable (power of 2), a system sample is ~2 KB of JSON
+#define PANEL_TX_HIGH_WATERMARK 2048 // output waiting above which samples are skipped and the lamp state waits (coalesced)
+#define PANEL_RX_BUF_SIZE 1024 // receive ring of the framed stream, the largest frame accepted (power of 2)
+
+class ThreadPanel : public ardufreertos::StaticThread<PANEL_QUEUE_SIZE, PANEL_STACK_SIZE>
 {
 public:
     typedef enum _ConnectionState
@@ -40,27 +47,65 @@ public:
 
     virtual void start(void *);
     virtual void onMessage(const Message &msg);
+    virtual void onBatchEnd(uint16_t count);
 
 protected:
-    typedef void (ThreadPanel::*handlerFunc)(const Message &);
-    std::map<int16_t, handlerFunc> handlerMap;
+    __EVENT_TABLE_DECLARATION(ThreadPanel, EventApp)
+    typedef MessageTypes<SoftwareTimerTick, TcpConnection> TypedHandlers;
 
 private:
-    friend TaskTcpClient;
+    friend TypedHandlers;
 
     static ThreadPanel *_instance;
     ardufreertos::PeriodicTimer _timer1Hz;
     bool _isNetworkAvailable;
     ConnectionState _connectionState;
     int _sock;
-    TaskHandle_t _hTaskConnect;
+    uint32_t _connection; // generation of _sock, incremented by closeSocket()
+
+    // reconnect backoff, AppTcpRetry is a scheduled message
+    ardufreertos::ScheduleId _retryId;
+    uint32_t _retryDelayMs;
+
+    // server address resolved ahead of the reconnects, renewed by the periodic AppAddressRefresh
+    AddressCache _addresses;
+    ardufreertos::ScheduleId _refreshId;
+
+    // latest lamp state of current batch, sent in onBatchEnd()
+    bool _isLampStatePending;
+    int _lampState;
+
+    // output not taken by the socket yet: frames queued by the handlers, sent by flushTcp() once per batch
+    SendRing<PANEL_TX_BUF_SIZE> _txRing;
+    bool _isFlushing;
+
+    // framed input, FrameLine until the panel answers the hello of runTcpClient()
+    FrameDecoder<PANEL_RX_BUF_SIZE> _rxFrames;
+    char _rxScratch[PANEL_RX_BUF_SIZE]; // a frame which wraps around the end of _rxFrames, made contiguous
+    FrameFormat _txFormat; // FrameLine up to the confirmation of the hello answer
+    bool _isHelloAnswered;
+    bool _isCbor; // messages are LampCbor instead of LampModel (JSON), both ways
 
     virtual void setup(void);
     void handlerUpdateDevice(const Message &msg);
-    void handlerTcpConnection(const Message &msg);
+    void handlerTcpRetry(const Message &msg);
     void handlerUserCommand(const Message &msg);
     void handlerNetworkAvailable(const Message &msg);
-    void handlerSoftwareTimer(TimerHandle_t xTimer);
+    void handlerAddressCache(const Message &msg);
+    void postUserCommand(uint16_t command, uint32_t arg);
+    void on(const SoftwareTimerTick &tick);
+    void on(const TcpConnection &connection);
+
+    ardufreertos::Coroutine runTcpClient(void);
+    ardufreertos::Coroutine flushTcp(int sock);
+    bool sendTcpFrame(const char *data, size_t length);
+    bool queueTcpFrame(const char *data, size_t length);
+    bool sendHello(int formats, int encodings);
+    void processTcpFrame(const StreamFrame &frame);
+    bool sendLampEvent(const char *event, int arg0, int arg1, const void *data = nullptr, size_t size = 0);
+    void sendLampState(int state);
+    void sendSystemSample(void);
+    void processLampEvent(const char *device, const char *event, int arg0, int arg1);
 
     void closeSocket(void);
 
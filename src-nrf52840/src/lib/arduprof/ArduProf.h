@@ -19,8 +19,10 @@
  */
 #pragma once
 #include "./type/Message.h"
+#include "./type/EventTable.h"
 
 #ifdef __ZEPHYR__
+#include "./os/zephyr/MessageFifo.h"
 #include "./os/zephyr/MessageQueue.h"
 #include "./os/zephyr/MessageBus.h"
 #endif
\ No newline at end of file
@@ -20,13 +20,22 @@
 #pragma once
 #include <stdbool.h>
 #include "./MessageQueue.h"
+#include "../../type/MessageStats.h"
 
 #ifdef __ZEPHYR__
 
+#ifndef ARDUPROF_POLL_SOURCES
+#define ARDUPROF_POLL_SOURCES 4 // MessageFifo sources of one MessageBus, all waited for by a single k_poll()
+#endif
+
 class MessageBus : public MessageQueue
 {
 public:
-    MessageBus(k_msgq *queue) : MessageQueue(queue), _context(nullptr), _isDone(false)
+    MessageBus(k_msgq *queue) : MessageQueue(queue), _context(nullptr), _isDone(false), _batchSize(1), _batchStats(), _sourceCount(0), _pollCount(0), _nextSource(0)
+    {
+    }
+
+    MessageBus(MessageFifo *fifo) : MessageQueue(fifo), _context(nullptr), _isDone(false), _batchSize(1), _batchStats(), _sourceCount(0), _pollCount(0), _nextSource(0)
     {
     }
 
@@ -41,13 +50,45 @@ public:
 
     virtual void onMessage(const Message &msg) = 0;
 
+    // called before the first / after the last message of each batch dispatched by messageLoop()
+    virtual void onBatchBegin(void) {}
+    virtual void onBatchEnd(uint16_t /*count*/) {}
+
+    // also dispatch the messages of "fifo", e.g. one source per producer (BLE, button) with a slab of its own.
+    // Call before messageLoop(); the queue of the bus and the sources are serviced round-robin, one message each
+    bool addSource(MessageFifo *fifo)
+    {
+        if (fifo == nullptr || _sourceCount >= ARDUPROF_POLL_SOURCES)
+        {
+            return false;
+        }
+        _sources[_sourceCount++] = fifo;
+        _pollCount = 0; // rebuild the poll events
+        return true;
+    }
+
+    // wait up to "timeout" for a message, then dispatch it and up to (batchSize - 1) messages already queued
     virtual void messageLoop(k_timeout_t timeout = K_FOREVER)
     // virtual void messageLoop(k_timeout_t timeout = K_MSEC(1000))
     {
+        if (_fifo || _sourceCount)
+        {
+            pollLoop(timeout);
+            return;
+        }
+
         Message msg;
         if (!k_msgq_get(queue(), &msg, timeout))
         {
-            onMessage(msg);
+            onBatchBegin();
+            uint16_t count = 0;
+            do
+            {
+                onMessage(msg);
+                count++;
+            } while (count < _batchSize && !k_msgq_get(queue(), &msg, K_NO_WAIT));
+            onBatchEnd(count);
+            _batchStats.update(count);
         }
     }
 
@@ -64,9 +105,124 @@ public:
         return _context;
     }
 
+    // maximum number of messages dispatched per wake-up, 1 (default) dispatches one message per wake-up
+    void setBatchSize(uint16_t batchSize)
+    {
+        _batchSize = batchSize ? batchSize : 1;
+    }
+    uint16_t batchSize(void)
+    {
+        return _batchSize;
+    }
+
+    const BatchStats &batchStats(void)
+    {
+        return _batchStats;
+    }
+    void resetBatchStats(void)
+    {
+        _batchStats.reset();
+    }
+
 protected:
     void *_context;
     bool _isDone;
+
+    uint16_t _batchSize;
+    BatchStats _batchStats;
+
+    MessageFifo *_sources[ARDUPROF_POLL_SOURCES];
+    uint8_t _sourceCount;
+    k_poll_event _pollEvents[ARDUPROF_POLL_SOURCES + 2]; // k_msgq, own fifo, sources
+    uint8_t _pollCount;
+    uint8_t _nextSource; // index in _pollEvents order of the first queue serviced by the next batch
+
+    void initPollEvents(void)
+    {
+        _pollCount = 0;
+        if (_queue)
+        {
+            k_poll_event_init(&_pollEvents[_pollCount++], K_POLL_TYPE_MSGQ_DATA_AVAILABLE, K_POLL_MODE_NOTIFY_ONLY, _queue);
+        }
+        if (_fifo)
+        {
+            k_poll_event_init(&_pollEvents[_pollCount++], K_POLL_TYPE_FIFO_DATA_AVAILABLE, K_POLL_MODE_NOTIFY_ONLY, _fifo->fifo());
+        }
+        for (uint8_t i = 0; i < _sourceCount; i++)
+        {
+            k_poll_event_init(&_pollEvents[_pollCount++], K_POLL_TYPE_FIFO_DATA_AVAILABLE, K_POLL_MODE_NOTIFY_ONLY, _sources[i]->fifo());
+        }
+    }
+
+    // one k_poll() on all queues, then a batch taking one message of each queue in turn, so that a busy one cannot
+    // starve the others; the first queue serviced rotates from batch to batch. Messages are handled in their slab block
+    void pollLoop(k_timeout_t timeout)
+    {
+        if (_pollCount == 0)
+        {
+            initPollEvents();
+        }
+        if (k_poll(_pollEvents, _pollCount, timeout) != 0)
+        {
+            return; // timeout
+        }
+        for (uint8_t i = 0; i < _pollCount; i++)
+        {
+            _pollEvents[i].state = K_POLL_STATE_NOT_READY;
+        }
+
+        uint16_t count = 0;
+        bool isTaken = true;
+        while (isTaken && count < _batchSize)
+        {
+            isTaken = false;
+            for (uint8_t i = 0; i < _pollCount && count < _batchSize; i++)
+            {
+                isTaken |= dispatchOne((_nextSource + i) % _pollCount, count);
+            }
+        }
+        _nextSource = (_nextSource + 1) % _pollCount;
+
+        if (count)
+        {
+            onBatchEnd(count);
+            _batchStats.update(count);
+        }
+    }
+
+    // dispatch one message of queue "index" (_pollEvents order: k_msgq, own fifo, sources), false if it is empty
+    bool dispatchOne(uint8_t index, uint16_t &count)
+    {
+        if (_queue && index-- == 0)
+        {
+            Message msg;
+            if (k_msgq_get(_queue, &msg, K_NO_WAIT))
+            {
+                return false;
+            }
+            dispatch(msg, count);
+            return true;
+        }
+        MessageFifo *fifo = (_fifo && index-- == 0) ? _fifo : _sources[index];
+        SlabMessage *block = fifo->get(K_NO_WAIT);
+        if (block == nullptr)
+        {
+            return false;
+        }
+        dispatch(block->msg, count);
+        fifo->free(block);
+        return true;
+    }
+
+    inline void dispatch(const Message &msg, uint16_t &count)
+    {
+        if (count == 0)
+        {
+            onBatchBegin();
+        }
+        onMessage(msg);
+        count++;
+    }
 };
 
 #endif
\ No newline at end of file
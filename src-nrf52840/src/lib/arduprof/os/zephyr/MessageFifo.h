@@ -0,0 +1,127 @@
+/* Copyright 2024 teamprof.net@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#pragma once
+#include <stdint.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+
+#include "../../type/Message.h"
+
+#ifdef __ZEPHYR__
+
+// slab block of a MessageFifo, the first word is the k_fifo link
+typedef struct _SlabMessage
+{
+    void *fifoReserved;
+    Message msg;
+} SlabMessage;
+
+// define a k_mem_slab of "count" message blocks for one or more MessageFifo
+#define ARDUPROF_MESSAGE_SLAB_DEFINE(name, count) \
+    K_MEM_SLAB_DEFINE(name, sizeof(SlabMessage), count, alignof(SlabMessage))
+
+/////////////////////////////////////////////////////////////////////////////
+// Zero-copy message queue: messages live in k_mem_slab blocks linked into a k_fifo.
+// A producer fills a block in place (alloc() + send(), or post()), the consumer dispatches the
+// message from the block and frees it: no copy into and out of a ring as with k_msgq.
+// Producers may run in threads or ISRs (K_NO_WAIT); there is one consumer, see MessageBus.
+/////////////////////////////////////////////////////////////////////////////
+class MessageFifo
+{
+public:
+    MessageFifo(k_mem_slab *slab) : _slab(slab)
+    {
+        k_fifo_init(&_fifo);
+        atomic_clear(&_dropped);
+    }
+
+    // producer: block to fill in place, nullptr (counted as dropped) if the slab is exhausted
+    Message *alloc(k_timeout_t timeout = K_NO_WAIT)
+    {
+        void *block;
+        if (k_mem_slab_alloc(_slab, &block, timeout) != 0)
+        {
+            atomic_inc(&_dropped);
+            return nullptr;
+        }
+        return &static_cast<SlabMessage *>(block)->msg;
+    }
+
+    // producer: queue a message from alloc()
+    void send(Message *msg)
+    {
+        k_fifo_put(&_fifo, CONTAINER_OF(msg, SlabMessage, msg));
+    }
+
+    // producer: alloc() and send() in one step, returns false if the slab is exhausted
+    bool post(const Message &msg, k_timeout_t timeout = K_NO_WAIT)
+    {
+        Message *block = alloc(timeout);
+        if (!block)
+        {
+            return false;
+        }
+        *block = msg;
+        send(block);
+        return true;
+    }
+    bool post(int16_t event, int16_t iParam = 0, uint16_t uParam = 0, uint32_t lParam = 0L, k_timeout_t timeout = K_NO_WAIT)
+    {
+        Message *block = alloc(timeout);
+        if (!block)
+        {
+            return false;
+        }
+        block->event = event;
+        block->iParam = iParam;
+        block->uParam = uParam;
+        block->lParam = lParam;
+        send(block);
+        return true;
+    }
+
+    // consumer: next block, to be handed back with free() once its message is handled
+    SlabMessage *get(k_timeout_t timeout = K_NO_WAIT)
+    {
+        return static_cast<SlabMessage *>(k_fifo_get(&_fifo, timeout));
+    }
+    void free(SlabMessage *block)
+    {
+        k_mem_slab_free(_slab, static_cast<void *>(block));
+    }
+
+    k_fifo *fifo(void)
+    {
+        return &_fifo;
+    }
+
+    // messages lost because the slab was exhausted
+    uint32_t dropped(void)
+    {
+        return (uint32_t)atomic_get(&_dropped);
+    }
+
+private:
+    k_mem_slab *_slab;
+    k_fifo _fifo;
+    atomic_t _dropped;
+};
+
+#endif
@@ -22,13 +22,19 @@
 #include <zephyr/kernel.h>
 
 #include "../../type/Message.h"
+#include "./MessageFifo.h"
 
 #ifdef __ZEPHYR__
 
 class MessageQueue
 {
 public:
-    MessageQueue(k_msgq *queue) : _queue(queue)
+    MessageQueue(k_msgq *queue) : _queue(queue), _fifo(nullptr)
+    {
+    }
+
+    // zero-copy backend: k_mem_slab blocks in a k_fifo, see MessageFifo
+    MessageQueue(MessageFifo *fifo) : _queue(nullptr), _fifo(fifo)
     {
     }
     //     // MessageQueue(uint16_t queueLength,
@@ -75,22 +81,56 @@ public:
         }
     }
 
+    void postEvent(MessageFifo *fifo, int16_t event, int16_t iParam = 0, uint16_t uParam = 0, uint32_t lParam = 0L, k_timeout_t timeout = K_NO_WAIT)
+    {
+        if (fifo && !fifo->post(event, iParam, uParam, lParam, timeout))
+        {
+            // LOG_INF("Failed to post event, slab exhausted");
+        }
+    }
+    inline void postEvent(MessageFifo *fifo, const Message &msg, k_timeout_t timeout = K_NO_WAIT)
+    {
+        if (fifo && !fifo->post(msg, timeout))
+        {
+            // LOG_INF("Failed to post event, slab exhausted");
+        }
+    }
+
     inline void postEvent(int16_t event, int16_t iParam = 0, uint16_t uParam = 0, uint32_t lParam = 0L, k_timeout_t timeout = K_NO_WAIT)
     {
-        postEvent(queue(), event, iParam, uParam, lParam, timeout);
+        if (_fifo)
+        {
+            postEvent(_fifo, event, iParam, uParam, lParam, timeout);
+        }
+        else
+        {
+            postEvent(queue(), event, iParam, uParam, lParam, timeout);
+        }
     }
     inline void postEvent(const Message &msg, k_timeout_t timeout = K_NO_WAIT)
     {
-        postEvent(queue(), msg, timeout);
+        if (_fifo)
+        {
+            postEvent(_fifo, msg, timeout);
+        }
+        else
+        {
+            postEvent(queue(), msg, timeout);
+        }
     }
 
     inline k_msgq *queue(void)
     {
         return _queue;
     }
+    inline MessageFifo *fifo(void)
+    {
+        return _fifo;
+    }
 
 protected:
     k_msgq *_queue;
+    MessageFifo *_fifo; // zero-copy backend, nullptr for k_msgq
 };
 
 /////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,108 @@
+/* Copyright 2024 teamprof.net@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "./Message.h"
+
+/////////////////////////////////////////////////////////////////////////////
+// EventTable: flat handler table indexed by event.
+//
+// The table is built at compile time from the __EVENT_MAP() entries, so it is
+// constant-initialized into .rodata (flash) and a lookup is one bounds check
+// plus one array index. Unlike std::map::operator[], looking up an unknown
+// event never allocates.
+//
+// Events must be in range [0, size). An event out of range or mapped twice
+// makes the initializer a non-constant expression and fails the build.
+//
+// header:
+//     __EVENT_TABLE_DECLARATION(ThreadApp, EventNull) // largest event handled
+//
+// source:
+//     __EVENT_TABLE_DEFINITION(ThreadApp,
+//                              __EVENT_MAP(ThreadApp, EventNull));
+//
+//     void ThreadApp::onMessage(const Message &msg)
+//     {
+//         if (!handlerTable.dispatch(this, msg)) { ... unsupported event ... }
+//     }
+/////////////////////////////////////////////////////////////////////////////
+template <typename T, size_t N>
+struct EventTable
+{
+    typedef void (T::*Handler)(const Message &);
+
+    typedef struct _Entry
+    {
+        int16_t event;
+        Handler handler;
+    } Entry;
+
+    Handler handlers[N];
+
+    constexpr size_t size(void) const
+    {
+        return N;
+    }
+
+    constexpr Handler operator[](int16_t event) const
+    {
+        return ((uint16_t)event < N) ? handlers[event] : nullptr;
+    }
+
+    inline bool dispatch(T *instance, const Message &msg) const
+    {
+        Handler handler = (*this)[msg.event];
+        if (handler)
+        {
+            (instance->*handler)(msg);
+            return true;
+        }
+        return false;
+    }
+};
+
+// not constexpr: reaching it while building a table fails compilation
+inline void eventTableDuplicateEvent(void) {}
+
+template <typename Table, size_t N>
+constexpr Table makeEventTable(const typename Table::Entry (&entries)[N])
+{
+    Table table = {};
+    for (size_t i = 0; i < N; i++)
+    {
+        // an event outside [0, size) is an out-of-bounds write: not a constant expression
+        if (table.handlers[entries[i].event] != nullptr)
+        {
+            eventTableDuplicateEvent();
+        }
+        table.handlers[entries[i].event] = entries[i].handler;
+    }
+    return table;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+#define __EVENT_TABLE_DECLARATION(class, maxEvent)                \
+    typedef EventTable<class, (size_t)(maxEvent) + 1> HandlerTable; \
+    static const HandlerTable handlerTable;
+#define __EVENT_TABLE_DEFINITION(class, ...) \
+    constexpr class ::HandlerTable class ::handlerTable = makeEventTable<class ::HandlerTable>({__VA_ARGS__})
+/////////////////////////////////////////////////////////////////////////////
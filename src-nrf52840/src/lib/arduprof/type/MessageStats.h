@@ -0,0 +1,64 @@
+/* Copyright 2024 teamprof.net@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#pragma once
+#include <stdint.h>
+
+#ifndef ARDUPROF_BATCH_HISTOGRAM_SIZE
+#define ARDUPROF_BATCH_HISTOGRAM_SIZE 6 // batch size buckets: 1, 2-3, 4-7, 8-15, 16-31, 32+
+#endif
+
+/////////////////////////////////////////////////////////////////////////////
+// statistics of MessageBus::messageLoop() batches
+/////////////////////////////////////////////////////////////////////////////
+typedef struct _BatchStats
+{
+    uint32_t batches;  // number of wake-ups which dispatched at least one message
+    uint32_t messages; // number of dispatched messages
+    uint16_t maxBatch; // largest batch seen
+    uint32_t histogram[ARDUPROF_BATCH_HISTOGRAM_SIZE];
+
+    void reset(void)
+    {
+        *this = {};
+    }
+
+    void update(uint16_t count)
+    {
+        batches++;
+        messages += count;
+        if (count > maxBatch)
+        {
+            maxBatch = count;
+        }
+
+        uint16_t bucket = 0;
+        while ((count >>= 1) != 0 && bucket < ARDUPROF_BATCH_HISTOGRAM_SIZE - 1)
+        {
+            bucket++;
+        }
+        histogram[bucket]++;
+    }
+
+    // average batch size x 100
+    uint32_t average100(void) const
+    {
+        return batches ? (uint32_t)(((uint64_t)messages * 100) / batches) : 0;
+    }
+} BatchStats;
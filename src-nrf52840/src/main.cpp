@@ -54,32 +54,48 @@ static struct led_service_cb led_callbacks = {
 	.read = onLedChrcRead,
 };
 
+///////////////////////////////////////////////////////////////////////
+// zero-copy message sources of MainTask, one slab per producer so that a burst
+// from one source cannot starve the others; all waited for with one k_poll()
+#define TASK_QUEUE_SIZE 16  // messages posted to MainTask itself
+#define BUTTON_QUEUE_SIZE 4 // button callback
+#define BLE_QUEUE_SIZE 8    // BLE callbacks (connection, LED characteristic)
+#define TASK_BATCH_SIZE 8   // max messages dispatched per wake-up
+
+ARDUPROF_MESSAGE_SLAB_DEFINE(taskSlab, TASK_QUEUE_SIZE);
+ARDUPROF_MESSAGE_SLAB_DEFINE(buttonSlab, BUTTON_QUEUE_SIZE);
+ARDUPROF_MESSAGE_SLAB_DEFINE(bleSlab, BLE_QUEUE_SIZE);
+
+static MessageFifo taskFifo(&taskSlab);
+static MessageFifo buttonFifo(&buttonSlab);
+static MessageFifo bleFifo(&bleSlab);
+
 static void button_changed(uint32_t button_state, uint32_t has_changed)
 {
 	LOG_DBG("button_state=%u, has_changed=%u", button_state, has_changed);
 	if (!button_state && has_changed & USER_BUTTON)
 	{
-		MainTask::getInstance()->postEvent(EventUserInput, ActionToggleLed);
+		buttonFifo.post(EventUserInput, ActionToggleLed);
 	}
 }
 
-///////////////////////////////////////////////////////////////////////
-#define TASK_QUEUE_SIZE 32 // message queue size for app task
-K_MSGQ_DEFINE(taskQueue, sizeof(Message), TASK_QUEUE_SIZE, alignof(uint32_t));
-
 MainTask *MainTask::_instance = NULL;
 
 ///////////////////////////////////////////////////////////////////////
-MainTask::MainTask() : MessageBus(&taskQueue), _ledState(false)
+MainTask::MainTask() : MessageBus(&taskFifo), _ledState(false)
 {
-	handlerMap = {
-		__EVENT_MAP(MainTask, EventUserInput),
-		__EVENT_MAP(MainTask, EventBleConnection),
-		__EVENT_MAP(MainTask, EventBleLed),
-		__EVENT_MAP(MainTask, EventNull), // {EventNull, &MainTask::handlerEventNull},
-	};
+	setBatchSize(TASK_BATCH_SIZE);
+	addSource(&buttonFifo);
+	addSource(&bleFifo);
 }
 
+// setup event handlers
+__EVENT_TABLE_DEFINITION(MainTask,
+						 __EVENT_MAP(MainTask, EventUserInput),
+						 __EVENT_MAP(MainTask, EventBleConnection),
+						 __EVENT_MAP(MainTask, EventBleLed),
+						 __EVENT_MAP(MainTask, EventNull)); // {EventNull, &MainTask::handlerEventNull},
+
 MainTask *MainTask::getInstance(void)
 {
 	if (!_instance)
@@ -100,12 +116,7 @@ void MainTask::start(void *ctx)
 
 void MainTask::onMessage(const Message &msg)
 {
-	auto func = handlerMap[msg.event];
-	if (func)
-	{
-		(this->*func)(msg);
-	}
-	else
+	if (!handlerTable.dispatch(this, msg))
 	{
 		LOG_DBG("Unsupported event=%hd, iParam=%hd, uParam=%hu, lParam=%u", msg.event, msg.iParam, msg.uParam, msg.lParam);
 	}
@@ -186,7 +197,7 @@ __EVENT_FUNC_DEFINITION(MainTask, EventNull, msg) // void MainTask::handlerEvent
 void postMainEvent(int16_t event, int16_t iParam, uint16_t uParam, uint32_t lParam)
 {
 	LOG_DBG("event=%hd, iParam=%hd, uParam=%hu, lParam=%u", event, iParam, uParam, lParam);
-	MainTask::getInstance()->postEvent(event, iParam, uParam, lParam);
+	bleFifo.post(event, iParam, uParam, lParam);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -22,8 +22,8 @@
 #include <stdint.h>
 
 #ifdef __cplusplus
-#include <map>
 #include "./lib/arduprof/ArduProf.h"
+#include "./AppEvent.h"
 
 class MainTask : public MessageBus
 {
@@ -34,8 +34,7 @@ public:
     bool getLedState(void);
 
 protected:
-    typedef void (MainTask::*handlerFunc)(const Message &);
-    std::map<int16_t, handlerFunc> handlerMap;
+    __EVENT_TABLE_DECLARATION(MainTask, EventUserInput)
 
 private:
     MainTask();
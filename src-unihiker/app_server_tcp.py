@@ -19,18 +19,32 @@
 import json
 import os
 import logging
-from circuits import Component, handler, Event, ipc
+from circuits import Component, handler, Event, Timer, ipc
 from circuits.net.sockets import TCPServer
 from app_event import AppEvent
+import system_sample
+import stream_frame
+import lamp_cbor
 from const import AppConfig, EventValue, ConnectionType, ConnectionState, UserButton
 
 
+class TcpClient():
+    """Stream state of a lamp connection: frame format and encoding of each way, as answered to its hello"""
+
+    def __init__(self):
+        self.frames = stream_frame.FrameDecoder()
+        self.isCbor = False  # received frames
+        self.txFormat = stream_frame.FRAME_LINE
+        self.txCbor = False
+        self.pending = None  # (format, isCbor) of the received frames once the lamp confirms the answer
+
+
 class AppServerTcp(TCPServer):
     channel = 'tcp'
 
     def __init__(self, *args, **kwargs):
         super().__init__(*args, **kwargs)
-        self.clients = set()
+        self.clients = {}  # sock: TcpClient
 
         log_level = logging.DEBUG
         logging.basicConfig(
@@ -45,18 +59,20 @@ class AppServerTcp(TCPServer):
 
     def started(self, *args):
         self.logger.debug(f'{self.name} started: pid={os.getpid()}')
+        Timer(AppConfig.SamplePeriod, Event.create('pollSample'), self.channel,
+              persist=True).register(self)
 
     @handler('connect')
     def on_connect(self, sock, host, port):
         self.logger.debug(f'on_connect: sock={sock}, host={host}, port={port}')
-        self.clients.add(sock)
+        self.clients[sock] = TcpClient()
         self.fire(AppEvent(EventValue.ConnectionUpdate,
                   ConnectionType.Tcp, ConnectionState.Connected), self.parent)
 
     @handler('disconnect')
     def on_disconnect(self, sock):
         self.logger.debug(f'on_disconnect: sock={sock}')
-        self.clients.remove(sock)
+        self.clients.pop(sock, None)
         self.fire(AppEvent(EventValue.ConnectionUpdate, ConnectionType.Tcp,
                   ConnectionState.Disconnected), self.parent)
 
@@ -74,15 +90,61 @@ class AppServerTcp(TCPServer):
                   the value returned.
         """
 
+        client = self.clients.get(sock)
+        if client is None:
+            return
+        client.frames.feed(data)
+        for frame in client.frames.frames():
+            self.processFrame(sock, client, frame)
+
+    def processFrame(self, sock, client, frame):
         try:
-            json_obj = json.loads(data)
+            json_obj = lamp_cbor.decode(frame) if client.isCbor else json.loads(frame)
+            if json_obj.get("event") == "hello":
+                if client.pending is not None:
+                    # the lamp's confirmation: its frames after this one are in the chosen format and encoding
+                    client.frames.format, client.isCbor = client.pending
+                    client.pending = None
+                    self.logger.debug(f'{self.name}: hello confirmed')
+                    return
+                # answered in the current format and encoding, the frames sent after it are in the chosen ones
+                format = stream_frame.choose(int(json_obj.get("arg0", 0)))
+                offered = int(json_obj.get("arg1", 0))
+                encoding = lamp_cbor.ENCODING_JSON
+                if AppConfig.CborTransport and format == stream_frame.FRAME_LENGTH and offered & lamp_cbor.ENCODING_CBOR:
+                    encoding = lamp_cbor.ENCODING_CBOR
+                self.sendMessage(sock, {"device": "lamp-esp",
+                              "event": "hello", "arg0": format, "arg1": encoding})
+                client.txFormat = format
+                client.txCbor = encoding == lamp_cbor.ENCODING_CBOR
+                client.pending = (format, client.txCbor)
+                self.logger.debug(f'{self.name}: hello: format={format}, encoding={encoding}')
+                return
+            if json_obj.get("event") == "sample":
+                self.logSample(json_obj)
+                return
             self.fire(AppEvent(EventValue.DataTcp, obj=json_obj), self.parent)
         except json.JSONDecodeError as e:
-            self.logger.debug(f"JSON data is not well-formed: data={data}")
-        except TypeError as e:
+            self.logger.debug(f"JSON data is not well-formed: data={frame}")
+        except lamp_cbor.CborError as e:
+            self.logger.debug(f"CBOR data is not well-formed: {e}: data={frame.hex()}")
+        except (TypeError, ValueError) as e:
             self.logger.debug(
-                f"Invalid input type for json.loads(): type(data)={type(data)}")
-            # print("Invalid input type for json.loads:", e)
+                f"Invalid input for json.loads(): type(data)={type(frame)}")
+
+    def sendMessage(self, sock, jsonObj):
+        client = self.clients.get(sock)
+        if client is None:
+            return
+        if client.txCbor:
+            data = lamp_cbor.encode(jsonObj)
+        else:
+            data = bytes(json.dumps(jsonObj), encoding="utf-8")
+        sock.sendall(stream_frame.encode(client.txFormat, data))
+
+    def broadcastMessage(self, jsonObj):
+        for client in list(self.clients):
+            self.sendMessage(client, jsonObj)
 
     @handler('AppEvent')
     def onAppEvent(self, event):
@@ -98,10 +160,29 @@ class AppServerTcp(TCPServer):
     def handleEventReqUpdate(self, event):
         jsonObj = {"device": "lamp-esp",
                    "event": "req-update", "arg0": 0, "arg1": 0}
-        josnStr = json.dumps(jsonObj)
-        data = bytes(josnStr, encoding="utf-8")
-        for client in self.clients:
-            client.send(data)
+        self.broadcastMessage(jsonObj)
+
+    def pollSample(self):
+        jsonObj = {"device": "lamp-esp",
+                   "event": "req-sample", "arg0": 0, "arg1": 0}
+        self.broadcastMessage(jsonObj)
+
+    def logSample(self, jsonObj):
+        try:
+            data = jsonObj.get("data", "")
+            sample = system_sample.decode(data if isinstance(data, bytes) else bytes.fromhex(data))
+        except ValueError:
+            sample = None
+        if sample is None:
+            self.logger.debug(f'{self.name}: invalid sample: arg0={jsonObj.get("arg0")}')
+            return
+        self.logger.debug(
+            f'{self.name}: sample {sample["seq"]}: cores={sample["cores"]}%, heap={sample["heap"]}')
+        for task in sample['tasks']:
+            self.logger.debug(f'  task {task}')
+        for queue in sample['queues']:
+            self.logger.debug(f'  queue {queue}')
+        self.logger.debug(f'  metrics {sample["metrics"]}')
 
     def handleEventUser(self, event):
         self.logger.debug(
@@ -112,7 +193,4 @@ class AppServerTcp(TCPServer):
                    "event": "user-click", "arg0": arg0, "arg1": 0}
         self.logger.debug(f'jsonObj={jsonObj}')
         # jsonObj = { "device":"fan", "event": "user-click", "arg0": 0, "arg1": arg1 }
-        josnStr = json.dumps(jsonObj)
-        data = bytes(josnStr, encoding="utf-8")
-        for client in self.clients:
-            client.send(data)
+        self.broadcastMessage(jsonObj)
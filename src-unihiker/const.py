@@ -22,6 +22,8 @@ from enum import Enum
 class AppConfig():
     ServerIP = '0.0.0.0'
     ServerPort = 8080
+    SamplePeriod = 10  # seconds between SystemSampler snapshots requested to the lamp-esp
+    CborTransport = True  # CBOR messages if the lamp-esp offers them in its hello, else JSON
 
 
 class EventValue(Enum):
@@ -0,0 +1,128 @@
+# Copyright 2024 teamprof.net@gmail.com
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy of this
+# software and associated documentation files (the "Software"), to deal in the Software
+# without restriction, including without limitation the rights to use, copy, modify,
+# merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+# permit persons to whom the Software is furnished to do so, subject to the following
+# conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+# INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+# PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+# HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+# OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+# SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+import struct
+
+# CBOR encoding of the lamp messages, see LampCbor (src-esp32s3/main/model/LampCbor.h): a map
+# with integer keys, the device and event names as codes and "data" as a byte string. Only the
+# CBOR items of these messages are supported: unsigned and negative integers, byte and text
+# strings and maps
+
+ENCODING_JSON = 1
+ENCODING_CBOR = 2
+
+KEYS = ["device", "event", "arg0", "arg1", "data"]
+# codes are indexes: in the order of LampCbor.cpp
+DEVICES = ["lamp-esp"]
+EVENTS = ["req-update", "user-click", "update", "req-sample", "sample", "hello"]
+
+
+class CborError(ValueError):
+    pass
+
+
+def _head(major, value):
+    if value < 24:
+        return bytes([major << 5 | value])
+    if value < 0x100:
+        return struct.pack('>BB', major << 5 | 24, value)
+    if value < 0x10000:
+        return struct.pack('>BH', major << 5 | 25, value)
+    if value < 0x100000000:
+        return struct.pack('>BI', major << 5 | 26, value)
+    return struct.pack('>BQ', major << 5 | 27, value)
+
+
+def _item(value):
+    if isinstance(value, int):
+        return _head(0, value) if value >= 0 else _head(1, -1 - value)
+    if isinstance(value, (bytes, bytearray)):
+        return _head(2, len(value)) + bytes(value)
+    if isinstance(value, str):
+        raw = value.encode('utf-8')
+        return _head(3, len(raw)) + raw
+    raise TypeError(f'unsupported CBOR item: {type(value)}')
+
+
+def encode(jsonObj):
+    """Returns the message "jsonObj" (dict of a JSON message) as CBOR bytes"""
+    items = []
+    for code, key in enumerate(KEYS):
+        if key not in jsonObj:
+            continue
+        value = jsonObj[key]
+        if key == "device":
+            value = DEVICES.index(value)
+        elif key == "event":
+            value = EVENTS.index(value)
+        items.append(_item(code) + _item(value))
+    return _head(5, len(items)) + b''.join(items)
+
+
+def _read(data, offset):
+    first = data[offset]
+    major, info = first >> 5, first & 0x1f
+    offset += 1
+    if info < 24:
+        value = info
+    elif info <= 27:
+        size = 1 << (info - 24)
+        if offset + size > len(data):
+            raise CborError('truncated CBOR')
+        value = int.from_bytes(data[offset:offset + size], 'big')
+        offset += size
+    else:
+        raise CborError(f'unsupported CBOR item: 0x{first:02x}')
+
+    if major == 0:
+        return value, offset
+    if major == 1:
+        return -1 - value, offset
+    if major in (2, 3):
+        if offset + value > len(data):
+            raise CborError('truncated CBOR')
+        raw = bytes(data[offset:offset + value])
+        return (raw if major == 2 else raw.decode('utf-8')), offset + value
+    if major == 5:
+        obj = {}
+        for _ in range(value):
+            key, offset = _read(data, offset)
+            obj[key], offset = _read(data, offset)
+        return obj, offset
+    raise CborError(f'unsupported CBOR item: 0x{first:02x}')
+
+
+def decode(data):
+    """Returns the CBOR message "data" as the dict of the JSON message, raises CborError if invalid"""
+    try:
+        obj, _ = _read(data, 0)
+    except IndexError:
+        raise CborError('truncated CBOR')
+    if not isinstance(obj, dict):
+        raise CborError('CBOR message is not a map')
+    jsonObj = {}
+    for code, value in obj.items():
+        if not isinstance(code, int) or not 0 <= code < len(KEYS):
+            continue
+        key = KEYS[code]
+        if key == "device":
+            value = DEVICES[value] if isinstance(value, int) and 0 <= value < len(DEVICES) else None
+        elif key == "event":
+            value = EVENTS[value] if isinstance(value, int) and 0 <= value < len(EVENTS) else None
+        jsonObj[key] = value
+    return jsonObj
@@ -0,0 +1,77 @@
+# Copyright 2024 teamprof.net@gmail.com
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy of this
+# software and associated documentation files (the "Software"), to deal in the Software
+# without restriction, including without limitation the rights to use, copy, modify,
+# merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+# permit persons to whom the Software is furnished to do so, subject to the following
+# conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+# INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+# PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+# HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+# OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+# SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+import struct
+
+# Framing of the TCP stream with the lamp-esp, see FrameDecoder (ArduProf type/FrameDecoder.h):
+#   FRAME_LINE:   payload b'\n', for JSON text (json.dumps() output has no newline)
+#   FRAME_LENGTH: 2-byte big-endian payload length, payload
+# The lamp offers the formats (bits) in a {"event": "hello"} line. The panel's frames after its
+# answer are in the format chosen; the lamp confirms it with a last hello line, maybe after other
+# lines if the answer came late, and its frames after that one are in the format chosen
+
+FRAME_LINE = 1
+FRAME_LENGTH = 2
+LENGTH = struct.Struct('>H')
+LINE_MAX = 4096  # a longer line is dropped
+
+
+def choose(offered):
+    """Returns the format answered to a hello offering "offered" (bits)"""
+    return FRAME_LENGTH if offered & FRAME_LENGTH else FRAME_LINE
+
+
+def encode(format, payload):
+    """Returns "payload" (bytes) framed in "format\""""
+    if format == FRAME_LENGTH:
+        return LENGTH.pack(len(payload)) + payload
+    return payload + b'\n'
+
+
+class FrameDecoder:
+    """Incremental decoder: feed() what was read, frames() yields the complete frames however
+    the stream was split. "format" may be changed between two frames, e.g. on a hello"""
+
+    def __init__(self, format=FRAME_LINE):
+        self.format = format
+        self.buffer = bytearray()
+
+    def feed(self, data):
+        self.buffer += data
+
+    def frames(self):
+        while True:
+            if self.format == FRAME_LENGTH:
+                if len(self.buffer) < LENGTH.size:
+                    return
+                (length,) = LENGTH.unpack_from(self.buffer, 0)
+                if len(self.buffer) < LENGTH.size + length:
+                    return
+                frame = bytes(self.buffer[LENGTH.size:LENGTH.size + length])
+                del self.buffer[:LENGTH.size + length]
+            else:
+                end = self.buffer.find(b'\n')
+                if end < 0:
+                    if len(self.buffer) > LINE_MAX:
+                        self.buffer.clear()
+                    return
+                frame = bytes(self.buffer[:end]).rstrip(b'\r')
+                del self.buffer[:end + 1]
+                if not frame:
+                    continue
+            yield frame
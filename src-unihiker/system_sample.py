@@ -0,0 +1,84 @@
+# Copyright 2024 teamprof.net@gmail.com
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy of this
+# software and associated documentation files (the "Software"), to deal in the Software
+# without restriction, including without limitation the rights to use, copy, modify,
+# merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+# permit persons to whom the Software is furnished to do so, subject to the following
+# conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+# INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+# PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+# HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+# OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+# SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+import struct
+
+# Decoder of the snapshot of ArduProf SystemSampler (os/freertos/SystemSampler.h),
+# sent hex-encoded in "data" of a {"event": "sample"} message by the lamp-esp
+
+SAMPLE_MAGIC = 0x53535041  # "APSS"
+SAMPLE_VERSION = 1
+
+# magic, version, cores, tasks, queues, metrics, nameSize, taskCount, seq, timeMs, periodMs
+HEADER = struct.Struct('<IBBBBBBHIII')
+CORES = 2  # ARDUPROF_SAMPLER_CORES
+HEAP = struct.Struct('<IIIHH')  # free, minFree, largest, fragmentation, reserved
+
+
+def _name(raw):
+    return raw.split(b'\0', 1)[0].decode('utf-8', 'replace')
+
+
+def decode(data):
+    """Returns the snapshot "data" (bytes) as a dict, None if it is not a valid snapshot"""
+    if len(data) < HEADER.size:
+        return None
+    magic, version, cores, tasks, queues, metrics, nameSize, taskCount, seq, timeMs, periodMs = HEADER.unpack_from(
+        data, 0)
+    if magic != SAMPLE_MAGIC or version != SAMPLE_VERSION:
+        return None
+
+    offset = HEADER.size
+    corePermille = struct.unpack_from(f'<{CORES}H', data, offset)
+    offset += 2 * CORES
+    free, minFree, largest, fragmentation, _ = HEAP.unpack_from(data, offset)
+    offset += HEAP.size
+
+    task = struct.Struct(f'<{nameSize}sIHBB')
+    queue = struct.Struct(f'<{nameSize}sHHII')
+    metric = struct.Struct(f'<{nameSize}si')
+    if len(data) < offset + tasks * task.size + queues * queue.size + metrics * metric.size:
+        return None
+
+    sample = {
+        'seq': seq,
+        'timeMs': timeMs,
+        'periodMs': periodMs,
+        'taskCount': taskCount,
+        'cores': [permille / 10 for permille in corePermille[:cores]],
+        'heap': {'free': free, 'minFree': minFree, 'largest': largest, 'fragmentation': fragmentation / 10},
+        'tasks': [],
+        'queues': [],
+        'metrics': {},
+    }
+    for _ in range(tasks):
+        name, stackFree, cpu, priority, core = task.unpack_from(data, offset)
+        offset += task.size
+        sample['tasks'].append({'name': _name(name), 'cpu': cpu / 10, 'stackFree': stackFree,
+                                'priority': priority, 'core': None if core == 0xff else core})
+    for _ in range(queues):
+        name, depth, highWater, dispatched, lost = queue.unpack_from(
+            data, offset)
+        offset += queue.size
+        sample['queues'].append({'name': _name(name), 'depth': depth, 'highWater': highWater,
+                                 'dispatched': dispatched, 'lost': lost})
+    for _ in range(metrics):
+        name, value = metric.unpack_from(data, offset)
+        offset += metric.size
+        sample['metrics'][_name(name)] = value
+    return sample